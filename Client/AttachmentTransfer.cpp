@@ -0,0 +1,318 @@
+#include "AttachmentTransfer.h"
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QDebug>
+
+AttachmentTransfer::AttachmentTransfer(const QString &host, quint16 port, QObject *parent)
+    : QObject(parent), m_host(host), m_port(port)
+{
+    m_pool.setMaxThreadCount(1);
+
+    m_socket = new QTcpSocket(this);
+    connect(m_socket, &QTcpSocket::connected, this, &AttachmentTransfer::onConnected);
+    connect(m_socket, &QTcpSocket::readyRead, this, &AttachmentTransfer::onReadyRead);
+    connect(m_socket, &QTcpSocket::disconnected, this, &AttachmentTransfer::onDisconnected);
+    // 发送缓冲腾出空间后继续发送下一块
+    connect(m_socket, &QTcpSocket::bytesWritten, this, [this]() {
+        if (m_mode == Uploading) {
+            sendNextChunks();
+        }
+    });
+}
+
+void AttachmentTransfer::upload(const QString &senderId, const QString &receiverId, const QString &filePath)
+{
+    if (isBusy()) {
+        emit failed("BUSY");
+        return;
+    }
+    reset();
+
+    m_uploadFile.setFileName(filePath);
+    if (!m_uploadFile.open(QIODevice::ReadOnly)) {
+        emit failed("OPEN_ERROR");
+        return;
+    }
+
+    m_senderId = senderId;
+    m_receiverId = receiverId;
+    m_totalSize = m_uploadFile.size();
+    m_mode = Hashing;
+    startHashing(filePath);
+}
+
+void AttachmentTransfer::download(const QString &userId, qint64 attachmentId, const QString &savePath)
+{
+    if (isBusy()) {
+        emit failed("BUSY");
+        return;
+    }
+    reset();
+
+    // 已有的 .part 为上次中断时收到的部分，从其末尾续传
+    m_savePath = savePath;
+    m_partFile.setFileName(savePath + ".part");
+    if (!m_partFile.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        emit failed("OPEN_ERROR");
+        return;
+    }
+
+    m_attachmentId = attachmentId;
+    m_receivedOffset = m_partFile.size();
+    m_mode = Downloading;
+    m_pendingRequest = QString("ATTACH_GET#%1#%2#%3\n").arg(userId).arg(attachmentId).arg(m_receivedOffset).toUtf8();
+    ensureConnected();
+}
+
+void AttachmentTransfer::cancel()
+{
+    if (!isBusy()) {
+        return;
+    }
+    // 断开连接丢弃途中的数据；服务器和本地保留已传完的部分，下次可续传
+    reset();
+    m_socket->abort();
+}
+
+void AttachmentTransfer::ensureConnected()
+{
+    if (m_socket->state() == QAbstractSocket::ConnectedState) {
+        sendPendingRequest();
+    } else if (m_socket->state() == QAbstractSocket::UnconnectedState) {
+        m_socket->connectToHost(m_host, m_port);
+    }
+}
+
+void AttachmentTransfer::onConnected()
+{
+    // 大文件传输时加大内核收发缓冲，减少高延迟链路上的窗口等待
+    m_socket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, SOCKET_BUFFER_SIZE);
+    m_socket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, SOCKET_BUFFER_SIZE);
+    sendPendingRequest();
+}
+
+void AttachmentTransfer::sendPendingRequest()
+{
+    if (!m_pendingRequest.isEmpty()) {
+        m_socket->write(m_pendingRequest);
+        m_pendingRequest.clear();
+    }
+}
+
+void AttachmentTransfer::onDisconnected()
+{
+    if (isBusy() && m_mode != Hashing && m_mode != Verifying) {
+        finishWithError("DISCONNECTED");
+    }
+}
+
+void AttachmentTransfer::startHashing(const QString &path)
+{
+    const int generation = ++m_generation;
+    // 析构时会等待线程池中的任务结束，任务内可以安全使用 this
+    m_pool.start([this, generation, path]() {
+        QByteArray sha256 = hashFile(path);
+        QMetaObject::invokeMethod(this, "onHashed", Qt::QueuedConnection,
+                                  Q_ARG(int, generation), Q_ARG(QByteArray, sha256));
+    });
+}
+
+QByteArray AttachmentTransfer::hashFile(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    QByteArray block(CHUNK_SIZE, Qt::Uninitialized);
+    qint64 n;
+    while ((n = file.read(block.data(), block.size())) > 0) {
+        hash.addData(QByteArrayView(block.constData(), n));
+    }
+    if (n < 0) {
+        return QByteArray();
+    }
+    return hash.result().toHex();
+}
+
+void AttachmentTransfer::onHashed(int generation, const QByteArray &sha256)
+{
+    if (generation != m_generation) {
+        return; // 传输已取消或已开始新的传输
+    }
+
+    if (m_mode == Hashing) {
+        if (sha256.isEmpty()) {
+            finishWithError("READ_ERROR");
+            return;
+        }
+        m_mode = Uploading;
+        m_pendingRequest = "ATTACH_BEGIN#" + m_senderId.toUtf8() + "#" + m_receiverId.toUtf8() + "#" + sha256 + "#"
+                           + QByteArray::number(m_totalSize) + "#" + QFileInfo(m_uploadFile.fileName()).fileName().toUtf8() + "\n";
+        ensureConnected();
+    } else if (m_mode == Verifying) {
+        if (sha256 != m_expectedSha256) {
+            // 内容不一致，丢弃已下载的部分，下次重新下载
+            QFile::remove(m_partFile.fileName());
+            finishWithError("HASH_MISMATCH");
+            return;
+        }
+
+        if (QFile::exists(m_savePath)) {
+            QFile::remove(m_savePath);
+        }
+        if (!QFile::rename(m_partFile.fileName(), m_savePath)) {
+            finishWithError("RENAME_ERROR");
+            return;
+        }
+
+        qint64 attachmentId = m_attachmentId;
+        QString savePath = m_savePath;
+        reset();
+        emit downloadFinished(attachmentId, savePath);
+    }
+}
+
+void AttachmentTransfer::onReadyRead()
+{
+    m_buffer.append(m_socket->readAll());
+
+    while (isBusy()) {
+        // ATTACH_DATA 帧的原始数据直接写入 .part，不做按行解析
+        if (m_binaryRemaining > 0) {
+            const qint64 take = qMin<qint64>(m_binaryRemaining, m_buffer.size());
+            if (take == 0) {
+                break;
+            }
+            if (m_partFile.write(m_buffer.constData(), take) != take) {
+                finishWithError("WRITE_ERROR");
+                return;
+            }
+            m_buffer.remove(0, take);
+            m_binaryRemaining -= take;
+            m_receivedOffset += take;
+            if (m_binaryRemaining == 0) {
+                emit downloadProgress(m_receivedOffset, m_totalSize);
+            }
+            continue;
+        }
+
+        int pos = m_buffer.indexOf('\n');
+        if (pos < 0) {
+            break;
+        }
+        QByteArray line = m_buffer.left(pos);
+        m_buffer.remove(0, pos + 1);
+        handleLine(line);
+    }
+}
+
+void AttachmentTransfer::handleLine(const QByteArray &line)
+{
+    const QList<QByteArray> parts = line.split('#');
+    const QByteArray type = parts.value(0);
+
+    if (type == "ATTACH_BEGIN_SUCCESS" && m_mode == Uploading) {
+        // ATTACH_BEGIN_SUCCESS#附件ID#服务器已收到的字节数
+        m_attachmentId = parts.value(1).toLongLong();
+        startChunks(parts.value(2).toLongLong());
+    } else if (type == "ATTACH_CHUNK_SUCCESS" && m_mode == Uploading) {
+        m_ackedOffset = parts.value(2).toLongLong();
+        emit uploadProgress(m_ackedOffset, m_totalSize);
+        sendNextChunks();
+    } else if (type == "ATTACH_COMPLETE" && m_mode == Uploading) {
+        qint64 attachmentId = m_attachmentId;
+        qint64 totalSize = m_totalSize;
+        reset();
+        emit uploadProgress(totalSize, totalSize);
+        emit uploadFinished(attachmentId);
+    } else if (type == "ATTACH_GET_SUCCESS" && m_mode == Downloading) {
+        // ATTACH_GET_SUCCESS#附件ID#大小#sha256#偏移；服务器不接受本地偏移时从其给出的偏移重新写
+        m_totalSize = parts.value(2).toLongLong();
+        m_expectedSha256 = parts.value(3);
+        qint64 offset = parts.value(4).toLongLong();
+        if (offset != m_receivedOffset) {
+            m_partFile.resize(offset);
+            m_receivedOffset = offset;
+        }
+        emit downloadProgress(m_receivedOffset, m_totalSize);
+    } else if (type == "ATTACH_DATA" && m_mode == Downloading) {
+        // ATTACH_DATA#附件ID#偏移#字节数，之后是原始数据
+        if (parts.value(2).toLongLong() != m_receivedOffset) {
+            finishWithError("OFFSET_MISMATCH");
+            return;
+        }
+        m_binaryRemaining = parts.value(3).toLongLong();
+    } else if (type == "ATTACH_GET_DONE" && m_mode == Downloading) {
+        m_partFile.close();
+        m_mode = Verifying;
+        startHashing(m_partFile.fileName());
+    } else if (type == "ATTACH_BEGIN_FAIL") {
+        finishWithError(QString::fromUtf8(parts.value(1)));
+    } else if (type == "ATTACH_CHUNK_FAIL" || type == "ATTACH_FAIL" || type == "ATTACH_GET_FAIL") {
+        finishWithError(QString::fromUtf8(parts.value(2)));
+    }
+}
+
+void AttachmentTransfer::startChunks(qint64 offset)
+{
+    m_sendOffset = offset;
+    m_ackedOffset = offset;
+    emit uploadProgress(offset, m_totalSize);
+
+    if (offset >= m_totalSize) {
+        return; // 服务器已有全部数据，等待 ATTACH_COMPLETE
+    }
+    if (!m_uploadFile.seek(offset)) {
+        finishWithError("READ_ERROR");
+        return;
+    }
+    sendNextChunks();
+}
+
+// 最多 MAX_CHUNKS_IN_FLIGHT 块未被确认，既占满链路又不把整个文件读进内存
+void AttachmentTransfer::sendNextChunks()
+{
+    while (m_sendOffset < m_totalSize
+           && m_sendOffset - m_ackedOffset < static_cast<qint64>(MAX_CHUNKS_IN_FLIGHT) * CHUNK_SIZE) {
+        QByteArray data = m_uploadFile.read(qMin<qint64>(CHUNK_SIZE, m_totalSize - m_sendOffset));
+        if (data.isEmpty()) {
+            finishWithError("READ_ERROR");
+            return;
+        }
+        m_socket->write("ATTACH_CHUNK#" + QByteArray::number(m_attachmentId) + "#" + QByteArray::number(m_sendOffset)
+                        + "#" + QByteArray::number(data.size()) + "\n");
+        m_socket->write(data);
+        m_sendOffset += data.size();
+    }
+}
+
+void AttachmentTransfer::finishWithError(const QString &reason)
+{
+    qDebug() << "附件传输失败:" << reason;
+    const bool streaming = (m_mode == Uploading || m_mode == Downloading);
+    reset();
+    // 途中的数据已无法对齐，断开连接；下次传输重新连接并从已完成的偏移续传
+    if (streaming) {
+        m_socket->abort();
+    }
+    emit failed(reason);
+}
+
+void AttachmentTransfer::reset()
+{
+    ++m_generation;
+    m_mode = Idle;
+    m_buffer.clear();
+    m_pendingRequest.clear();
+    m_uploadFile.close();
+    m_partFile.close();
+    m_attachmentId = 0;
+    m_totalSize = 0;
+    m_sendOffset = 0;
+    m_ackedOffset = 0;
+    m_receivedOffset = 0;
+    m_binaryRemaining = 0;
+    m_expectedSha256.clear();
+}
@@ -0,0 +1,87 @@
+#ifndef ATTACHMENTTRANSFER_H
+#define ATTACHMENTTRANSFER_H
+
+#include <QObject>
+#include <QTcpSocket>
+#include <QFile>
+#include <QByteArray>
+#include <QString>
+#include <QThreadPool>
+
+/**
+ * 聊天附件传输
+ * 使用单独的服务器连接，大文件传输不阻塞聊天消息。
+ * 上传：后台线程计算 SHA-256 → ATTACH_BEGIN 得到服务器已收到的偏移（服务器已有相同内容时直接完成）
+ *       → 从该偏移起以 1MB 为一块发送 ATTACH_CHUNK，最多 4 块未确认，每块确认后报告进度。
+ * 下载：数据先写入 "<保存路径>.part"，中断后再次下载时从已有字节数续传，收完校验 SHA-256 后改名。
+ * 同一时间只进行一个传输。
+ */
+class AttachmentTransfer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AttachmentTransfer(const QString &host, quint16 port, QObject *parent = nullptr);
+
+    void upload(const QString &senderId, const QString &receiverId, const QString &filePath);
+    void download(const QString &userId, qint64 attachmentId, const QString &savePath);
+    void cancel();
+    bool isBusy() const { return m_mode != Idle; }
+
+signals:
+    void uploadProgress(qint64 sentBytes, qint64 totalBytes);
+    void uploadFinished(qint64 attachmentId);
+    void downloadProgress(qint64 receivedBytes, qint64 totalBytes);
+    void downloadFinished(qint64 attachmentId, const QString &savePath);
+    void failed(const QString &reason);
+
+private slots:
+    void onConnected();
+    void onReadyRead();
+    void onDisconnected();
+    void onHashed(int generation, const QByteArray &sha256); // 后台哈希完成（上传前或下载校验）
+
+private:
+    enum Mode { Idle, Hashing, Uploading, Downloading, Verifying };
+
+    static const int CHUNK_SIZE = 1024 * 1024;
+    static const int MAX_CHUNKS_IN_FLIGHT = 4;
+    static const int SOCKET_BUFFER_SIZE = 4 * 1024 * 1024;
+
+    void ensureConnected();
+    void sendPendingRequest();
+    void handleLine(const QByteArray &line);
+    void startChunks(qint64 offset);
+    void sendNextChunks();
+    void startHashing(const QString &path);
+    void finishWithError(const QString &reason);
+    void reset();
+    static QByteArray hashFile(const QString &path);
+
+    QString m_host;
+    quint16 m_port;
+    QTcpSocket *m_socket;
+    QByteArray m_buffer;
+    QByteArray m_pendingRequest;    // 连接建立后发送的请求
+    Mode m_mode = Idle;
+    int m_generation = 0;           // 后台哈希完成时据此判断传输是否已取消或更换
+    QThreadPool m_pool;             // 计算大文件哈希，不阻塞界面线程
+
+    // 上传
+    QString m_senderId;
+    QString m_receiverId;
+    QFile m_uploadFile;
+    qint64 m_attachmentId = 0;
+    qint64 m_totalSize = 0;
+    qint64 m_sendOffset = 0;        // 已发出的字节数
+    qint64 m_ackedOffset = 0;       // 服务器已确认的字节数
+
+    // 下载
+    QString m_savePath;
+    QFile m_partFile;
+    QByteArray m_expectedSha256;
+    qint64 m_receivedOffset = 0;    // 已写入 .part 的字节数
+    qint64 m_binaryRemaining = 0;   // 当前 ATTACH_DATA 帧还未收到的字节数
+};
+
+#endif // ATTACHMENTTRANSFER_H
@@ -0,0 +1,260 @@
+#include "AudioStream.h"
+#include <QMediaDevices>
+#include <QDateTime>
+#include <QtEndian>
+#include <QDebug>
+#include <cstring>
+
+AudioStream::AudioStream(MediaChannel *channel, QObject *parent)
+    : QObject(parent)
+    , m_channel(channel)
+    , m_playbackTimer(new QTimer(this))
+{
+    // 播放设备缓冲只有几帧，需要及时补充
+    m_playbackTimer->setTimerType(Qt::PreciseTimer);
+    m_playbackTimer->setInterval(FRAME_MS / 2);
+    connect(m_playbackTimer, &QTimer::timeout, this, &AudioStream::feedPlayback);
+    connect(m_channel, &MediaChannel::packetReceived, this, &AudioStream::onPacketReceived);
+}
+
+AudioStream::~AudioStream()
+{
+    stop();
+}
+
+QAudioFormat AudioStream::format()
+{
+    QAudioFormat format;
+    format.setSampleRate(SAMPLE_RATE);
+    format.setChannelCount(1);
+    format.setSampleFormat(QAudioFormat::Int16);
+    return format;
+}
+
+void AudioStream::setCaptureDevice(QIODevice *device)
+{
+    m_externalCapture = device;
+}
+
+void AudioStream::setVolume(qreal volume)
+{
+    m_volume = volume;
+    if (m_sink) {
+        m_sink->setVolume(volume);
+    }
+}
+
+void AudioStream::start()
+{
+    if (m_running) {
+        return;
+    }
+    m_running = true;
+    m_captureBuffer.clear();
+    m_encoderState = ImaAdpcm::State();
+    m_jitterBuffer.clear();
+    m_playing = false;
+    m_concealedCount = 0;
+    m_lastFrame.clear();
+
+    const QAudioFormat audioFormat = format();
+
+    if (!m_captureEnabled) {
+        // 只接收不采集
+    } else if (m_externalCapture) {
+        m_captureIo = m_externalCapture;
+    } else {
+        QAudioDevice input = QMediaDevices::defaultAudioInput();
+        if (input.isNull() || !input.isFormatSupported(audioFormat)) {
+            qDebug() << "麦克风不可用或不支持 16kHz 单声道，本端不发送音频";
+        } else {
+            m_source = new QAudioSource(input, audioFormat, this);
+            m_source->setBufferSize(FRAME_BYTES * 2); // 小缓冲降低采集时延
+            m_captureIo = m_source->start();
+        }
+    }
+    if (m_captureIo) {
+        connect(m_captureIo, &QIODevice::readyRead, this, &AudioStream::onCaptureReadyRead);
+    }
+
+    QAudioDevice output = QMediaDevices::defaultAudioOutput();
+    if (output.isNull() || !output.isFormatSupported(audioFormat)) {
+        qDebug() << "扬声器不可用或不支持 16kHz 单声道，本端不播放音频";
+    } else {
+        m_sink = new QAudioSink(output, audioFormat, this);
+        m_sink->setBufferSize(FRAME_BYTES * 4);
+        m_sink->setVolume(m_volume);
+        m_playbackIo = m_sink->start();
+        m_playbackTimer->start();
+    }
+}
+
+void AudioStream::stop()
+{
+    if (!m_running) {
+        return;
+    }
+    m_running = false;
+    m_playbackTimer->stop();
+
+    if (m_captureIo) {
+        disconnect(m_captureIo, &QIODevice::readyRead, this, &AudioStream::onCaptureReadyRead);
+        m_captureIo = nullptr;
+    }
+    if (m_source) {
+        m_source->stop();
+        delete m_source;
+        m_source = nullptr;
+    }
+    if (m_sink) {
+        m_sink->stop();
+        delete m_sink;
+        m_sink = nullptr;
+        m_playbackIo = nullptr;
+    }
+    m_jitterBuffer.clear();
+}
+
+void AudioStream::onCaptureReadyRead()
+{
+    if (!m_captureIo) {
+        return;
+    }
+    m_captureBuffer.append(m_captureIo->readAll());
+
+    while (m_captureBuffer.size() >= FRAME_BYTES) {
+        const QByteArray pcm = m_captureBuffer.left(FRAME_BYTES);
+        m_captureBuffer.remove(0, FRAME_BYTES);
+        if (!m_muted) {
+            sendFrame(pcm);
+        }
+    }
+}
+
+void AudioStream::sendFrame(const QByteArray &pcm)
+{
+    if (!m_channel->hasPeer()) {
+        return;
+    }
+
+    ImaAdpcm::State startState = m_encoderState;
+    const QByteArray encoded = ImaAdpcm::encode(reinterpret_cast<const qint16 *>(pcm.constData()),
+                                                FRAME_SAMPLES, m_encoderState);
+
+    // 采集时间取该帧第一个样本的时刻
+    const quint32 timestamp = static_cast<quint32>(QDateTime::currentMSecsSinceEpoch() - FRAME_MS);
+
+    // 包头: seq(4) timestamp(4) predictor(2) index(1) 保留(1)，大端序
+    QByteArray packet(PACKET_HEADER_SIZE + encoded.size(), Qt::Uninitialized);
+    uchar *header = reinterpret_cast<uchar *>(packet.data());
+    qToBigEndian<quint32>(m_nextSeq++, header);
+    qToBigEndian<quint32>(timestamp, header + 4);
+    qToBigEndian<qint16>(startState.predictor, header + 8);
+    header[10] = startState.index;
+    header[11] = 0;
+    std::memcpy(packet.data() + PACKET_HEADER_SIZE, encoded.constData(), encoded.size());
+
+    m_channel->sendPacket(MediaChannel::AudioFrame, packet);
+}
+
+void AudioStream::onPacketReceived(quint8 type, const QByteArray &payload)
+{
+    if (!m_running || type != MediaChannel::AudioFrame || payload.size() <= PACKET_HEADER_SIZE) {
+        return;
+    }
+    // 没有播放设备时不会有人取走缓冲中的帧，直接丢弃
+    if (!m_sink) {
+        return;
+    }
+
+    const uchar *header = reinterpret_cast<const uchar *>(payload.constData());
+    const quint32 seq = qFromBigEndian<quint32>(header);
+
+    // 已经播放（或已隐藏）过的序号直接丢弃
+    if (m_playing && seq < m_playSeq) {
+        return;
+    }
+
+    EncodedFrame frame;
+    frame.timestamp = qFromBigEndian<quint32>(header + 4);
+    frame.state.predictor = qFromBigEndian<qint16>(header + 8);
+    frame.state.index = header[10];
+    frame.data = payload.mid(PACKET_HEADER_SIZE);
+    m_jitterBuffer.insert(seq, frame);
+
+    // 播放停滞（如设备阻塞）时缓冲也不无限增长，超出上限丢弃最旧的帧
+    while (m_jitterBuffer.size() > MAX_JITTER_FRAMES) {
+        m_jitterBuffer.erase(m_jitterBuffer.begin());
+    }
+}
+
+QByteArray AudioStream::concealFrame()
+{
+    // 重复上一帧并逐帧减半，避免突然静音产生的爆音和重复造成的机械声
+    if (m_lastFrame.isEmpty()) {
+        return QByteArray(FRAME_BYTES, '\0');
+    }
+
+    qint16 *samples = reinterpret_cast<qint16 *>(m_lastFrame.data());
+    for (int i = 0; i < FRAME_SAMPLES; ++i) {
+        samples[i] = static_cast<qint16>(samples[i] / 2);
+    }
+    return m_lastFrame;
+}
+
+void AudioStream::feedPlayback()
+{
+    if (!m_sink || !m_playbackIo) {
+        return;
+    }
+
+    if (!m_playing) {
+        if (m_jitterBuffer.size() < JITTER_TARGET_FRAMES) {
+            return;
+        }
+        m_playing = true;
+        m_playSeq = m_jitterBuffer.firstKey();
+        m_concealedCount = 0;
+    }
+
+    // 积压过多（例如网络恢复后一批包同时到达）时跳到较新的位置
+    if (m_jitterBuffer.size() > MAX_BUFFERED_FRAMES) {
+        m_playSeq = m_jitterBuffer.lastKey() - JITTER_TARGET_FRAMES + 1;
+    }
+    while (!m_jitterBuffer.isEmpty() && m_jitterBuffer.firstKey() < m_playSeq) {
+        m_jitterBuffer.erase(m_jitterBuffer.begin());
+    }
+
+    while (m_sink->bytesFree() >= FRAME_BYTES) {
+        QByteArray pcm;
+        quint32 timestamp = 0;
+        bool concealed = false;
+
+        auto it = m_jitterBuffer.find(m_playSeq);
+        if (it != m_jitterBuffer.end()) {
+            pcm = ImaAdpcm::decode(it->data, FRAME_SAMPLES, it->state);
+            timestamp = it->timestamp;
+            m_jitterBuffer.erase(it);
+            m_lastFrame = pcm;
+            m_concealedCount = 0;
+        } else {
+            if (m_jitterBuffer.isEmpty() && m_concealedCount >= MAX_CONCEALED_FRAMES) {
+                // 对端停止发送（静音或断流），重新进入缓冲状态
+                m_playing = false;
+                m_lastFrame.clear();
+                return;
+            }
+            pcm = concealFrame();
+            m_concealedCount++;
+            concealed = true;
+        }
+
+        m_playbackIo->write(pcm);
+        m_playSeq++;
+
+        if (!concealed) {
+            const int queuedBytes = m_sink->bufferSize() - m_sink->bytesFree();
+            emit framePlayed(timestamp, queuedBytes / (FRAME_BYTES / FRAME_MS));
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef AUDIOSTREAM_H
+#define AUDIOSTREAM_H
+
+#include <QObject>
+#include <QAudioFormat>
+#include <QAudioSource>
+#include <QAudioSink>
+#include <QMap>
+#include <QTimer>
+#include "MediaChannel.h"
+#include "ImaAdpcm.h"
+
+// 通话音频流：QAudioSource 采集 16kHz 单声道，每 20ms 一帧经 IMA ADPCM 编码后
+// 以带序号的 UDP 包发送；接收端经抖动缓冲按序号播放，缺帧时用上一帧衰减重复做丢包隐藏，
+// 最后通过 QAudioSink 播放
+class AudioStream : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AudioStream(MediaChannel *channel, QObject *parent = nullptr);
+    ~AudioStream();
+
+    void start();
+    void stop();
+    void setMuted(bool muted) { m_muted = muted; }
+    void setVolume(qreal volume);
+
+    // 用给定数据源代替麦克风（格式须与 format() 一致），供环回测试使用
+    void setCaptureDevice(QIODevice *device);
+    // 关闭后 start() 不打开麦克风，只接收播放
+    void setCaptureEnabled(bool enabled) { m_captureEnabled = enabled; }
+
+    static QAudioFormat format();
+
+    static const int SAMPLE_RATE = 16000;
+    static const int FRAME_MS = 20;
+    static const int FRAME_SAMPLES = SAMPLE_RATE * FRAME_MS / 1000;
+    static const int FRAME_BYTES = FRAME_SAMPLES * 2;
+
+signals:
+    // 一帧解码后的音频写入播放设备；captureTimestamp 为发送端采集时间（毫秒，取低 32 位），
+    // queuedMs 为写入时播放设备中尚未播出的音频时长
+    void framePlayed(quint32 captureTimestamp, int queuedMs);
+
+private slots:
+    void onCaptureReadyRead();
+    void onPacketReceived(quint8 type, const QByteArray &payload);
+    void feedPlayback();
+
+private:
+    struct EncodedFrame {
+        quint32 timestamp = 0;
+        ImaAdpcm::State state;
+        QByteArray data;
+    };
+
+    static const int PACKET_HEADER_SIZE = 12;
+    static const int JITTER_TARGET_FRAMES = 3;   // 开始播放前缓冲的帧数（60ms）
+    static const int MAX_BUFFERED_FRAMES = 15;   // 积压超过该值时跳帧追赶，限制时延
+    static const int MAX_CONCEALED_FRAMES = 5;   // 连续隐藏超过该帧数后停止播放并重新缓冲
+    static const int MAX_JITTER_FRAMES = 50;     // 抖动缓冲的硬上限（1 秒），播放停滞时丢弃最旧的帧
+
+    void sendFrame(const QByteArray &pcm);
+    QByteArray concealFrame();
+
+    MediaChannel *m_channel;
+    bool m_running = false;
+    bool m_muted = false;
+    bool m_captureEnabled = true;
+    qreal m_volume = 1.0;
+
+    // 采集与发送
+    QAudioSource *m_source = nullptr;
+    QIODevice *m_captureIo = nullptr;
+    QIODevice *m_externalCapture = nullptr;
+    QByteArray m_captureBuffer;
+    quint32 m_nextSeq = 0;
+    ImaAdpcm::State m_encoderState;
+
+    // 接收与播放
+    QAudioSink *m_sink = nullptr;
+    QIODevice *m_playbackIo = nullptr;
+    QMap<quint32, EncodedFrame> m_jitterBuffer;
+    bool m_playing = false;
+    quint32 m_playSeq = 0;
+    QByteArray m_lastFrame;
+    int m_concealedCount = 0;
+    QTimer *m_playbackTimer;
+};
+
+#endif // AUDIOSTREAM_H
@@ -0,0 +1,173 @@
+#include "AvatarService.h"
+#include <QCoreApplication>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+#include <QPainter>
+#include <QPainterPath>
+#include <QDir>
+#include <QFile>
+#include <QDebug>
+
+// 原图最多保留 240px，足够绘制个人信息页的大头像
+static const int SOURCE_MAX_SIZE = 240;
+static const char *DEFAULT_AVATAR = ":/default_avatar.png";
+
+static AvatarService *s_avatarService = nullptr;
+
+AvatarService *AvatarService::instance()
+{
+    if (!s_avatarService) {
+        s_avatarService = new AvatarService(QCoreApplication::instance());
+    }
+    return s_avatarService;
+}
+
+AvatarService::AvatarService(QObject *parent)
+    : QObject(parent)
+{
+    m_cacheDir = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/avatar_cache";
+    QDir().mkpath(m_cacheDir);
+}
+
+QString AvatarService::diskCachePath(const QString &userKey) const
+{
+    QByteArray hash = QCryptographicHash::hash(userKey.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return m_cacheDir + "/" + QString::fromLatin1(hash) + ".img";
+}
+
+QImage AvatarService::normalize(const QImage &image)
+{
+    if (image.isNull()) {
+        return image;
+    }
+    QImage result = image;
+    if (result.width() > SOURCE_MAX_SIZE || result.height() > SOURCE_MAX_SIZE) {
+        result = result.scaled(SOURCE_MAX_SIZE, SOURCE_MAX_SIZE, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
+    }
+    return result.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+}
+
+QImage AvatarService::sourceImage(const QString &userKey)
+{
+    auto it = m_sources.constFind(userKey);
+    if (it != m_sources.constEnd()) {
+        return it.value();
+    }
+
+    QImage image;
+    // 服务器下发过的头像保存在本地磁盘缓存中，重启后不必重新拉取
+    QString cachePath = diskCachePath(userKey);
+    if (QFile::exists(cachePath)) {
+        image.load(cachePath);
+    }
+    if (image.isNull() && m_sourcePaths.contains(userKey)) {
+        image.load(m_sourcePaths.value(userKey));
+    }
+    if (image.isNull()) {
+        if (!m_requested.contains(userKey)) {
+            m_requested.insert(userKey);
+            emit avatarNeeded(userKey);
+        }
+        image.load(DEFAULT_AVATAR);
+    }
+
+    image = normalize(image);
+    m_sources.insert(userKey, image);
+    return image;
+}
+
+QPixmap AvatarService::render(const QImage &source, int size, Shape shape)
+{
+    QPixmap pixmap(size, size);
+    pixmap.fill(Qt::transparent);
+
+    QPainter painter(&pixmap);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+
+    QPainterPath clip;
+    if (shape == Circle) {
+        clip.addEllipse(0, 0, size, size);
+    } else {
+        clip.addRoundedRect(0, 0, size, size, 4, 4);
+    }
+
+    if (source.isNull()) {
+        painter.fillPath(clip, QColor("#c4c4c4"));
+        return pixmap;
+    }
+
+    // 裁成正方形后铺满
+    QImage scaled = source.scaled(size, size, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
+    QRect crop((scaled.width() - size) / 2, (scaled.height() - size) / 2, size, size);
+    painter.setClipPath(clip);
+    painter.drawImage(QRect(0, 0, size, size), scaled, crop);
+    return pixmap;
+}
+
+QPixmap AvatarService::avatar(const QString &userKey, int size, Shape shape)
+{
+    const QString renderKey = QString("%1|%2|%3").arg(userKey).arg(size).arg(shape);
+    auto it = m_rendered.constFind(renderKey);
+    if (it != m_rendered.constEnd()) {
+        return it.value();
+    }
+
+    QPixmap pixmap = render(sourceImage(userKey), size, shape);
+    m_rendered.insert(renderKey, pixmap);
+    return pixmap;
+}
+
+void AvatarService::setAvatarSource(const QString &userKey, const QString &imagePath)
+{
+    if (m_sourcePaths.value(userKey) == imagePath) {
+        return;
+    }
+    m_sourcePaths.insert(userKey, imagePath);
+    // 已经用默认头像绘制过的需要重新绘制
+    if (m_sources.contains(userKey)) {
+        dropRendered(userKey);
+        emit avatarChanged(userKey);
+    }
+}
+
+void AvatarService::setAvatarData(const QString &userKey, const QByteArray &imageData)
+{
+    QImage image;
+    if (!image.loadFromData(imageData)) {
+        qDebug() << "头像数据无法解码:" << userKey;
+        return;
+    }
+
+    QFile file(diskCachePath(userKey));
+    if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        file.write(imageData);
+        file.close();
+    }
+
+    dropRendered(userKey);
+    m_sources.insert(userKey, normalize(image));
+    m_requested.remove(userKey);
+    emit avatarChanged(userKey);
+}
+
+void AvatarService::invalidate(const QString &userKey)
+{
+    QFile::remove(diskCachePath(userKey));
+    dropRendered(userKey);
+    m_requested.remove(userKey);
+    emit avatarChanged(userKey);
+}
+
+void AvatarService::dropRendered(const QString &userKey)
+{
+    m_sources.remove(userKey);
+    const QString prefix = userKey + "|";
+    for (auto it = m_rendered.begin(); it != m_rendered.end();) {
+        if (it.key().startsWith(prefix)) {
+            it = m_rendered.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef AVATARSERVICE_H
+#define AVATARSERVICE_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QImage>
+#include <QPixmap>
+
+/**
+ * 头像服务（全局共用）
+ * 每个用户的头像只解码一次，按需要的尺寸和形状预先绘制好并缓存，
+ * 联系人列表、聊天气泡和个人信息页共用同一份；不再为每个控件设置 border-image 样式表。
+ *
+ * 头像来源按优先级：setAvatarData 提供的图片数据（来自服务器，同时写入本地磁盘缓存）
+ * > 本地磁盘缓存 > setAvatarSource 登记的图片路径 > 默认头像。
+ * 都没有时发出 avatarNeeded，由持有服务器连接的窗口去拉取后调用 setAvatarData。
+ * 用户保存新头像后调用 setAvatarData 或 invalidate，所有使用处通过 avatarChanged 刷新。
+ */
+class AvatarService : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Shape {
+        RoundedSquare,   // 4px 圆角方形，联系人列表和聊天气泡
+        Circle           // 圆形，个人信息页
+    };
+
+    static AvatarService *instance();
+
+    // userKey 为调用方识别用户的字符串（用户名或用户ID），同一用户在各处使用同一个 key 即共享缓存
+    QPixmap avatar(const QString &userKey, int size, Shape shape = RoundedSquare);
+
+    void setAvatarSource(const QString &userKey, const QString &imagePath);
+    void setAvatarData(const QString &userKey, const QByteArray &imageData);
+    void invalidate(const QString &userKey);
+
+signals:
+    void avatarChanged(const QString &userKey);
+    void avatarNeeded(const QString &userKey);
+
+private:
+    explicit AvatarService(QObject *parent = nullptr);
+
+    QImage sourceImage(const QString &userKey);
+    QString diskCachePath(const QString &userKey) const;
+    void dropRendered(const QString &userKey);
+    static QImage normalize(const QImage &image);
+    static QPixmap render(const QImage &source, int size, Shape shape);
+
+    QHash<QString, QImage> m_sources;          // 解码并缩小后的原图
+    QHash<QString, QString> m_sourcePaths;
+    QHash<QString, QPixmap> m_rendered;        // key: userKey + 尺寸 + 形状
+    QSet<QString> m_requested;                 // 已发出 avatarNeeded 的用户，只请求一次
+    QString m_cacheDir;
+};
+
+#endif // AVATARSERVICE_H
@@ -0,0 +1,216 @@
+#include "ChatBubbleDelegate.h"
+#include "AvatarService.h"
+#include <QPainter>
+#include <QPainterPath>
+#include <QAbstractItemView>
+#include <QApplication>
+#include <QTextLine>
+#include <QtMath>
+
+// 与原气泡控件保持一致的尺寸
+static const int ROW_MARGIN = 10;
+static const int AVATAR_SIZE = 40;
+static const int AVATAR_SPACING = 10;
+static const int NAME_SPACING = 5;
+static const int BUBBLE_PADDING = 10;
+static const int BUBBLE_RADIUS = 10;
+static const int IMAGE_MAX_SIZE = 150;
+static const int LAYOUT_CACHE_SIZE = 4000;  // 约为几屏消息的数倍，滚回时无需重新排版
+
+ChatBubbleDelegate::ChatBubbleDelegate(QObject *parent)
+    : QStyledItemDelegate(parent)
+    , m_layouts(LAYOUT_CACHE_SIZE)
+    , m_thumbnails(new ThumbnailLoader(this))
+{
+    connect(m_thumbnails, &ThumbnailLoader::thumbnailReady, this, &ChatBubbleDelegate::repaintNeeded);
+    connect(AvatarService::instance(), &AvatarService::avatarChanged, this, &ChatBubbleDelegate::repaintNeeded);
+
+    m_nameFont = QApplication::font();
+    m_nameFont.setPointSize(8);
+    m_textFont = QApplication::font();
+    m_textFont.setPointSize(12);
+    m_noticeFont = QApplication::font();
+}
+
+ChatBubbleDelegate::~ChatBubbleDelegate()
+{
+}
+
+void ChatBubbleDelegate::clearCache()
+{
+    m_layouts.clear();
+}
+
+int ChatBubbleDelegate::viewportWidth(const QStyleOptionViewItem &option)
+{
+    // QListView 计算行高时传入的 rect 可能为空，以视口宽度为准
+    if (const QAbstractItemView *view = qobject_cast<const QAbstractItemView *>(option.widget)) {
+        return view->viewport()->width();
+    }
+    return option.rect.width();
+}
+
+QSize ChatBubbleDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    const ChatMessageModel *model = qobject_cast<const ChatMessageModel *>(index.model());
+    if (!model) {
+        return QStyledItemDelegate::sizeHint(option, index);
+    }
+
+    const int width = viewportWidth(option);
+    const BubbleLayout *layout = layoutFor(model->messageAt(index.row()), width);
+    return QSize(width, layout->height);
+}
+
+void ChatBubbleDelegate::layoutText(BubbleLayout *layout, const QString &text, const QFont &font, int maxWidth) const
+{
+    QTextOption textOption;
+    textOption.setWrapMode(QTextOption::WrapAtWordBoundaryOrAnywhere);
+
+    QTextLayout &textLayout = layout->textLayout;
+    textLayout.setText(text);
+    textLayout.setFont(font);
+    textLayout.setTextOption(textOption);
+    textLayout.setCacheEnabled(true);
+
+    const QFontMetricsF metrics(font);
+    qreal height = 0;
+    textLayout.beginLayout();
+    while (true) {
+        QTextLine line = textLayout.createLine();
+        if (!line.isValid()) {
+            break;
+        }
+        line.setLineWidth(maxWidth);
+        line.setPosition(QPointF(0, height));
+        height += line.height();
+    }
+    textLayout.endLayout();
+
+    // 气泡宽度取实际最长一行，短消息不会被撑满
+    qreal naturalWidth = 0;
+    for (int i = 0; i < textLayout.lineCount(); ++i) {
+        naturalWidth = qMax(naturalWidth, textLayout.lineAt(i).naturalTextWidth());
+    }
+    layout->bubbleRect.setSize(QSize(qCeil(naturalWidth) + 2 * BUBBLE_PADDING,
+                                     qMax(qCeil(height), qCeil(metrics.height())) + 2 * BUBBLE_PADDING));
+}
+
+const ChatBubbleDelegate::BubbleLayout *ChatBubbleDelegate::layoutFor(const ChatMessage &message, int width) const
+{
+    BubbleLayout *cached = m_layouts.object(message.key);
+    if (cached && cached->width == width) {
+        return cached;
+    }
+
+    BubbleLayout *layout = new BubbleLayout;
+    layout->width = width;
+
+    if (message.type == ChatMessage::Notice) {
+        // 居中提示条
+        const int maxWidth = qMax(50, width - 2 * ROW_MARGIN - 2 * BUBBLE_PADDING);
+        layoutText(layout, message.content, m_noticeFont, maxWidth);
+        layout->bubbleRect.moveTopLeft(QPoint((width - layout->bubbleRect.width()) / 2, ROW_MARGIN));
+        layout->height = layout->bubbleRect.height() + 2 * ROW_MARGIN;
+    } else {
+        const QFontMetrics nameMetrics(m_nameFont);
+        const int contentLeft = ROW_MARGIN + AVATAR_SIZE + AVATAR_SPACING;
+        const int contentWidth = qMax(60, width - 2 * contentLeft);
+
+        if (message.type == ChatMessage::Image) {
+            // 只读图片头获取尺寸，不解码像素
+            QSize imageSize = m_thumbnails->imageSize(message.content);
+            if (!imageSize.isValid()) {
+                imageSize = QSize(IMAGE_MAX_SIZE, IMAGE_MAX_SIZE / 2);
+            }
+            layout->imageSize = imageSize.scaled(IMAGE_MAX_SIZE, IMAGE_MAX_SIZE, Qt::KeepAspectRatio);
+            layout->bubbleRect.setSize(layout->imageSize);
+        } else {
+            layoutText(layout, message.content, m_textFont, contentWidth - 2 * BUBBLE_PADDING);
+        }
+
+        const int nameWidth = qMin(contentWidth, nameMetrics.horizontalAdvance(message.sender));
+        const int nameTop = ROW_MARGIN;
+        const int bubbleTop = nameTop + nameMetrics.height() + NAME_SPACING;
+
+        if (message.isSelf) {
+            // 自己的消息：头像在最右侧，用户名和气泡右对齐
+            const int contentRight = width - ROW_MARGIN - AVATAR_SIZE - AVATAR_SPACING;
+            layout->avatarRect = QRect(width - ROW_MARGIN - AVATAR_SIZE, ROW_MARGIN, AVATAR_SIZE, AVATAR_SIZE);
+            layout->nameRect = QRect(contentRight - nameWidth, nameTop, nameWidth, nameMetrics.height());
+            layout->bubbleRect.moveTopLeft(QPoint(contentRight - layout->bubbleRect.width(), bubbleTop));
+        } else {
+            layout->avatarRect = QRect(ROW_MARGIN, ROW_MARGIN, AVATAR_SIZE, AVATAR_SIZE);
+            layout->nameRect = QRect(contentLeft, nameTop, nameWidth, nameMetrics.height());
+            layout->bubbleRect.moveTopLeft(QPoint(contentLeft, bubbleTop));
+        }
+        layout->height = qMax(layout->bubbleRect.bottom() + 1, layout->avatarRect.bottom() + 1) + ROW_MARGIN;
+    }
+
+    layout->textOrigin = QPointF(layout->bubbleRect.left() + BUBBLE_PADDING, layout->bubbleRect.top() + BUBBLE_PADDING);
+
+    const BubbleLayout *result = layout;
+    m_layouts.insert(message.key, layout);
+    return result;
+}
+
+void ChatBubbleDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    const ChatMessageModel *model = qobject_cast<const ChatMessageModel *>(index.model());
+    if (!model) {
+        QStyledItemDelegate::paint(painter, option, index);
+        return;
+    }
+
+    const ChatMessage &message = model->messageAt(index.row());
+    // 与 sizeHint 取同一宽度，行高和绘制用的是同一份排版
+    const int width = viewportWidth(option);
+    const BubbleLayout *layout = layoutFor(message, width);
+
+    painter->save();
+    painter->setRenderHint(QPainter::Antialiasing);
+    painter->translate(option.rect.topLeft());
+    painter->setClipRect(QRect(0, 0, width, option.rect.height()));
+
+    if (message.type == ChatMessage::Notice) {
+        painter->setPen(Qt::NoPen);
+        painter->setBrush(QColor("#dadada"));
+        painter->drawRoundedRect(layout->bubbleRect, BUBBLE_RADIUS, BUBBLE_RADIUS);
+        painter->setPen(QColor("#fdfdfd"));
+        layout->textLayout.draw(painter, layout->textOrigin);
+        painter->restore();
+        return;
+    }
+
+    // 头像由 AvatarService 预先绘制好圆角，直接贴图
+    painter->drawPixmap(layout->avatarRect, AvatarService::instance()->avatar(message.senderId, AVATAR_SIZE));
+
+    // 用户名
+    painter->setFont(m_nameFont);
+    painter->setPen(Qt::black);
+    painter->drawText(layout->nameRect, (message.isSelf ? Qt::AlignRight : Qt::AlignLeft) | Qt::AlignVCenter,
+                      message.sender);
+
+    if (message.type == ChatMessage::Image) {
+        // 解码在线程池中进行，未完成时先画占位底色，完成后 repaintNeeded 触发重绘
+        QPixmap image = m_thumbnails->thumbnail(message.content, layout->imageSize);
+        QPainterPath imageClip;
+        imageClip.addRoundedRect(layout->bubbleRect, BUBBLE_RADIUS, BUBBLE_RADIUS);
+        if (image.isNull()) {
+            painter->fillPath(imageClip, QColor("#e0e0e0"));
+        } else {
+            painter->save();
+            painter->setClipPath(imageClip, Qt::IntersectClip);
+            painter->drawPixmap(layout->bubbleRect, image);
+            painter->restore();
+        }
+    } else {
+        painter->setPen(Qt::NoPen);
+        painter->setBrush(QColor(message.isSelf ? "#95ec69" : "white"));
+        painter->drawRoundedRect(layout->bubbleRect, BUBBLE_RADIUS, BUBBLE_RADIUS);
+        painter->setPen(Qt::black);
+        layout->textLayout.draw(painter, layout->textOrigin);
+    }
+
+    painter->restore();
+}
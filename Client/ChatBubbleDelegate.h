@@ -0,0 +1,55 @@
+#ifndef CHATBUBBLEDELEGATE_H
+#define CHATBUBBLEDELEGATE_H
+
+#include <QStyledItemDelegate>
+#include <QCache>
+#include <QPixmap>
+#include <QTextLayout>
+#include <QFont>
+#include "ChatMessageModel.h"
+#include "ThumbnailLoader.h"
+
+// 聊天气泡委托：直接绘制头像、用户名和气泡，取代每条消息一套 QWidget/QLabel。
+// 每条消息的排版（换行后的文字、气泡位置）按视口宽度缓存，滚动时只绘制不重新排版
+class ChatBubbleDelegate : public QStyledItemDelegate
+{
+    Q_OBJECT
+
+public:
+    explicit ChatBubbleDelegate(QObject *parent = nullptr);
+    ~ChatBubbleDelegate();
+
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+    QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+
+    void clearCache();
+
+signals:
+    // 后台解码的图片就绪或头像更新，视图需要重绘可见区域
+    void repaintNeeded();
+
+private:
+    // 坐标均相对于行的左上角
+    struct BubbleLayout {
+        int width = 0;            // 排版时的视口宽度，宽度变化后重新排版
+        int height = 0;
+        QRect avatarRect;
+        QRect nameRect;
+        QRect bubbleRect;
+        QPointF textOrigin;
+        QTextLayout textLayout;
+        QSize imageSize;
+    };
+
+    const BubbleLayout *layoutFor(const ChatMessage &message, int width) const;
+    void layoutText(BubbleLayout *layout, const QString &text, const QFont &font, int maxWidth) const;
+    static int viewportWidth(const QStyleOptionViewItem &option);
+
+    QFont m_nameFont;
+    QFont m_textFont;
+    QFont m_noticeFont;
+    mutable QCache<quint64, BubbleLayout> m_layouts;
+    ThumbnailLoader *m_thumbnails;
+};
+
+#endif // CHATBUBBLEDELEGATE_H
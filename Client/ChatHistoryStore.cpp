@@ -0,0 +1,231 @@
+#include "ChatHistoryStore.h"
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QDebug>
+#include <algorithm>
+
+ChatHistoryStore::ChatHistoryStore(const QString &ownerId)
+    : m_ownerId(ownerId)
+{
+    // 同一用户可能同时打开多个窗口，每个实例使用自己的连接名
+    static int instanceCounter = 0;
+    m_connectionName = QString("chat_history_store_%1").arg(++instanceCounter);
+
+    QString dirPath = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/chat_history";
+    QDir().mkpath(dirPath);
+    QString fileName = QString::fromLatin1(QCryptographicHash::hash(ownerId.toUtf8(), QCryptographicHash::Sha1).toHex()) + ".db";
+    QString filePath = QDir(dirPath).filePath(fileName);
+
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+    db.setDatabaseName(filePath);
+    if (!db.open()) {
+        qDebug() << "本地聊天记录打开失败:" << filePath << db.lastError().text();
+        return;
+    }
+
+    // 聊天记录只允许当前系统用户读写
+    QFile::setPermissions(filePath, QFileDevice::ReadOwner | QFileDevice::WriteOwner);
+
+    m_open = createSchema();
+}
+
+ChatHistoryStore::~ChatHistoryStore()
+{
+    {
+        QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(m_connectionName);
+}
+
+bool ChatHistoryStore::createSchema()
+{
+    QSqlQuery query(QSqlDatabase::database(m_connectionName));
+    query.exec("PRAGMA journal_mode = WAL");
+    query.exec("PRAGMA synchronous = NORMAL");
+
+    bool ok = query.exec("CREATE TABLE IF NOT EXISTS message ("
+                         "message_id INTEGER PRIMARY KEY,"  // 服务器分配的消息ID
+                         "peer_id TEXT NOT NULL,"           // 会话对方的用户ID
+                         "sender_id TEXT NOT NULL,"
+                         "receiver_id TEXT NOT NULL,"
+                         "content TEXT NOT NULL,"
+                         "send_time TEXT"
+                         ")");
+    ok = ok && query.exec("CREATE INDEX IF NOT EXISTS idx_message_peer_id ON message(peer_id, message_id)");
+    ok = ok && query.exec("CREATE TABLE IF NOT EXISTS sync_state ("
+                          "key TEXT PRIMARY KEY,"
+                          "value TEXT NOT NULL"
+                          ")");
+    if (!ok) {
+        qDebug() << "本地聊天记录建表失败:" << query.lastError().text();
+    }
+    return ok;
+}
+
+QString ChatHistoryStore::peerOf(const StoredChatMessage &message) const
+{
+    if (message.senderId == m_ownerId) {
+        return message.receiverId;
+    }
+    if (message.receiverId == m_ownerId) {
+        return message.senderId;
+    }
+    return QString();
+}
+
+QVector<StoredChatMessage> ChatHistoryStore::loadConversation(const QString &peerId, int limit) const
+{
+    QVector<StoredChatMessage> messages;
+    if (!m_open) {
+        return messages;
+    }
+
+    // 先按 (peer_id, message_id) 索引倒序取最近的若干条，再按升序返回；LIMIT -1 即不限条数
+    QSqlQuery query(QSqlDatabase::database(m_connectionName));
+    query.prepare("SELECT message_id, sender_id, receiver_id, content, send_time FROM ("
+                  "  SELECT * FROM message WHERE peer_id = :peer_id ORDER BY message_id DESC LIMIT :limit"
+                  ") ORDER BY message_id ASC");
+    query.bindValue(":peer_id", peerId);
+    query.bindValue(":limit", limit > 0 ? limit : -1);
+
+    if (!query.exec()) {
+        qDebug() << "读取本地聊天记录失败:" << query.lastError().text();
+        return messages;
+    }
+
+    while (query.next()) {
+        StoredChatMessage message;
+        message.messageId = query.value(0).toLongLong();
+        message.senderId = query.value(1).toString();
+        message.receiverId = query.value(2).toString();
+        message.content = query.value(3).toString();
+        message.sendTime = query.value(4).toString();
+        messages.append(message);
+    }
+    return messages;
+}
+
+qint64 ChatHistoryStore::lastMessageId(const QString &peerId) const
+{
+    if (!m_open) {
+        return 0;
+    }
+
+    QSqlQuery query(QSqlDatabase::database(m_connectionName));
+    query.prepare("SELECT COALESCE(MAX(message_id), 0) FROM message WHERE peer_id = :peer_id");
+    query.bindValue(":peer_id", peerId);
+    if (query.exec() && query.next()) {
+        return query.value(0).toLongLong();
+    }
+    return 0;
+}
+
+QVector<StoredChatMessage> ChatHistoryStore::insertMessages(const QVector<StoredChatMessage> &messages)
+{
+    QVector<StoredChatMessage> inserted;
+    if (!m_open || messages.isEmpty()) {
+        return inserted;
+    }
+
+    // 整批一个事务写入
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    db.transaction();
+
+    QSqlQuery query(db);
+    query.prepare("INSERT OR IGNORE INTO message (message_id, peer_id, sender_id, receiver_id, content, send_time) "
+                  "VALUES (:message_id, :peer_id, :sender_id, :receiver_id, :content, :send_time)");
+
+    for (const StoredChatMessage &message : messages) {
+        QString peerId = peerOf(message);
+        if (message.messageId <= 0 || peerId.isEmpty()) {
+            continue;
+        }
+
+        query.bindValue(":message_id", message.messageId);
+        query.bindValue(":peer_id", peerId);
+        query.bindValue(":sender_id", message.senderId);
+        query.bindValue(":receiver_id", message.receiverId);
+        query.bindValue(":content", message.content);
+        query.bindValue(":send_time", message.sendTime);
+        if (!query.exec()) {
+            qDebug() << "写入本地聊天记录失败:" << query.lastError().text();
+            db.rollback();
+            return QVector<StoredChatMessage>();
+        }
+        if (query.numRowsAffected() > 0) {
+            inserted.append(message);
+        }
+    }
+
+    if (!db.commit()) {
+        qDebug() << "本地聊天记录提交失败:" << db.lastError().text();
+        db.rollback();
+        return QVector<StoredChatMessage>();
+    }
+
+    std::sort(inserted.begin(), inserted.end(), [](const StoredChatMessage &a, const StoredChatMessage &b) {
+        return a.messageId < b.messageId;
+    });
+    return inserted;
+}
+
+bool ChatHistoryStore::applyServerEpoch(const QString &epoch)
+{
+    if (!m_open || epoch.isEmpty()) {
+        return false;
+    }
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+    QSqlQuery query(db);
+    query.prepare("SELECT value FROM sync_state WHERE key = 'server_epoch'");
+    if (query.exec() && query.next() && query.value(0).toString() == epoch) {
+        return false;
+    }
+
+    // 旧 epoch 的 message_id 会与新分配的冲突，本地记录整体作废
+    db.transaction();
+    bool ok = query.exec("DELETE FROM message");
+    query.prepare("INSERT OR REPLACE INTO sync_state (key, value) VALUES ('server_epoch', :epoch)");
+    query.bindValue(":epoch", epoch);
+    ok = ok && query.exec();
+    if (!ok || !db.commit()) {
+        qDebug() << "本地聊天记录重置失败:" << query.lastError().text();
+        db.rollback();
+        return false;
+    }
+    qDebug() << "服务器已重启，清空本地聊天记录，重新同步:" << epoch;
+    return true;
+}
+
+QByteArray ChatHistoryStore::syncRequest(const QString &peerId) const
+{
+    return QString("GET_CHAT_HISTORY#%1#%2#%3\n").arg(m_ownerId, peerId).arg(lastMessageId(peerId)).toUtf8();
+}
+
+QVector<StoredChatMessage> ChatHistoryStore::parseHistoryRows(const QByteArray &json)
+{
+    QVector<StoredChatMessage> messages;
+    const QJsonArray rows = QJsonDocument::fromJson(json).array();
+    messages.reserve(rows.size());
+
+    for (const QJsonValue &value : rows) {
+        QJsonObject row = value.toObject();
+        StoredChatMessage message;
+        message.messageId = row["message_id"].toString().toLongLong();
+        message.senderId = row["sender_id"].toString();
+        message.receiverId = row["receiver_id"].toString();
+        message.content = row["content"].toString();
+        message.sendTime = row["send_time"].toString();
+        messages.append(message);
+    }
+    return messages;
+}
@@ -0,0 +1,59 @@
+#ifndef CHATHISTORYSTORE_H
+#define CHATHISTORYSTORE_H
+
+#include <QString>
+#include <QVector>
+#include <QByteArray>
+
+// 本地保存的一条聊天消息，messageId 为服务器分配的 message_id
+struct StoredChatMessage
+{
+    qint64 messageId = 0;
+    QString senderId;
+    QString receiverId;
+    QString content;     // 图片消息为服务器格式 [IMAGE:文件名]
+    QString sendTime;
+};
+
+/**
+ * 客户端聊天记录本地存储
+ * 每个登录用户一个 SQLite 文件，消息以服务器 message_id 为主键，并按 (peer_id, message_id) 建索引，
+ * 打开会话时直接从磁盘渲染，再以本地最大的 message_id 作为 since_message_id 只向服务器拉取新消息。
+ * 只保存服务器已确认（有 message_id）的消息；使用独立的连接名，不占用默认数据库连接。
+ */
+class ChatHistoryStore
+{
+public:
+    explicit ChatHistoryStore(const QString &ownerId);
+    ~ChatHistoryStore();
+
+    bool isOpen() const { return m_open; }
+    QString ownerId() const { return m_ownerId; }
+
+    // 按 message_id 升序返回与 peerId 的会话；limit > 0 时只取最近的 limit 条
+    QVector<StoredChatMessage> loadConversation(const QString &peerId, int limit = 0) const;
+    qint64 lastMessageId(const QString &peerId) const;
+
+    // 写入服务器返回的消息，已存在的 message_id 跳过；返回本地原先没有的消息（按 message_id 升序）
+    QVector<StoredChatMessage> insertMessages(const QVector<StoredChatMessage> &messages);
+
+    // 服务器每次启动重建消息表、message_id 从头分配，本地游标只在同一 epoch 内有效。
+    // epoch 与上次同步时不同（或本地记录没有 epoch）时清空本地记录并返回 true，之后重新全量同步
+    bool applyServerEpoch(const QString &epoch);
+
+    // 增量同步请求: GET_CHAT_HISTORY#ownerId#peerId#since_message_id
+    QByteArray syncRequest(const QString &peerId) const;
+    // 解析 GET_CHAT_HISTORY_SUCCESS# / CHAT_HISTORY_DELTA# 之后的 JSON 数组
+    static QVector<StoredChatMessage> parseHistoryRows(const QByteArray &json);
+
+    QString peerOf(const StoredChatMessage &message) const;
+
+private:
+    bool createSchema();
+
+    QString m_ownerId;
+    QString m_connectionName;
+    bool m_open = false;
+};
+
+#endif // CHATHISTORYSTORE_H
@@ -0,0 +1,61 @@
+#include "ChatMessageModel.h"
+
+ChatMessageModel::ChatMessageModel(QObject *parent)
+    : QAbstractListModel(parent)
+{
+}
+
+int ChatMessageModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_messages.size();
+}
+
+QVariant ChatMessageModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_messages.size()) {
+        return QVariant();
+    }
+
+    if (role == Qt::DisplayRole || role == Qt::ToolTipRole) {
+        return m_messages.at(index.row()).content;
+    }
+    return QVariant();
+}
+
+void ChatMessageModel::appendMessage(ChatMessage message)
+{
+    message.key = m_nextKey++;
+    const int row = m_messages.size();
+    beginInsertRows(QModelIndex(), row, row);
+    m_messages.append(std::move(message));
+    endInsertRows();
+}
+
+void ChatMessageModel::appendMessages(QVector<ChatMessage> messages)
+{
+    if (messages.isEmpty()) {
+        return;
+    }
+    for (ChatMessage &message : messages) {
+        message.key = m_nextKey++;
+    }
+
+    const int first = m_messages.size();
+    beginInsertRows(QModelIndex(), first, first + messages.size() - 1);
+    m_messages.reserve(first + messages.size());
+    for (ChatMessage &message : messages) {
+        m_messages.append(std::move(message));
+    }
+    endInsertRows();
+}
+
+void ChatMessageModel::clear()
+{
+    if (m_messages.isEmpty()) {
+        return;
+    }
+    beginResetModel();
+    m_messages.clear();
+    m_messages.squeeze();
+    endResetModel();
+}
@@ -0,0 +1,48 @@
+#ifndef CHATMESSAGEMODEL_H
+#define CHATMESSAGEMODEL_H
+
+#include <QAbstractListModel>
+#include <QVector>
+
+// 聊天窗口的一条消息
+struct ChatMessage
+{
+    enum Type {
+        Text = 0,    // 文字
+        Image = 1,   // 图片，content 为图片路径
+        Notice = 2   // 居中的提示（如文件通知）
+    };
+
+    quint64 key = 0;        // 模型内唯一编号，委托按它缓存排版结果
+    Type type = Text;
+    QString sender;
+    QString senderId;       // 发送者的服务器用户ID，头像按它查找
+    QString content;
+    bool isSelf = false;
+};
+
+// 聊天消息列表模型：只保存数据，不为每条消息创建控件，
+// 由 ChatBubbleDelegate 绘制，QListView 只处理可见行
+class ChatMessageModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    explicit ChatMessageModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    // 委托绘制时直接按行取数据，不经过 QVariant
+    const ChatMessage &messageAt(int row) const { return m_messages.at(row); }
+
+    void appendMessage(ChatMessage message);
+    void appendMessages(QVector<ChatMessage> messages);   // 加载历史记录时一次性插入
+    void clear();
+
+private:
+    QVector<ChatMessage> m_messages;
+    quint64 m_nextKey = 1;
+};
+
+#endif // CHATMESSAGEMODEL_H
@@ -0,0 +1,78 @@
+#include "CongestionController.h"
+
+CongestionController::CongestionController()
+{
+    m_levels = {
+        { QSize(320, 180),  10, 40, "180p" },
+        { QSize(480, 270),  12, 50, "270p" },
+        { QSize(640, 360),  15, 60, "360p" },
+        { QSize(960, 540),  20, 65, "540p" },
+        { QSize(1280, 720), 25, 70, "720p" },
+    };
+    m_levelIndex = 2; // 从 360p 起步，与原固定参数一致
+}
+
+bool CongestionController::onReport(const Report &report, qint64 nowMs)
+{
+    // 没有新的发送端报告可回显时本次报告不含 RTT，沿用上次测得的值
+    const int previousRttMs = m_lastReport.rttMs;
+    m_lastReport = report;
+    if (m_lastReport.rttMs < 0) {
+        m_lastReport.rttMs = previousRttMs;
+    }
+    const Report &current = m_lastReport;
+
+    const bool congested = current.lossFraction > LOSS_DECREASE
+                        || (current.rttMs >= 0 && current.rttMs > RTT_DECREASE_MS);
+    if (congested) {
+        m_goodReports = 0;
+        if (m_levelIndex == 0) {
+            return false;
+        }
+
+        // 刚升档就拥塞说明探测失败，加倍等待时间再尝试
+        if (m_lastChangeWasIncrease) {
+            m_holdMs = qMin(m_holdMs * 2, MAX_HOLD_MS);
+        }
+        m_levelIndex--;
+        m_lastChangeWasIncrease = false;
+        m_holdUntilMs = nowMs + m_holdMs;
+        return true;
+    }
+
+    const bool good = current.lossFraction < LOSS_INCREASE
+                   && current.rttMs >= 0 && current.rttMs < RTT_INCREASE_MS
+                   && current.jitterMs < JITTER_INCREASE_MS;
+    if (!good) {
+        m_goodReports = 0;
+        return false;
+    }
+
+    m_goodReports++;
+    if (m_lastChangeWasIncrease && m_goodReports >= GOOD_REPORTS_TO_INCREASE) {
+        // 升档后链路连续良好，探测成功：之后的拥塞不再算作探测失败，等待时间恢复默认
+        m_lastChangeWasIncrease = false;
+        m_holdMs = HOLD_AFTER_DECREASE_MS;
+    }
+    if (m_goodReports < GOOD_REPORTS_TO_INCREASE || nowMs < m_holdUntilMs
+        || m_levelIndex + 1 >= m_levels.size()) {
+        return false;
+    }
+
+    m_levelIndex++;
+    m_goodReports = 0;
+    m_lastChangeWasIncrease = true;
+    return true;
+}
+
+QString CongestionController::statsText() const
+{
+    const Level &level = currentLevel();
+    QString rtt = m_lastReport.rttMs >= 0 ? QString("%1ms").arg(m_lastReport.rttMs) : QString("--");
+    return QString("%1@%2fps 丢包 %3% RTT %4 抖动 %5ms")
+        .arg(level.name)
+        .arg(level.frameRate)
+        .arg(m_lastReport.lossFraction * 100.0, 0, 'f', 1)
+        .arg(rtt)
+        .arg(m_lastReport.jitterMs);
+}
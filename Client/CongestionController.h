@@ -0,0 +1,56 @@
+#ifndef CONGESTIONCONTROLLER_H
+#define CONGESTIONCONTROLLER_H
+
+#include <QSize>
+#include <QString>
+#include <QVector>
+
+// 视频通话的拥塞控制：根据接收端报告（丢包率、RTT、抖动）在预设的画质档位间升降
+// 丢包或时延恶化时立即降一档；链路持续良好一段时间后再试探升一档，升档失败后延长等待
+class CongestionController
+{
+public:
+    struct Level {
+        QSize size;
+        int frameRate;
+        int jpegQuality;
+        const char *name;
+    };
+
+    struct Report {
+        double lossFraction = 0.0; // 0.0 ~ 1.0
+        int rttMs = -1;            // -1 表示尚未测得
+        int jitterMs = 0;
+    };
+
+    CongestionController();
+
+    // 处理一份接收端报告，档位变化时返回 true
+    bool onReport(const Report &report, qint64 nowMs);
+
+    const Level &currentLevel() const { return m_levels[m_levelIndex]; }
+    int levelIndex() const { return m_levelIndex; }
+    int levelCount() const { return m_levels.size(); }
+    const Report &lastReport() const { return m_lastReport; }
+    QString statsText() const; // 状态栏显示用
+
+private:
+    static constexpr double LOSS_DECREASE = 0.10;   // 丢包超过 10% 降档
+    static constexpr double LOSS_INCREASE = 0.02;   // 丢包低于 2% 才考虑升档
+    static const int RTT_DECREASE_MS = 400;
+    static const int RTT_INCREASE_MS = 200;
+    static const int JITTER_INCREASE_MS = 30;
+    static const int GOOD_REPORTS_TO_INCREASE = 3;
+    static const int HOLD_AFTER_DECREASE_MS = 5000;
+    static const int MAX_HOLD_MS = 60000;
+
+    QVector<Level> m_levels;
+    int m_levelIndex;
+    int m_goodReports = 0;
+    qint64 m_holdUntilMs = 0;
+    int m_holdMs = HOLD_AFTER_DECREASE_MS;
+    bool m_lastChangeWasIncrease = false;
+    Report m_lastReport;
+};
+
+#endif // CONGESTIONCONTROLLER_H
@@ -0,0 +1,93 @@
+#include "ImaAdpcm.h"
+#include <QtGlobal>
+
+namespace ImaAdpcm {
+
+static const int INDEX_TABLE[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static const int STEP_TABLE[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static int decodeNibble(quint8 nibble, int &predictor, int &index)
+{
+    const int step = STEP_TABLE[index];
+    int diff = step >> 3;
+    if (nibble & 4) diff += step;
+    if (nibble & 2) diff += step >> 1;
+    if (nibble & 1) diff += step >> 2;
+    if (nibble & 8) {
+        predictor -= diff;
+    } else {
+        predictor += diff;
+    }
+    predictor = qBound(-32768, predictor, 32767);
+    index = qBound(0, index + INDEX_TABLE[nibble], 88);
+    return predictor;
+}
+
+QByteArray encode(const qint16 *samples, int sampleCount, State &state)
+{
+    QByteArray out((sampleCount + 1) / 2, '\0');
+    int predictor = state.predictor;
+    int index = state.index;
+
+    for (int i = 0; i < sampleCount; ++i) {
+        const int step = STEP_TABLE[index];
+        int diff = samples[i] - predictor;
+        quint8 nibble = 0;
+        if (diff < 0) {
+            nibble = 8;
+            diff = -diff;
+        }
+        if (diff >= step) { nibble |= 4; diff -= step; }
+        if (diff >= (step >> 1)) { nibble |= 2; diff -= step >> 1; }
+        if (diff >= (step >> 2)) { nibble |= 1; }
+
+        // 用与解码端相同的方式更新预测值，保证两端状态一致
+        decodeNibble(nibble, predictor, index);
+
+        if (i % 2 == 0) {
+            out[i / 2] = static_cast<char>(nibble);
+        } else {
+            out[i / 2] = static_cast<char>(static_cast<quint8>(out[i / 2]) | (nibble << 4));
+        }
+    }
+
+    state.predictor = static_cast<qint16>(predictor);
+    state.index = static_cast<quint8>(index);
+    return out;
+}
+
+QByteArray decode(const QByteArray &data, int sampleCount, State state)
+{
+    QByteArray out(sampleCount * 2, Qt::Uninitialized);
+    qint16 *samples = reinterpret_cast<qint16 *>(out.data());
+    int predictor = state.predictor;
+    int index = qBound(0, int(state.index), 88);
+
+    for (int i = 0; i < sampleCount; ++i) {
+        const int byteIndex = i / 2;
+        if (byteIndex >= data.size()) {
+            samples[i] = 0;
+            continue;
+        }
+        const quint8 byte = static_cast<quint8>(data[byteIndex]);
+        const quint8 nibble = (i % 2 == 0) ? (byte & 0x0f) : (byte >> 4);
+        samples[i] = static_cast<qint16>(decodeNibble(nibble, predictor, index));
+    }
+    return out;
+}
+
+}
@@ -0,0 +1,23 @@
+#ifndef IMAADPCM_H
+#define IMAADPCM_H
+
+#include <QByteArray>
+
+// IMA ADPCM 编解码（16 位 PCM <-> 4 位/样本，4:1 压缩）
+// 每个音频包携带编码起始状态，解码不依赖前一个包，丢包不会导致后续解码错位
+namespace ImaAdpcm {
+
+struct State {
+    qint16 predictor = 0;
+    quint8 index = 0;
+};
+
+// 编码 sampleCount 个样本，state 输入为起始状态，返回时更新为结束状态
+QByteArray encode(const qint16 *samples, int sampleCount, State &state);
+
+// 从给定起始状态解码，输出 sampleCount 个 16 位样本（字节序同本机）
+QByteArray decode(const QByteArray &data, int sampleCount, State state);
+
+}
+
+#endif // IMAADPCM_H
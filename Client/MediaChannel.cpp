@@ -0,0 +1,124 @@
+#include "MediaChannel.h"
+#include <QNetworkDatagram>
+#include <QRandomGenerator>
+#include <QTimer>
+#include <QDebug>
+
+MediaChannel::MediaChannel(QObject *parent)
+    : QObject(parent)
+    , m_socket(new QUdpSocket(this))
+{
+    connect(m_socket, &QUdpSocket::readyRead, this, &MediaChannel::onReadyRead);
+    loadSimulationFromEnvironment();
+}
+
+void MediaChannel::loadSimulationFromEnvironment()
+{
+    const QString spec = qEnvironmentVariable("MEDIA_NET_SIM");
+    if (spec.isEmpty()) {
+        return;
+    }
+
+    double loss = 0.0;
+    int delay = 0;
+    int jitter = 0;
+    for (const QString &item : spec.split(',', Qt::SkipEmptyParts)) {
+        const QString key = item.section('=', 0, 0).trimmed();
+        const QString value = item.section('=', 1, 1).trimmed();
+        if (key == "loss") {
+            loss = value.toDouble();
+        } else if (key == "delay") {
+            delay = value.toInt();
+        } else if (key == "jitter") {
+            jitter = value.toInt();
+        }
+    }
+    setNetworkSimulation(loss, delay, jitter);
+}
+
+void MediaChannel::setNetworkSimulation(double lossRate, int delayMs, int jitterMs)
+{
+    m_simLossRate = qBound(0.0, lossRate, 1.0);
+    m_simDelayMs = qMax(0, delayMs);
+    m_simJitterMs = qMax(0, jitterMs);
+    qDebug() << "媒体通道网络模拟: 丢包" << m_simLossRate << "时延" << m_simDelayMs << "抖动" << m_simJitterMs;
+}
+
+bool MediaChannel::bind()
+{
+    if (m_socket->state() == QAbstractSocket::BoundState) {
+        return true;
+    }
+    if (!m_socket->bind(QHostAddress::AnyIPv4, 0)) {
+        qDebug() << "媒体通道绑定失败:" << m_socket->errorString();
+        return false;
+    }
+    // 视频关键帧会被拆成多个分片突发发送，适当放大收发缓冲
+    m_socket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, 1024 * 1024);
+    m_socket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, 1024 * 1024);
+    qDebug() << "媒体通道已绑定端口:" << m_socket->localPort();
+    return true;
+}
+
+quint16 MediaChannel::localPort() const
+{
+    return m_socket->localPort();
+}
+
+void MediaChannel::setPeer(const QHostAddress &address, quint16 port)
+{
+    m_peerAddress = address;
+    m_peerPort = port;
+    qDebug() << "媒体通道对端:" << address.toString() << port;
+}
+
+void MediaChannel::close()
+{
+    m_peerPort = 0;
+    m_socket->close();
+}
+
+qint64 MediaChannel::sendPacket(PacketType type, const QByteArray &payload)
+{
+    if (!hasPeer()) {
+        return -1;
+    }
+
+    QByteArray datagram;
+    datagram.reserve(payload.size() + 2);
+    datagram.append(MAGIC);
+    datagram.append(static_cast<char>(type));
+    datagram.append(payload);
+
+    if (m_simLossRate > 0.0 && QRandomGenerator::global()->generateDouble() < m_simLossRate) {
+        return datagram.size(); // 模拟丢包
+    }
+    if (m_simDelayMs > 0 || m_simJitterMs > 0) {
+        // 模拟时延；抖动大于包间隔时会自然产生乱序
+        int delay = m_simDelayMs + (m_simJitterMs > 0 ? QRandomGenerator::global()->bounded(m_simJitterMs + 1) : 0);
+        QHostAddress address = m_peerAddress;
+        quint16 port = m_peerPort;
+        QTimer::singleShot(delay, this, [this, datagram, address, port]() {
+            m_socket->writeDatagram(datagram, address, port);
+        });
+        return datagram.size();
+    }
+
+    return m_socket->writeDatagram(datagram, m_peerAddress, m_peerPort);
+}
+
+void MediaChannel::onReadyRead()
+{
+    while (m_socket->hasPendingDatagrams()) {
+        QNetworkDatagram datagram = m_socket->receiveDatagram();
+        const QByteArray data = datagram.data();
+
+        // 只接受来自信令约定的对端（地址和端口都要一致）的数据；
+        // 双栈绑定时 IPv4 对端的地址以 ::ffff:a.b.c.d 形式出现，按兼容方式比较
+        if (data.size() < 2 || data.at(0) != MAGIC || datagram.senderPort() != m_peerPort
+            || !datagram.senderAddress().isEqual(m_peerAddress, QHostAddress::TolerantConversion)) {
+            continue;
+        }
+        emit packetReceived(static_cast<quint8>(data.at(1)), data.mid(2));
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef MEDIACHANNEL_H
+#define MEDIACHANNEL_H
+
+#include <QObject>
+#include <QUdpSocket>
+#include <QHostAddress>
+
+// 通话双方之间的点对点 UDP 媒体通道
+// 端口通过 VIDEO_CALL_REQUEST/RESPONSE 信令交换，服务器补上对端地址后转发
+// 每个数据报: [magic 'M'][type][负载]，type 区分视频分片、收发报告等不同流
+// 设置环境变量 MEDIA_NET_SIM="loss=0.05,delay=80,jitter=30" 可在发送端模拟丢包和时延，用于本地测试拥塞控制
+class MediaChannel : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum PacketType : quint8 {
+        VideoFragment = 'V',
+        SenderReport = 'S',   // 发送端报告：发送时间、已发分片数
+        ReceiverReport = 'R', // 接收端报告：丢包率、抖动、回显发送端报告用于计算 RTT
+        AudioFrame = 'A'      // 20ms 音频帧（IMA ADPCM）
+    };
+
+    explicit MediaChannel(QObject *parent = nullptr);
+
+    bool bind();                       // 绑定本地任意端口
+    quint16 localPort() const;
+    void setPeer(const QHostAddress &address, quint16 port);
+    bool hasPeer() const { return m_peerPort != 0; }
+    void close();
+
+    qint64 sendPacket(PacketType type, const QByteArray &payload);
+
+    // 本地网络模拟：丢包率 0~1，固定时延及随机抖动（毫秒）
+    void setNetworkSimulation(double lossRate, int delayMs, int jitterMs);
+
+signals:
+    void packetReceived(quint8 type, const QByteArray &payload);
+
+private slots:
+    void onReadyRead();
+
+private:
+    static const char MAGIC = 'M';
+
+    void loadSimulationFromEnvironment();
+
+    QUdpSocket *m_socket;
+    QHostAddress m_peerAddress;
+    quint16 m_peerPort = 0;
+
+    double m_simLossRate = 0.0;
+    int m_simDelayMs = 0;
+    int m_simJitterMs = 0;
+};
+
+#endif // MEDIACHANNEL_H
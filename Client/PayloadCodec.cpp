@@ -0,0 +1,227 @@
+#include "PayloadCodec.h"
+#include <QCborArray>
+#include <QCborMap>
+#include <QCborValue>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QDebug>
+
+namespace PayloadCodec {
+
+static Result decodeCborRows(const QByteArray &payload, QJsonArray &rows)
+{
+    QCborParserError error;
+    QCborValue root = QCborValue::fromCbor(payload, &error);
+    if (error.error != QCborError::NoError || !root.isMap()) {
+        qDebug() << "CBOR 负载解析失败:" << error.errorString();
+        return Result::Invalid;
+    }
+
+    const QCborMap map = root.toMap();
+    const QCborArray columns = map.value(QLatin1String("columns")).toArray();
+    const QCborArray rowValues = map.value(QLatin1String("rows")).toArray();
+
+    QStringList keys;
+    keys.reserve(columns.size());
+    for (const QCborValue &column : columns) {
+        keys.append(column.toString());
+    }
+
+    for (const QCborValue &rowValue : rowValues) {
+        const QCborArray row = rowValue.toArray();
+        QJsonObject object;
+        // 行比列短时视为尾部字段缺失；null 与 JSON 编码下省略字段等价
+        for (qsizetype i = 0; i < row.size() && i < keys.size(); ++i) {
+            const QCborValue value = row.at(i);
+            if (!value.isNull()) {
+                object.insert(keys[i], value.toJsonValue());
+            }
+        }
+        rows.append(object);
+    }
+    return Result::Ok;
+}
+
+Result decodeRows(const QByteArray &response, const QByteArray &prefix, QJsonArray &rows)
+{
+    if (!response.startsWith(prefix)) {
+        return Result::Invalid;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const QByteArray cborMarker("@cbor#");
+    if (response.mid(prefix.size(), cborMarker.size()) == cborMarker) {
+        // 逐块解码，直到长度为 0 的结束块；任一块未收完整都等待后续数据
+        QJsonArray decoded;
+        qsizetype pos = prefix.size();
+        while (true) {
+            if (response.size() - pos < cborMarker.size()) {
+                return Result::Incomplete;
+            }
+            if (response.mid(pos, cborMarker.size()) != cborMarker) {
+                return Result::Invalid;
+            }
+            qsizetype lengthStart = pos + cborMarker.size();
+            qsizetype headerEnd = response.indexOf('\n', lengthStart);
+            if (headerEnd < 0) {
+                return Result::Incomplete;
+            }
+
+            bool ok = false;
+            qsizetype length = response.mid(lengthStart, headerEnd - lengthStart).toLongLong(&ok);
+            if (!ok || length < 0) {
+                return Result::Invalid;
+            }
+            if (length == 0) {
+                break;
+            }
+            if (response.size() - (headerEnd + 1) < length) {
+                return Result::Incomplete;
+            }
+
+            Result result = decodeCborRows(response.mid(headerEnd + 1, length), decoded);
+            if (result != Result::Ok) {
+                return result;
+            }
+            pos = headerEnd + 1 + length;
+        }
+
+        rows = decoded;
+        qDebug() << "CBOR 列表解码:" << rows.size() << "行," << response.size() - prefix.size() << "字节,"
+                 << timer.nsecsElapsed() / 1000 << "us";
+        return Result::Ok;
+    }
+
+    QJsonDocument doc = QJsonDocument::fromJson(response.mid(prefix.size()).trimmed());
+    if (doc.isNull() || !doc.isArray()) {
+        return Result::Invalid;
+    }
+    rows = doc.array();
+    qDebug() << "JSON 列表解码:" << rows.size() << "行," << response.size() - prefix.size() << "字节,"
+             << timer.nsecsElapsed() / 1000 << "us";
+    return Result::Ok;
+}
+
+QByteArray cborRequest(const QString &request)
+{
+    return "SET_ENCODING#cbor\n" + request.toUtf8() + "\nSET_ENCODING#json\n";
+}
+
+void skipEncodingReplies(QByteArray &data)
+{
+    while (data.startsWith("SET_ENCODING_SUCCESS#")) {
+        qsizetype lineEnd = data.indexOf('\n');
+        if (lineEnd < 0) {
+            data.clear();
+            return;
+        }
+        data.remove(0, lineEnd + 1);
+    }
+}
+
+// tail 是否可能是被拆开的 "@cbor#<字节数>" 块头
+static bool isPartialCborHeader(const QByteArray &tail)
+{
+    const QByteArray marker("@cbor#");
+    if (tail.size() <= marker.size()) {
+        return marker.startsWith(tail);
+    }
+    if (!tail.startsWith(marker)) {
+        return false;
+    }
+    for (qsizetype i = marker.size(); i < tail.size(); ++i) {
+        if (tail[i] < '0' || tail[i] > '9') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 整行以 "@cbor#<字节数>\n" 结尾时返回块长度，否则返回 -1
+static qint64 cborChunkLength(const QByteArray &line)
+{
+    const QByteArray marker("@cbor#");
+    qsizetype markerPos = line.lastIndexOf(marker);
+    if (markerPos < 0) {
+        return -1;
+    }
+    qsizetype lengthStart = markerPos + marker.size();
+    bool ok = false;
+    qint64 length = line.mid(lengthStart, line.size() - 1 - lengthStart).toLongLong(&ok);
+    return ok && length >= 0 ? length : -1;
+}
+
+QByteArray inflateFrames(InflateState &state, const QByteArray &incoming)
+{
+    const QByteArray data = state.pending + incoming;
+    state.pending.clear();
+
+    // 压缩帧总是从一条消息的开头开始，只在行首识别；CBOR 块是二进制数据，按块头声明的长度整体跳过
+    QByteArray output;
+    qsizetype pos = 0;
+    while (pos < data.size()) {
+        if (state.cborRemaining > 0) {
+            qsizetype count = qMin<qint64>(state.cborRemaining, data.size() - pos);
+            output.append(data.mid(pos, count));
+            pos += count;
+            state.cborRemaining -= count;
+            continue;
+        }
+
+        qsizetype lineEnd = data.indexOf('\n', pos);
+
+        if (!state.atLineStart || data.mid(pos, 3) != "@z#") {
+            if (lineEnd < 0) {
+                // 末尾可能是被拆开的压缩帧头（只收到 "@" 或 "@z"）或 CBOR 块头，留到下次拼接后再判断
+                const QByteArray tail = data.mid(pos);
+                qsizetype keep = tail.size();
+                if (!state.atLineStart || !QByteArray("@z#").startsWith(tail)) {
+                    qsizetype at = tail.lastIndexOf('@');
+                    keep = at >= 0 && isPartialCborHeader(tail.mid(at)) ? tail.size() - at : 0;
+                }
+                if (keep < tail.size()) {
+                    output.append(tail.left(tail.size() - keep));
+                    state.atLineStart = false;
+                }
+                state.pending = tail.right(keep);
+                break;
+            }
+            const QByteArray line = data.mid(pos, lineEnd + 1 - pos);
+            output.append(line);
+            pos = lineEnd + 1;
+            qint64 chunkLength = cborChunkLength(line);
+            state.cborRemaining = qMax<qint64>(chunkLength, 0);
+            // 非空 CBOR 块之后紧跟下一个块头，不是新的一行
+            state.atLineStart = chunkLength <= 0;
+            continue;
+        }
+
+        if (lineEnd < 0) {
+            state.pending = data.mid(pos);
+            break;
+        }
+
+        bool ok = false;
+        qsizetype length = data.mid(pos + 3, lineEnd - pos - 3).toLongLong(&ok);
+        if (!ok || length < 0) {
+            // 帧头损坏，按普通文本交给上层处理
+            output.append(data.mid(pos, lineEnd + 1 - pos));
+            pos = lineEnd + 1;
+            continue;
+        }
+        if (data.size() - (lineEnd + 1) < length) {
+            state.pending = data.mid(pos);
+            break;
+        }
+
+        output.append(qUncompress(data.mid(lineEnd + 1, length)));
+        pos = lineEnd + 1 + length;
+    }
+    return output;
+}
+
+}
@@ -0,0 +1,38 @@
+#ifndef PAYLOADCODEC_H
+#define PAYLOADCODEC_H
+
+#include <QByteArray>
+#include <QJsonArray>
+
+// 解析服务器的列表响应，兼容两种负载编码：
+//   JSON 文本：prefix + [ {...}, ... ]
+//   CBOR 帧  ：prefix + ("@cbor#<字节数>\n" + { "rows": [[...], ...], "columns": [...] })... + "@cbor#0\n"
+// 连接通过 SET_ENCODING#cbor 协商后服务器才会发送 CBOR 帧；
+// 通过 SET_COMPRESSION#zlib 协商后，超过阈值的整条响应以 "@z#<字节数>\n" + qCompress 数据发送
+namespace PayloadCodec {
+
+enum class Result { Ok, Incomplete, Invalid };
+
+// response 须以 prefix 开头；CBOR 帧未收完整时返回 Incomplete，调用方应保留数据等待后续 readyRead
+Result decodeRows(const QByteArray &response, const QByteArray &prefix, QJsonArray &rows);
+
+// 以 CBOR 发出单个列表请求：请求前后分别切换连接编码，服务器按顺序处理，
+// 共用同一连接的其他窗口收到的仍是 JSON 文本
+QByteArray cborRequest(const QString &request);
+
+// 去掉数据开头的 SET_ENCODING_SUCCESS 回复行
+void skipEncodingReplies(QByteArray &data);
+
+// 按连接保存的拆包状态：一次 readyRead 可能停在一行中间或 CBOR 块中间
+struct InflateState {
+    QByteArray pending;          // 未收完整的压缩帧或帧头，下次调用时拼接
+    bool atLineStart = true;     // pending 之后的数据是否从一行开头开始
+    qint64 cborRemaining = 0;    // 当前 CBOR 块还未透传的字节数
+};
+
+// 展开接收数据中的压缩帧，返回还原后的数据；CBOR 块按声明的长度原样透传，不在其中查找帧头
+QByteArray inflateFrames(InflateState &state, const QByteArray &incoming);
+
+}
+
+#endif // PAYLOADCODEC_H
@@ -15,9 +15,12 @@
 #include <QTimer>
 #include <QEvent>
 #include <QMouseEvent>
+#include <QUuid>
+#include <QSet>
 
 PaymentWindow::PaymentWindow(QTcpSocket *socket, const QString &patientId, QWidget *parent)
-    : QWidget(parent), m_patientId(patientId), m_totalAmount(0.0), m_socket(socket)
+    : QWidget(parent), m_patientId(patientId), m_totalAmount(0.0), m_socket(socket),
+      m_paymentTimer(new QTimer(this)), m_paymentRetryCount(0), m_paymentVersion(0)
 {
     setWindowTitle("门诊缴费");
     setMinimumSize(900, 600);
@@ -28,6 +31,9 @@ PaymentWindow::PaymentWindow(QTcpSocket *socket, const QString &patientId, QWidg
         connect(m_socket, &QTcpSocket::readyRead, this, &PaymentWindow::onReadyRead);
     }
 
+    m_paymentTimer->setSingleShot(true);
+    connect(m_paymentTimer, &QTimer::timeout, this, &PaymentWindow::onPaymentTimeout);
+
     initUI();
     loadPaymentData();
 }
@@ -277,99 +283,33 @@ void PaymentWindow::onReadyRead()
 {
     if (!m_socket) return;
 
-    QByteArray data = m_socket->readAll();
-    QString response = QString::fromUtf8(data);
+    m_readBuffer.append(m_socket->readAll());
+
+    // 服务器推送和请求响应可能粘在一起，按行处理
+    while (m_readBuffer.contains('\n')) {
+        int pos = m_readBuffer.indexOf('\n');
+        QByteArray line = m_readBuffer.left(pos);
+        m_readBuffer = m_readBuffer.mid(pos + 1);
+        if (!line.isEmpty()) {
+            handleServerResponse(QString::fromUtf8(line));
+        }
+    }
+}
 
+void PaymentWindow::handleServerResponse(const QString &response)
+{
     if (response.startsWith("GET_PAYMENT_ITEMS_SUCCESS")) {
         // 解析缴费项目数据
         QString jsonStr = response.section('#', 1);
         QJsonDocument doc = QJsonDocument::fromJson(jsonStr.toUtf8());
 
         if (!doc.isNull() && doc.isArray()) {
-            QJsonArray itemsArray = doc.array();
-
-            // 清空表格
-            paymentTable->setRowCount(0);
-            rowToApplicationIdMap.clear();
-
-            // 过滤出待支付的项目
-            QJsonArray pendingItems;
-            for (const QJsonValue &value : itemsArray) {
-                QJsonObject item = value.toObject();
-                QString status = item["status"].toString();
-                if (status == "pending") {
-                    pendingItems.append(item);
-                }
-            }
-
-            // 如果没有待支付项目
-            if (pendingItems.isEmpty()) {
-                paymentTable->setRowCount(1);
-                QTableWidgetItem *emptyItem = new QTableWidgetItem("暂无待支付项目");
-                emptyItem->setTextAlignment(Qt::AlignCenter);
-                paymentTable->setItem(0, 0, emptyItem);
-                paymentTable->setSpan(0, 0, 1, paymentTable->columnCount());
-                
-                // 重置UI状态
-                m_totalAmount = 0.0;
-                totalAmountLabel->setText("合计金额: ¥0.00");
-                payButton->setEnabled(false);
-                payButton->setText("立即支付");
-                selectAllButton->setText("全选");
-                return;
+            m_paymentItems = doc.array();
+            m_paymentVersion = 0;
+            for (const QJsonValue &value : m_paymentItems) {
+                m_paymentVersion = qMax(m_paymentVersion, value.toObject()["version"].toVariant().toLongLong());
             }
-
-            // 填充表格数据（只显示待支付项目）
-            paymentTable->setRowCount(pendingItems.size());
-            for (int row = 0; row < pendingItems.size(); ++row) {
-                QJsonObject item = pendingItems[row].toObject();
-
-                // 选择列 - 使用复选框，扩大点击范围
-                QWidget *checkWidget = new QWidget();
-                checkWidget->setStyleSheet("QWidget:hover { background-color: #f0f0f0; }"); // 悬停效果
-                QHBoxLayout *checkLayout = new QHBoxLayout(checkWidget);
-                QCheckBox *checkBox = new QCheckBox();
-                checkBox->setStyleSheet("QCheckBox::indicator { width: 18px; height: 18px; }"); // 增大复选框尺寸
-                connect(checkBox, &QCheckBox::stateChanged, this, &PaymentWindow::updateTotalAmount);
-                
-                // 让整个widget都能响应点击
-                checkWidget->installEventFilter(this);
-                checkWidget->setProperty("checkbox", QVariant::fromValue(checkBox));
-                
-                checkLayout->addWidget(checkBox);
-                checkLayout->setAlignment(Qt::AlignCenter);
-                checkLayout->setContentsMargins(5, 5, 5, 5); // 增加边距，扩大点击范围
-                paymentTable->setCellWidget(row, 0, checkWidget);
-
-                // 缴费事项列
-                paymentTable->setItem(row, 1, new QTableWidgetItem(item["description"].toString()));
-
-                // 金额列
-                double amount = item["amount"].toDouble();
-                paymentTable->setItem(row, 2, new QTableWidgetItem(QString("¥%1").arg(amount, 0, 'f', 2)));
-
-                // 开具时间列
-                paymentTable->setItem(row, 3, new QTableWidgetItem(item["created_at"].toString()));
-
-                // 状态列 - 都是待支付状态
-                QTableWidgetItem *statusItem = new QTableWidgetItem("待支付");
-                statusItem->setForeground(QBrush(QColor("#e74c3c"))); // 红色
-                paymentTable->setItem(row, 4, statusItem);
-
-                // 设置所有单元格文本居中
-                for (int col = 1; col < paymentTable->columnCount(); ++col) {
-                    paymentTable->item(row, col)->setTextAlignment(Qt::AlignCenter);
-                }
-
-                // 记录申请ID（如果有的话）
-                if (item.contains("application_id")) {
-                    rowToApplicationIdMap[row] = item["application_id"].toString();
-                }
-            }
-            
-            // 数据加载完成后重置UI状态
-            updateTotalAmount(); // 这会重置总金额、按钮状态等
-            
+            renderPendingItems();
         } else {
             qDebug() << "Invalid JSON data format: " << jsonStr;
             paymentTable->setRowCount(1);
@@ -378,6 +318,12 @@ void PaymentWindow::onReadyRead()
             paymentTable->setItem(0, 0, errorItem);
             paymentTable->setSpan(0, 0, 1, paymentTable->columnCount());
         }
+    } else if (response.startsWith("PAYMENT_ITEMS_DELTA")) {
+        // 增量数据：服务器推送或 since_version 请求的响应，只包含变更的缴费项目
+        QJsonDocument doc = QJsonDocument::fromJson(response.section('#', 1).toUtf8());
+        if (!doc.isNull() && doc.isArray()) {
+            applyPaymentDelta(doc.array());
+        }
     } else if (response.startsWith("db_error")) {
         // 数据库错误处理
         QString errorMsg = response.section('#', 1);
@@ -388,8 +334,14 @@ void PaymentWindow::onReadyRead()
         paymentTable->setItem(0, 0, errorItem);
         paymentTable->setSpan(0, 0, 1, paymentTable->columnCount());
     } else if (response.startsWith("PROCESS_PAYMENT_SUCCESS")) {
-        // 支付成功处理
-        QString paymentId = response.section('#', 1);
+        // 支付成功处理；响应末尾带回幂等键，超时重发后原响应和回放响应可能都会到达，只处理一次
+        QString paymentKey = response.section('#', 2, 2).trimmed();
+        if (m_pendingPaymentRequest.isEmpty() || (!paymentKey.isEmpty() && paymentKey != m_pendingPaymentKey)) {
+            qDebug() << "忽略已处理的支付响应:" << paymentKey;
+            return;
+        }
+        finishPaymentRequest();
+        QString paymentId = response.section('#', 1, 1).trimmed();
         qDebug() << "支付成功，支付ID:" << paymentId;
         
         // 立即重置总金额和相关状态
@@ -415,16 +367,21 @@ void PaymentWindow::onReadyRead()
             emit paymentSuccess("general", 0.0, "门诊缴费");
         });
         
-        // 延迟更长时间再重新加载数据，避免与信号处理冲突
+        // 延迟更长时间再拉取变更，避免与信号处理冲突；服务器推送已到达时这里只会返回空增量
         QTimer::singleShot(500, this, [this]() {
-            // 重新加载数据
             if (m_socket && m_socket->state() == QAbstractSocket::ConnectedState) {
-                loadPaymentData();
+                QString request = QString("GET_PAYMENT_ITEMS#%1#%2").arg(m_patientId).arg(m_paymentVersion);
+                m_socket->write(request.toUtf8() + "\n");
             }
         });
         
     } else if (response.startsWith("PROCESS_PAYMENT_FAIL")) {
         // 支付失败处理
+        if (m_pendingPaymentRequest.isEmpty()) {
+            qDebug() << "忽略已处理的支付响应:" << response.trimmed();
+            return;
+        }
+        finishPaymentRequest();
         QString errorMsg = response.section('#', 1);
         qDebug() << "支付失败:" << errorMsg;
         
@@ -438,6 +395,140 @@ void PaymentWindow::onReadyRead()
     }
 }
 
+void PaymentWindow::applyPaymentDelta(const QJsonArray &rows)
+{
+    if (rows.isEmpty()) return;
+
+    // 已有的项目原位替换，新项目插到最前面（列表按开具时间倒序）
+    QJsonArray newRows;
+    for (const QJsonValue &value : rows) {
+        QJsonObject row = value.toObject();
+        int itemId = row["item_id"].toInt();
+        m_paymentVersion = qMax(m_paymentVersion, row["version"].toVariant().toLongLong());
+
+        bool replaced = false;
+        for (int i = 0; i < m_paymentItems.size(); ++i) {
+            if (m_paymentItems[i].toObject()["item_id"].toInt() == itemId) {
+                m_paymentItems[i] = row;
+                replaced = true;
+                break;
+            }
+        }
+        if (!replaced) {
+            newRows.append(row);
+        }
+    }
+    for (int i = newRows.size() - 1; i >= 0; --i) {
+        m_paymentItems.prepend(newRows[i]);
+    }
+
+    qDebug() << "应用缴费项目增量:" << rows.size() << "项，当前版本:" << m_paymentVersion;
+    renderPendingItems();
+}
+
+void PaymentWindow::renderPendingItems()
+{
+    // 记录当前勾选的项目，刷新后恢复
+    QSet<int> checkedItemIds;
+    for (auto it = rowToItemIdMap.constBegin(); it != rowToItemIdMap.constEnd(); ++it) {
+        QWidget *widget = paymentTable->cellWidget(it.key(), 0);
+        QCheckBox *checkBox = widget ? widget->findChild<QCheckBox*>() : nullptr;
+        if (checkBox && checkBox->isChecked()) {
+            checkedItemIds.insert(it.value());
+        }
+    }
+
+    // 清空表格
+    paymentTable->clearSpans();
+    paymentTable->setRowCount(0);
+    rowToApplicationIdMap.clear();
+    rowToItemIdMap.clear();
+
+    // 过滤出待支付的项目
+    QJsonArray pendingItems;
+    for (const QJsonValue &value : m_paymentItems) {
+        QJsonObject item = value.toObject();
+        QString status = item["status"].toString();
+        if (status == "pending") {
+            pendingItems.append(item);
+        }
+    }
+
+    // 如果没有待支付项目
+    if (pendingItems.isEmpty()) {
+        paymentTable->setRowCount(1);
+        QTableWidgetItem *emptyItem = new QTableWidgetItem("暂无待支付项目");
+        emptyItem->setTextAlignment(Qt::AlignCenter);
+        paymentTable->setItem(0, 0, emptyItem);
+        paymentTable->setSpan(0, 0, 1, paymentTable->columnCount());
+
+        // 重置UI状态
+        m_totalAmount = 0.0;
+        totalAmountLabel->setText("合计金额: ¥0.00");
+        payButton->setEnabled(false);
+        payButton->setText("立即支付");
+        selectAllButton->setText("全选");
+        return;
+    }
+
+    // 填充表格数据（只显示待支付项目）
+    paymentTable->setRowCount(pendingItems.size());
+    for (int row = 0; row < pendingItems.size(); ++row) {
+        QJsonObject item = pendingItems[row].toObject();
+
+        // 选择列 - 使用复选框，扩大点击范围
+        QWidget *checkWidget = new QWidget();
+        checkWidget->setStyleSheet("QWidget:hover { background-color: #f0f0f0; }"); // 悬停效果
+        QHBoxLayout *checkLayout = new QHBoxLayout(checkWidget);
+        QCheckBox *checkBox = new QCheckBox();
+        checkBox->setStyleSheet("QCheckBox::indicator { width: 18px; height: 18px; }"); // 增大复选框尺寸
+        checkBox->setChecked(checkedItemIds.contains(item["item_id"].toInt()));
+        connect(checkBox, &QCheckBox::stateChanged, this, &PaymentWindow::updateTotalAmount);
+
+        // 让整个widget都能响应点击
+        checkWidget->installEventFilter(this);
+        checkWidget->setProperty("checkbox", QVariant::fromValue(checkBox));
+
+        checkLayout->addWidget(checkBox);
+        checkLayout->setAlignment(Qt::AlignCenter);
+        checkLayout->setContentsMargins(5, 5, 5, 5); // 增加边距，扩大点击范围
+        paymentTable->setCellWidget(row, 0, checkWidget);
+
+        // 缴费事项列
+        paymentTable->setItem(row, 1, new QTableWidgetItem(item["description"].toString()));
+
+        // 金额列
+        double amount = item["amount"].toDouble();
+        paymentTable->setItem(row, 2, new QTableWidgetItem(QString("¥%1").arg(amount, 0, 'f', 2)));
+
+        // 开具时间列（服务器时间戳带毫秒和逻辑计数，显示到秒）
+        paymentTable->setItem(row, 3, new QTableWidgetItem(item["created_at"].toString().left(19)));
+
+        // 状态列 - 都是待支付状态
+        QTableWidgetItem *statusItem = new QTableWidgetItem("待支付");
+        statusItem->setForeground(QBrush(QColor("#e74c3c"))); // 红色
+        paymentTable->setItem(row, 4, statusItem);
+
+        // 设置所有单元格文本居中
+        for (int col = 1; col < paymentTable->columnCount(); ++col) {
+            paymentTable->item(row, col)->setTextAlignment(Qt::AlignCenter);
+        }
+
+        // 记录申请ID（如果有的话）
+        if (item.contains("application_id")) {
+            rowToApplicationIdMap[row] = item["application_id"].toString();
+        }
+        rowToItemIdMap[row] = item["item_id"].toInt();
+    }
+
+    // 数据加载完成后重置UI状态
+    updateTotalAmount(); // 这会重置总金额、按钮状态等
+    if (!m_pendingPaymentRequest.isEmpty()) {
+        // 支付请求仍在处理中，保持按钮禁用
+        payButton->setEnabled(false);
+    }
+}
+
 void PaymentWindow::onItemSelectionChanged()
 {
     // 当选择变化时更新总金额
@@ -486,12 +577,7 @@ void PaymentWindow::onPayButtonClicked()
                 if (m_socket && m_socket->state() == QAbstractSocket::ConnectedState) {
                     payButton->setEnabled(false);
                     payButton->setText("支付中...");
-                    
-                    QJsonDocument doc(paymentRequest);
-                    QString request = "PROCESS_PAYMENT#" + doc.toJson(QJsonDocument::Compact);
-                    qDebug() << "发送单项支付请求:" << request;
-                    m_socket->write(request.toUtf8() + "\n");
-                    m_socket->flush();
+                    sendPaymentRequest(paymentRequest);
                 } else {
                     QMessageBox::warning(this, "连接错误", "与服务器连接已断开，请重新连接后再试");
                 }
@@ -535,18 +621,59 @@ void PaymentWindow::onPayButtonClicked()
             // 禁用支付按钮，防止重复点击
             payButton->setEnabled(false);
             payButton->setText("支付中...");
-            
-            QJsonDocument doc(paymentRequest);
-            QString jsonString = doc.toJson(QJsonDocument::Compact);
-            QString request = QString("PROCESS_PAYMENT#%1").arg(jsonString);
-            m_socket->write(request.toUtf8() + "\n");
-            m_socket->flush(); // 确保数据立即发送
+            sendPaymentRequest(paymentRequest);
         } else {
             QMessageBox::warning(this, "连接错误", "与服务器连接已断开，请重新连接后再试");
         }
     }
 }
 
+// 发送支付请求：每次支付生成新的幂等键，超时重发时原样发送同一请求
+void PaymentWindow::sendPaymentRequest(QJsonObject paymentRequest)
+{
+    m_pendingPaymentKey = QUuid::createUuid().toString(QUuid::WithoutBraces);
+    paymentRequest["idempotency_key"] = m_pendingPaymentKey;
+
+    QJsonDocument doc(paymentRequest);
+    m_pendingPaymentRequest = "PROCESS_PAYMENT#" + doc.toJson(QJsonDocument::Compact) + "\n";
+    m_paymentRetryCount = 0;
+
+    qDebug() << "发送支付请求:" << m_pendingPaymentRequest.trimmed();
+    m_socket->write(m_pendingPaymentRequest);
+    m_socket->flush(); // 确保数据立即发送
+    m_paymentTimer->start(3000);
+}
+
+// 收到支付结果后停止重发
+void PaymentWindow::finishPaymentRequest()
+{
+    m_paymentTimer->stop();
+    m_pendingPaymentRequest.clear();
+    m_pendingPaymentKey.clear();
+    m_paymentRetryCount = 0;
+}
+
+void PaymentWindow::onPaymentTimeout()
+{
+    if (m_pendingPaymentRequest.isEmpty()) return;
+
+    if (m_paymentRetryCount >= 3 || !m_socket || m_socket->state() != QAbstractSocket::ConnectedState) {
+        finishPaymentRequest();
+        if (payButton) {
+            payButton->setEnabled(true);
+            payButton->setText("立即支付");
+        }
+        QMessageBox::warning(this, "支付超时", "服务器未响应，请稍后刷新查看支付结果");
+        return;
+    }
+
+    ++m_paymentRetryCount;
+    qDebug() << "支付请求超时，第" << m_paymentRetryCount << "次重发";
+    m_socket->write(m_pendingPaymentRequest);
+    m_socket->flush();
+    m_paymentTimer->start(3000);
+}
+
 void PaymentWindow::onBackButtonClicked()
 {
     emit backRequested();
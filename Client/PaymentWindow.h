@@ -8,6 +8,9 @@
 #include <QLabel>
 #include <QTcpSocket>
 #include <QMap>
+#include <QTimer>
+#include <QJsonObject>
+#include <QJsonArray>
 
 class PaymentWindow : public QWidget
 {
@@ -30,11 +33,17 @@ private slots:
     void onSelectAllClicked();
     void onItemSelectionChanged();
     void onReadyRead();
+    void onPaymentTimeout();
 
 private:
     void initUI();
     void loadPaymentData();
     void updateTotalAmount();
+    void sendPaymentRequest(QJsonObject paymentRequest);
+    void handleServerResponse(const QString &response);
+    void renderPendingItems();                         // 根据本地缓存的缴费项目刷新待支付表格
+    void applyPaymentDelta(const QJsonArray &rows);    // 按 item_id 合并增量数据
+    void finishPaymentRequest();
     bool eventFilter(QObject *obj, QEvent *event) override; // 添加事件过滤器
     QString m_patientId;
     QTableWidget *paymentTable;
@@ -47,7 +56,19 @@ private:
 
     // 存储申请ID与行号的映射
     QMap<int, QString> rowToApplicationIdMap;
+    QMap<int, int> rowToItemIdMap; // 行号与缴费项目ID的映射，刷新表格时保留勾选状态
+
+    // 本地缓存的全部缴费项目及已同步到的最大版本号
+    QJsonArray m_paymentItems;
+    qint64 m_paymentVersion;
+    QByteArray m_readBuffer; // 按行拆分服务器数据
     QTcpSocket *m_socket; // 添加socket成员变量用于与服务器通信
+
+    // 支付请求超时重发：重发时沿用同一个幂等键，服务器只会扣费一次
+    QTimer *m_paymentTimer;
+    QByteArray m_pendingPaymentRequest;
+    QString m_pendingPaymentKey;    // 等待结果的支付的幂等键，其他键的响应视为重复
+    int m_paymentRetryCount;
 };
 
 #endif // PAYMENTWINDOW_H
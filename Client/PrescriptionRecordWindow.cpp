@@ -15,9 +15,10 @@
 #include <QTextEdit>
 #include <QBrush>
 #include <QTableWidgetItem>
+#include <QShowEvent>
 
 PrescriptionRecordWindow::PrescriptionRecordWindow(QTcpSocket *socket, const QString &patientId, QWidget *parent)
-    : QWidget(parent), m_socket(socket), m_patientId(patientId)
+    : QWidget(parent), m_socket(socket), m_patientId(patientId), m_prescriptionVersion(0)
 {
     setWindowTitle("处方记录");
     setMinimumSize(900, 600);
@@ -147,10 +148,31 @@ void PrescriptionRecordWindow::onBackButtonClicked()
     this->close();
 }
 
+void PrescriptionRecordWindow::showEvent(QShowEvent *event)
+{
+    QWidget::showEvent(event);
+
+    // 再次显示时只拉取上次同步之后变更的处方
+    if (m_prescriptionVersion > 0 && m_socket && m_socket->state() == QAbstractSocket::ConnectedState) {
+        QString request = QString("GET_PATIENT_PRESCRIPTIONS#%1#%2").arg(m_patientId).arg(m_prescriptionVersion);
+        m_socket->write(request.toUtf8() + "\n");
+        m_socket->flush();
+    }
+}
+
 void PrescriptionRecordWindow::onReadyRead()
 {
-    QByteArray data = m_socket->readAll();
-    handleServerResponse(data);
+    m_readBuffer.append(m_socket->readAll());
+
+    // 服务器推送和请求响应可能粘在一起，按行处理
+    while (m_readBuffer.contains('\n')) {
+        int pos = m_readBuffer.indexOf('\n');
+        QByteArray line = m_readBuffer.left(pos);
+        m_readBuffer = m_readBuffer.mid(pos + 1);
+        if (!line.isEmpty()) {
+            handleServerResponse(line);
+        }
+    }
 }
 
 void PrescriptionRecordWindow::handleServerResponse(const QByteArray &response)
@@ -164,50 +186,17 @@ void PrescriptionRecordWindow::handleServerResponse(const QByteArray &response)
 
         if (!doc.isNull() && doc.isArray()) {
             m_prescriptionData = doc.array(); // 保存处方数据
-
-            // 清空表格
-            prescriptionTable->setRowCount(0);
-
-            // 填充处方数据
-            prescriptionTable->setRowCount(m_prescriptionData.size());
-            for (int i = 0; i < m_prescriptionData.size(); ++i) {
-                QJsonObject record = m_prescriptionData[i].toObject();
-
-                prescriptionTable->setItem(i, 0, new QTableWidgetItem(QString::number(record["prescription_id"].toInt())));
-                prescriptionTable->setItem(i, 1, new QTableWidgetItem(record["prescribed_date"].toString()));
-                prescriptionTable->setItem(i, 2, new QTableWidgetItem(record["doctor_name"].toString() + " (" + record["department"].toString() + ")"));
-                prescriptionTable->setItem(i, 3, new QTableWidgetItem(record["medicine_name"].toString()));
-                prescriptionTable->setItem(i, 4, new QTableWidgetItem(record["dosage"].toString() + " | " + record["usage"].toString() + " | " + record["frequency"].toString()));
-                prescriptionTable->setItem(i, 5, new QTableWidgetItem(QString::number(record["quantity"].toInt()))); // 购买数量列
-
-                // 状态列
-                QString status = record["status"].toString();
-                QTableWidgetItem *statusItem = new QTableWidgetItem();
-                if (status == "completed") {
-                    statusItem->setText("已完成");
-                    statusItem->setForeground(QBrush(QColor("#28a745"))); // 绿色
-                } else if (status == "active") {
-                    statusItem->setText("进行中");
-                    statusItem->setForeground(QBrush(QColor("#007bff"))); // 蓝色
-                } else if (status == "cancelled") {
-                    statusItem->setText("已取消");
-                    statusItem->setForeground(QBrush(QColor("#dc3545"))); // 红色
-                } else {
-                    statusItem->setText(status);
-                }
-                prescriptionTable->setItem(i, 6, statusItem);  // 状态列现在是第6列
-
-                // 设置所有单元格文本居中
-                for (int col = 0; col < prescriptionTable->columnCount(); ++col) {
-                    if (prescriptionTable->item(i, col)) {
-                        prescriptionTable->item(i, col)->setTextAlignment(Qt::AlignCenter);
-                    }
-                }
+            m_prescriptionVersion = 0;
+            for (const QJsonValue &value : m_prescriptionData) {
+                m_prescriptionVersion = qMax(m_prescriptionVersion, value.toObject()["version"].toVariant().toLongLong());
             }
-            
-            // 调整列宽
-            prescriptionTable->resizeColumnsToContents();
-            prescriptionTable->horizontalHeader()->setStretchLastSection(true);
+            refreshPrescriptionTable();
+        }
+    } else if (responseStr.startsWith("PRESCRIPTION_DELTA")) {
+        // 增量数据：服务器推送或 since_version 请求的响应，只包含变更的处方
+        QJsonDocument doc = QJsonDocument::fromJson(responseStr.section('#', 1).toUtf8());
+        if (!doc.isNull() && doc.isArray()) {
+            applyPrescriptionDelta(doc.array());
         }
     } else if (responseStr.startsWith("PRESCRIPTION_LIST_FAIL")) {
         QMessageBox::warning(this, "加载失败", "获取处方数据失败");
@@ -221,6 +210,85 @@ void PrescriptionRecordWindow::handleServerResponse(const QByteArray &response)
     }
 }
 
+void PrescriptionRecordWindow::applyPrescriptionDelta(const QJsonArray &rows)
+{
+    if (rows.isEmpty()) return;
+
+    // 已有的处方原位替换，新处方插到最前面（列表按开具时间倒序）
+    QJsonArray newRows;
+    for (const QJsonValue &value : rows) {
+        QJsonObject row = value.toObject();
+        int prescriptionId = row["prescription_id"].toInt();
+        m_prescriptionVersion = qMax(m_prescriptionVersion, row["version"].toVariant().toLongLong());
+
+        bool replaced = false;
+        for (int i = 0; i < m_prescriptionData.size(); ++i) {
+            if (m_prescriptionData[i].toObject()["prescription_id"].toInt() == prescriptionId) {
+                m_prescriptionData[i] = row;
+                replaced = true;
+                break;
+            }
+        }
+        if (!replaced) {
+            newRows.append(row);
+        }
+    }
+    for (int i = newRows.size() - 1; i >= 0; --i) {
+        m_prescriptionData.prepend(newRows[i]);
+    }
+
+    qDebug() << "应用处方增量:" << rows.size() << "条，当前版本:" << m_prescriptionVersion;
+    refreshPrescriptionTable();
+}
+
+void PrescriptionRecordWindow::refreshPrescriptionTable()
+{
+    // 清空表格
+    prescriptionTable->clearSpans();
+    prescriptionTable->setRowCount(0);
+
+    // 填充处方数据
+    prescriptionTable->setRowCount(m_prescriptionData.size());
+    for (int i = 0; i < m_prescriptionData.size(); ++i) {
+        QJsonObject record = m_prescriptionData[i].toObject();
+
+        prescriptionTable->setItem(i, 0, new QTableWidgetItem(QString::number(record["prescription_id"].toInt())));
+        prescriptionTable->setItem(i, 1, new QTableWidgetItem(record["prescribed_date"].toString().left(19)));
+        prescriptionTable->setItem(i, 2, new QTableWidgetItem(record["doctor_name"].toString() + " (" + record["department"].toString() + ")"));
+        prescriptionTable->setItem(i, 3, new QTableWidgetItem(record["medicine_name"].toString()));
+        prescriptionTable->setItem(i, 4, new QTableWidgetItem(record["dosage"].toString() + " | " + record["usage"].toString() + " | " + record["frequency"].toString()));
+        prescriptionTable->setItem(i, 5, new QTableWidgetItem(QString::number(record["quantity"].toInt()))); // 购买数量列
+
+        // 状态列
+        QString status = record["status"].toString();
+        QTableWidgetItem *statusItem = new QTableWidgetItem();
+        if (status == "completed") {
+            statusItem->setText("已完成");
+            statusItem->setForeground(QBrush(QColor("#28a745"))); // 绿色
+        } else if (status == "active") {
+            statusItem->setText("进行中");
+            statusItem->setForeground(QBrush(QColor("#007bff"))); // 蓝色
+        } else if (status == "cancelled") {
+            statusItem->setText("已取消");
+            statusItem->setForeground(QBrush(QColor("#dc3545"))); // 红色
+        } else {
+            statusItem->setText(status);
+        }
+        prescriptionTable->setItem(i, 6, statusItem);  // 状态列现在是第6列
+
+        // 设置所有单元格文本居中
+        for (int col = 0; col < prescriptionTable->columnCount(); ++col) {
+            if (prescriptionTable->item(i, col)) {
+                prescriptionTable->item(i, col)->setTextAlignment(Qt::AlignCenter);
+            }
+        }
+    }
+
+    // 调整列宽
+    prescriptionTable->resizeColumnsToContents();
+    prescriptionTable->horizontalHeader()->setStretchLastSection(true);
+}
+
 PrescriptionRecordWindow::~PrescriptionRecordWindow()
 {
     // socket 由父对象管理，不需要手动删除
@@ -256,7 +324,7 @@ PrescriptionDetailDialog::PrescriptionDetailDialog(const QJsonObject &prescripti
     
     // 直接在构造函数中填充数据
     prescriptionIdLabel->setText(QString::number(prescriptionData["prescription_id"].toInt()));
-    prescriptionDateLabel->setText(prescriptionData["prescribed_date"].toString());
+    prescriptionDateLabel->setText(prescriptionData["prescribed_date"].toString().left(19));
     doctorNameLabel->setText(prescriptionData["doctor_name"].toString());
     doctorDepartmentLabel->setText(prescriptionData["department"].toString());
     
@@ -457,7 +525,14 @@ void PrescriptionDetailDialog::handleServerResponse(const QByteArray &response)
                 QJsonObject item = value.toObject();
                 QString applicationId = item["application_id"].toString();
                 
-                if (applicationId == m_prescriptionRef) {
+                // 多药品处方合并为一个缴费项目，application_id 形如 PRESC_12,13,14
+                bool matched = applicationId == m_prescriptionRef;
+                if (!matched && applicationId.startsWith("PRESC_")) {
+                    QString prescriptionId = m_prescriptionRef.mid(6);
+                    matched = applicationId.mid(6).split(',', Qt::SkipEmptyParts).contains(prescriptionId);
+                }
+
+                if (matched) {
                     // 找到匹配的缴费项目
                     double amount = item["amount"].toDouble();
                     QString status = item["status"].toString();
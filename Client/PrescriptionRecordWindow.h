@@ -70,14 +70,21 @@ private slots:
     void onReadyRead();
     void onRowDoubleClicked(QTableWidgetItem* item);
 
+protected:
+    void showEvent(QShowEvent *event) override;
+
 private:
     void initUI();
     void loadPrescriptionData();
     void handleServerResponse(const QByteArray &response);
+    void applyPrescriptionDelta(const QJsonArray &rows); // 按处方ID合并增量数据
+    void refreshPrescriptionTable();
 
     QTcpSocket *m_socket;
     QString m_patientId;
     QJsonArray m_prescriptionData; // 存储处方数据用于详情查看
+    qint64 m_prescriptionVersion;  // 已同步到的最大版本号，增量请求时作为 since_version
+    QByteArray m_readBuffer;       // 按行拆分服务器数据
 
     QTableWidget *prescriptionTable;
     QPushButton *backButton;
@@ -1,40 +1,87 @@
 #include "SimpleVoiceRecognition.h"
+#include "SpeechWorker.h"
 #include <QMouseEvent>
+#include <QMediaDevices>
+#include <QAudioFormat>
 #include <QJsonDocument>
 #include <QJsonObject>
-#include <QTextStream>
-#include <QUuid>
+#include <QJsonArray>
+
+// 识别使用 16kHz 单声道 16 位 PCM，与 VOSK 小模型一致
+static const int RECOGNITION_SAMPLE_RATE = 16000;
+// 流式识别每次送入 20ms 音频，语音活动检测也按同样的帧长判断
+static const int FRAME_MS = 20;
+static const int STREAM_CHUNK_BYTES = RECOGNITION_SAMPLE_RATE / 50 * 2;
+static const int PRE_ROLL_FRAMES = 10;          // 语音开始前保留 200ms
+static const int NO_SPEECH_TIMEOUT_MS = 5000;   // 自动停止模式下一直无人说话则放弃
+static const int MAX_PAUSE_MS = 2000;           // 句中停顿最多缓存 2 秒，更长的停顿视为一句话结束
+
+// 语音指令表：识别短语（按模型分词，以空格分隔）-> 指令名
+// 只列出窗口实际处理的指令，新增指令时要同时在 onVoiceCommand 里处理
+struct VoiceCommand {
+    const char *phrase;
+    const char *command;
+};
+
+static const VoiceCommand VOICE_COMMANDS[] = {
+    { "发送", "send" },
+    { "取消", "cancel" }
+};
+
+static QStringList voiceCommandGrammar()
+{
+    QStringList grammar;
+    for (const VoiceCommand &entry : VOICE_COMMANDS) {
+        grammar.append(QString::fromUtf8(entry.phrase));
+    }
+    return grammar;
+}
+
+static QString matchVoiceCommand(const QString &text)
+{
+    QString spoken = text;
+    spoken.remove(' ');
+    for (const VoiceCommand &entry : VOICE_COMMANDS) {
+        if (QString::fromUtf8(entry.phrase).remove(' ') == spoken) {
+            return QString::fromLatin1(entry.command);
+        }
+    }
+    return QString();
+}
 
 SimpleVoiceRecognition::SimpleVoiceRecognition(QObject *parent)
     : QObject(parent)
-    , m_recordingProcess(nullptr)
-    , m_recognitionProcess(nullptr)
+    , m_audioSource(nullptr)
+    , m_audioDevice(nullptr)
+    , m_recordedBytes(0)
+    , m_sentBytes(0)
+    , m_pendingRequestId(0)
+    , m_speechDetected(false)
+    , m_silenceMs(0)
+    , m_autoStopSilenceMs(0)
+    , m_autoStopPending(false)
+    , m_commandMode(false)
+    , m_pendingIsCommand(false)
     , m_isRecording(false)
 {
     m_voskModelPath = getVoskModelPath();
     
-    // 创建临时目录
-    QString tempDir = QStandardPaths::writableLocation(QStandardPaths::TempLocation);
-    QDir().mkpath(tempDir + "/voice_recognition");
-    m_tempAudioPath = tempDir + "/voice_recognition";
+    SpeechWorker *worker = SpeechWorker::instance();
+    connect(worker, &SpeechWorker::resultReady, this, &SimpleVoiceRecognition::onWorkerResult);
+    connect(worker, &SpeechWorker::errorOccurred, this, &SimpleVoiceRecognition::onWorkerError);
+    connect(worker, &SpeechWorker::partialResult, this, &SimpleVoiceRecognition::onWorkerPartial);
+    
+    // 提前在后台加载模型，第一次说话时不必再等待
+    if (isVoskModelAvailable()) {
+        worker->start(m_voskModelPath);
+    }
 }
 
 SimpleVoiceRecognition::~SimpleVoiceRecognition()
 {
-    if (m_isRecording) {
-        stopRecording();
-    }
-    
-    if (m_recordingProcess) {
-        m_recordingProcess->kill();
-        m_recordingProcess->waitForFinished(3000);
-        delete m_recordingProcess;
-    }
-    
-    if (m_recognitionProcess) {
-        m_recognitionProcess->kill();
-        m_recognitionProcess->waitForFinished(3000);
-        delete m_recognitionProcess;
+    if (m_audioSource) {
+        m_audioSource->stop();
+        delete m_audioSource;
     }
 }
 
@@ -78,35 +125,52 @@ void SimpleVoiceRecognition::startRecording()
         return;
     }
     
-    // 生成唯一的音频文件名
-    QString uuid = QUuid::createUuid().toString(QUuid::WithoutBraces);
-    m_currentAudioFile = m_tempAudioPath + "/voice_" + uuid + ".wav";
+    QAudioFormat format;
+    format.setSampleRate(RECOGNITION_SAMPLE_RATE);
+    format.setChannelCount(1);
+    format.setSampleFormat(QAudioFormat::Int16);
     
-    // 创建录音脚本
-    QString recordingScript = m_tempAudioPath + "/record_audio.py";
-    createRecordingScript(recordingScript);
-    
-    // 启动录音进程
-    if (m_recordingProcess) {
-        delete m_recordingProcess;
+    QAudioDevice device = QMediaDevices::defaultAudioInput();
+    if (device.isNull()) {
+        emit recognitionError("未找到麦克风设备");
+        return;
+    }
+    if (!device.isFormatSupported(format)) {
+        emit recognitionError("麦克风不支持16kHz单声道录音");
+        return;
     }
     
-    m_recordingProcess = new QProcess(this);
-    connect(m_recordingProcess, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
-            this, &SimpleVoiceRecognition::onRecordingProcessFinished);
+    // 确保识别进程在运行（进程异常退出后在这里重新拉起，录音期间加载模型）
+    SpeechWorker::instance()->start(m_voskModelPath);
     
-    QStringList arguments;
-    arguments << recordingScript << m_currentAudioFile;
+    if (m_audioSource) {
+        delete m_audioSource;
+    }
+    m_audioSource = new QAudioSource(device, format, this);
+    m_audioSource->setBufferSize(STREAM_CHUNK_BYTES * 4); // 小缓冲让音频尽快送到识别进程
+    m_chunkBuffer.clear();
+    m_recordedBytes = 0;
+    m_sentBytes = 0;
+    // 噪声底跨录音保留，只有第一次录音需要校准
+    m_vad.resetSpeechState();
+    m_speechDetected = false;
+    m_preRoll.clear();
+    m_trailingSilence.clear();
+    m_silenceMs = 0;
+    m_autoStopPending = false;
+    m_audioDevice = m_audioSource->start();
+    if (!m_audioDevice) {
+        emit recognitionError("录音失败，请检查麦克风设备和权限");
+        return;
+    }
+    connect(m_audioDevice, &QIODevice::readyRead, this, &SimpleVoiceRecognition::onAudioReadyRead);
     
-    m_recordingProcess->start("python", arguments);
+    // 之前未返回的结果随新一次录音作废；识别会话等检测到语音后再创建
+    m_pendingRequestId = 0;
     
-    if (m_recordingProcess->waitForStarted()) {
-        m_isRecording = true;
-        emit recordingStateChanged(true);
-        qDebug() << "开始录音:" << m_currentAudioFile;
-    } else {
-        emit recognitionError("无法启动录音进程，请确保Python已安装");
-    }
+    m_isRecording = true;
+    emit recordingStateChanged(true);
+    qDebug() << "开始录音";
 }
 
 void SimpleVoiceRecognition::stopRecording()
@@ -118,280 +182,200 @@ void SimpleVoiceRecognition::stopRecording()
     m_isRecording = false;
     emit recordingStateChanged(false);
     
-    if (m_recordingProcess && m_recordingProcess->state() == QProcess::Running) {
-        // 发送停止信号给Python脚本
-        m_recordingProcess->write("stop\n");
-        m_recordingProcess->waitForBytesWritten();
-        
-        // 等待进程结束
-        if (!m_recordingProcess->waitForFinished(5000)) {
-            m_recordingProcess->kill();
-        }
-    }
-}
-
-void SimpleVoiceRecognition::createRecordingScript(const QString &scriptPath)
-{
-    QString script = R"(
-import sys
-import pyaudio
-import wave
-import threading
-import signal
-import time
-
-class AudioRecorder:
-    def __init__(self, filename):
-        self.filename = filename
-        self.is_recording = False
-        self.frames = []
-        
-        # 音频参数
-        self.chunk = 1024
-        self.format = pyaudio.paInt16
-        self.channels = 1
-        self.rate = 16000
-        
-        self.audio = pyaudio.PyAudio()
-        self.stream = None
-        
-    def start_recording(self):
-        try:
-            self.stream = self.audio.open(
-                format=self.format,
-                channels=self.channels,
-                rate=self.rate,
-                input=True,
-                frames_per_buffer=self.chunk
-            )
-            
-            self.is_recording = True
-            print("开始录音...")
-            
-            while self.is_recording:
-                try:
-                    data = self.stream.read(self.chunk, exception_on_overflow=False)
-                    self.frames.append(data)
-                except Exception as e:
-                    print(f"录音错误: {e}")
-                    break
-                    
-        except Exception as e:
-            print(f"无法启动录音: {e}")
-            return False
-            
-        return True
-        
-    def stop_recording(self):
-        self.is_recording = False
-        
-        if self.stream:
-            self.stream.stop_stream()
-            self.stream.close()
-            
-        self.audio.terminate()
-        
-        # 保存音频文件
-        try:
-            wf = wave.open(self.filename, 'wb')
-            wf.setnchannels(self.channels)
-            wf.setsampwidth(self.audio.get_sample_size(self.format))
-            wf.setframerate(self.rate)
-            wf.writeframes(b''.join(self.frames))
-            wf.close()
-            print(f"音频已保存: {self.filename}")
-            return True
-        except Exception as e:
-            print(f"保存音频失败: {e}")
-            return False
-
-def main():
-    if len(sys.argv) != 2:
-        print("用法: python record_audio.py <输出文件>")
-        sys.exit(1)
-        
-    output_file = sys.argv[1]
-    recorder = AudioRecorder(output_file)
+    // 取出设备缓冲中剩余的音频后停止采集
+    onAudioReadyRead();
+    m_autoStopPending = false;
+    m_audioSource->stop();
+    m_audioDevice = nullptr;
     
-    # 启动录音
-    recording_thread = threading.Thread(target=recorder.start_recording)
-    recording_thread.start()
+    // 仍在说话时松开，不足 20ms 的尾部一并送出；尾部静音直接丢弃
+    if (m_speechDetected && m_silenceMs == 0) {
+        feedFrame(m_chunkBuffer);
+    }
+    m_recordedBytes += m_chunkBuffer.size();
+    m_chunkBuffer.clear();
+    m_trailingSilence.clear();
+    m_preRoll.clear();
     
-    try:
-        # 等待停止信号
-        while True:
-            line = input()
-            if line.strip() == "stop":
-                break
-    except:
-        pass
+    const int bytesPerMs = RECOGNITION_SAMPLE_RATE * 2 / 1000;
+    qDebug() << "录音结束，录音时长(ms):" << m_recordedBytes / bytesPerMs
+             << "送识别(ms):" << m_sentBytes / bytesPerMs
+             << "噪声底(dB):" << m_vad.noiseFloorDb();
     
-    # 停止录音
-    recorder.stop_recording()
-    recording_thread.join()
+    if (m_recordedBytes == 0) {
+        emit recognitionError("录音失败，请检查麦克风设备和权限");
+        return;
+    }
+    if (!m_speechDetected) {
+        // 整段都是静音或噪声，不占用识别进程
+        emit recognitionError("未检测到语音");
+        return;
+    }
     
-    print("录音完成")
+    // 音频已在录音过程中解码完毕，这里只需取最终结果
+    SpeechWorker::instance()->endStream(m_pendingRequestId);
+}
 
-if __name__ == "__main__":
-    main()
-)";
+void SimpleVoiceRecognition::onAudioReadyRead()
+{
+    if (!m_audioDevice) {
+        return;
+    }
+    m_chunkBuffer.append(m_audioDevice->readAll());
+    
+    int offset = 0;
+    while (m_chunkBuffer.size() - offset >= STREAM_CHUNK_BYTES) {
+        processFrame(m_chunkBuffer.mid(offset, STREAM_CHUNK_BYTES));
+        offset += STREAM_CHUNK_BYTES;
+    }
+    m_recordedBytes += offset;
+    m_chunkBuffer.remove(0, offset);
     
-    QFile file(scriptPath);
-    if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        QTextStream out(&file);
-        out << script;
-        file.close();
+    if (m_autoStopPending) {
+        // 不在读数据的过程中直接停止录音，放到事件循环里处理
+        m_autoStopPending = false;
+        QMetaObject::invokeMethod(this, &SimpleVoiceRecognition::stopRecording, Qt::QueuedConnection);
     }
 }
 
-void SimpleVoiceRecognition::createRecognitionScript(const QString &scriptPath)
+void SimpleVoiceRecognition::processFrame(const QByteArray &frame)
 {
-    QString script = R"(
-import sys
-import json
-import wave
-import os
-
-try:
-    from vosk import Model, KaldiRecognizer, SetLogLevel
-except ImportError:
-    print(json.dumps({"error": "VOSK not installed. Please install with: pip install vosk"}, ensure_ascii=False))
-    sys.exit(1)
-
-def recognize_audio(audio_path, model_path):
-    try:
-        SetLogLevel(0)
-        
-        if not os.path.exists(audio_path):
-            return {"error": "音频文件不存在"}
-            
-        if not os.path.exists(model_path):
-            return {"error": "VOSK模型不存在"}
-        
-        wf = wave.open(audio_path, "rb")
-        
-        if wf.getnchannels() != 1 or wf.getsampwidth() != 2 or wf.getcomptype() != "NONE":
-            wf.close()
-            return {"error": "音频文件必须是单声道16位PCM WAV格式"}
-        
-        model = Model(model_path)
-        rec = KaldiRecognizer(model, wf.getframerate())
-        rec.SetWords(True)
-        
-        results = []
-        
-        while True:
-            data = wf.readframes(4000)
-            if len(data) == 0:
-                break
-            if rec.AcceptWaveform(data):
-                result = json.loads(rec.Result())
-                text = result.get("text", "")
-                if text:
-                    results.append(text)
-        
-        final_result = json.loads(rec.FinalResult())
-        final_text = final_result.get("text", "")
-        if final_text:
-            results.append(final_text)
-        
-        wf.close()
-        
-        full_text = " ".join(results).strip()
-        
-        if full_text:
-            return {"success": True, "text": full_text}
-        else:
-            return {"error": "未识别到语音内容"}
-            
-    except Exception as e:
-        return {"error": f"识别过程出错: {str(e)}"}
-
-if __name__ == "__main__":
-    if len(sys.argv) != 3:
-        print(json.dumps({"error": "参数错误"}, ensure_ascii=False))
-        sys.exit(1)
-    
-    audio_path = sys.argv[1]
-    model_path = sys.argv[2]
+    const bool speaking = m_vad.processFrame(reinterpret_cast<const qint16 *>(frame.constData()),
+                                             frame.size() / 2);
+    
+    if (speaking) {
+        if (!m_speechDetected) {
+            // 检测到语音才创建识别会话，并补上语音开始前的几帧
+            m_speechDetected = true;
+            m_pendingIsCommand = m_commandMode;
+            m_pendingRequestId = SpeechWorker::instance()->beginStream(
+                RECOGNITION_SAMPLE_RATE, m_pendingIsCommand ? voiceCommandGrammar() : QStringList());
+            for (const QByteArray &preRoll : m_preRoll) {
+                feedFrame(preRoll);
+            }
+            m_preRoll.clear();
+        }
+        // 句中停顿保留原样，保证识别器能正确断词
+        for (const QByteArray &silence : m_trailingSilence) {
+            feedFrame(silence);
+        }
+        m_trailingSilence.clear();
+        m_silenceMs = 0;
+        feedFrame(frame);
+        return;
+    }
     
-    result = recognize_audio(audio_path, model_path)
-    print(json.dumps(result, ensure_ascii=False))
-)";
+    if (!m_speechDetected) {
+        m_preRoll.append(frame);
+        if (m_preRoll.size() > PRE_ROLL_FRAMES) {
+            m_preRoll.removeFirst();
+        }
+        if (m_autoStopSilenceMs > 0 && m_recordedBytes / (RECOGNITION_SAMPLE_RATE * 2 / 1000) >= NO_SPEECH_TIMEOUT_MS) {
+            m_autoStopPending = true;
+        }
+        return;
+    }
     
-    QFile file(scriptPath);
-    if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        QTextStream out(&file);
-        out << script;
-        file.close();
+    // 停顿超过 MAX_PAUSE_MS 时把缓存的停顿一次送出让识别器断句，之后的静音直接丢弃，
+    // 按住不放时缓存不会随时长增长；继续说话时开始下一句
+    m_silenceMs += FRAME_MS;
+    if (m_silenceMs <= MAX_PAUSE_MS) {
+        m_trailingSilence.append(frame);
+        if (m_silenceMs == MAX_PAUSE_MS) {
+            for (const QByteArray &silence : m_trailingSilence) {
+                feedFrame(silence);
+            }
+            m_trailingSilence.clear();
+        }
+    }
+    if (m_autoStopSilenceMs > 0 && m_silenceMs >= m_autoStopSilenceMs) {
+        m_autoStopPending = true;
     }
 }
 
-void SimpleVoiceRecognition::onRecordingProcessFinished(int exitCode, QProcess::ExitStatus exitStatus)
+void SimpleVoiceRecognition::feedFrame(const QByteArray &frame)
 {
-    Q_UNUSED(exitStatus)
-    
-    qDebug() << "录音进程结束，退出码:" << exitCode;
-    
-    if (exitCode == 0 && QFile::exists(m_currentAudioFile)) {
-        // 录音成功，开始识别
-        performRecognition(m_currentAudioFile);
-    } else {
-        emit recognitionError("录音失败，请检查麦克风设备和权限");
+    if (frame.isEmpty()) {
+        return;
     }
+    SpeechWorker::instance()->feedStream(m_pendingRequestId, frame);
+    m_sentBytes += frame.size();
 }
 
-void SimpleVoiceRecognition::performRecognition(const QString &audioPath)
+void SimpleVoiceRecognition::onWorkerPartial(int requestId, const QString &text)
 {
-    QString recognitionScript = m_tempAudioPath + "/voice_recognition.py";
-    createRecognitionScript(recognitionScript);
-    
-    if (m_recognitionProcess) {
-        delete m_recognitionProcess;
+    if (requestId == m_pendingRequestId) {
+        emit partialResult(text);
     }
-    
-    m_recognitionProcess = new QProcess(this);
-    connect(m_recognitionProcess, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
-            this, &SimpleVoiceRecognition::onRecognitionProcessFinished);
-    
-    QStringList arguments;
-    arguments << recognitionScript << audioPath << m_voskModelPath;
-    
-    m_recognitionProcess->start("python", arguments);
 }
 
-void SimpleVoiceRecognition::onRecognitionProcessFinished(int exitCode, QProcess::ExitStatus exitStatus)
+void SimpleVoiceRecognition::onWorkerResult(int requestId, const QString &text)
 {
-    Q_UNUSED(exitStatus)
+    // 识别进程为所有语音按钮共用，只处理本对象提交的请求
+    if (requestId != m_pendingRequestId) {
+        return;
+    }
+    m_pendingRequestId = 0;
     
-    if (exitCode == 0) {
-        QByteArray output = m_recognitionProcess->readAllStandardOutput();
-        QString outputStr = QString::fromUtf8(output).trimmed();
-        
-        QJsonParseError error;
-        QJsonDocument doc = QJsonDocument::fromJson(outputStr.toUtf8(), &error);
-        
-        if (error.error == QJsonParseError::NoError && doc.isObject()) {
-            QJsonObject obj = doc.object();
-            
-            if (obj.contains("success") && obj["success"].toBool()) {
-                QString text = obj["text"].toString();
-                emit recognitionResult(text);
-            } else if (obj.contains("error")) {
-                QString errorMsg = obj["error"].toString();
-                emit recognitionError(errorMsg);
-            }
+    if (m_pendingIsCommand) {
+        QString command = matchVoiceCommand(text);
+        if (command.isEmpty()) {
+            emit recognitionError("未识别的语音指令");
         } else {
-            emit recognitionError("识别结果解析失败");
+            qDebug() << "语音指令:" << command << text;
+            emit commandRecognized(command, text);
         }
-    } else {
-        QByteArray errorOutput = m_recognitionProcess->readAllStandardError();
-        QString errorStr = QString::fromUtf8(errorOutput);
-        emit recognitionError("语音识别失败: " + errorStr);
+        return;
+    }
+    emit recognitionResult(text);
+}
+
+QString SimpleVoiceRecognition::vocabularyRequest()
+{
+    QString version = SpeechWorker::instance()->vocabularyVersion();
+    return version.isEmpty() ? QString("GET_SPEECH_VOCABULARY") : "GET_SPEECH_VOCABULARY#" + version;
+}
+
+bool SimpleVoiceRecognition::handleVocabularyResponse(const QString &response)
+{
+    if (response.startsWith("SPEECH_VOCABULARY_UNCHANGED#")) {
+        return true;
+    }
+    if (response.startsWith("SPEECH_VOCABULARY_FAIL")) {
+        qDebug() << "获取语音识别词表失败:" << response.trimmed();
+        return true;
+    }
+    const QString prefix = "SPEECH_VOCABULARY_SUCCESS#";
+    if (!response.startsWith(prefix)) {
+        return false;
     }
     
-    // 清理临时文件
-    QFile::remove(m_currentAudioFile);
+    // 药品名中可能含 '#'，不能按 '#' 切分
+    QJsonDocument doc = QJsonDocument::fromJson(response.mid(prefix.size()).trimmed().toUtf8());
+    if (!doc.isObject()) {
+        qDebug() << "语音识别词表解析失败";
+        return true;
+    }
+    
+    QJsonObject obj = doc.object();
+    QStringList terms;
+    for (const QJsonValue &value : obj["medicines"].toArray()) {
+        terms.append(value.toString());
+    }
+    for (const QJsonValue &value : obj["departments"].toArray()) {
+        terms.append(value.toString());
+    }
+    SpeechWorker::instance()->setVocabulary(terms, obj["version"].toString());
+    return true;
+}
+
+void SimpleVoiceRecognition::onWorkerError(int requestId, const QString &error)
+{
+    if (requestId != m_pendingRequestId) {
+        return;
+    }
+    m_pendingRequestId = 0;
+    emit recognitionError(error);
 }
 
 // SimpleVoiceButton 实现
@@ -400,6 +384,7 @@ SimpleVoiceButton::SimpleVoiceButton(QWidget *parent)
     , m_voiceRecognition(new SimpleVoiceRecognition(this))
     , m_isPressed(false)
     , m_isRecording(false)
+    , m_handsFree(false)
     , m_animationTimer(new QTimer(this))
     , m_animationFrame(0)
 {
@@ -407,8 +392,12 @@ SimpleVoiceButton::SimpleVoiceButton(QWidget *parent)
     setToolTip("按住说话，松开识别");
     setFixedSize(40, 30);
     
+    connect(m_voiceRecognition, &SimpleVoiceRecognition::partialResult,
+            this, &SimpleVoiceButton::voicePartialText);
     connect(m_voiceRecognition, &SimpleVoiceRecognition::recognitionResult,
             this, &SimpleVoiceButton::onRecognitionResult);
+    connect(m_voiceRecognition, &SimpleVoiceRecognition::commandRecognized,
+            this, [this](const QString &command, const QString &) { emit voiceCommand(command); });
     connect(m_voiceRecognition, &SimpleVoiceRecognition::recognitionError,
             this, &SimpleVoiceButton::onRecognitionError);
     connect(m_voiceRecognition, &SimpleVoiceRecognition::recordingStateChanged,
@@ -426,8 +415,17 @@ SimpleVoiceButton::~SimpleVoiceButton()
 void SimpleVoiceButton::mousePressEvent(QMouseEvent *event)
 {
     if (event->button() == Qt::LeftButton) {
-        m_isPressed = true;
-        m_voiceRecognition->startRecording();
+        if (m_handsFree) {
+            // 免按住模式下再次单击可提前结束
+            if (m_voiceRecognition->isRecording()) {
+                m_voiceRecognition->stopRecording();
+            } else {
+                m_voiceRecognition->startRecording();
+            }
+        } else {
+            m_isPressed = true;
+            m_voiceRecognition->startRecording();
+        }
     }
     QPushButton::mousePressEvent(event);
 }
@@ -441,6 +439,14 @@ void SimpleVoiceButton::mouseReleaseEvent(QMouseEvent *event)
     QPushButton::mouseReleaseEvent(event);
 }
 
+void SimpleVoiceButton::setHandsFreeMode(bool enabled)
+{
+    m_handsFree = enabled;
+    // 说完后停顿 1.2 秒自动结束录音
+    m_voiceRecognition->setAutoStopSilenceMs(enabled ? 1200 : 0);
+    updateButtonAppearance();
+}
+
 void SimpleVoiceButton::updateAnimation()
 {
     m_animationFrame = (m_animationFrame + 1) % 3;
@@ -457,7 +463,7 @@ void SimpleVoiceButton::updateButtonAppearance()
     } else {
         setStyleSheet("QPushButton { background-color: #f0f0f0; border: 1px solid #ccc; border-radius: 5px; }");
         setText("🎤");
-        setToolTip("按住说话，松开识别");
+        setToolTip(m_handsFree ? "单击开始说话，说完自动识别" : "按住说话，松开识别");
         m_animationTimer->stop();
     }
 }
@@ -3,10 +3,11 @@
 
 #include <QObject>
 #include <QPushButton>
-#include <QProcess>
 #include <QTimer>
-#include <QTemporaryFile>
+#include <QAudioSource>
 #include <QDir>
+#include <QList>
+#include "VoiceActivityDetector.h"
 #include <QStandardPaths>
 #include <QApplication>
 #include <QMessageBox>
@@ -14,7 +15,10 @@
 
 /**
  * 简化版语音识别类
- * 使用外部录音工具来避免Qt音频权限问题
+ * 录音在进程内用 QAudioSource 完成，按住期间每 20ms 把 PCM 送入常驻识别进程（SpeechWorker）
+ * 并返回中间结果，松开后只需取最终结果，不落盘、不重复加载模型。
+ * 送入识别前先经过语音活动检测：去掉首尾静音，整段无语音时不提交识别，
+ * 设置了自动停止时长后，说完停顿即自动结束录音（免按住模式）
  */
 class SimpleVoiceRecognition : public QObject
 {
@@ -28,28 +32,56 @@ public:
     void stopRecording();
     bool isRecording() const { return m_isRecording; }
     bool isVoskModelAvailable() const;
+    
+    // 语音结束后静音达到该时长自动停止录音，0 表示只在 stopRecording 时停止
+    void setAutoStopSilenceMs(int ms) { m_autoStopSilenceMs = ms; }
+    int autoStopSilenceMs() const { return m_autoStopSilenceMs; }
+    
+    // 指令模式：只识别固定的语音指令（发送、取消），结果通过 commandRecognized 返回
+    void setCommandMode(bool enabled) { m_commandMode = enabled; }
+    bool isCommandMode() const { return m_commandMode; }
+    
+    // 专业词表：持有服务器连接的窗口发送 vocabularyRequest()，收到的响应交给 handleVocabularyResponse()；
+    // 请求带上当前词表版本，词表未变化时服务器不会重复下发
+    static QString vocabularyRequest();
+    static bool handleVocabularyResponse(const QString &response);
 
 signals:
+    void partialResult(const QString &text);     // 按住说话期间的中间识别结果（整句文本，会被后续结果替换）
     void recognitionResult(const QString &text);
+    void commandRecognized(const QString &command, const QString &spokenText);
     void recognitionError(const QString &error);
     void recordingStateChanged(bool isRecording);
 
 private slots:
-    void onRecordingProcessFinished(int exitCode, QProcess::ExitStatus exitStatus);
-    void onRecognitionProcessFinished(int exitCode, QProcess::ExitStatus exitStatus);
+    void onAudioReadyRead();
+    void onWorkerPartial(int requestId, const QString &text);
+    void onWorkerResult(int requestId, const QString &text);
+    void onWorkerError(int requestId, const QString &error);
 
 private:
     QString getVoskModelPath() const;
-    void performRecognition(const QString &audioPath);
-    void createRecordingScript(const QString &scriptPath);
-    void createRecognitionScript(const QString &scriptPath);
+    void processFrame(const QByteArray &frame);
+    void feedFrame(const QByteArray &frame);
     
-    QProcess *m_recordingProcess;
-    QProcess *m_recognitionProcess;
+    QAudioSource *m_audioSource;
+    QIODevice *m_audioDevice;
+    QByteArray m_chunkBuffer;       // 不足一个 20ms 块的剩余音频
+    qint64 m_recordedBytes;
+    qint64 m_sentBytes;             // 实际送入识别的音频量（去掉静音后）
+    int m_pendingRequestId;         // 当前流式识别会话编号，检测到语音后才创建
+    
+    VoiceActivityDetector m_vad;
+    bool m_speechDetected;
+    QList<QByteArray> m_preRoll;         // 语音开始前的最近几帧，保留字头
+    QList<QByteArray> m_trailingSilence; // 语音后的静音帧，继续说话时补发，结束时丢弃
+    int m_silenceMs;
+    int m_autoStopSilenceMs;
+    bool m_autoStopPending;
+    bool m_commandMode;
+    bool m_pendingIsCommand;        // 当前会话按指令模式创建
     bool m_isRecording;
     QString m_voskModelPath;
-    QString m_tempAudioPath;
-    QString m_currentAudioFile;
 };
 
 /**
@@ -64,9 +96,17 @@ public:
     ~SimpleVoiceButton();
 
 signals:
+    void voicePartialText(const QString &text);  // 说话过程中的中间结果，可直接刷新输入框
     void voiceTextRecognized(const QString &text);
+    void voiceCommand(const QString &command);
     void voiceError(const QString &error);
 
+public:
+    // 免按住模式：单击开始录音，说完停顿后自动结束
+    void setHandsFreeMode(bool enabled);
+    bool isHandsFreeMode() const { return m_handsFree; }
+    void setCommandMode(bool enabled) { m_voiceRecognition->setCommandMode(enabled); }
+
 protected:
     void mousePressEvent(QMouseEvent *event) override;
     void mouseReleaseEvent(QMouseEvent *event) override;
@@ -83,6 +123,7 @@ private:
     SimpleVoiceRecognition *m_voiceRecognition;
     bool m_isPressed;
     bool m_isRecording;
+    bool m_handsFree;
     QTimer *m_animationTimer;
     int m_animationFrame;
 };
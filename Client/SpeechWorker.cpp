@@ -0,0 +1,485 @@
+#include "SpeechWorker.h"
+#include <QCoreApplication>
+#include <QStandardPaths>
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QDebug>
+
+static SpeechWorker *s_instance = nullptr;
+
+SpeechWorker *SpeechWorker::instance()
+{
+    if (!s_instance) {
+        // 随应用对象销毁，退出时一并结束识别进程
+        s_instance = new SpeechWorker(QCoreApplication::instance());
+    }
+    return s_instance;
+}
+
+SpeechWorker::SpeechWorker(QObject *parent)
+    : QObject(parent)
+    , m_process(nullptr)
+    , m_ready(false)
+    , m_nextRequestId(1)
+{
+}
+
+SpeechWorker::~SpeechWorker()
+{
+    if (m_process) {
+        disconnect(m_process, nullptr, this, nullptr);
+        if (m_process->state() == QProcess::Running) {
+            m_process->write("{\"cmd\":\"quit\"}\n");
+            m_process->closeWriteChannel();
+            if (!m_process->waitForFinished(1000)) {
+                m_process->kill();
+                m_process->waitForFinished(1000);
+            }
+        }
+    }
+    s_instance = nullptr;
+}
+
+void SpeechWorker::start(const QString &modelPath)
+{
+    if (m_process && m_process->state() != QProcess::NotRunning) {
+        return;
+    }
+    m_modelPath = modelPath;
+    m_ready = false;
+    m_stdoutBuffer.clear();
+
+    QString script = writeWorkerScript();
+    if (script.isEmpty()) {
+        failOutstanding("无法写入语音识别脚本");
+        return;
+    }
+
+    if (!m_process) {
+        m_process = new QProcess(this);
+        connect(m_process, &QProcess::readyReadStandardOutput,
+                this, &SpeechWorker::onReadyReadStandardOutput);
+        connect(m_process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+                this, &SpeechWorker::onProcessFinished);
+        connect(m_process, &QProcess::errorOccurred, this, &SpeechWorker::onProcessError);
+        // 模型加载日志走 stderr，直接转发到控制台便于排查
+        m_process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    }
+
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    env.insert("PYTHONIOENCODING", "utf-8");
+    m_process->setProcessEnvironment(env);
+
+    qDebug() << "启动常驻语音识别进程，模型:" << m_modelPath;
+    m_process->start("python", QStringList() << script << m_modelPath);
+    
+    // 词表排在所有请求之前，模型加载完成后先生效
+    if (!m_vocabulary.isEmpty()) {
+        QJsonObject header;
+        header["cmd"] = "vocabulary";
+        header["terms"] = QJsonArray::fromStringList(m_vocabulary);
+        sendMessage(header);
+    }
+}
+
+void SpeechWorker::setVocabulary(const QStringList &terms, const QString &version)
+{
+    m_vocabulary = terms;
+    m_vocabularyVersion = version;
+    qDebug() << "更新语音识别词表，词条数:" << terms.size() << "版本:" << version;
+
+    // 进程未运行时由 start() 下发
+    if (m_process && m_process->state() != QProcess::NotRunning) {
+        QJsonObject header;
+        header["cmd"] = "vocabulary";
+        header["terms"] = QJsonArray::fromStringList(m_vocabulary);
+        sendMessage(header);
+    }
+}
+
+bool SpeechWorker::ensureRunning(int requestId)
+{
+    if (m_process && m_process->state() != QProcess::NotRunning) {
+        return true;
+    }
+    if (m_modelPath.isEmpty()) {
+        QMetaObject::invokeMethod(this, [this, requestId]() {
+            emit errorOccurred(requestId, "语音识别进程未启动");
+        }, Qt::QueuedConnection);
+        return false;
+    }
+    // 进程意外退出后按需重启
+    start(m_modelPath);
+    return true;
+}
+
+int SpeechWorker::recognize(const QByteArray &pcm, int sampleRate)
+{
+    int id = m_nextRequestId++;
+    if (!ensureRunning(id)) {
+        return id;
+    }
+    m_outstandingRequests.append(id);
+
+    QJsonObject header;
+    header["cmd"] = "recognize";
+    header["id"] = id;
+    header["rate"] = sampleRate;
+    sendMessage(header, pcm);
+    return id;
+}
+
+int SpeechWorker::beginStream(int sampleRate, const QStringList &grammar)
+{
+    int id = m_nextRequestId++;
+    if (!ensureRunning(id)) {
+        return id;
+    }
+    m_outstandingRequests.append(id);
+
+    QJsonObject header;
+    header["cmd"] = "begin";
+    header["id"] = id;
+    header["rate"] = sampleRate;
+    if (!grammar.isEmpty()) {
+        header["grammar"] = QJsonArray::fromStringList(grammar);
+    }
+    sendMessage(header);
+    return id;
+}
+
+void SpeechWorker::feedStream(int streamId, const QByteArray &pcm)
+{
+    if (pcm.isEmpty() || !m_outstandingRequests.contains(streamId)) {
+        return;
+    }
+    QJsonObject header;
+    header["cmd"] = "audio";
+    header["id"] = streamId;
+    sendMessage(header, pcm);
+}
+
+void SpeechWorker::endStream(int streamId)
+{
+    if (!m_outstandingRequests.contains(streamId)) {
+        return;
+    }
+    QJsonObject header;
+    header["cmd"] = "end";
+    header["id"] = streamId;
+    sendMessage(header);
+}
+
+void SpeechWorker::sendMessage(const QJsonObject &header, const QByteArray &pcm)
+{
+    QJsonObject message = header;
+    if (!pcm.isEmpty() || header["cmd"].toString() == "recognize") {
+        message["bytes"] = static_cast<qint64>(pcm.size());
+    }
+
+    QByteArray data = QJsonDocument(message).toJson(QJsonDocument::Compact);
+    data.append('\n');
+    data.append(pcm);
+
+    // 模型加载期间先排队；流式识别时录音可能早于模型就绪，音频按序补发
+    if (m_ready) {
+        m_process->write(data);
+    } else {
+        m_queuedMessages.append(data);
+    }
+}
+
+void SpeechWorker::onReadyReadStandardOutput()
+{
+    m_stdoutBuffer.append(m_process->readAllStandardOutput());
+
+    int newline;
+    while ((newline = m_stdoutBuffer.indexOf('\n')) >= 0) {
+        QByteArray line = m_stdoutBuffer.left(newline).trimmed();
+        m_stdoutBuffer.remove(0, newline + 1);
+        if (!line.isEmpty()) {
+            handleMessage(line);
+        }
+    }
+}
+
+void SpeechWorker::handleMessage(const QByteArray &line)
+{
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(line, &error);
+    if (error.error != QJsonParseError::NoError || !doc.isObject()) {
+        qDebug() << "语音识别进程输出:" << line;
+        return;
+    }
+
+    QJsonObject obj = doc.object();
+    QString event = obj["event"].toString();
+    int id = obj["id"].toInt();
+
+    if (event == "ready") {
+        m_ready = true;
+        qDebug() << "VOSK模型加载完成，待发送消息:" << m_queuedMessages.size();
+        for (const QByteArray &data : m_queuedMessages) {
+            m_process->write(data);
+        }
+        m_queuedMessages.clear();
+        emit ready();
+    } else if (event == "partial") {
+        emit partialResult(id, obj["text"].toString());
+    } else if (event == "result") {
+        m_outstandingRequests.removeOne(id);
+        emit resultReady(id, obj["text"].toString());
+    } else if (event == "error") {
+        m_outstandingRequests.removeOne(id);
+        emit errorOccurred(id, obj["error"].toString());
+    }
+}
+
+void SpeechWorker::failOutstanding(const QString &error)
+{
+    const QList<int> ids = m_outstandingRequests;
+    m_outstandingRequests.clear();
+    m_queuedMessages.clear();
+
+    for (int id : ids) {
+        emit errorOccurred(id, error);
+    }
+}
+
+void SpeechWorker::onProcessFinished(int exitCode, QProcess::ExitStatus exitStatus)
+{
+    qDebug() << "语音识别进程退出，退出码:" << exitCode << "状态:" << exitStatus;
+    m_ready = false;
+
+    // 模型加载阶段退出通常是缺少 vosk 库或模型损坏
+    onReadyReadStandardOutput();
+    failOutstanding("语音识别进程已退出，请确保已安装 vosk (pip install vosk)");
+}
+
+void SpeechWorker::onProcessError(QProcess::ProcessError error)
+{
+    if (error == QProcess::FailedToStart) {
+        m_ready = false;
+        failOutstanding("无法启动语音识别进程，请确保Python已安装");
+    }
+}
+
+QString SpeechWorker::writeWorkerScript() const
+{
+    QString script = R"(
+import sys
+import json
+import re
+
+def send(message):
+    sys.stdout.buffer.write((json.dumps(message, ensure_ascii=False) + "\n").encode("utf-8"))
+    sys.stdout.buffer.flush()
+
+try:
+    from vosk import Model, KaldiRecognizer, SetLogLevel
+except ImportError:
+    sys.stderr.write("VOSK not installed. Please install with: pip install vosk\n")
+    sys.exit(1)
+
+def read_exact(stream, size):
+    chunks = []
+    while size > 0:
+        data = stream.read(size)
+        if not data:
+            return None
+        chunks.append(data)
+        size -= len(data)
+    return b"".join(chunks)
+
+try:
+    from pypinyin import lazy_pinyin
+except ImportError:
+    lazy_pinyin = None
+
+CJK_SPACE = re.compile(r"(?<=[\u4e00-\u9fff]) +(?=[\u4e00-\u9fff])")
+
+def compact(text):
+    """中文模型按词输出并以空格分隔，汉字之间的空格去掉"""
+    return CJK_SPACE.sub("", text).strip()
+
+class Vocabulary:
+    """药品/科室词表纠错：识别文本中与词条读音相同（无 pypinyin 时为字形相近）的片段替换为词条"""
+    def __init__(self, terms):
+        unique = {t.strip() for t in terms if len(t.strip()) >= 2}
+        # 长词优先，避免短词先替换破坏长词
+        self.terms = sorted(unique, key=len, reverse=True)
+        self.keys = {t: self.key(t) for t in self.terms}
+
+    @staticmethod
+    def key(text):
+        if lazy_pinyin is None:
+            return list(text)
+        return [lazy_pinyin(ch)[0] for ch in text]
+
+    @staticmethod
+    def close(a, b):
+        # 四个字及以上的词条允许一个音节（字）不同
+        diff = sum(1 for x, y in zip(a, b) if x != y)
+        return diff == 0 or (len(a) >= 4 and diff <= 1)
+
+    def correct(self, text):
+        if not self.terms or not text:
+            return text
+        keys = self.key(text)
+        protected = [False] * len(text)
+        replacements = []
+        for term in self.terms:
+            size = len(term)
+            term_key = self.keys[term]
+            start = 0
+            while start + size <= len(text):
+                if any(protected[start:start + size]):
+                    start += 1
+                    continue
+                if text[start:start + size] == term or self.close(keys[start:start + size], term_key):
+                    replacements.append((start, size, term))
+                    for i in range(start, start + size):
+                        protected[i] = True
+                    start += size
+                else:
+                    start += 1
+        for start, size, term in sorted(replacements, reverse=True):
+            text = text[:start] + term + text[start + size:]
+        return text
+
+vocabulary = Vocabulary([])
+
+def finalize(text):
+    return vocabulary.correct(compact(text))
+
+def recognize(model, pcm, rate):
+    rec = KaldiRecognizer(model, rate)
+    results = []
+    for offset in range(0, len(pcm), 8000):
+        if rec.AcceptWaveform(pcm[offset:offset + 8000]):
+            text = json.loads(rec.Result()).get("text", "")
+            if text:
+                results.append(text)
+    text = json.loads(rec.FinalResult()).get("text", "")
+    if text:
+        results.append(text)
+    return finalize(" ".join(results))
+
+class Stream:
+    """流式识别会话：已确定的分句 + 当前句的中间结果"""
+    def __init__(self, model, rate, grammar=None):
+        if grammar:
+            # 受限语法：只在给定短语中解码，其余一律识别为 [unk]
+            self.rec = KaldiRecognizer(model, rate, json.dumps(list(grammar) + ["[unk]"], ensure_ascii=False))
+        else:
+            self.rec = KaldiRecognizer(model, rate)
+        self.grammar = bool(grammar)
+        self.segments = []
+        self.last_partial = ""
+
+    def accept(self, pcm):
+        """送入一块音频，中间结果有变化时返回完整文本，否则返回 None"""
+        if self.rec.AcceptWaveform(pcm):
+            text = json.loads(self.rec.Result()).get("text", "")
+            if text:
+                self.segments.append(text)
+            current = ""
+        else:
+            current = json.loads(self.rec.PartialResult()).get("partial", "")
+        text = " ".join(self.segments + ([current] if current else []))
+        text = compact(text) if self.grammar else finalize(text)
+        if text == self.last_partial:
+            return None
+        self.last_partial = text
+        return text
+
+    def finish(self):
+        text = json.loads(self.rec.FinalResult()).get("text", "")
+        if text:
+            self.segments.append(text)
+        text = " ".join(s for s in self.segments if s != "[unk]")
+        # 指令模式的结果原样返回，由客户端匹配指令表
+        return compact(text) if self.grammar else finalize(text)
+
+def main():
+    if len(sys.argv) != 2:
+        sys.stderr.write("用法: python speech_worker.py <模型路径>\n")
+        sys.exit(1)
+
+    SetLogLevel(-1)
+    model = Model(sys.argv[1])
+    send({"event": "ready"})
+
+    global vocabulary
+    streams = {}
+    stdin = sys.stdin.buffer
+    while True:
+        line = stdin.readline()
+        if not line:
+            break
+        try:
+            request = json.loads(line)
+        except ValueError:
+            continue
+
+        cmd = request.get("cmd")
+        request_id = request.get("id", 0)
+        pcm = b""
+        if "bytes" in request:
+            pcm = read_exact(stdin, int(request["bytes"]))
+            if pcm is None:
+                break
+
+        if cmd == "quit":
+            break
+        try:
+            if cmd == "recognize":
+                text = recognize(model, pcm, int(request.get("rate", 16000)))
+            elif cmd == "begin":
+                streams[request_id] = Stream(model, int(request.get("rate", 16000)), request.get("grammar"))
+                continue
+            elif cmd == "vocabulary":
+                vocabulary = Vocabulary(request.get("terms", []))
+                continue
+            elif cmd == "audio":
+                stream = streams.get(request_id)
+                if stream is not None:
+                    partial = stream.accept(pcm)
+                    if partial is not None:
+                        send({"event": "partial", "id": request_id, "text": partial})
+                continue
+            elif cmd == "end":
+                stream = streams.pop(request_id, None)
+                if stream is None:
+                    continue
+                text = stream.finish()
+            else:
+                continue
+
+            if text:
+                send({"event": "result", "id": request_id, "text": text})
+            else:
+                send({"event": "error", "id": request_id, "error": "未识别到语音内容"})
+        except Exception as e:
+            streams.pop(request_id, None)
+            send({"event": "error", "id": request_id, "error": f"识别过程出错: {str(e)}"})
+
+if __name__ == "__main__":
+    main()
+)";
+
+    QString dirPath = QStandardPaths::writableLocation(QStandardPaths::TempLocation) + "/voice_recognition";
+    QDir().mkpath(dirPath);
+    QString scriptPath = dirPath + "/speech_worker.py";
+
+    QFile file(scriptPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return QString();
+    }
+    file.write(script.toUtf8());
+    file.close();
+    return scriptPath;
+}
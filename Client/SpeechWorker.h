@@ -0,0 +1,81 @@
+#ifndef SPEECHWORKER_H
+#define SPEECHWORKER_H
+
+#include <QObject>
+#include <QProcess>
+#include <QByteArray>
+#include <QList>
+#include <QStringList>
+#include <QJsonObject>
+
+/**
+ * 常驻语音识别进程
+ * 启动一个长期运行的 Python 进程，VOSK 模型只在启动时加载一次，
+ * 之后通过标准输入/输出管道逐条提交音频、返回识别结果。
+ * 整个程序共用一个实例，多个语音按钮不会重复加载模型。
+ *
+ * 管道协议（每条消息一行 JSON，UTF-8；带 bytes 字段的消息后紧跟 M 字节 16 位单声道 PCM）：
+ *   整段识别: {"cmd":"recognize","id":N,"rate":16000,"bytes":M}
+ *   流式识别: {"cmd":"begin","id":N,"rate":16000[,"grammar":[...]]} -> {"cmd":"audio","id":N,"bytes":M} ... -> {"cmd":"end","id":N}
+ *   纠错词表: {"cmd":"vocabulary","terms":[...]}
+ *   响应: {"event":"ready"} / {"event":"partial","id":N,"text":"..."}
+ *         {"event":"result","id":N,"text":"..."} / {"event":"error","id":N,"error":"..."}
+ */
+class SpeechWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    static SpeechWorker *instance();
+
+    // 启动识别进程并在后台加载模型；进程已在运行时直接返回
+    void start(const QString &modelPath);
+    bool isReady() const { return m_ready; }
+
+    // 提交一段 PCM 音频，返回请求编号；模型尚未加载完时先排队
+    int recognize(const QByteArray &pcm, int sampleRate = 16000);
+
+    // 流式识别：边录边送，识别进程每收到一块音频就解码并返回中间结果
+    // grammar 非空时只在给定短语内解码（指令模式），比完整语言模型快且不会识别成无关词
+    int beginStream(int sampleRate = 16000, const QStringList &grammar = QStringList());
+    void feedStream(int streamId, const QByteArray &pcm);
+    void endStream(int streamId);   // 结束后通过 resultReady 返回最终文本
+
+    // 专业词表（药品名、科室名）：识别结果中读音相同或相近的片段替换为词表中的写法；
+    // 识别进程重启后自动重新下发
+    void setVocabulary(const QStringList &terms, const QString &version);
+    QString vocabularyVersion() const { return m_vocabularyVersion; }
+
+signals:
+    void ready();
+    void partialResult(int requestId, const QString &text);
+    void resultReady(int requestId, const QString &text);
+    void errorOccurred(int requestId, const QString &error);
+
+private slots:
+    void onReadyReadStandardOutput();
+    void onProcessFinished(int exitCode, QProcess::ExitStatus exitStatus);
+    void onProcessError(QProcess::ProcessError error);
+
+private:
+    explicit SpeechWorker(QObject *parent = nullptr);
+    ~SpeechWorker();
+
+    QString writeWorkerScript() const;
+    bool ensureRunning(int requestId);
+    void sendMessage(const QJsonObject &header, const QByteArray &pcm = QByteArray());
+    void handleMessage(const QByteArray &line);
+    void failOutstanding(const QString &error);
+
+    QProcess *m_process;
+    QString m_modelPath;
+    QByteArray m_stdoutBuffer;
+    bool m_ready;
+    int m_nextRequestId;
+    QList<QByteArray> m_queuedMessages; // 模型加载完成前暂存的消息，按顺序补发
+    QList<int> m_outstandingRequests;   // 尚未返回最终结果的请求
+    QStringList m_vocabulary;
+    QString m_vocabularyVersion;
+};
+
+#endif // SPEECHWORKER_H
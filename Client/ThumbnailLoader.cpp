@@ -0,0 +1,90 @@
+#include "ThumbnailLoader.h"
+#include <QImageReader>
+#include <QDebug>
+
+static const int DEFAULT_MEMORY_BUDGET_KB = 32 * 1024;
+
+ThumbnailLoader::ThumbnailLoader(QObject *parent)
+    : QObject(parent)
+    , m_cache(DEFAULT_MEMORY_BUDGET_KB)
+{
+    // 解码以 IO 和 CPU 为主，两个线程足够，不与界面线程争抢
+    m_pool.setMaxThreadCount(2);
+}
+
+ThumbnailLoader::~ThumbnailLoader()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+QString ThumbnailLoader::cacheKey(const QString &path, const QSize &size)
+{
+    return QString("%1@%2x%3").arg(path).arg(size.width()).arg(size.height());
+}
+
+QSize ThumbnailLoader::imageSize(const QString &path)
+{
+    auto it = m_sizes.constFind(path);
+    if (it != m_sizes.constEnd()) {
+        return it.value();
+    }
+
+    QImageReader reader(path);
+    reader.setAutoTransform(true);
+    QSize size = reader.size();
+    if (size.isValid() && (reader.transformation() & QImageIOHandler::TransformationRotate90)) {
+        size.transpose();
+    }
+    m_sizes.insert(path, size);
+    return size;
+}
+
+QPixmap ThumbnailLoader::thumbnail(const QString &path, const QSize &size)
+{
+    const QString key = cacheKey(path, size);
+    if (QPixmap *cached = m_cache.object(key)) {
+        return *cached;
+    }
+    if (m_pending.contains(key) || m_failed.contains(key)) {
+        return QPixmap();
+    }
+    m_pending.insert(key);
+
+    // 析构时会等待线程池中的任务结束，任务内可以安全使用 this
+    m_pool.start([this, key, path, size]() {
+        QImageReader reader(path);
+        reader.setAutoTransform(true);
+        // 让解码器直接输出目标尺寸，JPEG 可在解码阶段按比例缩小，不必先还原整张原图。
+        // 缩放发生在 EXIF 旋转之前，目标尺寸按显示方向计算后要换回存储方向
+        QSize sourceSize = reader.size();
+        if (sourceSize.isValid()) {
+            const bool rotated = reader.transformation() & QImageIOHandler::TransformationRotate90;
+            QSize targetSize = (rotated ? sourceSize.transposed() : sourceSize).scaled(size, Qt::KeepAspectRatio);
+            reader.setScaledSize(rotated ? targetSize.transposed() : targetSize);
+        }
+        QImage image = reader.read();
+        if (!sourceSize.isValid() && !image.isNull()) {
+            image = image.scaled(size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        }
+        QMetaObject::invokeMethod(this, "onDecoded", Qt::QueuedConnection,
+                                  Q_ARG(QString, key), Q_ARG(QString, path), Q_ARG(QImage, image));
+    });
+    return QPixmap();
+}
+
+void ThumbnailLoader::onDecoded(const QString &key, const QString &path, const QImage &image)
+{
+    m_pending.remove(key);
+    if (image.isNull()) {
+        qDebug() << "图片解码失败:" << path;
+        m_failed.insert(key);
+        return;
+    }
+
+    // QPixmap 只能在界面线程创建
+    QPixmap *pixmap = new QPixmap(QPixmap::fromImage(image));
+    const int cost = qMax(1, static_cast<int>(image.sizeInBytes() / 1024));
+    m_cache.insert(key, pixmap, cost);
+    emit thumbnailReady(path);
+}
@@ -0,0 +1,46 @@
+#ifndef THUMBNAILLOADER_H
+#define THUMBNAILLOADER_H
+
+#include <QObject>
+#include <QCache>
+#include <QHash>
+#include <QSet>
+#include <QPixmap>
+#include <QImage>
+#include <QThreadPool>
+
+// 聊天图片缩略图加载：在线程池中用 QImageReader 按目标尺寸解码（不先解码原图再缩放），
+// 结果放入按内存预算淘汰的 LRU 缓存；图片未就绪时返回空图并在后台解码，完成后发出 thumbnailReady
+class ThumbnailLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ThumbnailLoader(QObject *parent = nullptr);
+    ~ThumbnailLoader();
+
+    // 取缩略图；未缓存时返回空 QPixmap 并提交后台解码
+    QPixmap thumbnail(const QString &path, const QSize &size);
+
+    // 原图尺寸（只读文件头），结果缓存，重新加载聊天记录时不再读文件
+    QSize imageSize(const QString &path);
+
+    void setMemoryBudget(int kilobytes) { m_cache.setMaxCost(kilobytes); }
+
+signals:
+    void thumbnailReady(const QString &path);
+
+private slots:
+    void onDecoded(const QString &cacheKey, const QString &path, const QImage &image);
+
+private:
+    static QString cacheKey(const QString &path, const QSize &size);
+
+    QThreadPool m_pool;
+    QCache<QString, QPixmap> m_cache;   // 开销按 KB 计
+    QSet<QString> m_pending;            // 正在解码的请求，避免重复提交
+    QSet<QString> m_failed;             // 无法解码的文件不再反复尝试
+    QHash<QString, QSize> m_sizes;
+};
+
+#endif // THUMBNAILLOADER_H
@@ -0,0 +1,377 @@
+#include "VideoStream.h"
+#include <QBuffer>
+#include <QtEndian>
+#include <QVideoFrameFormat>
+#include <QDebug>
+#include <cstring>
+
+VideoStream::VideoStream(MediaChannel *channel, QObject *parent)
+    : QObject(parent)
+    , m_channel(channel)
+    , m_reportTimer(new QTimer(this))
+    , m_playoutTimer(new QTimer(this))
+{
+    m_clock.start();
+    m_playoutTimer->setInterval(5);
+    connect(m_playoutTimer, &QTimer::timeout, this, &VideoStream::playout);
+    m_reportTimer->setInterval(REPORT_INTERVAL_MS);
+    connect(m_reportTimer, &QTimer::timeout, this, &VideoStream::sendReports);
+    connect(m_channel, &MediaChannel::packetReceived, this, &VideoStream::onPacketReceived);
+    m_encodePool.setMaxThreadCount(1);
+}
+
+VideoStream::~VideoStream()
+{
+    m_encodePool.clear();
+    m_encodePool.waitForDone();
+}
+
+void VideoStream::start()
+{
+    m_running = true;
+    m_encoding = false;
+    m_lastSentMs = -1;
+    m_pendingFrames.clear();
+    m_hasClockOffset = false;
+    m_lastPlayedFrameId = -1;
+    m_hasSeq = false;
+    m_receivedPackets = 0;
+    m_expectedPrior = 0;
+    m_receivedPrior = 0;
+    m_jitter = 0.0;
+    m_hasTransit = false;
+    m_hasSr = false;
+    m_srSinceLastReport = false;
+    m_srPacketsSentPrior = 0;
+    m_playoutTimer->start();
+    m_reportTimer->start();
+}
+
+void VideoStream::stop()
+{
+    m_running = false;
+    m_playoutTimer->stop();
+    m_reportTimer->stop();
+    m_pendingFrames.clear();
+}
+
+void VideoStream::sendFrame(const QVideoFrame &frame)
+{
+    if (!m_running || !m_channel->hasPeer()) {
+        return;
+    }
+
+    // 摄像头通常以 30fps 输出，按目标帧率抽帧
+    qint64 now = m_clock.elapsed();
+    if (m_encoding || (m_lastSentMs >= 0 && now - m_lastSentMs < m_frameIntervalMs)) {
+        return;
+    }
+    m_lastSentMs = now;
+    m_encoding = true;
+
+    // 转换、缩放和 JPEG 编码在后台线程完成，编码参数按提交时的值
+    const QSize targetSize = m_targetSize;
+    const int quality = m_jpegQuality;
+    m_encodePool.start([this, frame, targetSize, quality, now]() {
+        QByteArray encoded;
+        QImage image = frame.toImage();
+        if (!image.isNull()) {
+            if (image.width() > targetSize.width() || image.height() > targetSize.height()) {
+                // 实时链路优先保证编码耗时，使用快速缩放
+                image = image.scaled(targetSize, Qt::KeepAspectRatio, Qt::FastTransformation);
+            }
+            QBuffer buffer(&encoded);
+            buffer.open(QIODevice::WriteOnly);
+            if (!image.save(&buffer, "JPG", quality)) {
+                encoded.clear();
+            }
+        }
+        QMetaObject::invokeMethod(this, "onFrameEncoded", Qt::QueuedConnection,
+                                  Q_ARG(QByteArray, encoded), Q_ARG(qint64, now));
+    });
+}
+
+void VideoStream::onFrameEncoded(const QByteArray &encoded, qint64 captureMs)
+{
+    m_encoding = false;
+    if (!m_running || !m_channel->hasPeer()) {
+        return;
+    }
+    if (encoded.isEmpty()) {
+        qDebug() << "视频帧编码失败";
+        return;
+    }
+
+    const quint32 frameId = m_nextFrameId++;
+    const quint32 timestamp = static_cast<quint32>(captureMs);
+    const int fragmentCount = (encoded.size() + MAX_FRAGMENT_PAYLOAD - 1) / MAX_FRAGMENT_PAYLOAD;
+
+    // 分片头: frameId(4) timestamp(4) seq(4) index(2) count(2)，大端序
+    for (int index = 0; index < fragmentCount; ++index) {
+        const int offset = index * MAX_FRAGMENT_PAYLOAD;
+        const int length = qMin(MAX_FRAGMENT_PAYLOAD, static_cast<int>(encoded.size()) - offset);
+
+        QByteArray packet(FRAGMENT_HEADER_SIZE + length, Qt::Uninitialized);
+        uchar *header = reinterpret_cast<uchar *>(packet.data());
+        qToBigEndian<quint32>(frameId, header);
+        qToBigEndian<quint32>(timestamp, header + 4);
+        qToBigEndian<quint32>(m_nextSeq++, header + 8);
+        qToBigEndian<quint16>(static_cast<quint16>(index), header + 12);
+        qToBigEndian<quint16>(static_cast<quint16>(fragmentCount), header + 14);
+        std::memcpy(packet.data() + FRAGMENT_HEADER_SIZE, encoded.constData() + offset, length);
+
+        m_channel->sendPacket(MediaChannel::VideoFragment, packet);
+        m_sentPackets++;
+    }
+}
+
+void VideoStream::onPacketReceived(quint8 type, const QByteArray &payload)
+{
+    if (!m_running) {
+        return;
+    }
+    switch (type) {
+    case MediaChannel::VideoFragment:
+        handleFragment(payload);
+        break;
+    case MediaChannel::SenderReport:
+        handleSenderReport(payload);
+        break;
+    case MediaChannel::ReceiverReport:
+        handleReceiverReport(payload);
+        break;
+    default:
+        break;
+    }
+}
+
+void VideoStream::handleFragment(const QByteArray &payload)
+{
+    if (payload.size() <= FRAGMENT_HEADER_SIZE) {
+        return;
+    }
+
+    const uchar *header = reinterpret_cast<const uchar *>(payload.constData());
+    const quint32 frameId = qFromBigEndian<quint32>(header);
+    const quint32 timestamp = qFromBigEndian<quint32>(header + 4);
+    const quint32 seq = qFromBigEndian<quint32>(header + 8);
+    const quint16 index = qFromBigEndian<quint16>(header + 12);
+    const quint16 count = qFromBigEndian<quint16>(header + 14);
+
+    if (count == 0 || index >= count) {
+        return;
+    }
+
+    // 丢包统计按分片序号计算，包括之后会被丢弃的迟到分片
+    if (!m_hasSeq) {
+        m_baseSeq = seq;
+        m_maxSeq = seq;
+        m_hasSeq = true;
+    } else if (seq > m_maxSeq) {
+        m_maxSeq = seq;
+    }
+    m_receivedPackets++;
+    // 已经播放过（或已跳过）的帧直接丢弃
+    if (static_cast<qint64>(frameId) <= m_lastPlayedFrameId) {
+        return;
+    }
+
+    const qint64 now = m_clock.elapsed();
+
+    // 以观察到的最小传输时延为基准对齐双方时钟，抖动由固定播放延迟吸收
+    const qint64 offset = now - static_cast<qint64>(timestamp);
+    if (!m_hasClockOffset || offset < m_clockOffsetMs) {
+        m_clockOffsetMs = offset;
+        m_hasClockOffset = true;
+    }
+
+    PendingFrame &frame = m_pendingFrames[frameId];
+    if (frame.fragments.isEmpty()) {
+        // 到达抖动按帧计算（同一帧的分片时间戳相同、连续到达），算法同 RFC 3550
+        if (m_hasTransit) {
+            const qint64 d = qAbs(offset - m_lastTransit);
+            m_jitter += (static_cast<double>(d) - m_jitter) / 16.0;
+        }
+        m_lastTransit = offset;
+        m_hasTransit = true;
+
+        frame.timestamp = timestamp;
+        frame.fragments.resize(count);
+        frame.firstArrivalMs = now;
+    }
+    if (frame.fragments.size() != count || !frame.fragments[index].isEmpty()) {
+        return; // 重复或不一致的分片
+    }
+
+    frame.fragments[index] = payload.mid(FRAGMENT_HEADER_SIZE);
+    frame.received++;
+
+    // 缓冲过多时丢弃最旧的帧，防止内存无限增长
+    while (m_pendingFrames.size() > MAX_PENDING_FRAMES) {
+        dropPendingFront();
+    }
+}
+
+void VideoStream::dropPendingFront()
+{
+    // 丢弃的帧之后迟到的分片不再重建该帧
+    auto front = m_pendingFrames.begin();
+    m_lastPlayedFrameId = qMax<qint64>(m_lastPlayedFrameId, front.key());
+    m_pendingFrames.erase(front);
+}
+
+void VideoStream::playout()
+{
+    if (m_pendingFrames.isEmpty() || !m_hasClockOffset) {
+        return;
+    }
+
+    const qint64 now = m_clock.elapsed();
+
+    // 找到已到播放时间的最新完整帧，比它更早的帧（无论是否完整）都不再需要
+    qint64 dueFrameId = -1;
+    for (auto it = m_pendingFrames.cbegin(); it != m_pendingFrames.cend(); ++it) {
+        const PendingFrame &frame = it.value();
+        const qint64 playoutAt = static_cast<qint64>(frame.timestamp) + m_clockOffsetMs + m_playoutDelayMs;
+        if (playoutAt > now) {
+            break;
+        }
+        if (frame.received == frame.fragments.size()) {
+            dueFrameId = it.key();
+        }
+    }
+
+    if (dueFrameId < 0) {
+        // 没有可播放的帧时，队首长时间收不齐的帧视为丢失；只从队首连续丢弃，
+        // 播放位置不会越过仍在等待分片的更早的帧
+        while (!m_pendingFrames.isEmpty()
+               && now - m_pendingFrames.first().firstArrivalMs > INCOMPLETE_TIMEOUT_MS) {
+            dropPendingFront();
+        }
+        return;
+    }
+
+    auto due = m_pendingFrames.find(static_cast<quint32>(dueFrameId));
+    QByteArray encoded;
+    for (const QByteArray &fragment : std::as_const(due.value().fragments)) {
+        encoded.append(fragment);
+    }
+
+    // 播放该帧，之前的帧（未收齐的）随之丢弃
+    m_pendingFrames.erase(m_pendingFrames.begin(), std::next(due));
+    m_lastPlayedFrameId = dueFrameId;
+
+    QImage image;
+    if (image.loadFromData(encoded, "JPG")) {
+        emit remoteFrameReady(image);
+    }
+}
+
+void VideoStream::sendReports()
+{
+    if (!m_running || !m_channel->hasPeer()) {
+        return;
+    }
+
+    const qint64 now = m_clock.elapsed();
+
+    // 发送端报告: senderTime(4) packetsSent(4)
+    QByteArray sr(8, Qt::Uninitialized);
+    uchar *srData = reinterpret_cast<uchar *>(sr.data());
+    qToBigEndian<quint32>(static_cast<quint32>(now), srData);
+    qToBigEndian<quint32>(m_sentPackets, srData + 4);
+    m_channel->sendPacket(MediaChannel::SenderReport, sr);
+
+    // 接收端报告: lossFraction(1, x/255) highestSeq(4) jitter(4) lsr(4) dlsr(4) hasLsr(1)
+    const bool newSr = m_srSinceLastReport;
+    m_srSinceLastReport = false;
+
+    quint8 lossFraction = 0;
+    qint64 receivedInterval = 0;
+    if (m_hasSeq) {
+        const quint32 expected = m_maxSeq - m_baseSeq + 1;
+        const qint64 expectedInterval = static_cast<qint64>(expected) - m_expectedPrior;
+        receivedInterval = static_cast<qint64>(m_receivedPackets) - m_receivedPrior;
+        const qint64 lostInterval = expectedInterval - receivedInterval;
+        m_expectedPrior = expected;
+        m_receivedPrior = m_receivedPackets;
+
+        if (expectedInterval > 0 && lostInterval > 0) {
+            lossFraction = static_cast<quint8>(qMin<qint64>(255, lostInterval * 255 / expectedInterval));
+        }
+    }
+    if (receivedInterval == 0) {
+        if (newSr) {
+            // 对端仍在发送但本周期一个分片都没收到；对端报告没有新发送的分片时是主动停发，不算丢包
+            if (m_lastSrPacketsSent > m_srPacketsSentPrior) {
+                lossFraction = 255;
+            }
+        } else if (m_hasSeq || m_hasSr) {
+            // 分片和发送端报告都没收到：链路中断
+            lossFraction = 255;
+        }
+    }
+    m_srPacketsSentPrior = m_lastSrPacketsSent;
+
+    QByteArray rr(18, Qt::Uninitialized);
+    uchar *rrData = reinterpret_cast<uchar *>(rr.data());
+    rrData[0] = lossFraction;
+    qToBigEndian<quint32>(m_maxSeq, rrData + 1);
+    qToBigEndian<quint32>(static_cast<quint32>(m_jitter), rrData + 5);
+    // 只回显上次报告之后新收到的发送端报告，旧报告算出的 RTT 会把报告丢失的时间也算进去
+    qToBigEndian<quint32>(newSr ? m_lastSrTimestamp : 0, rrData + 9);
+    qToBigEndian<quint32>(newSr ? static_cast<quint32>(now - m_lastSrArrivalMs) : 0, rrData + 13);
+    rrData[17] = newSr ? 1 : 0;
+    m_channel->sendPacket(MediaChannel::ReceiverReport, rr);
+}
+
+void VideoStream::handleSenderReport(const QByteArray &payload)
+{
+    if (payload.size() < 8) {
+        return;
+    }
+    const uchar *data = reinterpret_cast<const uchar *>(payload.constData());
+    m_lastSrTimestamp = qFromBigEndian<quint32>(data);
+    m_lastSrPacketsSent = qFromBigEndian<quint32>(data + 4);
+    m_lastSrArrivalMs = m_clock.elapsed();
+    m_hasSr = true;
+    m_srSinceLastReport = true;
+}
+
+void VideoStream::handleReceiverReport(const QByteArray &payload)
+{
+    if (payload.size() < 18) {
+        return;
+    }
+    const uchar *data = reinterpret_cast<const uchar *>(payload.constData());
+    const double lossFraction = data[0] / 255.0;
+    const int jitterMs = static_cast<int>(qFromBigEndian<quint32>(data + 5));
+    const quint32 lsr = qFromBigEndian<quint32>(data + 9);
+    const quint32 dlsr = qFromBigEndian<quint32>(data + 13);
+    const bool hasLsr = data[17] != 0;
+
+    // RTT = 现在 - 回显的发送时间 - 对端持有报告的时长，lsr 使用本端时钟
+    int rttMs = -1;
+    if (hasLsr) {
+        const qint64 rtt = m_clock.elapsed() - static_cast<qint64>(lsr) - static_cast<qint64>(dlsr);
+        rttMs = static_cast<int>(qMax<qint64>(0, rtt));
+    }
+
+    emit receiverReportReceived(lossFraction, rttMs, jitterMs);
+}
+
+QVideoFrame VideoStream::imageToVideoFrame(const QImage &image)
+{
+    const QImage rgba = image.convertToFormat(QImage::Format_RGBA8888);
+    QVideoFrame frame(QVideoFrameFormat(rgba.size(), QVideoFrameFormat::Format_RGBA8888));
+    if (!frame.map(QVideoFrame::WriteOnly)) {
+        return QVideoFrame();
+    }
+
+    const int rowBytes = rgba.width() * 4;
+    for (int y = 0; y < rgba.height(); ++y) {
+        std::memcpy(frame.bits(0) + y * frame.bytesPerLine(0), rgba.constScanLine(y), rowBytes);
+    }
+    frame.unmap();
+    return frame;
+}
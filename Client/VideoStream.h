@@ -0,0 +1,110 @@
+#ifndef VIDEOSTREAM_H
+#define VIDEOSTREAM_H
+
+#include <QObject>
+#include <QImage>
+#include <QMap>
+#include <QVector>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QVideoFrame>
+#include "MediaChannel.h"
+
+// 视频通话的媒体流：发送端在后台线程把摄像头帧缩放后编码为 JPEG（MJPEG），回到本线程拆分成 UDP 分片发送；
+// 接收端重组分片，经抖动缓冲按发送时间戳匀速播放，解码后交给界面渲染
+// 双方每秒互发类 RTCP 的收发报告，发送端据此得到丢包率、RTT 和抖动，供拥塞控制调整画质
+class VideoStream : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit VideoStream(MediaChannel *channel, QObject *parent = nullptr);
+    ~VideoStream();
+
+    void start();
+    void stop();
+
+    // 发送参数
+    void setTargetSize(const QSize &size) { m_targetSize = size; }
+    void setFrameRate(int fps) { m_frameIntervalMs = fps > 0 ? 1000 / fps : 66; }
+    void setJpegQuality(int quality) { m_jpegQuality = qBound(10, quality, 95); }
+    void setPlayoutDelay(int ms) { m_playoutDelayMs = ms; }
+
+    static QVideoFrame imageToVideoFrame(const QImage &image);
+
+public slots:
+    void sendFrame(const QVideoFrame &frame);
+
+signals:
+    void remoteFrameReady(const QImage &image);
+    void receiverReportReceived(double lossFraction, int rttMs, int jitterMs); // 对端对本端发送流的统计
+
+private slots:
+    void onFrameEncoded(const QByteArray &encoded, qint64 captureMs);
+    void onPacketReceived(quint8 type, const QByteArray &payload);
+    void playout();
+    void sendReports();
+
+private:
+    struct PendingFrame {
+        quint32 timestamp = 0;   // 发送端时间戳（毫秒）
+        QVector<QByteArray> fragments;
+        int received = 0;
+        qint64 firstArrivalMs = 0;
+    };
+
+    static const int MAX_FRAGMENT_PAYLOAD = 1100; // 留出 IP/UDP 头余量，避免 IP 分片
+    static const int FRAGMENT_HEADER_SIZE = 16;
+    static const int REPORT_INTERVAL_MS = 1000;
+    static const int MAX_PENDING_FRAMES = 30;
+    static const int INCOMPLETE_TIMEOUT_MS = 500;
+
+    void handleFragment(const QByteArray &payload);
+    void handleSenderReport(const QByteArray &payload);
+    void handleReceiverReport(const QByteArray &payload);
+    void dropPendingFront(); // 丢弃最旧的待播帧，播放位置随之前移
+
+    MediaChannel *m_channel;
+    QElapsedTimer m_clock;
+    bool m_running = false;
+
+    // 发送端
+    QSize m_targetSize = QSize(640, 360);
+    int m_frameIntervalMs = 66; // 约 15fps
+    int m_jpegQuality = 60;
+    qint64 m_lastSentMs = -1;
+    quint32 m_nextFrameId = 0;
+    quint32 m_nextSeq = 0;       // 分片序号，用于接收端统计丢包
+    quint32 m_sentPackets = 0;
+    QTimer *m_reportTimer;
+    QThreadPool m_encodePool;    // 单线程按顺序编码，不占用界面线程
+    bool m_encoding = false;     // 上一帧还在编码时新到的摄像头帧直接跳过，不积压
+
+    // 接收端抖动缓冲
+    QMap<quint32, PendingFrame> m_pendingFrames; // 按帧号排序
+    qint64 m_clockOffsetMs = 0;   // 本地时间 - 发送端时间戳，取观察到的最小值
+    bool m_hasClockOffset = false;
+    int m_playoutDelayMs = 100;
+    qint64 m_lastPlayedFrameId = -1;
+    QTimer *m_playoutTimer;
+
+    // 接收统计（参照 RTCP 接收报告）
+    bool m_hasSeq = false;
+    quint32 m_baseSeq = 0;
+    quint32 m_maxSeq = 0;
+    quint32 m_receivedPackets = 0;
+    quint32 m_expectedPrior = 0;
+    quint32 m_receivedPrior = 0;
+    double m_jitter = 0.0;          // 到达间隔抖动估计（毫秒）
+    qint64 m_lastTransit = 0;
+    bool m_hasTransit = false;
+    quint32 m_lastSrTimestamp = 0;  // 最近一次发送端报告中的发送时间（对端时钟）
+    qint64 m_lastSrArrivalMs = 0;
+    bool m_hasSr = false;
+    bool m_srSinceLastReport = false; // 上次发出接收端报告之后是否收到过新的发送端报告
+    quint32 m_lastSrPacketsSent = 0;
+    quint32 m_srPacketsSentPrior = 0;
+};
+
+#endif // VIDEOSTREAM_H
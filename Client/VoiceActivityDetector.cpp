@@ -0,0 +1,89 @@
+#include "VoiceActivityDetector.h"
+#include <cmath>
+
+// 判定阈值（dB），噪声底按 dBFS 计
+static const double SPEECH_MARGIN_DB = 10.0;    // 浊音：高于噪声底 10dB
+static const double FRICATIVE_MARGIN_DB = 5.0;  // 清辅音：高于噪声底 5dB 且过零率高
+static const double FRICATIVE_ZCR = 0.25;
+static const double MIN_SPEECH_DB = -50.0;      // 绝对下限，安静环境中的底噪不会被当作语音
+static const double SILENCE_DB = -90.0;
+static const int CALIBRATION_FRAMES = 5;        // 前 100ms 用最小能量初始化噪声底
+
+VoiceActivityDetector::VoiceActivityDetector()
+{
+    reset();
+}
+
+void VoiceActivityDetector::reset()
+{
+    m_noiseFloorDb = SILENCE_DB;
+    m_framesSeen = 0;
+    resetSpeechState();
+}
+
+void VoiceActivityDetector::resetSpeechState()
+{
+    m_lastEnergyDb = SILENCE_DB;
+    m_speechRun = 0;
+    m_hangover = 0;
+    m_speaking = false;
+}
+
+bool VoiceActivityDetector::isCalibrated() const
+{
+    return m_framesSeen >= CALIBRATION_FRAMES;
+}
+
+bool VoiceActivityDetector::processFrame(const qint16 *samples, int sampleCount)
+{
+    if (sampleCount <= 0) {
+        return m_speaking;
+    }
+
+    double sumSquares = 0.0;
+    int zeroCrossings = 0;
+    for (int i = 0; i < sampleCount; ++i) {
+        const double s = samples[i];
+        sumSquares += s * s;
+        if (i > 0 && ((samples[i - 1] >= 0) != (samples[i] >= 0))) {
+            zeroCrossings++;
+        }
+    }
+
+    const double rms = std::sqrt(sumSquares / sampleCount) / 32768.0;
+    const double energyDb = rms > 0.0 ? qMax(20.0 * std::log10(rms), SILENCE_DB) : SILENCE_DB;
+    const double zcr = static_cast<double>(zeroCrossings) / sampleCount;
+    m_lastEnergyDb = energyDb;
+
+    // 校准阶段：第一次录音的前几帧通常还没开口，取最小能量作为初始噪声底；
+    // 这些帧不参与语音判定，之后的录音沿用已学到的噪声底，不再校准
+    if (m_framesSeen < CALIBRATION_FRAMES) {
+        m_noiseFloorDb = (m_framesSeen == 0) ? energyDb : qMin(m_noiseFloorDb, energyDb);
+        m_framesSeen++;
+        return false;
+    }
+
+    const bool voiced = energyDb > m_noiseFloorDb + SPEECH_MARGIN_DB;
+    const bool fricative = energyDb > m_noiseFloorDb + FRICATIVE_MARGIN_DB && zcr > FRICATIVE_ZCR;
+    const bool speechFrame = energyDb > MIN_SPEECH_DB && (voiced || fricative);
+
+    if (speechFrame) {
+        m_speechRun++;
+        // 已在语音段内时任一语音帧都会延长拖尾
+        if (m_speaking || m_speechRun >= ONSET_FRAMES) {
+            m_speaking = true;
+            m_hangover = HANGOVER_FRAMES;
+        }
+    } else {
+        m_speechRun = 0;
+        // 噪声底只在非语音帧上更新：下降快、上升慢，跟随病房里逐渐变化的环境噪声
+        const double rate = energyDb < m_noiseFloorDb ? 0.3 : 0.02;
+        m_noiseFloorDb += (energyDb - m_noiseFloorDb) * rate;
+
+        if (m_speaking && --m_hangover <= 0) {
+            m_speaking = false;
+        }
+    }
+
+    return m_speaking;
+}
@@ -0,0 +1,43 @@
+#ifndef VOICEACTIVITYDETECTOR_H
+#define VOICEACTIVITYDETECTOR_H
+
+#include <QtGlobal>
+
+/**
+ * 基于短时能量和过零率的语音活动检测
+ * 按 20ms 帧判断是否有人说话：能量明显高于自适应噪声底即为语音，
+ * 能量略高但过零率高的帧按清辅音（s、sh、x 等）处理；
+ * 连续若干帧语音才算开始，语音结束后保持一段拖尾，避免切掉字尾
+ */
+class VoiceActivityDetector
+{
+public:
+    VoiceActivityDetector();
+
+    // 清除全部状态，下一帧起重新校准噪声底
+    void reset();
+    // 开始新一段录音：保留已学到的噪声底，只清除语音段状态。
+    // 按下按钮就开口时前 100ms 已是语音，每次都重新校准会把说话声当成噪声底
+    void resetSpeechState();
+    bool isCalibrated() const;
+
+    // 输入一帧 16 位单声道 PCM，返回当前是否处于语音段
+    bool processFrame(const qint16 *samples, int sampleCount);
+
+    bool isSpeaking() const { return m_speaking; }
+    double noiseFloorDb() const { return m_noiseFloorDb; }
+    double lastEnergyDb() const { return m_lastEnergyDb; }
+
+private:
+    static const int ONSET_FRAMES = 3;      // 连续 60ms 语音才进入语音段，过滤咳嗽、碰撞等短促噪声
+    static const int HANGOVER_FRAMES = 15;  // 语音结束后保持 300ms
+
+    double m_noiseFloorDb;
+    double m_lastEnergyDb;
+    int m_framesSeen;
+    int m_speechRun;
+    int m_hangover;
+    bool m_speaking;
+};
+
+#endif // VOICEACTIVITYDETECTOR_H
@@ -7,14 +7,34 @@ TEMPLATE = app
 INCLUDEPATH += $$PWD  # 添加当前目录到头文件搜索路径
 
 SOURCES += \
+    AttachmentTransfer.cpp \
+    AvatarService.cpp \
+    ChatBubbleDelegate.cpp \
+    ChatHistoryStore.cpp \
+    ChatMessageModel.cpp \
+    PayloadCodec.cpp \
+    SimpleVoiceRecognition.cpp \
     SocketThread.cpp \
+    SpeechWorker.cpp \
+    ThumbnailLoader.cpp \
+    VoiceActivityDetector.cpp \
     chatwindow.cpp \
     loginwindow.cpp \
     main.cpp \
     personalinfomanage.cpp
 
 HEADERS += \
+    AttachmentTransfer.h \
+    AvatarService.h \
+    ChatBubbleDelegate.h \
+    ChatHistoryStore.h \
+    ChatMessageModel.h \
+    PayloadCodec.h \
+    SimpleVoiceRecognition.h \
     SocketThread.h \
+    SpeechWorker.h \
+    ThumbnailLoader.h \
+    VoiceActivityDetector.h \
     chatwindow.h \
     loginwindow.h \
     personalinfomanage.h
@@ -4,6 +4,7 @@
 #include <QPixmap>
 #include <QTextBrowser>
 #include <QFile>
+#include <QFileInfo>
 #include <QDataStream>
 #include <QTcpSocket>
 #include <QSqlQuery>
@@ -17,7 +18,23 @@
 #include <QTextDocument>
 #include <QTextCharFormat>
 #include <QTextImageFormat>
+#include <QScrollBar>
+#include <QApplication>
 #include "SocketThread.h"
+#include "AvatarService.h"
+#include "PayloadCodec.h"
+
+// 文件大小的显示文本
+static QString formatFileSize(qint64 bytes)
+{
+    if (bytes >= 1024 * 1024) {
+        return QString::number(bytes / (1024.0 * 1024.0), 'f', 1) + " MB";
+    }
+    if (bytes >= 1024) {
+        return QString::number(bytes / 1024.0, 'f', 1) + " KB";
+    }
+    return QString::number(bytes) + " B";
+}
 
 chatwindow::chatwindow(QWidget *parent)
     : QMainWindow(parent)
@@ -25,6 +42,34 @@ chatwindow::chatwindow(QWidget *parent)
 {
     ui->setupUi(this);
 
+    // 消息列表：模型 + 委托，只绘制可见行
+    m_messageModel = new ChatMessageModel(this);
+    m_bubbleDelegate = new ChatBubbleDelegate(this);
+    ui->ui_mag->setModel(m_messageModel);
+    ui->ui_mag->setItemDelegate(m_bubbleDelegate);
+    connect(m_bubbleDelegate, &ChatBubbleDelegate::repaintNeeded, ui->ui_mag->viewport(), QOverload<>::of(&QWidget::update));
+    ui->ui_mag->setSelectionMode(QAbstractItemView::NoSelection);
+    ui->ui_mag->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    ui->ui_mag->setVerticalScrollMode(QAbstractItemView::ScrollPerPixel);
+    ui->ui_mag->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    ui->ui_mag->setResizeMode(QListView::Adjust);       // 宽度变化后按新宽度重新排版
+    ui->ui_mag->setLayoutMode(QListView::Batched);      // 大量历史消息分批计算行高，不阻塞界面
+    ui->ui_mag->setBatchSize(200);
+
+    // 头像统一按用户ID缓存；头像更新（如保存了新头像）后刷新联系人列表
+    connect(AvatarService::instance(), &AvatarService::avatarChanged, this, [this](const QString &userId) {
+        QLabel *label = m_contactAvatarLabels.value(m_contactNames.value(userId));
+        if (label) {
+            label->setPixmap(AvatarService::instance()->avatar(userId, 30));
+        }
+    });
+    // 本地没有头像的用户向服务器查询资料，按其中的头像哈希拉取头像
+    connect(AvatarService::instance(), &AvatarService::avatarNeeded, this, [this](const QString &userId) {
+        if (!userId.isEmpty()) {
+            emit sendMsgSignal(QString("USERINFO#%1\n").arg(userId));
+        }
+    });
+
     // 禁用按钮
     ui->btn1->setEnabled(false);
     ui->sendPhotoButton->setEnabled(false);
@@ -43,6 +88,12 @@ chatwindow::chatwindow(QWidget *parent)
     emit startConnect(port, ip);
     connect(worker, &SocketThread::connectOK, this, [=](){
         qDebug()<<"connection";
+        // 聊天连接独占一条 TCP 连接，启用传输压缩；较大的聊天记录同步响应以压缩帧返回
+        emit sendMsgSignal("SET_COMPRESSION#zlib\n");
+        // 聊天记录同步握手：先确认服务器 epoch，本地游标失效时清空后重新同步
+        emit sendMsgSignal("CHAT_EPOCH\n");
+        // 语音识别词表（药品名、科室名），携带本地版本，未变化时服务器不重复下发
+        emit sendMsgSignal(SimpleVoiceRecognition::vocabularyRequest() + "\n");
     });
     connect(worker, &SocketThread::gameOver, this, [=](){
         sub->quit();
@@ -51,6 +102,8 @@ chatwindow::chatwindow(QWidget *parent)
         sub->deleteLater();  // 线程对象析构
     });
     sub->start();   // 启动子线程
+    // 文件传输使用单独的连接，大文件不阻塞聊天消息
+    setupAttachmentTransfer(ip, port);
     // 选择联系人
     connect(ui->chatList, &QListWidget::itemClicked, this, &chatwindow::onContactClicked);
     // 发送图片
@@ -59,14 +112,31 @@ chatwindow::chatwindow(QWidget *parent)
     connect(ui->sendFileButton, &QPushButton::clicked, this, &chatwindow::sendFileButton_clicked);
     // 接收文件
     connect(ui->receiveFileButton, &QPushButton::clicked, this, &chatwindow::receiveFileButton_clicked);
-    // 语音识别
-    // connect(ui->voiceInputButton, &QPushButton::pressed, this, &chatwindow::startRecording);
-    // connect(ui->voiceInputButton, &QPushButton::released, this, &chatwindow::stopRecording);
+    // 语音识别：按住说话，中间结果实时显示在输入框，松开后替换为最终结果；
+    // 按住 Ctrl 再按按钮为指令模式，只识别"发送""取消"等固定指令
+    m_voiceRecognition = new SimpleVoiceRecognition(this);
+    ui->voiceInputButton->setToolTip("按住说话，松开识别；按住 Ctrl 说语音指令（发送、取消）");
+    connect(ui->voiceInputButton, &QPushButton::pressed, this, [this]() {
+        m_dictationPrefix = ui->idt->toPlainText();
+        m_voiceRecognition->setCommandMode(QApplication::keyboardModifiers().testFlag(Qt::ControlModifier));
+        m_voiceRecognition->startRecording();
+        // 顺带检查词表是否有更新（药品、科室变化后服务器版本随之变化）
+        emit sendMsgSignal(SimpleVoiceRecognition::vocabularyRequest() + "\n");
+    });
+    connect(ui->voiceInputButton, &QPushButton::released, m_voiceRecognition, &SimpleVoiceRecognition::stopRecording);
+    connect(m_voiceRecognition, &SimpleVoiceRecognition::partialResult, this, &chatwindow::showDictationText);
+    connect(m_voiceRecognition, &SimpleVoiceRecognition::recognitionResult, this, &chatwindow::showDictationText);
+    connect(m_voiceRecognition, &SimpleVoiceRecognition::commandRecognized, this, &chatwindow::onVoiceCommand);
+    connect(m_voiceRecognition, &SimpleVoiceRecognition::recognitionError, this, [this](const QString &error) {
+        ui->statusBar->showMessage(error, 3000);
+    });
     // connect(worker, &SocketThread::messageReceived, this, &chatwindow::readyRead_slot);
+    connect(worker, &SocketThread::messageReceived, this, &chatwindow::onServerMessage);
 
 }
 
 chatwindow::~chatwindow() {
+    delete m_historyStore;
     delete ui;
 }
 
@@ -77,8 +147,20 @@ void chatwindow::setCurrentUsername(const QString &username) {
 
 // 初始化联系人列表
 void chatwindow::initializeContactList(const QString &id) {
-    QString contactRequest = QString("CONTACTLIST#%1").arg(id);
-    emit sendMsgSignal(contactRequest.toUtf8());  // 通过信号发送给工作线程
+    // 打开当前用户的本地聊天记录
+    if (!m_historyStore || m_currentUserId != id) {
+        delete m_historyStore;
+        m_historyStore = new ChatHistoryStore(id);
+        m_currentUserId = id;
+        if (!m_serverEpoch.isEmpty()) {
+            m_historyStore->applyServerEpoch(m_serverEpoch);
+        }
+    }
+
+    // 联系人的服务器用户ID随联系人列表返回，登记后才能同步聊天记录
+    emit sendMsgSignal(QString("GET_CONTACT_LIST#%1\n").arg(id));
+    // 拉取尚未接收的文件
+    emit sendMsgSignal(QString("ATTACH_LIST#%1\n").arg(id));
 
 
     QSqlQuery query("SELECT username, avatar_path FROM usernames");
@@ -91,38 +173,8 @@ void chatwindow::initializeContactList(const QString &id) {
         if (username == currentusername) {
             continue;
         }
-
-        // 创建一个新的 QWidget 作为项
-        QWidget *widget = new QWidget();
-        QHBoxLayout *layout = new QHBoxLayout(widget);
-        layout->setContentsMargins(10, 10, 10, 10);
-        layout->setSpacing(10);
-
-        // 创建 QLabel 显示头像
-        QLabel *avatarLabel = new QLabel();
-        avatarLabel->setFixedSize(30, 30);
-        avatarLabel->setStyleSheet(QString("border-image: url(%1); border-radius: 3px;").arg(avatarPath));
-        layout->addWidget(avatarLabel);
-
-        // 创建 QLabel 显示用户名，并设置对象名称
-        QLabel *usernameLabel = new QLabel(username);
-        usernameLabel->setObjectName("usernameLabel");  // 设置对象名称
-        QFont font = usernameLabel->font();
-        font.setPointSize(18);
-        usernameLabel->setFont(font);
-        usernameLabel->setStyleSheet("color: black; background-color: rgba(0,0,0,0)");
-        layout->addWidget(usernameLabel);
-
-        // 将 QWidget 设置为 QListWidgetItem 的项
-        QListWidgetItem *item = new QListWidgetItem();
-        item->setSizeHint(widget->sizeHint());
-        ui->chatList->addItem(item);
-        ui->chatList->setItemWidget(item, widget);
-
-        widget->setStyleSheet(
-            "QWidget::hover { background-color: #c4c4c4; }"   // 鼠标悬停时的背景色
-            "QWidget::selected { background-color: #c4c4c4; }" // 项目被选中时的背景色
-            );
+        m_avatarPaths.insert(username, avatarPath);
+        addContactItem(username);
     }
 
     if (query.lastError().isValid()) {
@@ -132,6 +184,50 @@ void chatwindow::initializeContactList(const QString &id) {
     }
 }
 
+// 在联系人列表中添加一行，头像在登记用户ID后由 AvatarService 提供
+void chatwindow::addContactItem(const QString &username)
+{
+    if (m_contactAvatarLabels.contains(username)) {
+        return;
+    }
+
+    // 创建一个新的 QWidget 作为项
+    QWidget *widget = new QWidget();
+    QHBoxLayout *layout = new QHBoxLayout(widget);
+    layout->setContentsMargins(10, 10, 10, 10);
+    layout->setSpacing(10);
+
+    // 创建 QLabel 显示头像，尚未登记ID的联系人先显示默认头像
+    QString userId = m_contactIds.value(username);
+    if (!userId.isEmpty()) {
+        registerAvatarSource(userId, username);
+    }
+    QLabel *avatarLabel = new QLabel();
+    avatarLabel->setFixedSize(30, 30);
+    avatarLabel->setPixmap(AvatarService::instance()->avatar(userId, 30));
+    layout->addWidget(avatarLabel);
+    m_contactAvatarLabels.insert(username, avatarLabel);
+
+    // 创建 QLabel 显示用户名，并设置对象名称
+    QLabel *usernameLabel = new QLabel(username);
+    usernameLabel->setObjectName("usernameLabel");  // 设置对象名称
+    QFont font = usernameLabel->font();
+    font.setPointSize(18);
+    usernameLabel->setFont(font);
+    usernameLabel->setStyleSheet("color: black; background-color: rgba(0,0,0,0)");
+    layout->addWidget(usernameLabel);
+
+    // 将 QWidget 设置为 QListWidgetItem 的项
+    QListWidgetItem *item = new QListWidgetItem();
+    item->setSizeHint(widget->sizeHint());
+    ui->chatList->addItem(item);
+    ui->chatList->setItemWidget(item, widget);
+
+    widget->setStyleSheet(
+        "QWidget::hover { background-color: #c4c4c4; }"   // 鼠标悬停时的背景色
+        "QWidget::selected { background-color: #c4c4c4; }" // 项目被选中时的背景色
+        );
+}
 
 //点击联系人
 void chatwindow::onContactClicked(QListWidgetItem *item) {
@@ -161,78 +257,222 @@ void chatwindow::onContactClicked(QListWidgetItem *item) {
     ui->chatWindowTitleLabel->setText(username);
 
     // 清空当前聊天记录
-    ui->ui_mag->clear();
-    loadChatHistory(currentusername, username);
+    m_messageModel->clear();
+    loadChatHistory(username);
 
     // 若有未接收文件则显示
-    QSqlQuery query;
-    QString received;
-    QString sender;
-
-    query.prepare("SELECT received, username FROM files WHERE received = '0' AND username = :username");
-    query.bindValue(":username", username);
-
-    if (query.exec() && query.next()) {
-        received = query.value(0).toString();
-        sender = query.value(1).toString();
-
-        if (received == "0") {
-            QListWidgetItem *item = new QListWidgetItem();
-            QWidget *fileBubble = createFileBubble(sender + "向你发来了新文件");
-            item->setSizeHint(fileBubble->sizeHint());
-            ui->ui_mag->addItem(item);
-            ui->ui_mag->setItemWidget(item, fileBubble);
+    QString peerId = m_contactIds.value(username);
+    for (const PendingAttachment &attachment : m_pendingAttachments) {
+        if (attachment.senderId == peerId) {
+            showAttachmentNotice(attachment);
         }
-    } else {
-        qDebug() << "Error retrieving file data from database:" << query.lastError().text();
     }
 }
 
-//存储聊天记录
-void chatwindow::saveMessageToHistory(const QString &sender, const QString &receiver, const QString &content, const QString &contentType) {
-    QSqlQuery query;
-    query.prepare("INSERT INTO chat_history (sender, receiver, content, contentType) VALUES (?, ?, ?, ?)");
-    query.addBindValue(sender);
-    query.addBindValue(receiver);
-    query.addBindValue(content);
-    query.addBindValue(contentType);
-    query.exec();
+void chatwindow::setContactId(const QString &username, const QString &userId)
+{
+    m_contactIds.insert(username, userId);
+    m_contactNames.insert(userId, username);
+
+    registerAvatarSource(userId, username);
+    QLabel *label = m_contactAvatarLabels.value(username);
+    if (label) {
+        label->setPixmap(AvatarService::instance()->avatar(userId, 30));
+    }
 }
 
-//加载聊天记录
-void chatwindow::loadChatHistory(const QString &username1, const QString &username2) {
-    QSqlQuery query;
-    query.prepare("SELECT sender, receiver, content, contentType FROM chat_history "
-                  "WHERE (sender = ? AND receiver = ?) OR (sender = ? AND receiver = ?)");
-    query.addBindValue(username1);
-    query.addBindValue(username2);
-    query.addBindValue(username2);
-    query.addBindValue(username1);
-    query.exec();
-    QString username = ui->chatWindowTitleLabel->text();
-    while (query.next()) {
-        QString sender = query.value(0).toString();
-        QString receiver = query.value(1).toString();
-        QString content = query.value(2).toString();
-        QString contentType = query.value(3).toString();
-        bool isSelf = (currentusername == sender);
-        // 使用createMessageBubble或createImageBubble函数来显示消息
-        if (contentType == "0") {
-            if ((currentusername == sender && username == receiver) || (username == sender && currentusername == receiver)) {
-                QListWidgetItem *item = new QListWidgetItem();
-                QWidget *messageBubble = createMessageBubble(sender, content, isSelf);
-                item->setSizeHint(messageBubble->sizeHint());
-                ui->ui_mag->addItem(item);
-                ui->ui_mag->setItemWidget(item, messageBubble);
-            }
-        } else if (contentType == "1") {
-            if ((username == sender && currentusername == receiver) || (currentusername == sender && username == receiver)) {
-                QListWidgetItem *item = new QListWidgetItem();
-                QWidget *imageBubble = createImageBubble(sender, content, isSelf);
-                item->setSizeHint(imageBubble->sizeHint());
-                ui->ui_mag->addItem(item);
-                ui->ui_mag->setItemWidget(item, imageBubble);
+//加载聊天记录：先从本地存储渲染，再只向服务器拉取本地最后一条之后的新消息
+void chatwindow::loadChatHistory(const QString &username) {
+    QString peerId = m_contactIds.value(username);
+    if (!m_historyStore || peerId.isEmpty()) {
+        // 联系人列表返回、登记ID后再打开
+        qDebug() << "等待联系人ID后加载聊天记录:" << username;
+        m_pendingConversation = username;
+        return;
+    }
+    m_pendingConversation.clear();
+
+    appendStoredMessages(m_historyStore->loadConversation(peerId), false);
+    ui->ui_mag->scrollToBottom();
+
+    // 服务器 epoch 确认之前本地游标可能已失效，收到 CHAT_EPOCH 后再同步
+    if (!m_serverEpoch.isEmpty()) {
+        emit sendMsgSignal(QString::fromUtf8(m_historyStore->syncRequest(peerId)));
+    }
+}
+
+//把本地存储的消息转换后追加到当前会话，keepScroll 为 true 时已在底部才跟随滚动
+void chatwindow::appendStoredMessages(const QVector<StoredChatMessage> &messages, bool keepScroll)
+{
+    QString openPeerId = m_contactIds.value(ui->chatWindowTitleLabel->text());
+
+    // 先收集再一次性插入模型，视图只做一次布局
+    QVector<ChatMessage> converted;
+    converted.reserve(messages.size());
+    for (const StoredChatMessage &stored : messages) {
+        if (m_historyStore->peerOf(stored) != openPeerId) {
+            continue;
+        }
+        bool isSelf = (stored.senderId == m_currentUserId);
+        QString sender = isSelf ? currentusername : m_contactNames.value(stored.senderId, stored.senderId);
+
+        // 图片消息在服务器上的格式为 [IMAGE:文件名]
+        if (stored.content.startsWith("[IMAGE:") && stored.content.endsWith("]")) {
+            converted.append(makeMessage(ChatMessage::Image, sender, stored.content.mid(7, stored.content.size() - 8), isSelf));
+        } else {
+            converted.append(makeMessage(ChatMessage::Text, sender, stored.content, isSelf));
+        }
+    }
+    if (converted.isEmpty()) {
+        return;
+    }
+
+    QScrollBar *scrollBar = ui->ui_mag->verticalScrollBar();
+    bool atBottom = scrollBar->value() >= scrollBar->maximum();
+    m_messageModel->appendMessages(std::move(converted));
+    if (keepScroll && atBottom) {
+        ui->ui_mag->scrollToBottom();
+    }
+}
+
+//服务器数据：TCP 不保证一次读到的正好是一条消息，先缓存再按行切分，每一行单独分派
+void chatwindow::onServerMessage(QByteArray msg)
+{
+    msg = PayloadCodec::inflateFrames(m_inflateState, msg);
+    if (msg.isEmpty()) {
+        return; // 压缩帧尚未收完整
+    }
+
+    m_serverBuffer.append(msg);
+    int pos;
+    while ((pos = m_serverBuffer.indexOf('\n')) >= 0) {
+        QByteArray line = m_serverBuffer.left(pos);
+        m_serverBuffer.remove(0, pos + 1);
+        handleServerLine(line);
+    }
+}
+
+void chatwindow::handleServerLine(const QByteArray &line)
+{
+    if (line.startsWith("CHAT_EPOCH#")) {
+        m_serverEpoch = QString::fromUtf8(line.mid(line.indexOf('#') + 1)).trimmed();
+        if (m_historyStore && m_historyStore->applyServerEpoch(m_serverEpoch)) {
+            m_messageModel->clear();
+        }
+        // 握手完成前打开的会话在这里补做同步
+        QString openPeerId = m_contactIds.value(ui->chatWindowTitleLabel->text());
+        if (m_historyStore && !openPeerId.isEmpty()) {
+            emit sendMsgSignal(QString::fromUtf8(m_historyStore->syncRequest(openPeerId)));
+        }
+        return;
+    }
+    if (line.startsWith("GET_CONTACT_LIST_SUCCESS#")) {
+        // [{contact_id, username, name, last_message, last_time}]：登记联系人ID，本地列表中没有的联系人补上
+        const QJsonArray rows = QJsonDocument::fromJson(line.mid(line.indexOf('#') + 1)).array();
+        for (const QJsonValue &value : rows) {
+            QJsonObject row = value.toObject();
+            QString userId = row["contact_id"].toString();
+            QString username = row["username"].toString();
+            if (userId.isEmpty() || username.isEmpty()) {
+                continue;
             }
+            setContactId(username, userId);
+            addContactItem(username);
+        }
+        // 等待ID的会话仍在显示时打开
+        if (!m_pendingConversation.isEmpty() && m_pendingConversation == ui->chatWindowTitleLabel->text()) {
+            loadChatHistory(m_pendingConversation);
+        }
+        return;
+    }
+    if (line.startsWith("SPEECH_VOCABULARY_")) {
+        SimpleVoiceRecognition::handleVocabularyResponse(QString::fromUtf8(line));
+        return;
+    }
+    if (line.startsWith("USERINFO_SUCCESS#")) {
+        // avatarNeeded 发起的资料查询：按头像哈希拉取，多个用户共用同一头像时只拉取一次
+        QJsonObject user = QJsonDocument::fromJson(line.mid(line.indexOf('#') + 1)).object();
+        QString userId = user["id"].toString();
+        QString hash = user["avatar_hash"].toString();
+        if (userId.isEmpty() || hash.isEmpty()) {
+            return;  // 没有上传过头像，保持默认头像
+        }
+        QStringList &users = m_avatarFetches[hash];
+        if (users.isEmpty()) {
+            emit sendMsgSignal(QString("GET_AVATAR#%1\n").arg(hash));
+        }
+        if (!users.contains(userId)) {
+            users.append(userId);
+        }
+        return;
+    }
+    if (line.startsWith("GET_AVATAR_SUCCESS#") || line.startsWith("GET_AVATAR_FAIL#")) {
+        // GET_AVATAR_SUCCESS#哈希#尺寸#base64 / GET_AVATAR_FAIL#哈希#原因
+        const QList<QByteArray> parts = line.split('#');
+        const QStringList users = m_avatarFetches.take(QString::fromLatin1(parts.value(1)));
+        if (line.startsWith("GET_AVATAR_FAIL#")) {
+            qDebug() << "拉取头像失败:" << line;
+            return;
+        }
+        QByteArray imageData = QByteArray::fromBase64(parts.value(3));
+        for (const QString &userId : users) {
+            AvatarService::instance()->setAvatarData(userId, imageData);
+        }
+        return;
+    }
+    if (line.startsWith("ATTACH_LIST_SUCCESS#")) {
+        // 待接收文件列表：[{attachment_id, sender_id, file_name, size, ...}]
+        m_pendingAttachments.clear();
+        const QJsonArray rows = QJsonDocument::fromJson(line.mid(line.indexOf('#') + 1)).array();
+        for (const QJsonValue &value : rows) {
+            QJsonObject row = value.toObject();
+            PendingAttachment attachment;
+            attachment.attachmentId = row["attachment_id"].toVariant().toLongLong();
+            attachment.senderId = row["sender_id"].toString();
+            attachment.fileName = row["file_name"].toString();
+            attachment.size = row["size"].toVariant().toLongLong();
+            m_pendingAttachments.append(attachment);
+        }
+        return;
+    }
+    if (line.startsWith("NEW_ATTACHMENT#")) {
+        // NEW_ATTACHMENT#附件ID#发送者ID#字节数#文件名
+        QString text = QString::fromUtf8(line);
+        PendingAttachment attachment;
+        attachment.attachmentId = text.section('#', 1, 1).toLongLong();
+        attachment.senderId = text.section('#', 2, 2);
+        attachment.size = text.section('#', 3, 3).toLongLong();
+        attachment.fileName = text.section('#', 4);
+        m_pendingAttachments.append(attachment);
+        if (attachment.senderId == m_contactIds.value(ui->chatWindowTitleLabel->text())) {
+            showAttachmentNotice(attachment);
+        }
+        return;
+    }
+
+    if (line.startsWith("MESSAGE_NOT_SAVED#")) {
+        // MESSAGE_NOT_SAVED#消息ID#接收者ID：服务器已回执但多次写入失败而丢弃的消息
+        QString receiverId = QString::fromUtf8(line).section('#', 2, 2);
+        ui->statusBar->showMessage("发给 " + m_contactNames.value(receiverId, receiverId) + " 的一条消息未能保存，请重新发送");
+        return;
+    }
+
+    if (!m_historyStore) {
+        return;
+    }
+
+    if (line.startsWith("GET_CHAT_HISTORY_SUCCESS#") || line.startsWith("CHAT_HISTORY_DELTA#")) {
+        QByteArray json = line.mid(line.indexOf('#') + 1);
+        QVector<StoredChatMessage> inserted = m_historyStore->insertMessages(ChatHistoryStore::parseHistoryRows(json));
+        // 只有本地原先没有的消息才追加到界面
+        appendStoredMessages(inserted, true);
+        qDebug() << "聊天记录同步完成，新消息条数:" << inserted.size();
+    } else if (line.startsWith("NEW_MESSAGE#")) {
+        // NEW_MESSAGE#senderId#receiverId#content#time：正在查看该会话时增量拉取，消息带上服务器ID后再显示
+        QString senderId = QString::fromUtf8(line).section('#', 1, 1);
+        QString openPeerId = m_contactIds.value(ui->chatWindowTitleLabel->text());
+        if (!openPeerId.isEmpty() && senderId == openPeerId) {
+            emit sendMsgSignal(QString::fromUtf8(m_historyStore->syncRequest(openPeerId)));
         }
     }
 }
@@ -248,175 +488,68 @@ void chatwindow::readyRead_slot(QByteArray msg) {
     QString contentType = message.section('#', 0, 0);
     bool isSelf = (currentusername == sender);
     if(currentusername =="")return;
-    if(sender==currentusername)saveMessageToHistory(sender,receiver,content,contentType);
     //0是消息，1是图片，2是文件提示
     if (contentType == "0") {
         if ((currentusername == sender && username == receiver) || (username == sender && currentusername == receiver)) {
-            QListWidgetItem *item = new QListWidgetItem();
-            QWidget *messageBubble = createMessageBubble(sender, content, isSelf);
-            item->setSizeHint(messageBubble->sizeHint());
-            ui->ui_mag->addItem(item);
-            ui->ui_mag->setItemWidget(item, messageBubble);
+            appendMessage(makeMessage(ChatMessage::Text, sender, content, isSelf));
         }
     } else if (contentType == "1") {
         if ((username == sender && currentusername == receiver) || (currentusername == sender && username == receiver)) {
-            QListWidgetItem *item = new QListWidgetItem();
-            QWidget *imageBubble = createImageBubble(sender, content, isSelf);
-            item->setSizeHint(imageBubble->sizeHint());
-            ui->ui_mag->addItem(item);
-            ui->ui_mag->setItemWidget(item, imageBubble);
+            appendMessage(makeMessage(ChatMessage::Image, sender, content, isSelf));
         }
     } else if (contentType == "2") {
         if(receiver == currentusername)
         {
-            QListWidgetItem *item = new QListWidgetItem();
-            QWidget *fileBubble = createFileBubble(sender + content);
-            item->setSizeHint(fileBubble->sizeHint());
-            ui->ui_mag->addItem(item);
-            ui->ui_mag->setItemWidget(item, fileBubble);
+            appendMessage(makeMessage(ChatMessage::Notice, sender, sender + content, false));
         }
     }
 }
 
-//创建文字气泡
-QWidget* chatwindow::createMessageBubble(const QString &username, const QString &message, bool isSelf)
+//构造一条消息
+ChatMessage chatwindow::makeMessage(ChatMessage::Type type, const QString &sender, const QString &content, bool isSelf)
 {
-    QString avatarPath = getAvatarPathFromUsername(username);
-
-    QWidget *widget = new QWidget();
-    QHBoxLayout *layout = new QHBoxLayout(widget);
-    layout->setContentsMargins(10, 10, 10, 10);
-    layout->setSpacing(10);
-
-    // 设置头像
-    QLabel *avatarLabel = new QLabel();
-    avatarLabel->setFixedSize(40, 40); // 头像尺寸
-    avatarLabel->setStyleSheet(QString("border-image: url(%1); border-radius: 4px;").arg(avatarPath));
-    avatarLabel->setObjectName("avatarLabel");
-
-    // 设置消息区域
-    QWidget *messageWidget = new QWidget();
-    QVBoxLayout *messageLayout = new QVBoxLayout(messageWidget);
-    messageLayout->setContentsMargins(0, 0, 0, 0);
-    messageLayout->setSpacing(5);
-
-    //设置用户名
-    QLabel *usernameLabel = new QLabel(username);
-    usernameLabel->setObjectName("usernameLabel");
-    QFont font = usernameLabel->font();
-    font.setPointSize(8);
-    usernameLabel->setFont(font);
-    usernameLabel->setStyleSheet("color: black");
-    messageLayout->addWidget(usernameLabel);
-
-    //设置消息气泡
-    QLabel *messageLabel = new QLabel(message);
-    font.setPointSize(12);
-    messageLabel->setFont(font);
-    messageLabel->setWordWrap(true);
-    messageLabel->setStyleSheet(QString("background-color: %1; color: black; border-radius: 10px; padding: 10px;").arg(isSelf ? "#95ec69" : "white"));
-    messageLabel->setObjectName("messageLabel");
-    messageLayout->addWidget(messageLabel);
-
-    if (isSelf) {
-        // 如果是自己发的消息，头像显示在最右边
-        QHBoxLayout *rightLayout = new QHBoxLayout();
-        rightLayout->addStretch();
-        rightLayout->addWidget(messageWidget);
-        layout->addLayout(rightLayout);
-        layout->addWidget(avatarLabel);
-    } else {
-        // 如果是别人发的消息，头像显示在最左边
-        layout->addWidget(avatarLabel);
-        layout->addWidget(messageWidget);
-        layout->addStretch();
+    ChatMessage message;
+    message.type = type;
+    message.sender = sender;
+    message.content = content;
+    message.isSelf = isSelf;
+    // 未登记ID的发送者在 appendStoredMessages 中以用户ID作为名称
+    message.senderId = isSelf ? m_currentUserId : m_contactIds.value(sender, sender);
+    if (type != ChatMessage::Notice && !message.senderId.isEmpty()) {
+        registerAvatarSource(message.senderId, sender);
     }
-
-    widget->setLayout(layout);
-    return widget;
+    return message;
 }
 
-// 创建图像气泡
-QWidget* chatwindow::createImageBubble(const QString &username, const QString &imagePath, bool isSelf)
+//追加一条消息，已在底部时保持滚动到最新
+void chatwindow::appendMessage(const ChatMessage &message)
 {
-    QString avatarPath = getAvatarPathFromUsername(username);
-
-    QWidget *widget = new QWidget();
-    QHBoxLayout *layout = new QHBoxLayout(widget);
-    layout->setContentsMargins(10, 10, 10, 10);
-    layout->setSpacing(10);
-
-    // 设置头像
-    QLabel *avatarLabel = new QLabel();
-    avatarLabel->setFixedSize(40, 40); // 头像尺寸
-    avatarLabel->setStyleSheet(QString("border-image: url(%1); border-radius: 4px;").arg(avatarPath));
-    avatarLabel->setObjectName("avatarLabel");
-
-    // 设置用户名标签
-    QLabel *usernameLabel = new QLabel(username);
-    QFont font = usernameLabel->font();
-    font.setPointSize(8);
-    usernameLabel->setFont(font);
-    usernameLabel->setStyleSheet("color: black");
-
-    // 设置图片区域
-    QLabel *imageLabel = new QLabel();
-    QPixmap pixmap(imagePath);
-    imageLabel->setPixmap(pixmap.scaled(150, 150, Qt::KeepAspectRatio));
-    imageLabel->setStyleSheet("border-radius: 10px;");
-    imageLabel->setObjectName("imageLabel");
-
-    // 创建一个垂直布局，用于包含用户名和图片
-    QVBoxLayout *imageLayout = new QVBoxLayout();
-    imageLayout->setContentsMargins(0, 0, 0, 0);
-    imageLayout->setSpacing(5);
-    imageLayout->addWidget(usernameLabel);
-    imageLayout->addWidget(imageLabel);
-
-    // 将用户名和图片的垂直布局添加到主布局中
-    if (isSelf) {
-        // 如果是自己发的图片，头像显示在最右边
-        layout->addStretch();
-        layout->addLayout(imageLayout);
-        layout->addWidget(avatarLabel);
-    } else {
-        // 如果是别人发的图片，头像显示在最左边
-        layout->addWidget(avatarLabel);
-        layout->addLayout(imageLayout);
+    QScrollBar *scrollBar = ui->ui_mag->verticalScrollBar();
+    bool atBottom = scrollBar->value() >= scrollBar->maximum();
+    m_messageModel->appendMessage(message);
+    if (atBottom) {
+        ui->ui_mag->scrollToBottom();
     }
-
-    widget->setLayout(layout);
-    return widget;
 }
 
-//创建文件提示气泡
-QWidget* chatwindow::createFileBubble(const QString &content)
+// 登记用户的本地头像路径，头像由 AvatarService 按用户ID统一加载和绘制，每个用户名只查一次数据库；
+// 本地没有头像时不登记，AvatarService 先画默认头像并通过 avatarNeeded 向服务器拉取
+void chatwindow::registerAvatarSource(const QString &userId, const QString &username)
 {
-    QWidget *widget = new QWidget();
-    QHBoxLayout *layout = new QHBoxLayout(widget);
-    layout->setContentsMargins(10, 10, 10, 10);
-    layout->setAlignment(Qt::AlignCenter);  // 居中对齐
-
-    QLabel *fileLabel = new QLabel(content);
-    fileLabel->setStyleSheet("background-color: #dadada; color: #fdfdfd; border-radius: 10px; padding: 10px;");
-
-    layout->addWidget(fileLabel);
-    widget->setLayout(layout);
-
-    return widget;
-}
-
-// 获取头像路径的示例函数
-QString chatwindow::getAvatarPathFromUsername(const QString &username)
-{
-    // 根据用户名从数据库或其他数据源获取头像路径
-    QSqlQuery query;
-    query.prepare("SELECT avatar_path FROM usernames WHERE username = :username");
-    query.bindValue(":username", username);
-    if (query.exec() && query.next()) {
-        return ":/" + query.value(0).toString();  // 这里假设头像路径是相对路径
-    }
-    return ":/default_avatar.png";  // 默认头像路径
+    auto it = m_avatarPaths.constFind(username);
+    if (it == m_avatarPaths.constEnd()) {
+        QString avatarPath;
+        QSqlQuery query;
+        query.prepare("SELECT avatar_path FROM usernames WHERE username = :username");
+        query.bindValue(":username", username);
+        if (query.exec() && query.next()) {
+            avatarPath = ":/" + query.value(0).toString();  // 这里假设头像路径是相对路径
+        }
+        it = m_avatarPaths.insert(username, avatarPath);
+    }
+    if (!it.value().isEmpty()) {
+        AvatarService::instance()->setAvatarSource(userId, it.value());
+    }
 }
 
 //发送按钮对应的槽函数
@@ -450,87 +583,117 @@ void chatwindow::sendPhotoButton_clicked()
     }
 }
 
-//发送文件按钮
+//发送文件按钮：文件分块上传到服务器，服务器收齐并校验后通知对方
 void chatwindow::sendFileButton_clicked()
 {
     QString username = ui->chatWindowTitleLabel->text();
+    QString peerId = m_contactIds.value(username);
+    if (peerId.isEmpty() || m_currentUserId.isEmpty()) {
+        qDebug() << "未登记联系人ID，无法发送文件:" << username;
+        return;
+    }
+    if (m_attachmentTransfer->isBusy()) {
+        QMessageBox::information(this, "提示", "正在传输文件，请稍后再试");
+        return;
+    }
+
     QString filePath = QFileDialog::getOpenFileName(this, "选择文件", "", "Files (*.*)");
     qDebug() << "Sending file:" << filePath;
     // 检查是否选择了文件
     if (!filePath.isEmpty()) {
-        // 显示文件预览
-        QSqlQuery query;
-        // 删除表中的所有数据
-        if (!query.exec("DELETE FROM files")) {
-            qDebug() << "Error clearing table:" << query.lastError().text();
-        } else {
-            qDebug() << "Table data cleared successfully.";
-        }
-        //插入数据
-        query.prepare("INSERT INTO files (filepath, received, username) VALUES (:filepath, :received, :username)");
-        query.bindValue(":filepath", filePath);
-        query.bindValue(":received", "0");
-        query.bindValue(":username", currentusername);
-        if (!query.exec()) {
-            qDebug() << "Error inserting data:" << query.lastError().text();
-        } else {
-            qDebug() << "Inserted data for filepath:" << filePath;
-        }
-        QString sendMsg = "2#" + currentusername + "#向你发来了新文件#" +username;
-        //socket->write(sendMsg.toLocal8Bit());
-        emit sendMsgSignal(sendMsg);
+        m_attachmentTransfer->upload(m_currentUserId, peerId, filePath);
+        ui->statusBar->showMessage("正在准备发送 " + QFileInfo(filePath).fileName());
     }
 }
 
-//接收文件按钮
+//接收文件按钮：从服务器下载当前联系人发来的文件，之前中断的下载从断点继续
 void chatwindow::receiveFileButton_clicked() {
-    QSqlQuery query;
-    QString filePath;
-    // 查询文件路径
-    query.prepare("SELECT filepath FROM files");
-    if (query.exec() && query.next()) {
-        filePath = query.value(0).toString();
-    } else {
-        qDebug() << "Error retrieving file path from database:" << query.lastError().text();
+    if (m_attachmentTransfer->isBusy()) {
+        QMessageBox::information(this, "提示", "正在传输文件，请稍后再试");
+        return;
     }
 
-    if (filePath.isEmpty()) {
-        qDebug() << "File path is empty. Cannot receive file.";
+    // 取一份拷贝：保存对话框期间可能收到新文件通知而改动列表
+    QString peerId = m_contactIds.value(ui->chatWindowTitleLabel->text());
+    PendingAttachment attachment;
+    for (const PendingAttachment &pending : m_pendingAttachments) {
+        if (pending.senderId == peerId) {
+            attachment = pending;
+            break;
+        }
+    }
+    if (attachment.attachmentId == 0) {
+        qDebug() << "No pending file from" << peerId;
         return;
     }
-    //改为已接收
-    query.prepare("UPDATE files SET received = '1' WHERE filepath = :filepath");
-    query.bindValue(":filepath", filePath);
-    if (!query.exec()) {
-        qDebug() << "Error updating file status:" << query.lastError().text();
+
+    QString savePath = QFileDialog::getSaveFileName(this, "Save File As", attachment.fileName, "All Files (*.*)");
+    if (!savePath.isEmpty()) {
+        m_attachmentTransfer->download(m_currentUserId, attachment.attachmentId, savePath);
+        ui->statusBar->showMessage("正在接收 " + attachment.fileName);
     } else {
-        qDebug() << "File status updated successfully.";
+        qDebug() << "Save file operation was canceled.";
     }
-    qDebug()<<filePath;
-    QString savePath = QFileDialog::getSaveFileName(this, "Save File As", filePath, "All Files (*.*)");
-    if (!savePath.isEmpty()) {
-        QFile sourceFile(filePath); // 源文件路径
-        QFile destFile(savePath);   // 目标文件路径
-
-        // 打开源文件和目标文件
-        if (sourceFile.open(QIODevice::ReadOnly) && destFile.open(QIODevice::WriteOnly)) {
-            // 读取数据到缓冲区并写入目标文件
-            while (!sourceFile.atEnd()) {
-                QByteArray buf = sourceFile.read(1024); // 从源文件读取数据
-                qint64 bytesWritten = destFile.write(buf); // 写入数据到目标文件
-                if (bytesWritten == -1) {
-                    qDebug() << "Error writing to file:" << destFile.errorString();
-                    break;
-                }
+}
+
+void chatwindow::setupAttachmentTransfer(const QString &host, quint16 port)
+{
+    m_attachmentTransfer = new AttachmentTransfer(host, port, this);
+
+    connect(m_attachmentTransfer, &AttachmentTransfer::uploadProgress, this, [this](qint64 sent, qint64 total) {
+        ui->statusBar->showMessage(QString("正在发送文件 %1 / %2").arg(formatFileSize(sent), formatFileSize(total)));
+    });
+    connect(m_attachmentTransfer, &AttachmentTransfer::uploadFinished, this, [this](qint64) {
+        ui->statusBar->showMessage("文件发送完成", 5000);
+    });
+    connect(m_attachmentTransfer, &AttachmentTransfer::downloadProgress, this, [this](qint64 received, qint64 total) {
+        ui->statusBar->showMessage(QString("正在接收文件 %1 / %2").arg(formatFileSize(received), formatFileSize(total)));
+    });
+    connect(m_attachmentTransfer, &AttachmentTransfer::downloadFinished, this, [this](qint64 attachmentId, const QString &savePath) {
+        for (int i = 0; i < m_pendingAttachments.size(); ++i) {
+            if (m_pendingAttachments.at(i).attachmentId == attachmentId) {
+                m_pendingAttachments.removeAt(i);
+                break;
             }
-            sourceFile.close(); // 关闭源文件
-            destFile.close();   // 关闭目标文件
-            qDebug() << "File saved successfully to" << savePath;
-        } else {
-            qDebug() << "Error opening files:" << sourceFile.errorString() << destFile.errorString();
         }
+        ui->statusBar->showMessage("文件已保存到 " + savePath, 5000);
+    });
+    connect(m_attachmentTransfer, &AttachmentTransfer::failed, this, [this](const QString &reason) {
+        ui->statusBar->showMessage("文件传输中断（" + reason + "），再次操作将从断点继续");
+    });
+}
+
+void chatwindow::showAttachmentNotice(const PendingAttachment &attachment)
+{
+    QString sender = m_contactNames.value(attachment.senderId, attachment.senderId);
+    appendMessage(makeMessage(ChatMessage::Notice, sender,
+                              QString("%1向你发来了文件 %2（%3）").arg(sender, attachment.fileName, formatFileSize(attachment.size)),
+                              false));
+}
+
+//语音输入：中间结果是整句文本，每次替换上一次显示的内容，开始说话前已输入的文字保持不变
+void chatwindow::showDictationText(const QString &text)
+{
+    if (m_voiceRecognition->isCommandMode()) {
+        return;  // 指令模式的识别文本不写入输入框
+    }
+    QString dictated = text;
+    dictated.remove(' ');  // 中文模型按词以空格分隔
+    ui->idt->setPlainText(m_dictationPrefix + dictated);
+    ui->idt->moveCursor(QTextCursor::End);
+}
+
+//语音指令：聊天窗口只处理发送和取消，其余指令属于其他窗口
+void chatwindow::onVoiceCommand(const QString &command)
+{
+    if (command == "send") {
+        if (ui->btn1->isEnabled() && !ui->idt->toPlainText().isEmpty()) {
+            on_btn1_clicked();
+        }
+    } else if (command == "cancel") {
+        ui->idt->clear();
     } else {
-        qDebug() << "Save file operation was canceled.";
+        ui->statusBar->showMessage("聊天窗口不支持该语音指令", 3000);
     }
 }
 
@@ -24,6 +24,14 @@
 #include <QHBoxLayout>
 #include <QTextBrowser>
 #include <QThread>
+#include <QHash>
+#include <QPointer>
+#include "ChatMessageModel.h"
+#include "ChatBubbleDelegate.h"
+#include "ChatHistoryStore.h"
+#include "AttachmentTransfer.h"
+#include "SimpleVoiceRecognition.h"
+#include "PayloadCodec.h"
 
 
 QT_BEGIN_NAMESPACE
@@ -40,17 +48,21 @@ public:
     ~chatwindow();
     void setCurrentUsername(const QString &username);
     void initializeContactList(const QString &id);  // 初始化联系人列表
+    void setContactId(const QString &username, const QString &userId); // 登记联系人的服务器用户ID，用于同步聊天记录
     QString currentusername;  // 存储当前登录的用户名
 
 
 private slots:
     void readyRead_slot(QByteArray msg); //处理readyRead信号槽函数
+    void onServerMessage(QByteArray msg); //处理聊天记录同步的响应和新消息推送
     void on_btn1_clicked();
     void onContactClicked(QListWidgetItem *item);
     void sendPhotoButton_clicked();
     void sendFileButton_clicked();
     void receiveFileButton_clicked();
     //语音识别
+    void showDictationText(const QString &text);
+    void onVoiceCommand(const QString &command);
     // void startRecording();
     // void writeAudioData();
     // void stopRecording();
@@ -61,19 +73,45 @@ private slots:
 private:
     Ui::chatwindow *ui;
     void loadChatHistory(const QString &username);
+    void addContactItem(const QString &username);
+    void appendStoredMessages(const QVector<StoredChatMessage> &messages, bool keepScroll);
+    void handleServerLine(const QByteArray &line);
     QTcpSocket *socket;
     // 录音相关成员变量
     // QAudioInput *audioSource = nullptr;
     // QIODevice *audioIODevice = nullptr;
     // QFile *outputFile = nullptr;
-    //创建气泡相关
-    QWidget* createMessageBubble(const QString &username, const QString &message, bool isSelf);
-    QWidget* createImageBubble(const QString &username, const QString &imagePath, bool isSelf);
-    QWidget* createFileBubble(const QString &content);
-    QString getAvatarPathFromUsername(const QString &username);
-    //聊天记录相关
-    void saveMessageToHistory(const QString &sender, const QString &receiver, const QString &content, const QString &contentType);
-    void loadChatHistory(const QString &username1, const QString &username2);
+    SimpleVoiceRecognition *m_voiceRecognition;
+    QString m_dictationPrefix;                // 开始说话前输入框中已有的文字
+    //消息列表相关：消息存放在模型中，由委托绘制气泡
+    ChatMessage makeMessage(ChatMessage::Type type, const QString &sender, const QString &content, bool isSelf);
+    void appendMessage(const ChatMessage &message);
+    void registerAvatarSource(const QString &userId, const QString &username);
+    ChatMessageModel *m_messageModel;
+    ChatBubbleDelegate *m_bubbleDelegate;
+    QHash<QString, QString> m_avatarPaths;   // 用户名 -> 本地头像路径（为空表示本地没有），避免每条消息查一次数据库
+    QHash<QString, QPointer<QLabel>> m_contactAvatarLabels;  // 用户名 -> 联系人列表中的头像
+    QHash<QString, QStringList> m_avatarFetches;  // 正在拉取的头像哈希 -> 使用该头像的用户ID
+    //聊天记录相关：本地按服务器 message_id 保存，打开会话先从磁盘渲染，再按 since_message_id 增量同步
+    ChatHistoryStore *m_historyStore = nullptr;
+    QString m_currentUserId;
+    QHash<QString, QString> m_contactIds;     // 用户名 -> 服务器用户ID
+    QHash<QString, QString> m_contactNames;   // 服务器用户ID -> 用户名
+    QByteArray m_serverBuffer;                // 未收完整的一行服务器数据
+    QString m_serverEpoch;                    // 服务器本次启动的标识，确认后才发送增量同步
+    QString m_pendingConversation;            // 已选中、等待联系人ID的会话
+    PayloadCodec::InflateState m_inflateState; // 未收完整的压缩帧及拆包状态
+    //文件传输相关：文件分块上传到服务器，接收方从服务器下载，支持断点续传
+    struct PendingAttachment {
+        qint64 attachmentId = 0;
+        QString senderId;
+        QString fileName;
+        qint64 size = 0;
+    };
+    void setupAttachmentTransfer(const QString &host, quint16 port);
+    void showAttachmentNotice(const PendingAttachment &attachment);
+    AttachmentTransfer *m_attachmentTransfer = nullptr;
+    QList<PendingAttachment> m_pendingAttachments;  // 发给当前用户、尚未下载的文件
     SocketThread *socketThread;
 
 signals:
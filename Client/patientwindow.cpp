@@ -460,8 +460,8 @@ void PatientWindow::onPaymentRecordClicked()
 void PatientWindow::onMyDoctorClicked()
 {
     // 示例：打开与指定医生的聊天对话框
-    // 这里使用示例医生ID：120001
-    QString doctorId = "120001";
+    // 这里使用示例医生ID：12000001
+    QString doctorId = "12000001";
     QString doctorName = "张医生";
     
     DoctorChatDialog *chatDialog = new DoctorChatDialog(socket, id, doctorId, doctorName, this);
@@ -6,6 +6,7 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
+#include "PayloadCodec.h"
 
 PaymentRecordWindow::PaymentRecordWindow(QTcpSocket *socket, const QString &patientId, QWidget *parent)
     : QWidget(parent), patientId(patientId), m_socket(socket)
@@ -109,8 +110,9 @@ void PaymentRecordWindow::loadPaymentData()
 {
     // 如果有socket连接，从服务器获取数据
     if (m_socket && m_socket->state() == QAbstractSocket::ConnectedState) {
+        // 缴费记录以 CBOR 返回，只对这一个请求生效
         QString request = QString("GET_PAYMENT_RECORDS#%1").arg(patientId);
-        m_socket->write(request.toUtf8() + "\n");
+        m_socket->write(PayloadCodec::cborRequest(request));
 
         // 显示加载中
         paymentTable->setRowCount(1);
@@ -132,7 +134,18 @@ void PaymentRecordWindow::onReadyRead()
 {
     if (!m_socket) return;
 
-    QByteArray data = m_socket->readAll();
+    QByteArray data = PayloadCodec::inflateFrames(m_inflateState, m_socket->readAll());
+    if (data.isEmpty()) {
+        return; // 压缩帧尚未收完整
+    }
+    if (!m_pendingResponse.isEmpty()) {
+        data.prepend(m_pendingResponse);
+        m_pendingResponse.clear();
+    }
+    PayloadCodec::skipEncodingReplies(data);
+    if (data.isEmpty()) {
+        return;
+    }
     handleServerResponse(data);
 }
 
@@ -156,12 +169,15 @@ void PaymentRecordWindow::handleServerResponse(const QByteArray &response)
         paymentTable->setItem(0, 0, errorItem);
         paymentTable->setSpan(0, 0, 1, paymentTable->columnCount());
     } else if (responseStr.startsWith("GET_PAYMENT_RECORDS_SUCCESS")) {
-        // 解析缴费记录数据
-        QString jsonStr = responseStr.section('#', 1);
-        QJsonDocument doc = QJsonDocument::fromJson(jsonStr.toUtf8());
+        // 解析缴费记录数据（JSON 文本或协商后的 CBOR 帧）
+        QJsonArray recordsArray;
+        PayloadCodec::Result result = PayloadCodec::decodeRows(response, "GET_PAYMENT_RECORDS_SUCCESS#", recordsArray);
+        if (result == PayloadCodec::Result::Incomplete) {
+            m_pendingResponse = response; // CBOR 帧尚未收完整，等待后续数据
+            return;
+        }
 
-        if (!doc.isNull() && doc.isArray()) {
-            QJsonArray recordsArray = doc.array();
+        if (result == PayloadCodec::Result::Ok) {
 
             // 清空表格
             paymentTable->setRowCount(0);
@@ -196,7 +212,7 @@ void PaymentRecordWindow::handleServerResponse(const QByteArray &response)
                 paymentTable->setItem(row, 2, new QTableWidgetItem(paymentMethod));
 
                 // 缴费时间列
-                paymentTable->setItem(row, 3, new QTableWidgetItem(record["paid_at"].toString()));
+                paymentTable->setItem(row, 3, new QTableWidgetItem(record["paid_at"].toString().left(19)));
 
                 // 设置所有单元格文本居中
                 for (int col = 0; col < paymentTable->columnCount(); ++col) {
@@ -204,7 +220,7 @@ void PaymentRecordWindow::handleServerResponse(const QByteArray &response)
                 }
             }
         } else {
-            qDebug() << "Invalid JSON data format: " << jsonStr;
+            qDebug() << "Invalid payment records payload: " << responseStr.left(200);
             paymentTable->setRowCount(1);
             QTableWidgetItem *errorItem = new QTableWidgetItem("数据格式错误");
             errorItem->setTextAlignment(Qt::AlignCenter);
@@ -11,6 +11,7 @@
 #include <QDate>
 #include <QString>
 #include <QTcpSocket>
+#include "PayloadCodec.h"
 
 class PaymentRecordWindow : public QWidget
 {
@@ -35,6 +36,8 @@ private:
     QTableWidget *paymentTable;  // 缴费记录表格
     QPushButton *backButton;     // 返回按钮
     QTcpSocket *m_socket;        // 添加socket成员变量用于与服务器通信
+    QByteArray m_pendingResponse; // 未收完整的CBOR列表帧
+    PayloadCodec::InflateState m_inflateState; // 未收完整的压缩帧及拆包状态
 
     void initUI();      // 初始化界面
     void loadPaymentData();  // 加载缴费记录数据
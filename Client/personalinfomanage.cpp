@@ -1,11 +1,14 @@
 #include "personalinfomanage.h"
 #include "ui_personalinfomanage.h"
 #include "EmailVerificationDialog.h"
+#include "AvatarService.h"
 #include <QJsonObject>
 #include <QJsonDocument>
+#include <QCryptographicHash>
 #include <QRegularExpression>
 #include <QDebug>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QPainter>
 #include <QStyleFactory>
 #include <QVBoxLayout>
@@ -35,6 +38,12 @@ PersonalInfoManage::PersonalInfoManage(QTcpSocket *existingSocket, const QString
     // 连接信号
     disconnect(socket, &QTcpSocket::readyRead, this, &PersonalInfoManage::onReadyRead);
     connect(socket, &QTcpSocket::readyRead, this, &PersonalInfoManage::onReadyRead);
+    // 头像与聊天窗口共用，统一按用户ID缓存；其他窗口拉取到头像后刷新显示（正在预览新头像时不覆盖）
+    connect(AvatarService::instance(), &AvatarService::avatarChanged, this, [this](const QString &userId) {
+        if (userId == id && m_tempAvatarPath.isEmpty()) {
+            ui->avatarLabel->setPixmap(AvatarService::instance()->avatar(id, 120, AvatarService::Circle));
+        }
+    });
 
     QString infoRequest = QString("USERINFO#%1").arg(id);
     socket->write(infoRequest.toUtf8());
@@ -314,25 +323,15 @@ void PersonalInfoManage::handleServerResponse(const QString &response)
         originalValues["id_card"] = obj["id_card"].toString();
         originalValues["gender"] = gender;
 
-        // 加载头像
+        m_serverAvatarHash = obj["avatar_hash"].toString();
+
+        // 加载头像：交给共享的头像服务，聊天和联系人列表同时更新
         QString avatarBase64 = obj["avatar"].toString();
         if (!avatarBase64.isEmpty())
         {
-            QByteArray avatarData = QByteArray::fromBase64(avatarBase64.toUtf8());
-            QPixmap pixmap;
-            if (pixmap.loadFromData(avatarData))
-            {
-                // 调整为圆形头像
-                QPixmap rounded(pixmap.size());
-                rounded.fill(Qt::transparent);
-                QPainter painter(&rounded);
-                painter.setRenderHint(QPainter::Antialiasing);
-                painter.setBrush(QBrush(pixmap));
-                painter.setPen(Qt::NoPen);
-                painter.drawEllipse(pixmap.rect());
-                ui->avatarLabel->setPixmap(rounded.scaled(120, 120, Qt::KeepAspectRatio, Qt::SmoothTransformation));
-            }
+            AvatarService::instance()->setAvatarData(id, QByteArray::fromBase64(avatarBase64.toUtf8()));
         }
+        ui->avatarLabel->setPixmap(AvatarService::instance()->avatar(id, 120, AvatarService::Circle));
 
         // 恢复按钮状态
         ui->editButton->setVisible(true);
@@ -343,6 +342,37 @@ void PersonalInfoManage::handleServerResponse(const QString &response)
         // 设置输入框为只读
         setEditEnabled(false);
     }
+    else if (response.startsWith("AVATAR_CHECK_SUCCESS#"))
+    {
+        // AVATAR_CHECK_SUCCESS#exists|missing#sha256
+        QString status = response.trimmed().section('#', 1, 1);
+        QByteArray hash = response.trimmed().section('#', 2, 2).toLatin1();
+        if (hash != m_pendingAvatarHash)
+        {
+            return;
+        }
+
+        if (status == "exists")
+        {
+            qDebug() << "服务器已有该头像，跳过上传";
+            finishAvatarSave();
+        }
+        else
+        {
+            startAvatarUpload();
+        }
+    }
+    else if (response.startsWith("AVATAR_UPLOAD_SUCCESS#"))
+    {
+        if (response.trimmed().section('#', 1, 1).toLatin1() == m_pendingAvatarHash)
+        {
+            finishAvatarSave();
+        }
+    }
+    else if (response.startsWith("AVATAR_CHECK_FAIL#") || response.startsWith("AVATAR_UPLOAD_FAIL#"))
+    {
+        abortAvatarSave(response.trimmed().section('#', 1, 1));
+    }
     else if (response == "USERINFO_UPDATE_SUCCESS")
     {
         QMessageBox::information(this, "成功", "个人信息更新成功！");
@@ -390,18 +420,44 @@ void PersonalInfoManage::on_saveButton_clicked()
         userInfo["gender"] = "";
     }
 
-    // 检查是否有头像更新
-    if (!m_tempAvatarPath.isEmpty())
+    // 检查是否有头像更新：头像不再放进资料 JSON，先按内容哈希确认服务器是否已有
+    if (!m_tempAvatarPath.isEmpty() && m_pendingAvatarHash.isEmpty())
     {
-        QFile file(m_tempAvatarPath);
-        if (file.open(QIODevice::ReadOnly))
+        QFileInfo avatarInfo(m_tempAvatarPath);
+        if (avatarInfo.size() > AVATAR_MAX_BYTES)
+        {
+            QMessageBox::warning(this, "失败", "头像图片不能超过8MB，请重新选择！");
+            return;
+        }
+
+        QByteArray hash = fileSha256(m_tempAvatarPath);
+        if (hash.isEmpty())
+        {
+            QMessageBox::warning(this, "失败", "无法读取选择的头像文件，请重新选择！");
+            return;
+        }
+
+        if (hash != m_serverAvatarHash.toLatin1())
         {
-            QByteArray avatarData = file.readAll();
-            userInfo["avatar"] = QString(avatarData.toBase64());
-            file.close();
+            m_pendingAvatarHash = hash;
+            m_pendingUserInfo = userInfo;
+            socket->write("AVATAR_CHECK#" + id.toUtf8() + "#" + hash + "\n");
+            return;
         }
+
+        // 与服务器上的头像是同一张图片
+        m_tempAvatarPath.clear();
+    }
+    else if (!m_pendingAvatarHash.isEmpty())
+    {
+        return; // 上一次保存的头像还在上传
     }
 
+    sendUserInfoUpdate(userInfo);
+}
+
+void PersonalInfoManage::sendUserInfoUpdate(const QJsonObject &userInfo)
+{
     // 转换为JSON字符串
     QJsonDocument doc(userInfo);
     QString jsonString = doc.toJson(QJsonDocument::Compact);
@@ -411,6 +467,76 @@ void PersonalInfoManage::on_saveButton_clicked()
     socket->write(request.toUtf8());
 }
 
+QByteArray PersonalInfoManage::fileSha256(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return QByteArray();
+    }
+
+    // 按块读取计算，不把整张图片读进内存
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    if (!hash.addData(&file))
+    {
+        return QByteArray();
+    }
+    return hash.result().toHex();
+}
+
+// 头像不超过 8MB，整个读入后与头部一次写入：连接为各窗口共用，
+// 分块写入时其他窗口的请求可能插进头像数据中间，服务器会把它当作图片字节
+void PersonalInfoManage::startAvatarUpload()
+{
+    QFile file(m_tempAvatarPath);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        abortAvatarSave("OPEN_ERROR");
+        return;
+    }
+    QByteArray imageData = file.readAll();
+    file.close();
+    if (imageData.size() > AVATAR_MAX_BYTES)
+    {
+        abortAvatarSave("TOO_LARGE");
+        return;
+    }
+
+    // AVATAR_UPLOAD#userId#sha256#字节数 之后紧跟原始图片数据
+    QByteArray header = "AVATAR_UPLOAD#" + id.toUtf8() + "#" + m_pendingAvatarHash + "#"
+                        + QByteArray::number(imageData.size()) + "\n";
+    socket->write(header + imageData);
+}
+
+// 服务器已保存头像：更新共享头像缓存（其他界面随之刷新），再发送资料更新
+void PersonalInfoManage::finishAvatarSave()
+{
+    QFile file(m_tempAvatarPath);
+    if (file.open(QIODevice::ReadOnly))
+    {
+        AvatarService::instance()->setAvatarData(id, file.readAll());
+        file.close();
+    }
+
+    m_serverAvatarHash = QString::fromLatin1(m_pendingAvatarHash);
+    m_pendingAvatarHash.clear();
+    m_tempAvatarPath.clear();
+
+    sendUserInfoUpdate(m_pendingUserInfo);
+    m_pendingUserInfo = QJsonObject();
+}
+
+void PersonalInfoManage::abortAvatarSave(const QString &reason)
+{
+    qDebug() << "头像上传失败:" << reason;
+
+    m_pendingAvatarHash.clear();
+    m_pendingUserInfo = QJsonObject();
+
+    // 保留头像预览，用户可以直接再次保存重试
+    QMessageBox::warning(this, "失败", "头像上传失败，请重试！");
+}
+
 void PersonalInfoManage::on_cancelButton_clicked()
 {
     // 恢复原始值
@@ -436,6 +562,13 @@ void PersonalInfoManage::on_cancelButton_clicked()
         femaleRadioButton->setChecked(false);
     }
 
+    // 放弃未保存的头像预览
+    if (!m_tempAvatarPath.isEmpty())
+    {
+        m_tempAvatarPath.clear();
+        ui->avatarLabel->setPixmap(AvatarService::instance()->avatar(id, 120, AvatarService::Circle));
+    }
+
     // 恢复按钮状态
     ui->editButton->setVisible(true);
     ui->saveButton->setVisible(false);
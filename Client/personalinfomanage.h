@@ -6,6 +6,8 @@
 #include <QMessageBox>
 #include <QMap>
 #include <QRadioButton>
+#include <QJsonObject>
+#include <QFile>
 #include "EmailVerificationDialog.h"
 
 namespace Ui
@@ -24,6 +26,7 @@ public:
     QString id;
     QMap<QString, QString> originalValues;
     QString m_tempAvatarPath;
+    QString m_serverAvatarHash; // 服务器上当前头像的内容哈希（SHA-256），选中同一张图片时不再上传
 
 private slots:
     void on_editButton_clicked();
@@ -39,6 +42,17 @@ private:
     void handleServerResponse(const QString &response);
     void setEditEnabled(bool enabled);
     bool loadAvatarFromPath(const QString &path);
+
+    // 头像单独上传：先用内容哈希询问服务器（AVATAR_CHECK），服务器没有时再以二进制流上传（AVATAR_UPLOAD），
+    // 头像就绪后才发送资料更新，资料更新只包含元数据
+    static QByteArray fileSha256(const QString &path);
+    void startAvatarUpload();
+    void finishAvatarSave();
+    void abortAvatarSave(const QString &reason);
+    void sendUserInfoUpdate(const QJsonObject &userInfo);
+    QByteArray m_pendingAvatarHash;
+    QJsonObject m_pendingUserInfo;   // 等待头像就绪后发送的资料
+    static const qint64 AVATAR_MAX_BYTES = 8 * 1024 * 1024; // 与服务器限制一致
     void setupUI();
     void applyStyles();
     bool requiresEmailVerification(); // 检查是否需要邮箱验证
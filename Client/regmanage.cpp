@@ -9,6 +9,7 @@
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QColor>
+#include "PayloadCodec.h"
 
 // 主界面构造函数
 RegManage::RegManage(QTcpSocket *socket, const QString &doctorId, QWidget *parent)
@@ -87,8 +88,12 @@ void RegManage::loadData()
     table->setRowCount(0);
     
     // 发送请求获取医生的预约信息
-    QString request = "APPOINTMENTS#" + m_doctorId;
-    sendRequestToServer(request);
+    // 预约列表以 CBOR 返回，只对这一个请求生效
+    if (m_socket && m_socket->state() == QAbstractSocket::ConnectedState) {
+        m_socket->write(PayloadCodec::cborRequest("APPOINTMENTS#" + m_doctorId));
+    } else {
+        QMessageBox::warning(this, "网络错误", "未连接到服务器");
+    }
     
     // 显示加载提示
     table->setRowCount(1);
@@ -118,12 +123,15 @@ void RegManage::handleServerResponse(const QByteArray &response)
     qDebug() << "收到服务器响应:" << responseStr;
     
     if (responseStr.startsWith("APPOINTMENTS_SUCCESS")) {
-        // 解析预约数据
-        QString jsonStr = responseStr.section('#', 1);
-        QJsonDocument doc = QJsonDocument::fromJson(jsonStr.toUtf8());
+        // 解析预约数据（JSON 文本或协商后的 CBOR 帧）
+        QJsonArray appointments;
+        PayloadCodec::Result result = PayloadCodec::decodeRows(response, "APPOINTMENTS_SUCCESS#", appointments);
+        if (result == PayloadCodec::Result::Incomplete) {
+            m_pendingResponse = response; // CBOR 帧尚未收完整，等待后续数据
+            return;
+        }
         
-        if (!doc.isNull() && doc.isArray()) {
-            QJsonArray appointments = doc.array();
+        if (result == PayloadCodec::Result::Ok) {
             
             // 清空表格
             table->setRowCount(0);
@@ -266,7 +274,18 @@ void RegManage::onDetail(int row, int col)
 // 接收服务器数据
 void RegManage::onReadyRead()
 {
-    QByteArray data = m_socket->readAll();
+    QByteArray data = PayloadCodec::inflateFrames(m_inflateState, m_socket->readAll());
+    if (data.isEmpty()) {
+        return; // 压缩帧尚未收完整
+    }
+    if (!m_pendingResponse.isEmpty()) {
+        data.prepend(m_pendingResponse);
+        m_pendingResponse.clear();
+    }
+    PayloadCodec::skipEncodingReplies(data);
+    if (data.isEmpty()) {
+        return;
+    }
     handleServerResponse(data);
 }
 
@@ -6,6 +6,7 @@
 #include <QPushButton>
 #include <QTcpSocket>
 #include <vector>
+#include "PayloadCodec.h"
 
 // 患者信息结构体
 struct Patient {
@@ -37,6 +38,8 @@ private:
     QTcpSocket *m_socket;      // 网络套接字
     QString m_doctorId;        // 医生ID
     std::vector<Patient> data; // 患者数据
+    QByteArray m_pendingResponse; // 未收完整的CBOR列表帧
+    PayloadCodec::InflateState m_inflateState; // 未收完整的压缩帧及拆包状态
 
     void initUI();             // 初始化界面
     void loadData();           // 加载患者数据
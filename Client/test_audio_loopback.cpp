@@ -0,0 +1,152 @@
+#include <QCoreApplication>
+#include <QIODevice>
+#include <QTimer>
+#include <QDateTime>
+#include <QHostAddress>
+#include <QtMath>
+#include <QDebug>
+#include <algorithm>
+#include <cstring>
+#include "MediaChannel.h"
+#include "AudioStream.h"
+
+// 音频通话环回测试：两个媒体通道在本机互为对端，一端采集发送、另一端播放，
+// 统计“采集时刻 -> 从扬声器播出”的口到耳时延。
+// 用法: test_audio_loopback [--mic] [秒数]
+// 默认使用 440Hz 合成信号；设置 MEDIA_NET_SIM="loss=0.05,delay=80,jitter=30"（丢包率、时延毫秒、抖动毫秒）可模拟弱网
+
+// 以实时速率产生正弦波的数据源，代替麦克风
+class SineSource : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    explicit SineSource(QObject *parent = nullptr) : QIODevice(parent)
+    {
+        open(QIODevice::ReadOnly);
+        connect(&m_timer, &QTimer::timeout, this, &SineSource::produce);
+        m_timer.setTimerType(Qt::PreciseTimer);
+        m_timer.start(AudioStream::FRAME_MS);
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        const qint64 n = qMin(maxSize, static_cast<qint64>(m_pending.size()));
+        memcpy(data, m_pending.constData(), n);
+        m_pending.remove(0, n);
+        return n;
+    }
+
+    qint64 writeData(const char *, qint64) override { return -1; }
+    qint64 bytesAvailable() const override { return m_pending.size() + QIODevice::bytesAvailable(); }
+
+private slots:
+    void produce()
+    {
+        for (int i = 0; i < AudioStream::FRAME_SAMPLES; ++i) {
+            const double t = static_cast<double>(m_sampleIndex++) / AudioStream::SAMPLE_RATE;
+            const qint16 sample = static_cast<qint16>(8000.0 * qSin(2.0 * M_PI * 440.0 * t));
+            m_pending.append(reinterpret_cast<const char *>(&sample), sizeof(sample));
+        }
+        emit readyRead();
+    }
+
+private:
+    QTimer m_timer;
+    QByteArray m_pending;
+    qint64 m_sampleIndex = 0;
+};
+
+class LoopbackTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    LoopbackTest(bool useMic, int seconds, QObject *parent = nullptr) : QObject(parent)
+    {
+        m_senderChannel = new MediaChannel(this);
+        m_receiverChannel = new MediaChannel(this);
+        m_senderChannel->bind();
+        m_receiverChannel->bind();
+        m_senderChannel->setPeer(QHostAddress::LocalHost, m_receiverChannel->localPort());
+        m_receiverChannel->setPeer(QHostAddress::LocalHost, m_senderChannel->localPort());
+
+        m_sender = new AudioStream(m_senderChannel, this);
+        m_receiver = new AudioStream(m_receiverChannel, this);
+        if (!useMic) {
+            m_sender->setCaptureDevice(new SineSource(this));
+        }
+        // 接收端不采集，避免两端同时打开麦克风
+        m_receiver->setCaptureEnabled(false);
+        connect(m_receiver, &AudioStream::framePlayed, this, &LoopbackTest::onFramePlayed);
+
+        qDebug() << "音频环回测试开始，信号源:" << (useMic ? "麦克风" : "440Hz 正弦波")
+                 << "时长:" << seconds << "秒";
+        m_sender->start();
+        m_receiver->start();
+
+        QTimer::singleShot(seconds * 1000, this, &LoopbackTest::finish);
+    }
+
+private slots:
+    void onFramePlayed(quint32 captureTimestamp, int queuedMs)
+    {
+        const quint32 now = static_cast<quint32>(QDateTime::currentMSecsSinceEpoch());
+        m_latencies.append(static_cast<int>(now - captureTimestamp) + queuedMs);
+    }
+
+    void finish()
+    {
+        m_sender->stop();
+        m_receiver->stop();
+
+        if (m_latencies.isEmpty()) {
+            qDebug() << "没有播放任何音频帧，请检查音频设备";
+            QCoreApplication::exit(1);
+            return;
+        }
+
+        std::sort(m_latencies.begin(), m_latencies.end());
+        qint64 total = 0;
+        for (int latency : m_latencies) {
+            total += latency;
+        }
+        const int p95 = m_latencies[qMin(m_latencies.size() - 1, m_latencies.size() * 95 / 100)];
+
+        qDebug() << "已播放帧数:" << m_latencies.size();
+        qDebug() << "口到耳时延(ms) 最小:" << m_latencies.first()
+                 << "平均:" << total / m_latencies.size()
+                 << "P95:" << p95
+                 << "最大:" << m_latencies.last();
+        QCoreApplication::exit(0);
+    }
+
+private:
+    MediaChannel *m_senderChannel;
+    MediaChannel *m_receiverChannel;
+    AudioStream *m_sender;
+    AudioStream *m_receiver;
+    QList<int> m_latencies;
+};
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    bool useMic = false;
+    int seconds = 10;
+    const QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        if (args[i] == "--mic") {
+            useMic = true;
+        } else if (args[i].toInt() > 0) {
+            seconds = args[i].toInt();
+        }
+    }
+
+    LoopbackTest test(useMic, seconds);
+    return app.exec();
+}
+
+#include "test_audio_loopback.moc"
@@ -0,0 +1,108 @@
+#include <QApplication>
+#include <QListView>
+#include <QScrollBar>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <algorithm>
+#include "ChatMessageModel.h"
+#include "ChatBubbleDelegate.h"
+
+// 聊天消息列表滚动测试：载入大量消息后自动逐帧滚动，统计每帧耗时
+// 用法: test_chat_list [消息条数]，默认 50000
+class ScrollBenchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    ScrollBenchmark(QListView *view, QObject *parent = nullptr) : QObject(parent), m_view(view)
+    {
+        connect(&m_timer, &QTimer::timeout, this, &ScrollBenchmark::step);
+    }
+
+    void start()
+    {
+        m_frameTimer.start();
+        m_timer.start(0);
+    }
+
+private slots:
+    void step()
+    {
+        m_frameTimes.append(m_frameTimer.nsecsElapsed() / 1000000.0);
+        m_frameTimer.restart();
+
+        QScrollBar *bar = m_view->verticalScrollBar();
+        if (bar->value() >= bar->maximum() || m_frameTimes.size() >= 3000) {
+            finish();
+            return;
+        }
+        bar->setValue(bar->value() + 40);
+        m_view->viewport()->repaint();
+    }
+
+private:
+    void finish()
+    {
+        m_timer.stop();
+        m_frameTimes.removeFirst();
+        std::sort(m_frameTimes.begin(), m_frameTimes.end());
+        double total = 0;
+        for (double t : m_frameTimes) {
+            total += t;
+        }
+        qDebug() << "滚动帧数:" << m_frameTimes.size()
+                 << "平均(ms):" << total / m_frameTimes.size()
+                 << "P95(ms):" << m_frameTimes[m_frameTimes.size() * 95 / 100]
+                 << "最大(ms):" << m_frameTimes.last();
+        QApplication::quit();
+    }
+
+    QListView *m_view;
+    QTimer m_timer;
+    QElapsedTimer m_frameTimer;
+    QList<double> m_frameTimes;
+};
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+    const int count = argc > 1 ? QString(argv[1]).toInt() : 50000;
+
+    ChatMessageModel model;
+    ChatBubbleDelegate delegate;
+    QListView view;
+    view.setModel(&model);
+    view.setItemDelegate(&delegate);
+    view.setSelectionMode(QAbstractItemView::NoSelection);
+    view.setVerticalScrollMode(QAbstractItemView::ScrollPerPixel);
+    view.setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    view.setResizeMode(QListView::Adjust);
+    view.setLayoutMode(QListView::Batched);
+    view.setBatchSize(200);
+    view.resize(600, 800);
+    view.show();
+
+    QVector<ChatMessage> messages;
+    messages.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        ChatMessage message;
+        message.type = (i % 50 == 49) ? ChatMessage::Notice : ChatMessage::Text;
+        message.isSelf = (i % 3 == 0);
+        message.sender = message.isSelf ? "doctor001" : "patient002";
+        message.content = QString("第 %1 条消息：").arg(i) + QString("请按时服药，注意休息。").repeated(1 + i % 6);
+        messages.append(message);
+    }
+
+    QElapsedTimer loadTimer;
+    loadTimer.start();
+    model.appendMessages(std::move(messages));
+    qDebug() << "插入" << count << "条消息耗时(ms):" << loadTimer.elapsed();
+
+    ScrollBenchmark benchmark(&view);
+    // 等分批布局完成后再开始滚动
+    QTimer::singleShot(2000, &benchmark, &ScrollBenchmark::start);
+    return app.exec();
+}
+
+#include "test_chat_list.moc"
@@ -0,0 +1,151 @@
+#include <QCoreApplication>
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QStringList>
+#include <functional>
+#include <memory>
+#include "PayloadCodec.h"
+#include "../Server/JsonRowWriter.h"
+#include "../Server/CborRowWriter.h"
+
+// 列表响应编码对比：按各接口的行结构生成数据，分别用 JSON 和 CBOR 编码、再用 PayloadCodec 解码，
+// 输出每个接口的字节数与编解码耗时
+// 用法: test_payload_encoding [行数]，默认 2000
+// 编译时需要一并加入 ../Server/JsonRowWriter.cpp、../Server/CborRowWriter.cpp 和 PayloadCodec.cpp
+
+struct Endpoint {
+    const char *name;
+    QByteArray prefix;
+    std::function<void(int row, RowWriter &writer)> writeRow;
+};
+
+struct Measurement {
+    qint64 bytes = 0;
+    qint64 encodeUs = 0;
+    qint64 decodeUs = 0;
+    int rows = 0;
+    bool ok = false;
+};
+
+static Measurement measure(const Endpoint &endpoint, int rowCount, bool cbor)
+{
+    QByteArray wire;
+    QBuffer device(&wire);
+    device.open(QIODevice::WriteOnly);
+
+    std::unique_ptr<RowWriter> writer;
+    if (cbor) {
+        writer = std::make_unique<CborRowWriter>(&device, endpoint.prefix);
+    } else {
+        writer = std::make_unique<JsonRowWriter>(&device, endpoint.prefix);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < rowCount; ++i) {
+        writer->beginRow();
+        endpoint.writeRow(i, *writer);
+        writer->endRow();
+    }
+    writer->finish("\n");
+
+    Measurement result;
+    result.encodeUs = timer.nsecsElapsed() / 1000;
+    result.bytes = wire.size();
+
+    timer.restart();
+    QJsonArray rows;
+    result.ok = PayloadCodec::decodeRows(wire, endpoint.prefix, rows) == PayloadCodec::Result::Ok;
+    result.decodeUs = timer.nsecsElapsed() / 1000;
+    result.rows = rows.size();
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    int rowCount = 2000;
+    if (argc > 1) {
+        rowCount = qMax(1, QString::fromLocal8Bit(argv[1]).toInt());
+    }
+
+    const QString longText = QString("口服，一次1片，一日3次，饭后服用。").repeated(4);
+    const QList<Endpoint> endpoints = {
+        {"MEDICINE_SEARCH", "MEDICINE_SEARCH_SUCCESS#", [&](int i, RowWriter &w) {
+            w.addString("medicine_id", QString::number(10000 + i));
+            w.addString("name", QString("药品%1").arg(i));
+            w.addString("dosage_form", "片剂");
+            w.addString("specification", "0.25g*24片");
+            w.addString("manufacturer", "示例制药有限公司");
+            w.addString("usage", longText);
+            w.addString("indication", longText);
+            w.addString("side_effect", "偶见胃肠道不适");
+            w.addString("contraindication", "对本品过敏者禁用");
+            w.addString("notice", "对本品过敏者禁用");
+            w.addString("storage", "密封，阴凉干燥处保存");
+            w.addString("expiry_date", "2027-12-31");
+            w.addNumber("price", 12.5 + i % 100);
+            w.addString("description", longText);
+        }},
+        {"GET_CHAT_HISTORY", "GET_CHAT_HISTORY_SUCCESS#", [](int i, RowWriter &w) {
+            w.addString("message_id", QString::number(i + 1));
+            w.addString("sender_id", i % 2 ? "11000001" : "12000001");
+            w.addString("receiver_id", i % 2 ? "12000001" : "11000001");
+            w.addString("content", QString("第%1条消息，最近感觉怎么样？").arg(i));
+            w.addString("send_time", "2026-10-19 09:30:00.000000001");
+        }},
+        {"APPOINTMENTS", "APPOINTMENTS_SUCCESS#", [](int i, RowWriter &w) {
+            w.addString("patient_id", QString("1100%1").arg(i % 10000, 4, 10, QChar('0')));
+            w.addString("patient_name", "张三");
+            w.addString("appointment_date", "2026-10-20 10:00");
+            w.addString("department", "内科");
+            w.addString("symptom", "头痛、发热两天");
+            w.addString("phone", "13800000000");
+            w.addString("status", "pending");
+            w.addString("gender", i % 2 ? "男" : "女");
+            w.addInt("age", 20 + i % 60);
+        }},
+        {"GET_PAYMENT_RECORDS", "GET_PAYMENT_RECORDS_SUCCESS#", [](int i, RowWriter &w) {
+            w.addString("description", QString("处方缴费 #%1").arg(i));
+            w.addNumber("amount", 35.8 + i % 50);
+            w.addString("paid_at", "2026-10-19 09:30:00.000000001");
+            w.addString("payment_method", "online_payment");
+        }},
+        {"ATTACH_LIST", "ATTACH_LIST_SUCCESS#", [](int i, RowWriter &w) {
+            w.addInt("attachment_id", i + 1);
+            w.addString("sender_id", "12000001");
+            w.addString("file_name", QString("检查报告%1.pdf").arg(i));
+            w.addInt("size", 1048576 + i);
+            w.addString("sha256", QString(64, QChar('a' + i % 6)));
+            w.addString("created_at", "2026-10-19 09:30:00.000000001");
+        }},
+    };
+
+    QTextStream out(stdout);
+    out << "行数: " << rowCount << "\n";
+    out << QString("%1 %2 %3 %4 %5 %6 %7 %8\n")
+               .arg("接口", -20).arg("JSON字节", 10).arg("CBOR字节", 10).arg("体积比", 7)
+               .arg("JSON编码us", 11).arg("CBOR编码us", 11).arg("JSON解码us", 11).arg("CBOR解码us", 11);
+
+    bool allOk = true;
+    for (const Endpoint &endpoint : endpoints) {
+        const Measurement json = measure(endpoint, rowCount, false);
+        const Measurement cbor = measure(endpoint, rowCount, true);
+        allOk = allOk && json.ok && cbor.ok && json.rows == rowCount && cbor.rows == rowCount;
+
+        out << QString("%1 %2 %3 %4 %5 %6 %7 %8\n")
+                   .arg(endpoint.name, -20)
+                   .arg(json.bytes, 10).arg(cbor.bytes, 10)
+                   .arg(double(cbor.bytes) / double(qMax<qint64>(json.bytes, 1)), 7, 'f', 3)
+                   .arg(json.encodeUs, 11).arg(cbor.encodeUs, 11)
+                   .arg(json.decodeUs, 11).arg(cbor.decodeUs, 11);
+    }
+
+    if (!allOk) {
+        out << "解码结果与编码行数不一致\n";
+        return 1;
+    }
+    return 0;
+}
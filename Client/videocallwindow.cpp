@@ -19,14 +19,14 @@ VideoCallWindow::VideoCallWindow(QTcpSocket *socket, const QString &userId,
     , m_targetUserName(targetUserName)
     , m_camera(nullptr)
     , m_captureSession(nullptr)
-    , m_audioInput(nullptr)
-    , m_audioOutput(nullptr)
+    , m_audioStream(nullptr)
     , m_isCallActive(false)
     , m_isMuted(false)
     , m_isVideoEnabled(true)
     , m_cameraInitialized(false)
     , m_callDurationSeconds(0)
     , m_currentCameraIndex(0)
+    , m_remotePlaceholder(nullptr)
 {
     // 设置窗口基本属性
     setWindowTitle(QString("智能医疗 - 音视频通话 - %1").arg(m_targetUserName));
@@ -42,6 +42,14 @@ VideoCallWindow::VideoCallWindow(QTcpSocket *socket, const QString &userId,
         connect(m_socket, &QTcpSocket::readyRead, this, &VideoCallWindow::onSocketDataReceived);
     }
     
+    // 媒体通道在窗口创建时绑定端口，呼叫/应答信令中携带该端口
+    m_mediaChannel = new MediaChannel(this);
+    m_mediaChannel->bind();
+    m_videoStream = new VideoStream(m_mediaChannel, this);
+    connect(m_videoStream, &VideoStream::remoteFrameReady, this, &VideoCallWindow::onRemoteVideoFrame);
+    connect(m_videoStream, &VideoStream::receiverReportReceived, this, &VideoCallWindow::onReceiverReport);
+    m_congestionClock.start();
+    
     setupUI();
     initializeCamera();
     initializeAudio();
@@ -54,6 +62,7 @@ VideoCallWindow::~VideoCallWindow()
     if (m_isCallActive) {
         sendCallEnd();
     }
+    stopMediaSession();
     
     // 清理资源
     if (m_camera) {
@@ -63,12 +72,6 @@ VideoCallWindow::~VideoCallWindow()
     if (m_captureSession) {
         delete m_captureSession;
     }
-    if (m_audioInput) {
-        delete m_audioInput;
-    }
-    if (m_audioOutput) {
-        delete m_audioOutput;
-    }
 }
 
 void VideoCallWindow::setupUI()
@@ -125,6 +128,10 @@ void VideoCallWindow::setupVideoWidgets()
     remoteLayout->addWidget(remoteLabel);
     remoteLayout->addWidget(m_remoteVideoWidget);
     
+    // 本地预览的 videoSink 同时作为采集出口，把帧交给视频流编码发送
+    connect(m_localVideoWidget->videoSink(), &QVideoSink::videoFrameChanged,
+            this, &VideoCallWindow::onLocalVideoFrame);
+    
     videoSplitter->addWidget(localFrame);
     videoSplitter->addWidget(remoteFrame);
     videoSplitter->setStretchFactor(0, 1);
@@ -254,6 +261,7 @@ void VideoCallWindow::initializeCamera()
             
             m_captureSession->setCamera(m_camera);
             m_captureSession->setVideoOutput(m_localVideoWidget);
+            applyCaptureFormat(m_congestion.currentLevel().size, m_congestion.currentLevel().frameRate);
             
             // 启动摄像头预览
             m_camera->start();
@@ -267,8 +275,7 @@ void VideoCallWindow::initializeCamera()
             updateCameraStatus();
             qDebug() << "摄像头初始化成功:" << m_availableCameras[m_currentCameraIndex].description();
             
-            // 模拟远程视频流 - 在实际应用中，这里应该接收来自对方的视频流
-            // 目前先显示一个提示，表明这是远程视频区域
+            // 对方画面到达前显示等待提示
             setupRemoteVideoPlaceholder();
             
         } catch (const std::exception& e) {
@@ -305,65 +312,148 @@ void VideoCallWindow::initializeCamera()
 
 void VideoCallWindow::initializeAudio()
 {
-    // 初始化音频输入和输出
-    m_audioInput = new QAudioInput(this);
-    m_audioOutput = new QAudioOutput(this);
-    
-    if (m_captureSession) {
-        m_captureSession->setAudioInput(m_audioInput);
-        m_captureSession->setAudioOutput(m_audioOutput);
-    }
+    // 通话音频走媒体通道：采集、编码、抖动缓冲和播放都由 AudioStream 完成，
+    // 不再把麦克风直接接到本地扬声器上
+    m_audioStream = new AudioStream(m_mediaChannel, this);
     
     // 设置初始音量
-    if (m_audioOutput) {
-        m_audioOutput->setVolume(0.7); // 70%
-    }
+    m_audioStream->setVolume(0.7); // 70%
     
     qDebug() << "音频系统初始化完成";
 }
 
 void VideoCallWindow::setupRemoteVideoPlaceholder()
 {
-    // 在远程视频窗口显示占位符，提示用户这是对方的视频区域
-    // 在实际的视频通话应用中，这里应该显示来自对方的实时视频流
+    // 在远程视频窗口显示占位提示，收到对方第一帧后隐藏
+    if (!m_remotePlaceholder) {
+        m_remotePlaceholder = new QLabel("等待对方视频...", m_remoteVideoWidget);
+        m_remotePlaceholder->setAlignment(Qt::AlignCenter);
+        m_remotePlaceholder->setStyleSheet(
+            "QLabel {"
+            "    color: white;"
+            "    font-size: 16px;"
+            "    font-weight: bold;"
+            "    background-color: rgba(0, 0, 0, 0.7);"
+            "    border-radius: 8px;"
+            "    padding: 20px;"
+            "}"
+        );
+        
+        // 设置标签的大小和位置
+        m_remotePlaceholder->setGeometry(50, 100, 300, 100);
+    }
+    m_remotePlaceholder->show();
     
-    // 创建一个标签显示提示信息
-    QLabel *placeholderLabel = new QLabel("等待对方视频...", m_remoteVideoWidget);
-    placeholderLabel->setAlignment(Qt::AlignCenter);
-    placeholderLabel->setStyleSheet(
-        "QLabel {"
-        "    color: white;"
-        "    font-size: 16px;"
-        "    font-weight: bold;"
-        "    background-color: rgba(0, 0, 0, 0.7);"
-        "    border-radius: 8px;"
-        "    padding: 20px;"
-        "}"
-    );
+    qDebug() << "远程视频占位符设置完成";
+}
+
+void VideoCallWindow::startMediaSession(const QString &peerHost, const QString &peerPort)
+{
+    bool ok = false;
+    quint16 port = peerPort.toUShort(&ok);
+    QHostAddress address(peerHost);
+    if (!ok || port == 0 || address.isNull()) {
+        qDebug() << "对端媒体地址无效，仅保留信令:" << peerHost << peerPort;
+        return;
+    }
     
-    // 设置标签的大小和位置
-    placeholderLabel->setGeometry(50, 100, 300, 100);
-    placeholderLabel->show();
+    m_mediaChannel->setPeer(address, port);
+    applyVideoLevel();
+    m_videoStream->start();
+    m_audioStream->setMuted(m_isMuted);
+    m_audioStream->start();
+    qDebug() << "媒体流已建立:" << peerHost << port;
+}
+
+void VideoCallWindow::stopMediaSession()
+{
+    m_videoStream->stop();
+    if (m_audioStream) {
+        m_audioStream->stop();
+    }
+    m_mediaChannel->setPeer(QHostAddress(), 0);
     
-    qDebug() << "远程视频占位符设置完成";
+    if (m_remoteVideoWidget->videoSink()) {
+        m_remoteVideoWidget->videoSink()->setVideoFrame(QVideoFrame());
+    }
+    if (m_remotePlaceholder) {
+        m_remotePlaceholder->setText("等待对方视频...");
+        m_remotePlaceholder->show();
+    }
+}
+
+void VideoCallWindow::applyVideoLevel()
+{
+    const CongestionController::Level &level = m_congestion.currentLevel();
+    m_videoStream->setTargetSize(level.size);
+    m_videoStream->setFrameRate(level.frameRate);
+    m_videoStream->setJpegQuality(level.jpegQuality);
+    applyCaptureFormat(level.size, level.frameRate);
+    qDebug() << "视频档位:" << level.name << level.frameRate << "fps 质量" << level.jpegQuality;
+}
+
+void VideoCallWindow::applyCaptureFormat(const QSize &size, int frameRate)
+{
+    if (!m_camera) {
+        return;
+    }
     
-    // 在通话开始后，模拟显示对方的视频
-    // 注意：在真实的应用中，这里应该接收并解码来自网络的视频流
-    QTimer::singleShot(3000, [this, placeholderLabel]() {
-        if (m_isCallActive) {
-            placeholderLabel->setText("对方视频连接中...\n\n注意：当前为演示版本\n实际应用需要实现视频流传输");
-            placeholderLabel->setStyleSheet(
-                "QLabel {"
-                "    color: #3498db;"
-                "    font-size: 14px;"
-                "    font-weight: bold;"
-                "    background-color: rgba(255, 255, 255, 0.9);"
-                "    border-radius: 8px;"
-                "    padding: 20px;"
-                "}"
-            );
+    // 选择不小于目标分辨率、帧率满足要求的最小采集格式，减少采集和缩放开销
+    QCameraFormat best;
+    const QList<QCameraFormat> formats = m_camera->cameraDevice().videoFormats();
+    for (const QCameraFormat &format : formats) {
+        const QSize resolution = format.resolution();
+        if (resolution.width() < size.width() || resolution.height() < size.height()
+            || format.maxFrameRate() < frameRate) {
+            continue;
         }
-    });
+        if (best.isNull() || resolution.width() * resolution.height()
+                             < best.resolution().width() * best.resolution().height()) {
+            best = format;
+        }
+    }
+    
+    if (!best.isNull() && best != m_camera->cameraFormat()) {
+        m_camera->setCameraFormat(best);
+    }
+}
+
+void VideoCallWindow::onReceiverReport(double lossFraction, int rttMs, int jitterMs)
+{
+    if (!m_isCallActive) {
+        return;
+    }
+    
+    CongestionController::Report report;
+    report.lossFraction = lossFraction;
+    report.rttMs = rttMs;
+    report.jitterMs = jitterMs;
+    if (m_congestion.onReport(report, m_congestionClock.elapsed())) {
+        applyVideoLevel();
+    }
+    
+    // 状态栏：进度条显示当前画质档位，摄像头状态后附链路统计
+    m_connectionProgress->setRange(0, m_congestion.levelCount() - 1);
+    m_connectionProgress->setValue(m_congestion.levelIndex());
+    m_connectionProgress->setFormat(QString("画质 %1").arg(m_congestion.currentLevel().name));
+    m_connectionProgress->setTextVisible(true);
+    m_connectionProgress->setVisible(true);
+    updateCameraStatus();
+}
+
+void VideoCallWindow::onLocalVideoFrame(const QVideoFrame &frame)
+{
+    if (m_isCallActive && m_isVideoEnabled) {
+        m_videoStream->sendFrame(frame);
+    }
+}
+
+void VideoCallWindow::onRemoteVideoFrame(const QImage &image)
+{
+    if (m_remotePlaceholder && m_remotePlaceholder->isVisible()) {
+        m_remotePlaceholder->hide();
+    }
+    m_remoteVideoWidget->videoSink()->setVideoFrame(VideoStream::imageToVideoFrame(image));
 }
 
 void VideoCallWindow::updateCameraStatus()
@@ -380,6 +470,10 @@ void VideoCallWindow::updateCameraStatus()
             status += QString(" (%1/%2)").arg(m_currentCameraIndex + 1).arg(m_availableCameras.size());
         }
         
+        if (m_isCallActive && m_mediaChannel->hasPeer()) {
+            status += " | " + m_congestion.statsText();
+        }
+        
         m_cameraStatusLabel->setText(status);
     }
 }
@@ -523,6 +617,7 @@ void VideoCallWindow::onHangupButtonClicked()
 {
     if (m_isCallActive) {
         sendCallEnd();
+        stopMediaSession();
         
         m_isCallActive = false;
         m_callButton->setEnabled(true);
@@ -547,16 +642,16 @@ void VideoCallWindow::onMuteButtonClicked()
     if (m_isMuted) {
         m_muteButton->setText("取消静音");
         m_muteButton->setIcon(style()->standardIcon(QStyle::SP_MediaVolumeMuted));
-        // 实际静音处理
-        if (m_audioInput) {
-            m_audioInput->setVolume(0.0);
+        // 静音期间不再发送音频帧，对端抖动缓冲会自行停止播放
+        if (m_audioStream) {
+            m_audioStream->setMuted(true);
         }
     } else {
         m_muteButton->setText("静音");
         m_muteButton->setIcon(style()->standardIcon(QStyle::SP_MediaVolume));
-        // 恢复音量
-        if (m_audioInput) {
-            m_audioInput->setVolume(1.0);
+        // 恢复发送
+        if (m_audioStream) {
+            m_audioStream->setMuted(false);
         }
     }
 }
@@ -580,8 +675,8 @@ void VideoCallWindow::onVideoToggleClicked()
 
 void VideoCallWindow::onVolumeChanged(int value)
 {
-    if (m_audioOutput) {
-        m_audioOutput->setVolume(value / 100.0);
+    if (m_audioStream) {
+        m_audioStream->setVolume(value / 100.0);
     }
     m_volumeLabel->setText(QString("音量: %1%").arg(value));
 }
@@ -641,6 +736,10 @@ void VideoCallWindow::onSocketDataReceived()
                     sendCallResponse(reply == QMessageBox::Yes);
                     
                     if (reply == QMessageBox::Yes) {
+                        // 新格式携带主叫的媒体地址: VIDEO_CALL_REQUEST#from#to#host#port
+                        if (parts.size() >= 5) {
+                            startMediaSession(parts[3], parts[4]);
+                        }
                         m_isCallActive = true;
                         m_callButton->setEnabled(false);
                         m_hangupButton->setEnabled(true);
@@ -667,6 +766,10 @@ void VideoCallWindow::onSocketDataReceived()
                 // 如果我是发起者，那么senderId应该是目标用户，receiverId应该是我
                 if (receiverId == m_userId && senderId == m_targetUserId) {
                     if (accepted == "true" || accepted == "1") {
+                        // 新格式携带被叫的媒体地址: VIDEO_CALL_RESPONSE#from#to#accepted#host#port
+                        if (parts.size() >= 6) {
+                            startMediaSession(parts[4], parts[5]);
+                        }
                         m_isCallActive = true;
                         m_callButton->setEnabled(false);
                         m_hangupButton->setEnabled(true);
@@ -704,7 +807,9 @@ void VideoCallWindow::onSocketDataReceived()
 
 void VideoCallWindow::sendCallRequest()
 {
-    QString message = QString("VIDEO_CALL_REQUEST#%1#%2").arg(m_userId, m_targetUserId);
+    // 附带本地媒体端口，服务器补上本端地址后转发给对方
+    QString message = QString("VIDEO_CALL_REQUEST#%1#%2#%3").arg(m_userId, m_targetUserId)
+                          .arg(m_mediaChannel->localPort());
     m_socket->write(message.toUtf8() + "\n");
 }
 
@@ -712,7 +817,8 @@ void VideoCallWindow::sendCallResponse(bool accept)
 {
     QString acceptStr = accept ? "true" : "false";
     // 发送响应时：我是发送者，目标用户是接收者
-    QString message = QString("VIDEO_CALL_RESPONSE#%1#%2#%3").arg(m_userId, m_targetUserId, acceptStr);
+    QString message = QString("VIDEO_CALL_RESPONSE#%1#%2#%3#%4").arg(m_userId, m_targetUserId, acceptStr)
+                          .arg(m_mediaChannel->localPort());
     
     qDebug() << "发送通话响应:" << message;
     qDebug() << "响应内容: 发送者=" << m_userId << "接收者=" << m_targetUserId << "接受=" << acceptStr;
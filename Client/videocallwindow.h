@@ -10,8 +10,6 @@
 #include <QVideoWidget>
 #include <QCamera>
 #include <QMediaCaptureSession>
-#include <QAudioInput>
-#include <QAudioOutput>
 #include <QSlider>
 #include <QTextEdit>
 #include <QLineEdit>
@@ -22,6 +20,13 @@
 #include <QGroupBox>
 #include <QSplitter>
 #include <QMediaDevices>
+#include <QVideoSink>
+#include <QVideoFrame>
+#include <QElapsedTimer>
+#include "MediaChannel.h"
+#include "VideoStream.h"
+#include "AudioStream.h"
+#include "CongestionController.h"
 
 class VideoCallWindow : public QDialog
 {
@@ -46,6 +51,9 @@ private slots:
     void onSocketDataReceived();
     void onCameraStateChanged();
     void onCameraError(QCamera::Error error);
+    void onLocalVideoFrame(const QVideoFrame &frame); // 本地摄像头帧 -> 编码发送
+    void onRemoteVideoFrame(const QImage &image);     // 解码后的对方画面 -> 渲染
+    void onReceiverReport(double lossFraction, int rttMs, int jitterMs); // 对端接收报告 -> 拥塞控制
 
 private:
     void setupUI();
@@ -60,6 +68,10 @@ private:
     void sendCallEnd();
     void updateCameraStatus();
     void setupRemoteVideoPlaceholder();
+    void startMediaSession(const QString &peerHost, const QString &peerPort); // 按信令交换的地址建立点对点媒体流
+    void stopMediaSession();
+    void applyVideoLevel();  // 按拥塞控制的当前档位设置采集格式与编码参数
+    void applyCaptureFormat(const QSize &size, int frameRate);
 
     // UI组件
     QVBoxLayout *m_mainLayout;
@@ -72,8 +84,7 @@ private:
     QVideoWidget *m_remoteVideoWidget;
     QCamera *m_camera;
     QMediaCaptureSession *m_captureSession;
-    QAudioInput *m_audioInput;
-    QAudioOutput *m_audioOutput;
+    AudioStream *m_audioStream;
     
     // 控制按钮
     QPushButton *m_callButton;
@@ -105,6 +116,13 @@ private:
     QString m_targetUserId;
     QString m_targetUserName;
     
+    // 点对点媒体通道与视频流
+    MediaChannel *m_mediaChannel;
+    VideoStream *m_videoStream;
+    QLabel *m_remotePlaceholder;
+    CongestionController m_congestion;
+    QElapsedTimer m_congestionClock;
+
     // 可用摄像头列表
     QList<QCameraDevice> m_availableCameras;
     
@@ -0,0 +1,153 @@
+#include "CborRowWriter.h"
+#include <climits>
+
+CborRowWriter::CborRowWriter(QIODevice *device, const QByteArray &prefix, int chunkSize)
+    : m_device(device), m_prefix(prefix), m_buffer(&m_payload), m_writer(&m_buffer), m_chunkSize(chunkSize)
+{
+    // 块头要写出负载长度，一块在内存中编码完成后再写出，之后复用同一块内存
+    m_payload.reserve(m_chunkSize + 1024);
+    m_buffer.open(QIODevice::WriteOnly);
+}
+
+void CborRowWriter::beginRow()
+{
+    m_rowTimer.start();
+    if (!m_chunkOpen) {
+        startChunk();
+    }
+    m_row.fill(QCborValue(), m_columns.size());
+    m_cursor = 0;
+}
+
+void CborRowWriter::endRow()
+{
+    m_writer.startArray(m_row.size());
+    for (const QCborValue &value : std::as_const(m_row)) {
+        value.toCbor(m_writer);
+    }
+    m_writer.endArray();
+    m_rowCount++;
+
+    m_encodeNsecs += m_rowTimer.nsecsElapsed();
+
+    if (m_payload.size() >= m_chunkSize) {
+        flushChunk();
+    }
+}
+
+void CborRowWriter::addString(const char *key, const QString &value)
+{
+    setField(key, QCborValue(value));
+}
+
+void CborRowWriter::addNumber(const char *key, double value)
+{
+    setField(key, QCborValue(value));
+}
+
+void CborRowWriter::addInt(const char *key, qint64 value)
+{
+    setField(key, QCborValue(value));
+}
+
+void CborRowWriter::addNull(const char *key)
+{
+    setField(key, QCborValue(QCborValue::Null));
+}
+
+void CborRowWriter::setField(const char *key, const QCborValue &value)
+{
+    // 各行字段顺序相同，通常游标处即为目标列，无需查找
+    int column = -1;
+    if (m_cursor < m_columns.size() && m_columns[m_cursor] == key) {
+        column = m_cursor;
+    } else {
+        for (int i = 0; i < m_columns.size(); ++i) {
+            if (m_columns[i] == key) {
+                column = i;
+                break;
+            }
+        }
+    }
+
+    // 新出现的列追加到末尾，同一块中之前的行在解码时按 null 补齐
+    if (column < 0) {
+        m_columns.append(QByteArray(key));
+        column = m_columns.size() - 1;
+    }
+    if (column >= m_row.size()) {
+        m_row.resize(column + 1);
+    }
+
+    m_row[column] = value;
+    m_cursor = column + 1;
+}
+
+void CborRowWriter::startChunk()
+{
+    m_writer.startMap(2);
+    m_writer.append(QLatin1String("rows"));
+    m_writer.startArray(); // 不定长数组，块内行数无需预先知道
+    m_chunkOpen = true;
+}
+
+void CborRowWriter::flushChunk()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // 列名放在块尾，块内新出现的列也包含在内
+    m_writer.endArray();
+    m_writer.append(QLatin1String("columns"));
+    m_writer.startArray(m_columns.size());
+    for (const QByteArray &column : std::as_const(m_columns)) {
+        m_writer.append(QLatin1String(column));
+    }
+    m_writer.endArray();
+    m_writer.endMap();
+    m_chunkOpen = false;
+
+    m_encodeNsecs += timer.nsecsElapsed();
+
+    write("@cbor#" + QByteArray::number(m_payload.size()) + "\n");
+    write(m_payload);
+
+    // resize(0) 保留已分配的容量，下一块继续复用
+    m_payload.resize(0);
+    m_buffer.seek(0);
+}
+
+void CborRowWriter::write(const QByteArray &data)
+{
+    if (!m_prefixWritten) {
+        m_prefixWritten = true;
+        write(m_prefix);
+    }
+
+    // 峰值按 编码缓冲 + 连接发送缓冲中尚未发出的字节 计算，与 JsonRowWriter 一致
+    qint64 pending = m_device ? m_device->bytesToWrite() : 0;
+    m_peakBufferSize = qMax(m_peakBufferSize, static_cast<int>(qMin<qint64>(pending + m_payload.size(), INT_MAX)));
+    if (m_device) {
+        m_device->write(data);
+    }
+    m_bytesWritten += data.size();
+}
+
+void CborRowWriter::finish(const QByteArray &suffix)
+{
+    Q_UNUSED(suffix);
+
+    if (m_finished) {
+        return;
+    }
+    m_finished = true;
+
+    // 没有任何行时也输出一个空块，客户端据此得到列表为空
+    if (m_chunkOpen || m_rowCount == 0) {
+        if (!m_chunkOpen) {
+            startChunk();
+        }
+        flushChunk();
+    }
+    write("@cbor#0\n");
+}
@@ -0,0 +1,63 @@
+#ifndef CBORROWWRITER_H
+#define CBORROWWRITER_H
+
+#include "RowWriter.h"
+#include <QIODevice>
+#include <QBuffer>
+#include <QCborStreamWriter>
+#include <QCborValue>
+#include <QElapsedTimer>
+#include <QVector>
+
+// 以 CBOR 输出列表响应，供协商了 cbor 编码的连接使用
+// 负载按块输出，每块为 { "rows": [[v1, v2, ...], ...], "columns": ["k1", "k2", ...] }：
+// 字段名每块只写一次，数值直接以二进制写入，不做浮点数到字符串的格式化
+// CBOR 是二进制数据，可能包含 '\n' 和 '#'，因此每块前加长度头，整个响应为
+// prefix + ("@cbor#<字节数>\n" + 块)... + "@cbor#0\n"；块满即写入 socket，与 JSON 一样不在内存中保留整个响应
+class CborRowWriter : public RowWriter
+{
+public:
+    CborRowWriter(QIODevice *device, const QByteArray &prefix, int chunkSize = 16 * 1024);
+
+    void beginRow() override;
+    void endRow() override;
+
+    void addString(const char *key, const QString &value) override;
+    void addNumber(const char *key, double value) override;
+    void addInt(const char *key, qint64 value) override;
+    void addNull(const char *key) override; // 写入 null 占位，保持列对齐
+
+    void finish(const QByteArray &suffix = QByteArray()) override; // 以 "@cbor#0\n" 结尾，suffix 仅对文本帧有意义，这里忽略
+
+    const char *encodingName() const override { return "cbor"; }
+    int rowCount() const override { return m_rowCount; }
+    qint64 bytesWritten() const override { return m_bytesWritten; }
+    int peakBufferSize() const override { return m_peakBufferSize; }
+    qint64 encodeNsecs() const override { return m_encodeNsecs; }
+
+private:
+    void setField(const char *key, const QCborValue &value);
+    void startChunk();
+    void flushChunk();
+    void write(const QByteArray &data);
+
+    QIODevice *m_device;
+    QByteArray m_prefix;
+    QByteArray m_payload;
+    QBuffer m_buffer;
+    QCborStreamWriter m_writer;
+    QVector<QByteArray> m_columns;
+    QVector<QCborValue> m_row;
+    QElapsedTimer m_rowTimer;
+    int m_chunkSize;
+    int m_cursor = 0;
+    int m_rowCount = 0;
+    bool m_chunkOpen = false;
+    bool m_prefixWritten = false;
+    bool m_finished = false;
+    qint64 m_bytesWritten = 0;
+    int m_peakBufferSize = 0;
+    qint64 m_encodeNsecs = 0;
+};
+
+#endif // CBORROWWRITER_H
@@ -0,0 +1,23 @@
+#include "FramedRowWriter.h"
+
+FramedRowWriter::FramedRowWriter(const InnerFactory &makeInner, const FrameSink &sink)
+    : m_buffer(&m_frame), m_sink(sink)
+{
+    m_buffer.open(QIODevice::WriteOnly);
+    m_inner = makeInner(&m_buffer);
+}
+
+void FramedRowWriter::finish(const QByteArray &suffix)
+{
+    if (m_finished) {
+        return;
+    }
+    m_finished = true;
+
+    m_inner->finish(suffix);
+    m_buffer.close();
+
+    if (m_sink) {
+        m_sink(m_frame);
+    }
+}
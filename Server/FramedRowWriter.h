@@ -0,0 +1,43 @@
+#ifndef FRAMEDROWWRITER_H
+#define FRAMEDROWWRITER_H
+
+#include "RowWriter.h"
+#include <QBuffer>
+#include <functional>
+#include <memory>
+
+// 把内层 RowWriter 的输出先收集成完整的一帧，再交给 sink 发送
+// 用于启用了传输压缩的连接：压缩需要完整数据，无法边取数边写 socket
+class FramedRowWriter : public RowWriter
+{
+public:
+    using InnerFactory = std::function<std::unique_ptr<RowWriter>(QIODevice *device)>;
+    using FrameSink = std::function<void(const QByteArray &frame)>;
+
+    FramedRowWriter(const InnerFactory &makeInner, const FrameSink &sink);
+
+    void beginRow() override { m_inner->beginRow(); }
+    void endRow() override { m_inner->endRow(); }
+
+    void addString(const char *key, const QString &value) override { m_inner->addString(key, value); }
+    void addNumber(const char *key, double value) override { m_inner->addNumber(key, value); }
+    void addInt(const char *key, qint64 value) override { m_inner->addInt(key, value); }
+    void addNull(const char *key) override { m_inner->addNull(key); }
+
+    void finish(const QByteArray &suffix = QByteArray()) override;
+
+    const char *encodingName() const override { return m_inner->encodingName(); }
+    int rowCount() const override { return m_inner->rowCount(); }
+    qint64 bytesWritten() const override { return m_inner->bytesWritten(); }
+    int peakBufferSize() const override { return m_frame.size(); } // 整帧都在内存中
+    qint64 encodeNsecs() const override { return m_inner->encodeNsecs(); }
+
+private:
+    QByteArray m_frame;
+    QBuffer m_buffer;
+    std::unique_ptr<RowWriter> m_inner;
+    FrameSink m_sink;
+    bool m_finished = false;
+};
+
+#endif // FRAMEDROWWRITER_H
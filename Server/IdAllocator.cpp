@@ -0,0 +1,103 @@
+#include "IdAllocator.h"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QDebug>
+
+IdAllocator::IdAllocator(int blockSize) : m_blockSize(blockSize)
+{
+}
+
+void IdAllocator::setDatabase(const QSqlDatabase &db)
+{
+    QMutexLocker locker(&m_mutex);
+    m_db = db;
+    m_ranges.clear();
+}
+
+bool IdAllocator::ensureFloor(const QString &prefix, qint64 floor)
+{
+    QMutexLocker locker(&m_mutex);
+
+    QSqlQuery query(m_db);
+    query.prepare("INSERT OR IGNORE INTO id_block (prefix, next_hi) VALUES (:prefix, 0)");
+    query.bindValue(":prefix", prefix);
+    if (!query.exec()) {
+        qDebug() << "ID号段初始化失败:" << prefix << query.lastError().text();
+        return false;
+    }
+
+    // floor 所在的号段由本进程接管：数据库记录跳过该号段，内存中从 floor + 1 接着分配到号段末尾，
+    // 不会因为号段对齐而跳号（如已有 0010 时下一个是 0011 而不是 0101）
+    qint64 hi = floor / m_blockSize;
+    query.prepare("SELECT next_hi FROM id_block WHERE prefix = :prefix");
+    query.bindValue(":prefix", prefix);
+    if (!query.exec() || !query.next()) {
+        qDebug() << "ID号段初始化失败:" << prefix << query.lastError().text();
+        return false;
+    }
+    if (query.value(0).toLongLong() > hi + 1) {
+        return true; // 该号段之后的号段已被预留过，后续分配本来就大于 floor
+    }
+
+    query.prepare("UPDATE id_block SET next_hi = :next_hi WHERE prefix = :prefix");
+    query.bindValue(":next_hi", hi + 1);
+    query.bindValue(":prefix", prefix);
+    if (!query.exec()) {
+        qDebug() << "ID号段初始化失败:" << prefix << query.lastError().text();
+        return false;
+    }
+
+    Range &range = m_ranges[prefix];
+    if (range.next <= floor) {
+        range.next = floor + 1;
+        range.limit = (hi + 1) * m_blockSize;
+    }
+    return true;
+}
+
+qint64 IdAllocator::next(const QString &prefix)
+{
+    QMutexLocker locker(&m_mutex);
+
+    Range &range = m_ranges[prefix];
+    if (range.next == 0 || range.next > range.limit) {
+        if (!reserveBlock(prefix, range)) {
+            return -1;
+        }
+    }
+    return range.next++;
+}
+
+// 从数据库预留一个新号段，号段为 [hi * blockSize + 1, (hi + 1) * blockSize]
+bool IdAllocator::reserveBlock(const QString &prefix, Range &range)
+{
+    QSqlQuery query(m_db);
+    query.prepare("INSERT OR IGNORE INTO id_block (prefix, next_hi) VALUES (:prefix, 0)");
+    query.bindValue(":prefix", prefix);
+    if (!query.exec()) {
+        qDebug() << "ID号段预留失败:" << prefix << query.lastError().text();
+        return false;
+    }
+
+    // 号段不低于本进程已用过的号段，即使外层事务回滚了上次的预留也不会重复分配
+    query.prepare("UPDATE id_block SET next_hi = MAX(next_hi, :used_hi) + 1 WHERE prefix = :prefix");
+    query.bindValue(":used_hi", range.limit / m_blockSize);
+    query.bindValue(":prefix", prefix);
+    if (!query.exec()) {
+        qDebug() << "ID号段预留失败:" << prefix << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("SELECT next_hi FROM id_block WHERE prefix = :prefix");
+    query.bindValue(":prefix", prefix);
+    if (!query.exec() || !query.next()) {
+        qDebug() << "ID号段预留失败:" << prefix << query.lastError().text();
+        return false;
+    }
+
+    qint64 hi = query.value(0).toLongLong() - 1;
+    range.next = hi * m_blockSize + 1;
+    range.limit = (hi + 1) * m_blockSize;
+    qDebug() << "预留ID号段:" << prefix << range.next << "~" << range.limit;
+    return true;
+}
@@ -0,0 +1,35 @@
+#ifndef IDALLOCATOR_H
+#define IDALLOCATOR_H
+
+#include <QSqlDatabase>
+#include <QString>
+#include <QHash>
+#include <QMutex>
+
+// 按前缀分配递增序号（hi/lo 方式）
+// 数据库 id_block 表只记录每个前缀已预留到第几个号段（hi），号段内的序号（lo）在内存中分配，
+// 大部分分配不访问数据库；进程重启后未用完的号段直接跳过，序号仍保持递增
+class IdAllocator
+{
+public:
+    explicit IdAllocator(int blockSize = 100);
+
+    void setDatabase(const QSqlDatabase &db);
+    bool ensureFloor(const QString &prefix, qint64 floor); // 后续从 floor + 1 开始分配（用于接管已有数据）
+    qint64 next(const QString &prefix);                    // 分配下一个序号，失败返回 -1
+
+private:
+    struct Range {
+        qint64 next = 0;  // 下一个可用序号
+        qint64 limit = 0; // 号段内最后一个序号
+    };
+
+    bool reserveBlock(const QString &prefix, Range &range);
+
+    QSqlDatabase m_db;
+    int m_blockSize;
+    QMutex m_mutex;
+    QHash<QString, Range> m_ranges;
+};
+
+#endif // IDALLOCATOR_H
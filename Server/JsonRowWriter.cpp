@@ -0,0 +1,139 @@
+#include "JsonRowWriter.h"
+#include <QLocale>
+#include <cmath>
+#include <climits>
+
+JsonRowWriter::JsonRowWriter(QIODevice *device, const QByteArray &prefix, int chunkSize)
+    : m_device(device), m_chunkSize(chunkSize)
+{
+    // 预留一个块的容量（留出最后一行的余量），之后反复复用同一块内存
+    m_buffer.reserve(m_chunkSize + 1024);
+    m_buffer.append(prefix);
+    m_buffer.append('[');
+}
+
+void JsonRowWriter::beginRow()
+{
+    m_rowTimer.start();
+    if (m_rowCount > 0) {
+        m_buffer.append(',');
+    }
+    m_buffer.append('{');
+    m_firstField = true;
+}
+
+void JsonRowWriter::endRow()
+{
+    m_buffer.append('}');
+    m_rowCount++;
+    m_encodeNsecs += m_rowTimer.nsecsElapsed();
+    flushIfFull();
+}
+
+void JsonRowWriter::addString(const char *key, const QString &value)
+{
+    writeKey(key);
+    m_buffer.append('"');
+    appendEscaped(value);
+    m_buffer.append('"');
+}
+
+void JsonRowWriter::addNumber(const char *key, double value)
+{
+    writeKey(key);
+    if (std::isfinite(value)) {
+        // 与 QJsonDocument 一致：使用最短可还原表示，整数值不带小数部分
+        m_buffer.append(QByteArray::number(value, 'g', QLocale::FloatingPointShortest));
+    } else {
+        m_buffer.append("null");
+    }
+}
+
+void JsonRowWriter::addInt(const char *key, qint64 value)
+{
+    writeKey(key);
+    m_buffer.append(QByteArray::number(value));
+}
+
+void JsonRowWriter::addNull(const char *key)
+{
+    Q_UNUSED(key);
+}
+
+void JsonRowWriter::finish(const QByteArray &suffix)
+{
+    if (m_finished) {
+        return;
+    }
+    m_finished = true;
+
+    m_buffer.append(']');
+    m_buffer.append(suffix);
+    flush();
+}
+
+void JsonRowWriter::writeKey(const char *key)
+{
+    if (!m_firstField) {
+        m_buffer.append(',');
+    }
+    m_firstField = false;
+
+    m_buffer.append('"');
+    m_buffer.append(key);
+    m_buffer.append("\":", 2);
+}
+
+void JsonRowWriter::appendEscaped(const QString &value)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+
+    const QByteArray utf8 = value.toUtf8();
+    for (char ch : utf8) {
+        const unsigned char c = static_cast<unsigned char>(ch);
+        switch (c) {
+        case '"':  m_buffer.append("\\\"", 2); break;
+        case '\\': m_buffer.append("\\\\", 2); break;
+        case '\n': m_buffer.append("\\n", 2); break;
+        case '\r': m_buffer.append("\\r", 2); break;
+        case '\t': m_buffer.append("\\t", 2); break;
+        case '\b': m_buffer.append("\\b", 2); break;
+        case '\f': m_buffer.append("\\f", 2); break;
+        default:
+            if (c < 0x20) {
+                // 其余控制字符按 \u00XX 转义；非 ASCII 字节按 UTF-8 原样输出
+                m_buffer.append("\\u00", 4);
+                m_buffer.append(hexDigits[c >> 4]);
+                m_buffer.append(hexDigits[c & 0x0f]);
+            } else {
+                m_buffer.append(ch);
+            }
+            break;
+        }
+    }
+}
+
+void JsonRowWriter::flushIfFull()
+{
+    if (m_buffer.size() >= m_chunkSize) {
+        flush();
+    }
+}
+
+void JsonRowWriter::flush()
+{
+    if (m_buffer.isEmpty()) {
+        return;
+    }
+
+    // 峰值按 编码缓冲 + 连接发送缓冲中尚未发出的字节 计算，即该响应实际占用的内存上限
+    qint64 pending = m_device ? m_device->bytesToWrite() : 0;
+    m_peakBufferSize = qMax(m_peakBufferSize, static_cast<int>(qMin<qint64>(pending + m_buffer.size(), INT_MAX)));
+    if (m_device) {
+        m_device->write(m_buffer);
+    }
+    m_bytesWritten += m_buffer.size();
+
+    // resize(0) 保留已分配的容量，下一块继续复用
+    m_buffer.resize(0);
+}
@@ -0,0 +1,51 @@
+#ifndef JSONROWWRITER_H
+#define JSONROWWRITER_H
+
+#include "RowWriter.h"
+#include <QIODevice>
+#include <QElapsedTimer>
+
+// 把查询结果逐行写成 JSON 数组，直接输出到连接上
+// 响应格式为 prefix + [ {...}, {...} ] + suffix，只在内存中保留一个固定大小的缓冲块，
+// 块满即写入 socket，不再先构建 QJsonArray / QJsonDocument / QString 的多份完整副本；
+// socket 发送缓冲的积压由调用方按 bytesToWrite 控制取行节奏（见 Server::pumpRowStream）
+class JsonRowWriter : public RowWriter
+{
+public:
+    explicit JsonRowWriter(QIODevice *device, const QByteArray &prefix, int chunkSize = 16 * 1024);
+
+    void beginRow() override;
+    void endRow() override;
+
+    void addString(const char *key, const QString &value) override;
+    void addNumber(const char *key, double value) override;
+    void addInt(const char *key, qint64 value) override;
+    void addNull(const char *key) override; // JSON 中直接省略该字段，与原有输出保持一致
+
+    void finish(const QByteArray &suffix = QByteArray()) override; // 写入数组结尾和 suffix 并输出剩余缓冲
+
+    const char *encodingName() const override { return "json"; }
+    int rowCount() const override { return m_rowCount; }
+    qint64 bytesWritten() const override { return m_bytesWritten; }
+    int peakBufferSize() const override { return m_peakBufferSize; } // 编码缓冲与连接发送缓冲合计的峰值，用于评估内存占用
+    qint64 encodeNsecs() const override { return m_encodeNsecs; }
+
+private:
+    void writeKey(const char *key);
+    void appendEscaped(const QString &value);
+    void flushIfFull();
+    void flush();
+
+    QIODevice *m_device;
+    QByteArray m_buffer;
+    int m_chunkSize;
+    int m_rowCount = 0;
+    bool m_firstField = true;
+    bool m_finished = false;
+    qint64 m_bytesWritten = 0;
+    int m_peakBufferSize = 0;
+    QElapsedTimer m_rowTimer;
+    qint64 m_encodeNsecs = 0;
+};
+
+#endif // JSONROWWRITER_H
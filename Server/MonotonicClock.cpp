@@ -0,0 +1,67 @@
+#include "MonotonicClock.h"
+
+QDateTime MonotonicClock::Timestamp::toDateTime() const
+{
+    return QDateTime::fromMSecsSinceEpoch(physicalMs).toUTC();
+}
+
+QString MonotonicClock::Timestamp::toUtcString() const
+{
+    return toDateTime().toString("yyyy-MM-dd hh:mm:ss.zzz") + QString("%1").arg(logical, 6, 10, QLatin1Char('0'));
+}
+
+QString MonotonicClock::Timestamp::toLocalString() const
+{
+    return toDateTime().toLocalTime().toString("yyyy-MM-dd hh:mm:ss.zzz") + QString("%1").arg(logical, 6, 10, QLatin1Char('0'));
+}
+
+bool MonotonicClock::Timestamp::operator<(const Timestamp &other) const
+{
+    if (physicalMs != other.physicalMs) {
+        return physicalMs < other.physicalMs;
+    }
+    return logical < other.logical;
+}
+
+MonotonicClock::Timestamp MonotonicClock::now()
+{
+    QMutexLocker locker(&m_mutex);
+
+    qint64 wallMs = QDateTime::currentMSecsSinceEpoch();
+    if (wallMs > m_last.physicalMs) {
+        m_last.physicalMs = wallMs;
+        m_last.logical = 0;
+    } else {
+        // 系统时间回拨或同一毫秒内多次取值：沿用上次物理时间，逻辑计数递增
+        ++m_last.logical;
+    }
+    if (m_last.logical > MAX_LOGICAL) {
+        ++m_last.physicalMs;
+        m_last.logical = 0;
+    }
+    return m_last;
+}
+
+MonotonicClock::Timestamp MonotonicClock::update(const Timestamp &remote)
+{
+    QMutexLocker locker(&m_mutex);
+
+    qint64 wallMs = QDateTime::currentMSecsSinceEpoch();
+    qint64 physical = qMax(wallMs, qMax(m_last.physicalMs, remote.physicalMs));
+
+    if (physical == m_last.physicalMs && physical == remote.physicalMs) {
+        m_last.logical = qMax(m_last.logical, remote.logical) + 1;
+    } else if (physical == m_last.physicalMs) {
+        ++m_last.logical;
+    } else if (physical == remote.physicalMs) {
+        m_last.logical = remote.logical + 1;
+    } else {
+        m_last.logical = 0;
+    }
+    m_last.physicalMs = physical;
+    if (m_last.logical > MAX_LOGICAL) {
+        ++m_last.physicalMs;
+        m_last.logical = 0;
+    }
+    return m_last;
+}
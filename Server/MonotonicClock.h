@@ -0,0 +1,37 @@
+#ifndef MONOTONICCLOCK_H
+#define MONOTONICCLOCK_H
+
+#include <QDateTime>
+#include <QString>
+#include <QMutex>
+
+// 进程内单调时钟：为每次写操作生成时间戳，保证同一进程内严格递增
+// 采用混合逻辑时钟（HLC）结构：物理毫秒 + 逻辑计数，多节点部署时可通过 update() 合并远端时间戳
+class MonotonicClock
+{
+public:
+    struct Timestamp {
+        qint64 physicalMs = 0; // 物理时间（UTC毫秒）
+        quint32 logical = 0;   // 同一毫秒内的逻辑计数
+
+        // 字符串保留毫秒和逻辑计数：yyyy-MM-dd hh:mm:ss.zzz + 6位计数，按字符串排序即按时间戳排序，
+        // SQLite 日期函数把多出的位数当作小数秒，仍可正常解析；界面显示时取前19位即到秒
+        QDateTime toDateTime() const;
+        QString toUtcString() const;   // UTC 时间
+        QString toLocalString() const; // 本地时间，业务记录（处方、缴费、预约等）统一使用
+        bool operator<(const Timestamp &other) const;
+    };
+
+    static const quint32 MAX_LOGICAL = 999999; // 计数达到上限时借用下一毫秒，保证字符串定长
+
+    MonotonicClock() = default;
+
+    Timestamp now();                           // 本地事件：取当前时间戳
+    Timestamp update(const Timestamp &remote); // 收到远端时间戳时合并，保证因果顺序
+
+private:
+    QMutex m_mutex;
+    Timestamp m_last;
+};
+
+#endif // MONOTONICCLOCK_H
@@ -0,0 +1,30 @@
+#ifndef ROWWRITER_H
+#define ROWWRITER_H
+
+#include <QByteArray>
+#include <QString>
+
+// 列表响应的逐行输出接口，具体编码（JSON / CBOR）由连接协商结果决定
+class RowWriter
+{
+public:
+    virtual ~RowWriter() = default;
+
+    virtual void beginRow() = 0;
+    virtual void endRow() = 0;
+
+    virtual void addString(const char *key, const QString &value) = 0;
+    virtual void addNumber(const char *key, double value) = 0;
+    virtual void addInt(const char *key, qint64 value) = 0;
+    virtual void addNull(const char *key) = 0; // 字段缺失
+
+    virtual void finish(const QByteArray &suffix = QByteArray()) = 0;
+
+    virtual const char *encodingName() const = 0;
+    virtual int rowCount() const = 0;
+    virtual qint64 bytesWritten() const = 0;
+    virtual int peakBufferSize() const = 0; // 响应占用内存的峰值：编码缓冲加上连接发送缓冲中尚未发出的字节
+    virtual qint64 encodeNsecs() const = 0; // 行编码累计耗时（beginRow 到 endRow 及收尾），用于对比不同编码
+};
+
+#endif // ROWWRITER_H
@@ -6,12 +6,23 @@ TEMPLATE = app
 INCLUDEPATH += $$PWD  # 添加当前目录到头文件搜索路径
 
 SOURCES += \
+    CborRowWriter.cpp \
     ClientHandlerThread.cpp \
+    FramedRowWriter.cpp \
+    IdAllocator.cpp \
+    JsonRowWriter.cpp \
+    MonotonicClock.cpp \
     main.cpp \
     server.cpp
 
 HEADERS += \
+    CborRowWriter.h \
     ClientHandlerThread.h \
+    FramedRowWriter.h \
+    IdAllocator.h \
+    JsonRowWriter.h \
+    MonotonicClock.h \
+    RowWriter.h \
     server.h \
 
 FORMS += \
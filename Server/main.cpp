@@ -6,6 +6,10 @@ int main(int argc, char *argv[])
     QApplication a(argc, argv);
 
     Server server;
+    // --sync-messages：每条聊天消息提交成功后再回执（默认批量提交）
+    if (a.arguments().contains("--sync-messages")) {
+        server.setMessageDurability(Server::MessageDurability::Sync);
+    }
     server.start();  // 启动服务器
 
     return a.exec();
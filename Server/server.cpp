@@ -1,14 +1,48 @@
 #include "server.h"
 #include "ClientHandlerThread.h"
+#include "JsonRowWriter.h"
+#include "CborRowWriter.h"
+#include "FramedRowWriter.h"
+#include <QElapsedTimer>
+#include <QSqlRecord>
+#include <QCryptographicHash>
+#include <QImageReader>
+#include <QSaveFile>
 #include <QJsonObject>
 #include <QJsonDocument>
 #include <QJsonArray>
 #include <QSet>
+#include <QUuid>
 #include <QCoreApplication> // 包含QCoreApplication类的定义
+#include <algorithm>
+#include <iterator>
 
 Server::Server(QObject *parent) : QObject(parent)
 {
     m_server = new QTcpServer(this);
+    m_idempotencyCache.setMaxCost(1024); // 最多缓存1024条幂等响应，超出后按LRU淘汰
+
+    m_nextMessageId = 1;
+    m_chatEpoch = QUuid::createUuid().toString(QUuid::WithoutBraces);
+    m_messageDurability = MessageDurability::Batched;
+    m_messageFlushTimer = new QTimer(this);
+    m_messageFlushTimer->setSingleShot(true);
+    connect(m_messageFlushTimer, &QTimer::timeout, this, &Server::flushPendingMessages);
+
+    m_absenceTimer = new QTimer(this);
+    connect(m_absenceTimer, &QTimer::timeout, this, &Server::markAbsences);
+}
+
+Server::~Server()
+{
+    // 退出前把尚未落盘的聊天消息写入数据库
+    flushPendingMessages();
+}
+
+void Server::setMessageDurability(MessageDurability mode)
+{
+    m_messageDurability = mode;
+    qDebug() << "聊天消息落盘模式:" << (mode == MessageDurability::Sync ? "同步提交" : "批量提交");
 }
 
 void Server::initializeDatabase()
@@ -42,55 +76,64 @@ void Server::initializeDatabase()
     query.exec("DROP TABLE IF EXISTS patient");
     query.exec("DROP TABLE IF EXISTS doctor");
     query.exec("DROP TABLE IF EXISTS attendance");
+    query.exec("DROP TABLE IF EXISTS attendance_monthly");
+    query.exec("DROP TABLE IF EXISTS doctor_shift");
     query.exec("DROP TABLE IF EXISTS appointment");
     query.exec("DROP TABLE IF EXISTS leave");
     query.exec("DROP TABLE IF EXISTS message");
+    query.exec("DROP TABLE IF EXISTS attachment");
 
     query.exec("CREATE TABLE IF NOT EXISTS user ("
                "id TEXT PRIMARY KEY,"
                "username TEXT NOT NULL,"
                "password TEXT NOT NULL,"
                "avatar_path TEXT NOT NULL,"
+               "avatar_hash TEXT,"  // 通过 AVATAR_UPLOAD 上传的头像内容哈希（SHA-256），示例头像为空
                "real_name TEXT NOT NULL CHECK(real_name GLOB '*[一-龥]*'),"  // 确保包含至少一个汉字
                "birth_date TEXT NOT NULL,"  // 格式: YYYY-MM-DD
                "id_card TEXT NOT NULL,"  // 18位身份证号
                "phone TEXT NOT NULL,"  // 11位数字
-               "email TEXT NOT NULL"  // 包含@和.
+               "email TEXT NOT NULL,"  // 包含@和.
+               "gender TEXT,"  // 由身份证号在注册/保存资料时推断：男/女
+               "id_birth_date TEXT"  // 由身份证号推断的出生日期 YYYY-MM-DD，年龄在查询时由SQL计算
                ")");
 
     // 插入示例用户（添加额外字段）
     QVector<QStringList> users = {
         // id, username, password, avatar_path, real_name, birth_date, id_card, phone, email
         // 病人用户
-        {"110001", "张三", "123", "1.jpeg", "张三", "1990-01-01", "110101199001011234", "13800138001", "zhangsan@example.com"},
-        {"110002", "李四", "123", "2.jpeg", "李四", "1992-05-15", "210102199205152345", "13900139002", "lisi@example.com"},
-        {"110003", "王五", "123", "3.jpeg", "王五", "1988-11-30", "310103198811303456", "13700137003", "wangwu@example.com"},
-        {"110004", "刘六", "123", "7.jpeg", "刘六", "1985-08-12", "420104198508123456", "13600136007", "liuliu@example.com"},
-        {"110005", "陈七", "123", "8.jpeg", "陈七", "1978-03-25", "510105197803253456", "13500135008", "chenqi@example.com"},
-        {"110006", "赵八", "123", "9.jpeg", "赵八", "1995-11-08", "610106199511083456", "13400134009", "zhaoba@example.com"},
-        {"110007", "钱九", "123", "10.jpeg", "钱九", "1982-07-19", "710107198207193456", "13300133010", "qianjiu@example.com"},
-        {"110008", "孙十", "123", "11.jpeg", "孙十", "1991-02-14", "810108199102143456", "13200132011", "sunshi@example.com"},
-        {"110009", "周十一", "123", "12.jpeg", "周十一", "1987-09-30", "910109198709303456", "13100131012", "zhoushiyi@example.com"},
-        {"110010", "吴十二", "123", "13.jpeg", "吴十二", "1980-12-05", "101010198012053456", "13000130013", "wushier@example.com"},
+        {"11000001", "张三", "123", "1.jpeg", "张三", "1990-01-01", "110101199001011234", "13800138001", "zhangsan@example.com"},
+        {"11000002", "李四", "123", "2.jpeg", "李四", "1992-05-15", "210102199205152345", "13900139002", "lisi@example.com"},
+        {"11000003", "王五", "123", "3.jpeg", "王五", "1988-11-30", "310103198811303456", "13700137003", "wangwu@example.com"},
+        {"11000004", "刘六", "123", "7.jpeg", "刘六", "1985-08-12", "420104198508123456", "13600136007", "liuliu@example.com"},
+        {"11000005", "陈七", "123", "8.jpeg", "陈七", "1978-03-25", "510105197803253456", "13500135008", "chenqi@example.com"},
+        {"11000006", "赵八", "123", "9.jpeg", "赵八", "1995-11-08", "610106199511083456", "13400134009", "zhaoba@example.com"},
+        {"11000007", "钱九", "123", "10.jpeg", "钱九", "1982-07-19", "710107198207193456", "13300133010", "qianjiu@example.com"},
+        {"11000008", "孙十", "123", "11.jpeg", "孙十", "1991-02-14", "810108199102143456", "13200132011", "sunshi@example.com"},
+        {"11000009", "周十一", "123", "12.jpeg", "周十一", "1987-09-30", "910109198709303456", "13100131012", "zhoushiyi@example.com"},
+        {"11000010", "吴十二", "123", "13.jpeg", "吴十二", "1980-12-05", "101010198012053456", "13000130013", "wushier@example.com"},
 
         // 医生用户
-        {"120001", "张三1", "123", "4.jpeg", "张医生", "1985-03-22", "420104198503224567", "13600136004", "doctor1@hospital.com"},
-        {"120002", "李四1", "123", "5.jpeg", "李医生", "1982-07-18", "510105198207185678", "13500135005", "doctor2@hospital.com"},
-        {"120003", "王五1", "123", "6.jpeg", "王医生", "1979-09-09", "610106197909096789", "13400134006", "doctor3@hospital.com"},
-        {"120004", "刘六1", "123", "14.jpeg", "刘医生", "1976-04-15", "710107197604156789", "13300133014", "doctor4@hospital.com"},
-        {"120005", "陈七1", "123", "15.jpeg", "陈医生", "1980-08-28", "810108198008286789", "13200132015", "doctor5@hospital.com"},
-        {"120006", "赵八1", "123", "16.jpeg", "赵医生", "1978-12-10", "910109197812106789", "13100131016", "doctor6@hospital.com"},
-        {"120007", "钱九1", "123", "17.jpeg", "钱医生", "1983-06-20", "101010198306206789", "13000130017", "doctor7@hospital.com"},
-        {"120008", "孙十1", "123", "18.jpeg", "孙医生", "1975-10-05", "111111197510056789", "12900129018", "doctor8@hospital.com"},
-        {"120009", "周十一1", "123", "19.jpeg", "周医生", "1987-02-18", "121212198702186789", "12800128019", "doctor9@hospital.com"},
-        {"120010", "吴十二1", "123", "20.jpeg", "吴医生", "1981-07-22", "131313198107226789", "12700127020", "doctor10@hospital.com"}
+        {"12000001", "张三1", "123", "4.jpeg", "张医生", "1985-03-22", "420104198503224567", "13600136004", "doctor1@hospital.com"},
+        {"12000002", "李四1", "123", "5.jpeg", "李医生", "1982-07-18", "510105198207185678", "13500135005", "doctor2@hospital.com"},
+        {"12000003", "王五1", "123", "6.jpeg", "王医生", "1979-09-09", "610106197909096789", "13400134006", "doctor3@hospital.com"},
+        {"12000004", "刘六1", "123", "14.jpeg", "刘医生", "1976-04-15", "710107197604156789", "13300133014", "doctor4@hospital.com"},
+        {"12000005", "陈七1", "123", "15.jpeg", "陈医生", "1980-08-28", "810108198008286789", "13200132015", "doctor5@hospital.com"},
+        {"12000006", "赵八1", "123", "16.jpeg", "赵医生", "1978-12-10", "910109197812106789", "13100131016", "doctor6@hospital.com"},
+        {"12000007", "钱九1", "123", "17.jpeg", "钱医生", "1983-06-20", "101010198306206789", "13000130017", "doctor7@hospital.com"},
+        {"12000008", "孙十1", "123", "18.jpeg", "孙医生", "1975-10-05", "111111197510056789", "12900129018", "doctor8@hospital.com"},
+        {"12000009", "周十一1", "123", "19.jpeg", "周医生", "1987-02-18", "121212198702186789", "12800128019", "doctor9@hospital.com"},
+        {"12000010", "吴十二1", "123", "20.jpeg", "吴医生", "1981-07-22", "131313198107226789", "12700127020", "doctor10@hospital.com"}
     };
 
     foreach (const QStringList &user, users) {
         QSqlQuery insertQuery(m_db);
         insertQuery.prepare("INSERT INTO user "
-                            "(id, username, password, avatar_path, real_name, birth_date, id_card, phone, email) "
-                            "VALUES (:id, :username, :password, :avatar_path, :real_name, :birth_date, :id_card, :phone, :email)");
+                            "(id, username, password, avatar_path, real_name, birth_date, id_card, phone, email, gender, id_birth_date) "
+                            "VALUES (:id, :username, :password, :avatar_path, :real_name, :birth_date, :id_card, :phone, :email, :gender, :id_birth_date)");
+
+        QString gender, idBirthDate;
+        deriveIdCardInfo(user[6], gender, idBirthDate);
 
         insertQuery.bindValue(":id", user[0]);
         insertQuery.bindValue(":username", user[1]);
@@ -101,6 +144,8 @@ void Server::initializeDatabase()
         insertQuery.bindValue(":id_card", user[6]);       // 身份证号
         insertQuery.bindValue(":phone", user[7]);         // 手机号
         insertQuery.bindValue(":email", user[8]);        // 邮箱
+        insertQuery.bindValue(":gender", gender.isEmpty() ? QVariant() : QVariant(gender));
+        insertQuery.bindValue(":id_birth_date", idBirthDate.isEmpty() ? QVariant() : QVariant(idBirthDate));
 
         if (!insertQuery.exec()) {
             qDebug() << "用户插入失败:" << insertQuery.lastError().text()
@@ -148,6 +193,30 @@ void Server::initializeDatabase()
                "status TEXT CHECK(status IN ('normal', 'late', 'early_leave', 'absent')) NOT NULL,"
                "FOREIGN KEY(doctor_id) REFERENCES doctor(id) ON DELETE CASCADE"
                ")");
+    query.exec("CREATE INDEX IF NOT EXISTS idx_attendance_doctor_date ON attendance(doctor_id, date)");
+    query.exec("CREATE INDEX IF NOT EXISTS idx_doctor_department ON doctor(department)");
+
+    // 创建考勤月度汇总表，由签到/签退实时维护，统计查询无需扫描原始考勤记录
+    query.exec("CREATE TABLE IF NOT EXISTS attendance_monthly ("
+               "doctor_id TEXT NOT NULL,"                    // 医生ID
+               "month TEXT NOT NULL,"                        // 月份，格式: YYYY-MM
+               "normal_count INTEGER NOT NULL DEFAULT 0,"    // 正常天数
+               "late_count INTEGER NOT NULL DEFAULT 0,"      // 迟到天数
+               "early_leave_count INTEGER NOT NULL DEFAULT 0," // 早退天数
+               "absent_count INTEGER NOT NULL DEFAULT 0,"    // 缺勤天数
+               "PRIMARY KEY(doctor_id, month),"
+               "FOREIGN KEY(doctor_id) REFERENCES doctor(id) ON DELETE CASCADE"
+               ")");
+
+    // 创建医生班次表：签到迟到、签退早退和缺勤都按该表判断，没有班次的医生不做早退和缺勤判定
+    query.exec("CREATE TABLE IF NOT EXISTS doctor_shift ("
+               "doctor_id TEXT PRIMARY KEY,"                   // 医生ID
+               "shift_start TIME NOT NULL,"                    // 上班时间，晚于该时间签到为迟到
+               "shift_end TIME NOT NULL,"                      // 下班时间，早于该时间签退为早退
+               "work_days TEXT NOT NULL DEFAULT '1,2,3,4,5',"  // 工作日，1=周一 ... 7=周日
+               "effective_from DATE NOT NULL,"                 // 班次生效日期，此前的日期不补记缺勤
+               "FOREIGN KEY(doctor_id) REFERENCES doctor(id) ON DELETE CASCADE"
+               ")");
 
     // 创建请假表
     query.exec("CREATE TABLE IF NOT EXISTS leave ("
@@ -161,6 +230,7 @@ void Server::initializeDatabase()
                "applied_date DATETIME DEFAULT CURRENT_TIMESTAMP," // 申请日期
                "FOREIGN KEY(doctor_id) REFERENCES doctor(id) ON DELETE CASCADE"
                ")");
+    query.exec("CREATE INDEX IF NOT EXISTS idx_leave_doctor_dates ON leave(doctor_id, start_date, end_date)");
 
     // 创建聊天信息表
     query.exec("CREATE TABLE IF NOT EXISTS message ("
@@ -172,6 +242,24 @@ void Server::initializeDatabase()
                "FOREIGN KEY(sender_id) REFERENCES user(id) ON DELETE CASCADE,"
                "FOREIGN KEY(receiver_id) REFERENCES user(id) ON DELETE CASCADE"
                ")");
+    // 会话历史按 message_id 增量拉取，两个方向各走一次索引
+    query.exec("CREATE INDEX IF NOT EXISTS idx_message_pair ON message(sender_id, receiver_id, message_id)");
+
+    // 创建聊天附件表，文件内容按 sha256 存放在 attachments 目录
+    query.exec("CREATE TABLE IF NOT EXISTS attachment ("
+               "attachment_id INTEGER PRIMARY KEY AUTOINCREMENT,"
+               "sender_id TEXT NOT NULL,"
+               "receiver_id TEXT NOT NULL,"
+               "file_name TEXT NOT NULL,"
+               "size INTEGER NOT NULL,"           // 字节数
+               "sha256 TEXT NOT NULL,"            // 内容哈希，十六进制
+               "status TEXT CHECK(status IN ('uploading', 'complete')) DEFAULT 'uploading',"
+               "downloaded INTEGER DEFAULT 0,"    // 接收者是否已下载
+               "created_at TEXT,"
+               "FOREIGN KEY(sender_id) REFERENCES user(id) ON DELETE CASCADE,"
+               "FOREIGN KEY(receiver_id) REFERENCES user(id) ON DELETE CASCADE"
+               ")");
+    query.exec("CREATE INDEX IF NOT EXISTS idx_attachment_receiver ON attachment(receiver_id, status, downloaded)");
 
 
     // 创建药品表
@@ -221,6 +309,7 @@ void Server::initializeDatabase()
                "application_id TEXT,"
                "created_at TEXT NOT NULL,"
                "paid_at TEXT,"
+               "version INTEGER NOT NULL DEFAULT 0,"   // 变更版本号，由触发器维护
                "FOREIGN KEY(patient_id) REFERENCES user(id) ON DELETE CASCADE"
                ")");
 
@@ -268,27 +357,100 @@ void Server::initializeDatabase()
                "frequency TEXT NOT NULL,"          // 服用频次
                "quantity INTEGER NOT NULL DEFAULT 1," // 购买数量
                "notes TEXT NOT NULL DEFAULT '',"   // 备注信息
-               "prescribed_date DATETIME DEFAULT CURRENT_TIMESTAMP," // 开具时间，自动记录
+               "prescribed_date DATETIME DEFAULT (datetime('now', 'localtime'))," // 开具时间（本地时间，与缴费项目 created_at 一致）
                "status TEXT DEFAULT 'active',"     // 处方状态：active/completed/cancelled
+               "version INTEGER NOT NULL DEFAULT 0," // 变更版本号，由触发器维护
                "FOREIGN KEY(patient_id) REFERENCES patient(id) ON DELETE CASCADE,"  // 外键约束
                "FOREIGN KEY(doctor_id) REFERENCES doctor(id) ON DELETE CASCADE"
                ")");
 
+    // 变更版本表：每类实体一个递增版本号，处方和缴费项目每次插入/更新都会取得新版本
+    // 客户端携带 since_version 只拉取变更的行，服务端推送也只携带变更的行
+    query.exec("DROP TABLE IF EXISTS entity_version");
+    query.exec("CREATE TABLE IF NOT EXISTS entity_version ("
+               "entity TEXT PRIMARY KEY,"
+               "version INTEGER NOT NULL DEFAULT 0"
+               ")");
+    query.exec("INSERT OR IGNORE INTO entity_version (entity, version) VALUES ('prescription', 0), ('payment_items', 0), ('speech_vocabulary', 0)");
+
+    const QList<QPair<QString, QString>> versionedTables = {
+        {"prescription", "prescription_id"},
+        {"payment_items", "item_id"}
+    };
+    for (const auto &table : versionedTables) {
+        QString bumpVersion = QString(
+            "UPDATE entity_version SET version = version + 1 WHERE entity = '%1'; "
+            "UPDATE %1 SET version = (SELECT version FROM entity_version WHERE entity = '%1') "
+            "WHERE %2 = NEW.%2; ").arg(table.first, table.second);
+        if (!query.exec(QString("CREATE TRIGGER IF NOT EXISTS %1_version_insert AFTER INSERT ON %1 "
+                                "BEGIN %2 END").arg(table.first, bumpVersion))) {
+            qDebug() << "创建版本触发器失败:" << table.first << query.lastError().text();
+        }
+        // WHEN 条件避免触发器自身的 UPDATE 再次触发
+        if (!query.exec(QString("CREATE TRIGGER IF NOT EXISTS %1_version_update AFTER UPDATE ON %1 "
+                                "WHEN NEW.version = OLD.version BEGIN %2 END").arg(table.first, bumpVersion))) {
+            qDebug() << "创建版本触发器失败:" << table.first << query.lastError().text();
+        }
+    }
+
+    // 语音识别词表来自药品名称和医生科室，这两列变化时递增词表版本，词表缓存随之失效
+    const QList<QPair<QString, QString>> vocabularySources = {
+        {"medicine", "name"},
+        {"doctor", "department"}
+    };
+    const QString bumpVocabulary = "UPDATE entity_version SET version = version + 1 WHERE entity = 'speech_vocabulary'; ";
+    for (const auto &source : vocabularySources) {
+        const QStringList triggers = {
+            QString("CREATE TRIGGER IF NOT EXISTS %1_vocabulary_insert AFTER INSERT ON %1 "
+                    "BEGIN %2 END").arg(source.first, bumpVocabulary),
+            QString("CREATE TRIGGER IF NOT EXISTS %1_vocabulary_update AFTER UPDATE OF %3 ON %1 "
+                    "WHEN NEW.%3 IS NOT OLD.%3 BEGIN %2 END").arg(source.first, bumpVocabulary, source.second),
+            QString("CREATE TRIGGER IF NOT EXISTS %1_vocabulary_delete AFTER DELETE ON %1 "
+                    "BEGIN %2 END").arg(source.first, bumpVocabulary)
+        };
+        for (const QString &trigger : triggers) {
+            if (!query.exec(trigger)) {
+                qDebug() << "创建词表版本触发器失败:" << source.first << query.lastError().text();
+            }
+        }
+    }
+
+    // 创建ID号段表：记录每个ID前缀已预留的号段，配合 IdAllocator 使用
+    // 用户、住院申请表每次启动都会重建，号段表随之重建
+    query.exec("DROP TABLE IF EXISTS id_block");
+    query.exec("CREATE TABLE IF NOT EXISTS id_block ("
+               "prefix TEXT PRIMARY KEY,"           // ID前缀，如 11（患者）、12（医生）、HOSP
+               "next_hi INTEGER NOT NULL DEFAULT 0" // 下一个可预留的号段编号
+               ")");
+
+    // 创建幂等键表：记录缴费/预约/处方写操作的键和首次成功响应，客户端重试时直接回放
+    // 缴费、处方相关表每次启动都会重建，保存的响应随之失效，因此一起重建
+    query.exec("DROP TABLE IF EXISTS idempotency_key");
+    query.exec("CREATE TABLE IF NOT EXISTS idempotency_key ("
+               "idem_key TEXT NOT NULL,"             // 客户端生成的幂等键
+               "request_type TEXT NOT NULL,"         // 请求类型，如 PROCESS_PAYMENT
+               "payload_hash TEXT NOT NULL,"         // 请求内容（不含幂等键）的 SHA-256，同一键换了内容时拒绝
+               "response BLOB NOT NULL,"             // 首次成功处理时返回的完整响应
+               "created_at TEXT NOT NULL,"           // 记录时间，用于清理过期键
+               "PRIMARY KEY(idem_key, request_type)"
+               ")");
+    m_idempotencyCache.clear();
+
     // ================== 插入测试数据 ==================
 
     // 插入病人测试数据
     QVector<QStringList> patients = {
         // id, case_info
-        {"110001", "高血压病史5年，近期血压不稳定，需要定期服药监测"},
-        {"110002", "糖尿病II型，需要定期监测血糖，饮食控制严格"},
-        {"110003", "慢性胃炎，需定期复查胃镜，避免辛辣刺激食物"},
-        {"110004", "哮喘病史3年，对花粉尘螨过敏，随身携带喷雾剂"},
-        {"110005", "腰椎间盘突出，需要物理治疗和定期复查"},
-        {"110006", "甲状腺功能亢进，需要定期检查甲状腺激素水平"},
-        {"110007", "冠心病，支架术后需要长期服药和定期复查"},
-        {"110008", "抑郁症病史，需要定期心理咨询和药物治疗"},
-        {"110009", "过敏性鼻炎，季节性发作需要抗过敏治疗"},
-        {"110010", "骨质疏松，需要补钙和定期骨密度检查"}
+        {"11000001", "高血压病史5年，近期血压不稳定，需要定期服药监测"},
+        {"11000002", "糖尿病II型，需要定期监测血糖，饮食控制严格"},
+        {"11000003", "慢性胃炎，需定期复查胃镜，避免辛辣刺激食物"},
+        {"11000004", "哮喘病史3年，对花粉尘螨过敏，随身携带喷雾剂"},
+        {"11000005", "腰椎间盘突出，需要物理治疗和定期复查"},
+        {"11000006", "甲状腺功能亢进，需要定期检查甲状腺激素水平"},
+        {"11000007", "冠心病，支架术后需要长期服药和定期复查"},
+        {"11000008", "抑郁症病史，需要定期心理咨询和药物治疗"},
+        {"11000009", "过敏性鼻炎，季节性发作需要抗过敏治疗"},
+        {"11000010", "骨质疏松，需要补钙和定期骨密度检查"}
     };
 
     foreach (const QStringList &patient, patients) {
@@ -324,16 +486,16 @@ void Server::initializeDatabase()
     // 插入医生测试数据
     QVector<QStringList> doctors = {
         // id, department, title, introduction, registration_fee
-        {"120001", "心血管内科", "主任医师", "毕业于XX医科大学，擅长高血压、冠心病诊疗，20年临床经验", "100.0"},
-        {"120002", "内分泌科", "副主任医师", "糖尿病专家，发表SCI论文10余篇，擅长糖尿病并发症治疗", "80.0"},
-        {"120003", "消化内科", "主治医师", "胃肠镜操作专家，年完成胃镜手术千余例，擅长消化道疾病诊治", "50.0"},
-        {"120004", "呼吸内科", "主任医师", "擅长哮喘、COPD等呼吸系统疾病，15年临床经验", "50.0"},
-        {"120005", "骨科", "副主任医师", "擅长关节置换和脊柱手术，微创手术专家", "70.0"},
-        {"120006", "神经内科", "主治医师", "擅长脑血管疾病和神经系统疑难病症诊治", "200.0"},
-        {"120007", "皮肤科", "主任医师", "擅长湿疹、银屑病等皮肤疾病，中西医结合治疗", "85.0"},
-        {"120008", "眼科", "副主任医师", "擅长白内障手术和眼底疾病诊治", "50.0"},
-        {"120009", "耳鼻喉科", "主治医师", "擅长鼻窦炎、中耳炎等耳鼻喉疾病治疗", "50.0"},
-        {"120010", "心理科", "主任医师", "国家二级心理咨询师，擅长抑郁症、焦虑症治疗", "150.0"}
+        {"12000001", "心血管内科", "主任医师", "毕业于XX医科大学，擅长高血压、冠心病诊疗，20年临床经验", "100.0"},
+        {"12000002", "内分泌科", "副主任医师", "糖尿病专家，发表SCI论文10余篇，擅长糖尿病并发症治疗", "80.0"},
+        {"12000003", "消化内科", "主治医师", "胃肠镜操作专家，年完成胃镜手术千余例，擅长消化道疾病诊治", "50.0"},
+        {"12000004", "呼吸内科", "主任医师", "擅长哮喘、COPD等呼吸系统疾病，15年临床经验", "50.0"},
+        {"12000005", "骨科", "副主任医师", "擅长关节置换和脊柱手术，微创手术专家", "70.0"},
+        {"12000006", "神经内科", "主治医师", "擅长脑血管疾病和神经系统疑难病症诊治", "200.0"},
+        {"12000007", "皮肤科", "主任医师", "擅长湿疹、银屑病等皮肤疾病，中西医结合治疗", "85.0"},
+        {"12000008", "眼科", "副主任医师", "擅长白内障手术和眼底疾病诊治", "50.0"},
+        {"12000009", "耳鼻喉科", "主治医师", "擅长鼻窦炎、中耳炎等耳鼻喉疾病治疗", "50.0"},
+        {"12000010", "心理科", "主任医师", "国家二级心理咨询师，擅长抑郁症、焦虑症治疗", "150.0"}
     };
 
     foreach (const QStringList &doctor, doctors) {
@@ -352,29 +514,35 @@ void Server::initializeDatabase()
         }
     }
 
+    // 测试医生的班次，从今天起生效
+    if (!query.exec("INSERT INTO doctor_shift (doctor_id, shift_start, shift_end, effective_from) "
+                    "SELECT id, '08:30:00', '17:00:00', date('now', 'localtime') FROM doctor")) {
+        qDebug() << "医生班次插入失败:" << query.lastError().text();
+    }
+
     // 插入预约测试数据
     QVector<QStringList> appointments = {
         // patient_id, doctor_id, appointment_date, status
-        {"110001", "120001", "2023-08-15 09:30:00", "pending"},
-        {"110002", "120002", "2023-08-16 10:00:00", "pending"},
-        {"110003", "120003", "2023-08-17 14:30:00", "cancelled"},
-        {"110004", "120004", "2023-08-18 08:30:00", "confirmed"},
-        {"110005", "120005", "2023-08-19 14:00:00", "pending"},
-        {"110006", "120006", "2023-08-20 10:30:00", "confirmed"},
-        {"110007", "120007", "2023-08-21 09:00:00", "cancelled"},
-        {"110008", "120008", "2023-08-22 15:30:00", "pending"},
-        {"110009", "120009", "2023-08-23 11:00:00", "confirmed"},
-        {"110010", "120010", "2023-08-24 16:00:00", "pending"},
-        {"110001", "120004", "2023-08-25 09:30:00", "confirmed"},
-        {"110002", "120005", "2023-08-26 14:00:00", "pending"},
-        {"110003", "120006", "2023-08-27 10:30:00", "confirmed"},
-        {"110004", "120007", "2023-08-28 09:00:00", "cancelled"},
-        {"110005", "120008", "2023-08-29 15:30:00", "pending"},
-        {"110006", "120009", "2023-08-30 11:00:00", "confirmed"},
-        {"110007", "120010", "2023-08-31 16:00:00", "pending"},
-        {"110008", "120001", "2023-09-01 09:30:00", "confirmed"},
-        {"110009", "120002", "2023-09-02 10:00:00", "pending"},
-        {"110010", "120003", "2023-09-03 14:30:00", "cancelled"}
+        {"11000001", "12000001", "2023-08-15 09:30:00", "pending"},
+        {"11000002", "12000002", "2023-08-16 10:00:00", "pending"},
+        {"11000003", "12000003", "2023-08-17 14:30:00", "cancelled"},
+        {"11000004", "12000004", "2023-08-18 08:30:00", "confirmed"},
+        {"11000005", "12000005", "2023-08-19 14:00:00", "pending"},
+        {"11000006", "12000006", "2023-08-20 10:30:00", "confirmed"},
+        {"11000007", "12000007", "2023-08-21 09:00:00", "cancelled"},
+        {"11000008", "12000008", "2023-08-22 15:30:00", "pending"},
+        {"11000009", "12000009", "2023-08-23 11:00:00", "confirmed"},
+        {"11000010", "12000010", "2023-08-24 16:00:00", "pending"},
+        {"11000001", "12000004", "2023-08-25 09:30:00", "confirmed"},
+        {"11000002", "12000005", "2023-08-26 14:00:00", "pending"},
+        {"11000003", "12000006", "2023-08-27 10:30:00", "confirmed"},
+        {"11000004", "12000007", "2023-08-28 09:00:00", "cancelled"},
+        {"11000005", "12000008", "2023-08-29 15:30:00", "pending"},
+        {"11000006", "12000009", "2023-08-30 11:00:00", "confirmed"},
+        {"11000007", "12000010", "2023-08-31 16:00:00", "pending"},
+        {"11000008", "12000001", "2023-09-01 09:30:00", "confirmed"},
+        {"11000009", "12000002", "2023-09-02 10:00:00", "pending"},
+        {"11000010", "12000003", "2023-09-03 14:30:00", "cancelled"}
     };
 
     foreach (const QStringList &appointment, appointments) {
@@ -392,26 +560,26 @@ void Server::initializeDatabase()
     // 插入考勤测试数据
     QVector<QStringList> attendances = {
         // doctor_id, date, check_in_time, check_out_time, status
-        {"120001", "2025-08-01", "08:05:00", "17:30:00", "normal"},
-        {"120002", "2023-08-01", "08:45:00", "17:00:00", "late"},
-        {"120003", "2023-08-01", "08:10:00", "16:00:00", "early_leave"},
-        {"120004", "2023-08-01", "08:00:00", "17:00:00", "normal"},
-        {"120005", "2023-08-01", "08:20:00", "17:15:00", "normal"},
-        {"120006", "2023-08-01", "08:30:00", "16:45:00", "normal"},
-        {"120007", "2023-08-01", "08:10:00", "17:20:00", "normal"},
-        {"120008", "2023-08-01", "08:25:00", "16:50:00", "normal"},
-        {"120009", "2023-08-01", "08:15:00", "17:10:00", "normal"},
-        {"120010", "2023-08-01", "08:40:00", "17:05:00", "late"},
-        {"120001", "2025-08-02", "08:00:00", "17:00:00", "early_leave"},
-        {"120002", "2023-08-02", "08:10:00", "16:55:00", "normal"},
-        {"120003", "2023-08-02", "08:05:00", "16:30:00", "early_leave"},
-        {"120004", "2023-08-02", "08:20:00", "17:10:00", "normal"},
-        {"120005", "2023-08-02", "08:30:00", "17:20:00", "normal"},
-        {"120006", "2023-08-02", "08:15:00", "16:40:00", "early_leave"},
-        {"120007", "2023-08-02", "08:25:00", "17:15:00", "normal"},
-        {"120008", "2023-08-02", "08:35:00", "17:05:00", "normal"},
-        {"120009", "2023-08-02", "08:10:00", "17:00:00", "normal"},
-        {"120010", "2023-08-02", "08:50:00", "17:25:00", "late"}
+        {"12000001", "2025-08-01", "08:05:00", "17:30:00", "normal"},
+        {"12000002", "2023-08-01", "08:45:00", "17:00:00", "late"},
+        {"12000003", "2023-08-01", "08:10:00", "16:00:00", "early_leave"},
+        {"12000004", "2023-08-01", "08:00:00", "17:00:00", "normal"},
+        {"12000005", "2023-08-01", "08:20:00", "17:15:00", "normal"},
+        {"12000006", "2023-08-01", "08:30:00", "16:45:00", "normal"},
+        {"12000007", "2023-08-01", "08:10:00", "17:20:00", "normal"},
+        {"12000008", "2023-08-01", "08:25:00", "16:50:00", "normal"},
+        {"12000009", "2023-08-01", "08:15:00", "17:10:00", "normal"},
+        {"12000010", "2023-08-01", "08:40:00", "17:05:00", "late"},
+        {"12000001", "2025-08-02", "08:00:00", "17:00:00", "early_leave"},
+        {"12000002", "2023-08-02", "08:10:00", "16:55:00", "normal"},
+        {"12000003", "2023-08-02", "08:05:00", "16:30:00", "early_leave"},
+        {"12000004", "2023-08-02", "08:20:00", "17:10:00", "normal"},
+        {"12000005", "2023-08-02", "08:30:00", "17:20:00", "normal"},
+        {"12000006", "2023-08-02", "08:15:00", "16:40:00", "early_leave"},
+        {"12000007", "2023-08-02", "08:25:00", "17:15:00", "normal"},
+        {"12000008", "2023-08-02", "08:35:00", "17:05:00", "normal"},
+        {"12000009", "2023-08-02", "08:10:00", "17:00:00", "normal"},
+        {"12000010", "2023-08-02", "08:50:00", "17:25:00", "late"}
     };
 
     foreach (const QStringList &attendance, attendances) {
@@ -427,30 +595,38 @@ void Server::initializeDatabase()
         }
     }
 
+    // 根据测试考勤数据生成月度汇总
+    if (!query.exec("INSERT INTO attendance_monthly (doctor_id, month, normal_count, late_count, early_leave_count, absent_count) "
+                    "SELECT doctor_id, substr(date, 1, 7), "
+                    "SUM(status = 'normal'), SUM(status = 'late'), SUM(status = 'early_leave'), SUM(status = 'absent') "
+                    "FROM attendance GROUP BY doctor_id, substr(date, 1, 7)")) {
+        qDebug() << "考勤月度汇总生成失败:" << query.lastError().text();
+    }
+
 
     // 插入请假测试数据
     QVector<QStringList> leaves = {
         // doctor_id, leave_type, start_date, end_date, reason, status
-        {"120001", "年假", "2023-08-10", "2023-08-12", "家庭旅行", "approved"},
-        {"120002", "病假", "2023-08-15", "2023-08-16", "重感冒需休息", "applied"},
-        {"120003", "事假", "2023-08-20", "2023-08-21", "参加学术会议", "rejected"},
-        {"120004", "年假", "2023-08-05", "2023-08-07", "回乡探亲", "approved"},
-        {"120005", "病假", "2023-08-12", "2023-08-13", "急性肠胃炎", "approved"},
-        {"120006", "事假", "2023-08-18", "2023-08-19", "孩子家长会", "applied"},
-        {"120007", "年假", "2023-08-25", "2023-08-27", "短期旅行", "approved"},
-        {"120008", "病假", "2023-08-14", "2023-08-15", "牙痛需要治疗", "approved"},
-        {"120009", "事假", "2023-08-22", "2023-08-23", "办理房产手续", "rejected"},
-        {"120010", "年假", "2023-08-28", "2023-08-30", "个人休息", "applied"},
-        {"120001", "病假", "2023-09-05", "2023-09-06", "身体不适需要检查", "applied"},
-        {"120002", "事假", "2023-09-10", "2023-09-11", "参加朋友婚礼", "approved"},
-        {"120003", "年假", "2023-09-15", "2023-09-17", "短途旅行", "applied"},
-        {"120004", "病假", "2023-09-20", "2023-09-21", "感冒发烧", "approved"},
-        {"120005", "事假", "2023-09-25", "2023-09-26", "车辆年检", "rejected"},
-        {"120006", "年假", "2023-09-28", "2023-09-30", "国庆节前休息", "approved"},
-        {"120007", "病假", "2023-10-05", "2023-10-06", "腰部不适需要理疗", "applied"},
-        {"120008", "事假", "2023-10-10", "2023-10-11", "办理银行业务", "approved"},
-        {"120009", "年假", "2023-10-15", "2023-10-17", "陪伴家人", "applied"},
-        {"120010", "病假", "2023-10-20", "2023-10-21", "过敏反应需要休息", "approved"}
+        {"12000001", "年假", "2023-08-10", "2023-08-12", "家庭旅行", "approved"},
+        {"12000002", "病假", "2023-08-15", "2023-08-16", "重感冒需休息", "applied"},
+        {"12000003", "事假", "2023-08-20", "2023-08-21", "参加学术会议", "rejected"},
+        {"12000004", "年假", "2023-08-05", "2023-08-07", "回乡探亲", "approved"},
+        {"12000005", "病假", "2023-08-12", "2023-08-13", "急性肠胃炎", "approved"},
+        {"12000006", "事假", "2023-08-18", "2023-08-19", "孩子家长会", "applied"},
+        {"12000007", "年假", "2023-08-25", "2023-08-27", "短期旅行", "approved"},
+        {"12000008", "病假", "2023-08-14", "2023-08-15", "牙痛需要治疗", "approved"},
+        {"12000009", "事假", "2023-08-22", "2023-08-23", "办理房产手续", "rejected"},
+        {"12000010", "年假", "2023-08-28", "2023-08-30", "个人休息", "applied"},
+        {"12000001", "病假", "2023-09-05", "2023-09-06", "身体不适需要检查", "applied"},
+        {"12000002", "事假", "2023-09-10", "2023-09-11", "参加朋友婚礼", "approved"},
+        {"12000003", "年假", "2023-09-15", "2023-09-17", "短途旅行", "applied"},
+        {"12000004", "病假", "2023-09-20", "2023-09-21", "感冒发烧", "approved"},
+        {"12000005", "事假", "2023-09-25", "2023-09-26", "车辆年检", "rejected"},
+        {"12000006", "年假", "2023-09-28", "2023-09-30", "国庆节前休息", "approved"},
+        {"12000007", "病假", "2023-10-05", "2023-10-06", "腰部不适需要理疗", "applied"},
+        {"12000008", "事假", "2023-10-10", "2023-10-11", "办理银行业务", "approved"},
+        {"12000009", "年假", "2023-10-15", "2023-10-17", "陪伴家人", "applied"},
+        {"12000010", "病假", "2023-10-20", "2023-10-21", "过敏反应需要休息", "approved"}
     };
 
     foreach (const QStringList &leave, leaves) {
@@ -470,26 +646,26 @@ void Server::initializeDatabase()
     // 插入聊天信息测试数据
     QVector<QStringList> messages = {
         // sender_id, receiver_id, content
-        {"110001", "120001", "张医生您好，我昨天血压有点高，150/95，需要调整药物吗？"},
-        {"120001", "110001", "收到，建议今天再测量两次，如果持续偏高，可以考虑加半片硝苯地平"},
-        {"110002", "120002", "李医生，我今早空腹血糖7.8，需要加药吗？"},
-        {"120002", "110002", "血糖7.8稍高，建议先饮食控制，明天再测空腹血糖看看"},
-        {"110003", "120003", "王医生，我胃痛又犯了，需要提前来复查吗？"},
-        {"120003", "110003", "如果疼痛持续，建议明天来医院做个胃镜检查"},
-        {"110004", "120004", "刘医生，我最近哮喘发作比较频繁，需要调整用药吗？"},
-        {"120004", "110004", "建议增加喷雾剂使用频率，如果不见好转请来医院复查"},
-        {"110005", "120005", "陈医生，我的腰最近又疼了，需要来做理疗吗？"},
-        {"120005", "110005", "可以安排本周五下午来做物理治疗，记得带医保卡"},
-        {"110006", "120006", "赵医生，我最近头晕的厉害，需要检查什么？"},
-        {"120006", "110006", "建议做头颅CT和血压监测，明天上午可以来检查"},
-        {"110007", "120007", "钱医生，我皮肤过敏很严重，需要开什么药？"},
-        {"120007", "110007", "可以先用氯雷他定，如果不见效明天来医院开处方药"},
-        {"110008", "120008", "孙医生，我眼睛最近很干涩，需要用什么眼药水？"},
-        {"120008", "110008", "建议使用人工泪液，每天4-6次，避免长时间用眼"},
-        {"110009", "120009", "周医生，我鼻炎又犯了，打喷嚏流鼻涕很难受"},
-        {"120009", "110009", "可以用鼻喷雾剂控制症状，严重时来医院开口服药"},
-        {"110010", "120010", "吴医生，我最近睡眠很差，情绪低落，需要调整药物吗？"},
-        {"120010", "110010", "建议本周三下午来复诊，我们需要调整抗抑郁药物的剂量"}
+        {"11000001", "12000001", "张医生您好，我昨天血压有点高，150/95，需要调整药物吗？"},
+        {"12000001", "11000001", "收到，建议今天再测量两次，如果持续偏高，可以考虑加半片硝苯地平"},
+        {"11000002", "12000002", "李医生，我今早空腹血糖7.8，需要加药吗？"},
+        {"12000002", "11000002", "血糖7.8稍高，建议先饮食控制，明天再测空腹血糖看看"},
+        {"11000003", "12000003", "王医生，我胃痛又犯了，需要提前来复查吗？"},
+        {"12000003", "11000003", "如果疼痛持续，建议明天来医院做个胃镜检查"},
+        {"11000004", "12000004", "刘医生，我最近哮喘发作比较频繁，需要调整用药吗？"},
+        {"12000004", "11000004", "建议增加喷雾剂使用频率，如果不见好转请来医院复查"},
+        {"11000005", "12000005", "陈医生，我的腰最近又疼了，需要来做理疗吗？"},
+        {"12000005", "11000005", "可以安排本周五下午来做物理治疗，记得带医保卡"},
+        {"11000006", "12000006", "赵医生，我最近头晕的厉害，需要检查什么？"},
+        {"12000006", "11000006", "建议做头颅CT和血压监测，明天上午可以来检查"},
+        {"11000007", "12000007", "钱医生，我皮肤过敏很严重，需要开什么药？"},
+        {"12000007", "11000007", "可以先用氯雷他定，如果不见效明天来医院开处方药"},
+        {"11000008", "12000008", "孙医生，我眼睛最近很干涩，需要用什么眼药水？"},
+        {"12000008", "11000008", "建议使用人工泪液，每天4-6次，避免长时间用眼"},
+        {"11000009", "12000009", "周医生，我鼻炎又犯了，打喷嚏流鼻涕很难受"},
+        {"12000009", "11000009", "可以用鼻喷雾剂控制症状，严重时来医院开口服药"},
+        {"11000010", "12000010", "吴医生，我最近睡眠很差，情绪低落，需要调整药物吗？"},
+        {"12000010", "11000010", "建议本周三下午来复诊，我们需要调整抗抑郁药物的剂量"}
     };
 
     foreach (const QStringList &message, messages) {
@@ -506,11 +682,11 @@ void Server::initializeDatabase()
     // 添加处方测试数据
     QVector<QStringList> prescriptions = {
         // patient_id, doctor_id, medicine_name, dosage, usage, frequency, notes, status
-        {"110001", "120001", "阿司匹林肠溶片", "100mg", "口服", "一日1次", "饭后服用", "active"},
-        {"110001", "120001", "硝苯地平缓释片", "20mg", "口服", "一日2次", "早晚各一次", "completed"},
-        {"110001", "120002", "盐酸二甲双胍片", "500mg", "口服", "一日3次", "随餐服用", "pending"},
-        {"110002", "120003", "布洛芬缓释胶囊", "0.3g", "口服", "一日3次", "疼痛时服用", "active"},
-        {"110002", "120004", "氯雷他定片", "10mg", "口服", "一日1次", "睡前服用", "completed"}
+        {"11000001", "12000001", "阿司匹林肠溶片", "100mg", "口服", "一日1次", "饭后服用", "active"},
+        {"11000001", "12000001", "硝苯地平缓释片", "20mg", "口服", "一日2次", "早晚各一次", "completed"},
+        {"11000001", "12000002", "盐酸二甲双胍片", "500mg", "口服", "一日3次", "随餐服用", "pending"},
+        {"11000002", "12000003", "布洛芬缓释胶囊", "0.3g", "口服", "一日3次", "疼痛时服用", "active"},
+        {"11000002", "12000004", "氯雷他定片", "10mg", "口服", "一日1次", "睡前服用", "completed"}
     };*/
 
     /*foreach (const QStringList &prescription, prescriptions) {
@@ -657,16 +833,45 @@ void Server::handleClientData()
     QTcpSocket *clientSocket = qobject_cast<QTcpSocket*>(sender());
     if (!clientSocket) return;
 
-    QByteArray data = clientSocket->readAll();
+    // 处理TCP粘包问题：按换行符分割消息；未处理完的数据按连接保存
+    m_receiveBuffers[clientSocket].append(clientSocket->readAll());
+    processClientData(clientSocket);
+}
+
+void Server::processClientData(QTcpSocket *clientSocket)
+{
+    QByteArray buffer = m_receiveBuffers.take(clientSocket);
+
+    while (true) {
+        // 正在接收头像或附件的二进制数据时，先按声明的字节数消费，不做按行解析
+        if (m_avatarUploads.contains(clientSocket)) {
+            if (!consumeAvatarUpload(clientSocket, buffer)) {
+                break;
+            }
+            continue;
+        }
+        if (m_attachmentChunks.contains(clientSocket)) {
+            if (!consumeAttachmentChunk(clientSocket, buffer)) {
+                break;
+            }
+            continue;
+        }
 
-    // 处理TCP粘包问题：按换行符分割消息
-    static QByteArray buffer;
-    buffer.append(data);
+        // 上一个列表响应还没写完，后续请求等它写完再处理，避免两个响应交错
+        if (m_rowStreams.contains(clientSocket)) {
+            break;
+        }
+        // 列表响应中途失败时连接已被断开，剩下的请求不再处理
+        if (clientSocket->state() != QAbstractSocket::ConnectedState) {
+            break;
+        }
 
-    while (buffer.contains('\n')) {
         int pos = buffer.indexOf('\n');
+        if (pos < 0) {
+            break;
+        }
         QByteArray messageData = buffer.left(pos);
-        buffer = buffer.mid(pos + 1);
+        buffer.remove(0, pos + 1);
 
         QString message = QString::fromUtf8(messageData);
         qDebug() << "Received from client:" << message;
@@ -689,6 +894,18 @@ void Server::handleClientData()
     {
         handleRegister(message, clientSocket);
     }
+    else if (messageType == "SET_ENCODING")
+    {
+        handleSetEncoding(message, clientSocket);
+    }
+    else if (messageType == "SET_COMPRESSION")
+    {
+        handleSetCompression(message, clientSocket);
+    }
+    else if (messageType == "GET_COMPRESSION_STATS")
+    {
+        handleCompressionStats(clientSocket);
+    }
     else if (messageType == "APPOINTMENTS")
     {
         handleAppointmentsRequest(message, clientSocket);
@@ -706,6 +923,9 @@ void Server::handleClientData()
     else if (messageType == "HISTORY") {
         handleAttendanceHistory(message, clientSocket);
     }
+    else if (messageType == "ATTENDANCE_SUMMARY") {
+        handleAttendanceSummary(message, clientSocket);
+    }
     else if (messageType == "LEAVE") {
         handleLeaveApplication(message, clientSocket);
     }
@@ -715,6 +935,12 @@ void Server::handleClientData()
     else if (messageType == "RETURN") {
         handleReturnFromLeave(message, clientSocket);
     }
+    else if (messageType == "ROLLCALL_BOARD") {
+        handleRollCallBoard(message, clientSocket);
+    }
+    else if (messageType == "ROLLCALL_UNSUBSCRIBE") {
+        handleRollCallUnsubscribe(message, clientSocket);
+    }
     else if (messageType == "SEND_MESSAGE") {
         handleSendMessage(message, clientSocket);
     }
@@ -724,15 +950,43 @@ void Server::handleClientData()
     else if (messageType == "GET_CHAT_HISTORY") {
         handleGetChatHistory(message, clientSocket);
     }
+    else if (messageType == "CHAT_EPOCH") {
+        // 聊天记录同步握手：客户端本地记录的 message_id 只在同一 epoch 内有效
+        clientSocket->write("CHAT_EPOCH#" + m_chatEpoch.toUtf8() + "\n");
+    }
     else if (messageType == "GET_CONTACT_LIST") {
         handleGetContactList(message, clientSocket);
     }
     else if (messageType == "GET_IMAGE") {
         handleGetImage(message, clientSocket);
     }
+    else if (messageType == "GET_AVATAR") {
+        handleGetAvatar(message, clientSocket);
+    }
+    else if (messageType == "AVATAR_CHECK") {
+        handleAvatarCheck(message, clientSocket);
+    }
+    else if (messageType == "AVATAR_UPLOAD") {
+        handleAvatarUploadBegin(message, clientSocket);
+    }
+    else if (messageType == "ATTACH_BEGIN") {
+        handleAttachBegin(message, clientSocket);
+    }
+    else if (messageType == "ATTACH_CHUNK") {
+        handleAttachChunkBegin(message, clientSocket);
+    }
+    else if (messageType == "ATTACH_GET") {
+        handleAttachGet(message, clientSocket);
+    }
+    else if (messageType == "ATTACH_LIST") {
+        handleAttachList(message, clientSocket);
+    }
     else if (messageType == "MEDICINE_SEARCH") {
         handleMedicineSearch(message, clientSocket);
     }
+    else if (messageType == "GET_SPEECH_VOCABULARY") {
+        handleGetSpeechVocabulary(message, clientSocket);
+    }
     else if (messageType == "VIDEO_CALL_REQUEST") {
         handleVideoCallRequest(message, clientSocket);
     }
@@ -745,6 +999,9 @@ void Server::handleClientData()
     else if (messageType == "SUBMIT_PRESCRIPTION") {
         handleSubmitPrescription(message, clientSocket);  // 处理处方提交
     }
+    else if (messageType == "SUBMIT_PRESCRIPTION_BATCH") {
+        handleSubmitPrescriptionBatch(message, clientSocket);  // 处理多药品处方提交
+    }
     else if (messageType == "GET_PATIENT_PRESCRIPTIONS") {
         handleGetPatientPrescriptions(message, clientSocket);  // 处理患者处方查询
     }
@@ -776,13 +1033,17 @@ void Server::handleClientData()
         handleGetUserAppointments(message, clientSocket);
     }
     }
+
+    if (!buffer.isEmpty() && clientSocket->state() == QAbstractSocket::ConnectedState) {
+        m_receiveBuffers.insert(clientSocket, buffer);
+    }
 }
 
 void Server::handleUserInfoRequest(const QString &userId, QTcpSocket *clientSocket)
 {
     if (!m_db.isOpen()) {
         qDebug() << "Database not open in handleUserInfoRequest";
-        clientSocket->write("USERINFO_FAIL#DB_NOT_OPEN");
+        clientSocket->write("USERINFO_FAIL#DB_NOT_OPEN\n");
         return;
     }
 
@@ -792,7 +1053,7 @@ void Server::handleUserInfoRequest(const QString &userId, QTcpSocket *clientSock
 
     if (!query.exec()) {
         qDebug() << "用户信息查询失败:" << query.lastError().text();
-        clientSocket->write("USERINFO_FAIL");
+        clientSocket->write("USERINFO_FAIL\n");
         return;
     }
 
@@ -806,14 +1067,15 @@ void Server::handleUserInfoRequest(const QString &userId, QTcpSocket *clientSock
         userJson["phone"] = query.value("phone").toString();
         userJson["email"] = query.value("email").toString();
         userJson["avatar_path"] = query.value("avatar_path").toString(); // 添加头像路径
+        userJson["avatar_hash"] = query.value("avatar_hash").toString(); // 客户端据此判断是否需要上传，并用 GET_AVATAR 按哈希拉取头像
 
         QJsonDocument doc(userJson);
         QByteArray jsonData = doc.toJson(QJsonDocument::Compact);
 
-        clientSocket->write("USERINFO_SUCCESS#" + jsonData);
+        clientSocket->write("USERINFO_SUCCESS#" + jsonData + "\n");
         qDebug() << "已发送用户信息给用户:" << userId;
     } else {
-        clientSocket->write("USERINFO_FAIL#USER_NOT_FOUND");
+        clientSocket->write("USERINFO_FAIL#USER_NOT_FOUND\n");
         qDebug() << "用户不存在:" << userId;
     }
 }
@@ -843,17 +1105,31 @@ void Server::handleSaveUserInfo(const QString &message, QTcpSocket *clientSocket
         return;
     }
 
+    // 身份证号可能被修改，同步刷新推断出的性别和出生日期
+    QString gender, idBirthDate;
+    deriveIdCardInfo(jsonData["id_card"].toString(), gender, idBirthDate);
+
+    // 头像改由 AVATAR_CHECK / AVATAR_UPLOAD 单独上传，资料保存只是元数据更新；
+    // 只有请求里显式带了 avatar_path 才改写头像路径（并清除已失效的头像哈希）
+    const bool hasAvatarPath = jsonData.contains("avatar_path");
+
     QSqlQuery query(m_db);
-    query.prepare("UPDATE user SET real_name = :real_name, birth_date = :birth_date, "
-                  "id_card = :id_card, phone = :phone, email = :email, "
-                  "avatar_path = :avatar_path WHERE id = :id"); // 更新avatar_path字段
+    query.prepare(QString("UPDATE user SET real_name = :real_name, birth_date = :birth_date, "
+                          "id_card = :id_card, phone = :phone, email = :email, %1"
+                          "gender = :gender, id_birth_date = :id_birth_date "
+                          "WHERE id = :id")
+                      .arg(hasAvatarPath ? "avatar_path = :avatar_path, avatar_hash = NULL, " : ""));
 
     query.bindValue(":real_name", jsonData["real_name"].toString());
     query.bindValue(":birth_date", jsonData["birth_date"].toString());
     query.bindValue(":id_card", jsonData["id_card"].toString());
     query.bindValue(":phone", jsonData["phone"].toString());
     query.bindValue(":email", jsonData["email"].toString());
-    query.bindValue(":avatar_path", jsonData["avatar_path"].toString()); // 绑定头像路径
+    if (hasAvatarPath) {
+        query.bindValue(":avatar_path", jsonData["avatar_path"].toString()); // 绑定头像路径
+    }
+    query.bindValue(":gender", gender.isEmpty() ? QVariant() : QVariant(gender));
+    query.bindValue(":id_birth_date", idBirthDate.isEmpty() ? QVariant() : QVariant(idBirthDate));
     query.bindValue(":id", userId);
 
     if (query.exec()) {
@@ -871,6 +1147,28 @@ void Server::handleSaveUserInfo(const QString &message, QTcpSocket *clientSocket
 }
 
 
+// 从18位身份证号推断性别（第17位奇男偶女）和出生日期（第7-14位）
+// 只在注册、保存资料和初始化示例数据时调用，预约列表等读路径直接使用存储的列
+void Server::deriveIdCardInfo(const QString &idCard, QString &gender, QString &idBirthDate)
+{
+    gender.clear();
+    idBirthDate.clear();
+
+    if (idCard.length() < 18) {
+        return;
+    }
+
+    int genderDigit = idCard.at(16).digitValue();
+    if (genderDigit >= 0) {
+        gender = (genderDigit % 2 == 1) ? "男" : "女";
+    }
+
+    QDate birthDate = QDate::fromString(idCard.mid(6, 8), "yyyyMMdd");
+    if (birthDate.isValid() && birthDate.year() > 1900) {
+        idBirthDate = birthDate.toString("yyyy-MM-dd");
+    }
+}
+
 // 生成新的用户ID
 QString Server::generateUserId(const QString &identity)
 {
@@ -884,22 +1182,18 @@ QString Server::generateUserId(const QString &identity)
         prefix = "12";
     }
 
-    // 查询当前最大ID
-    QSqlQuery query(m_db);
-    query.prepare("SELECT MAX(id) FROM user WHERE id LIKE :prefix");
-    query.bindValue(":prefix", prefix + "%");
-
-    int maxNumber = 0;
-    if (query.exec() && query.next()) {
-        QString maxId = query.value(0).toString();
-        if (!maxId.isEmpty()) {
-            maxNumber = maxId.mid(2).toInt(); // 去掉前缀
-        }
+    // 序号由ID分配器在内存号段中分配，不再扫描 user 表
+    qint64 number = m_idAllocator.next(prefix);
+    if (number < 0) {
+        return "";
     }
 
-    // 生成新的ID
-    int newNumber = maxNumber + 1;
-    QString newId = prefix + QString::number(newNumber).rightJustified(4, '0');
+    // 序号定长补零，ID 按字符串排序即按注册顺序；超出位数时拒绝分配而不是加宽
+    if (number > USER_ID_MAX_SEQUENCE) {
+        qDebug() << "用户ID序号已用尽:" << prefix << number;
+        return "";
+    }
+    QString newId = prefix + QString::number(number).rightJustified(USER_ID_DIGITS, '0');
 
     return newId;
 }
@@ -930,11 +1224,18 @@ void Server::handleRegister(const QString &message, QTcpSocket *clientSocket)
 
     // 生成用户ID
     QString userId = generateUserId(identity);
+    if (userId.isEmpty()) {
+        clientSocket->write("REGISTER_FAIL#DB_ERROR");
+        return;
+    }
 
     // 插入用户到数据库
     QSqlQuery query(m_db);
-    query.prepare("INSERT INTO user (id, username, password, avatar_path, real_name, birth_date, id_card, phone, email) "
-                  "VALUES (:id, :username, :password, :avatar_path, :real_name, :birth_date, :id_card, :phone, :email)");
+    QString gender, idBirthDate;
+    deriveIdCardInfo(id_card, gender, idBirthDate);
+
+    query.prepare("INSERT INTO user (id, username, password, avatar_path, real_name, birth_date, id_card, phone, email, gender, id_birth_date) "
+                  "VALUES (:id, :username, :password, :avatar_path, :real_name, :birth_date, :id_card, :phone, :email, :gender, :id_birth_date)");
 
     query.bindValue(":id", userId);
     query.bindValue(":username", username);
@@ -945,6 +1246,8 @@ void Server::handleRegister(const QString &message, QTcpSocket *clientSocket)
     query.bindValue(":id_card", id_card);
     query.bindValue(":phone", phone);
     query.bindValue(":email", email);
+    query.bindValue(":gender", gender.isEmpty() ? QVariant() : QVariant(gender));
+    query.bindValue(":id_birth_date", idBirthDate.isEmpty() ? QVariant() : QVariant(idBirthDate));
 
     if (query.exec()) {
         // 根据身份插入到相应的表
@@ -974,21 +1277,229 @@ void Server::handleRegister(const QString &message, QTcpSocket *clientSocket)
     }
 }
 
+// 协商列表响应的负载编码
+// 请求格式: SET_ENCODING#cbor|json，回复实际采用的编码；不认识的编码回退为 json
+void Server::handleSetEncoding(const QString &message, QTcpSocket *clientSocket)
+{
+    QString requested = message.section('#', 1, 1).trimmed().toLower();
+
+    if (requested == "cbor") {
+        m_payloadEncodings[clientSocket] = PayloadEncoding::Cbor;
+        clientSocket->write("SET_ENCODING_SUCCESS#cbor\n");
+    } else {
+        m_payloadEncodings.remove(clientSocket);
+        clientSocket->write("SET_ENCODING_SUCCESS#json\n");
+    }
+    qDebug() << "连接负载编码:" << clientSocket->peerAddress().toString() << "->" << requested;
+}
+
+std::unique_ptr<RowWriter> Server::createRowWriter(QTcpSocket *clientSocket, const QByteArray &prefix)
+{
+    const bool cbor = m_payloadEncodings.value(clientSocket, PayloadEncoding::Json) == PayloadEncoding::Cbor;
+    auto makeWriter = [cbor, prefix](QIODevice *device) -> std::unique_ptr<RowWriter> {
+        if (cbor) {
+            return std::make_unique<CborRowWriter>(device, prefix);
+        }
+        return std::make_unique<JsonRowWriter>(device, prefix);
+    };
+
+    if (!m_compressionThresholds.contains(clientSocket)) {
+        return makeWriter(clientSocket);
+    }
+
+    // 启用压缩的连接先收集整帧，再统一走 writeFrame
+    QString opcode = QString::fromUtf8(prefix).section('#', 0, 0);
+    return std::make_unique<FramedRowWriter>(makeWriter, [this, clientSocket, opcode](const QByteArray &frame) {
+        writeFrame(clientSocket, opcode, frame);
+    });
+}
+
+// 协商传输压缩
+// 请求格式: SET_COMPRESSION#zlib[#threshold] 或 SET_COMPRESSION#none
+// 回复: SET_COMPRESSION_SUCCESS#zlib#<threshold> / SET_COMPRESSION_SUCCESS#none
+void Server::handleSetCompression(const QString &message, QTcpSocket *clientSocket)
+{
+    QStringList parts = message.split('#');
+    QString method = parts.size() > 1 ? parts[1].trimmed().toLower() : QString();
+
+    if (method != "zlib") {
+        m_compressionThresholds.remove(clientSocket);
+        clientSocket->write("SET_COMPRESSION_SUCCESS#none\n");
+        return;
+    }
+
+    int threshold = COMPRESSION_DEFAULT_THRESHOLD;
+    if (parts.size() > 2) {
+        bool ok = false;
+        int requested = parts[2].trimmed().toInt(&ok);
+        if (ok) {
+            threshold = qMax(requested, static_cast<int>(COMPRESSION_MIN_THRESHOLD));
+        }
+    }
+
+    m_compressionThresholds[clientSocket] = threshold;
+    clientSocket->write(QString("SET_COMPRESSION_SUCCESS#zlib#%1\n").arg(threshold).toUtf8());
+    qDebug() << "连接启用传输压缩:" << clientSocket->peerAddress().toString() << "阈值:" << threshold;
+}
+
+// 返回各响应类型的压缩统计：COMPRESSION_STATS_SUCCESS#{opcode: {...}}
+void Server::handleCompressionStats(QTcpSocket *clientSocket)
+{
+    QJsonObject statsObj;
+    for (auto it = m_compressionStats.constBegin(); it != m_compressionStats.constEnd(); ++it) {
+        const CompressionStats &stats = it.value();
+        QJsonObject item;
+        item["frames"] = stats.frames;
+        item["compressed_frames"] = stats.compressedFrames;
+        item["skipped_frames"] = stats.skippedFrames;
+        item["raw_bytes"] = stats.rawBytes;
+        item["wire_bytes"] = stats.wireBytes;
+        item["ratio"] = stats.rawBytes > 0 ? double(stats.wireBytes) / double(stats.rawBytes) : 1.0;
+        item["cpu_us"] = stats.cpuNsecs / 1000;
+        statsObj[it.key()] = item;
+    }
+
+    QJsonDocument doc(statsObj);
+    clientSocket->write("COMPRESSION_STATS_SUCCESS#" + doc.toJson(QJsonDocument::Compact) + "\n");
+}
+
+// 发送一帧完整响应；连接启用压缩且帧超过阈值时压缩发送
+// 压缩帧格式: "@z#<压缩后字节数>\n" + qCompress 数据，解压后即原始响应
+void Server::writeFrame(QTcpSocket *clientSocket, const QString &opcode, const QByteArray &frame, bool compressible)
+{
+    auto thresholdIt = m_compressionThresholds.constFind(clientSocket);
+    if (thresholdIt == m_compressionThresholds.constEnd()) {
+        clientSocket->write(frame);
+        return;
+    }
+
+    CompressionStats &stats = m_compressionStats[opcode];
+    stats.frames++;
+    stats.rawBytes += frame.size();
+
+    if (!compressible || frame.size() < thresholdIt.value()) {
+        if (!compressible) {
+            stats.skippedFrames++;
+        }
+        stats.wireBytes += frame.size();
+        clientSocket->write(frame);
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QByteArray compressed = qCompress(frame, COMPRESSION_LEVEL);
+    stats.cpuNsecs += timer.nsecsElapsed();
+
+    QByteArray header = "@z#" + QByteArray::number(compressed.size()) + "\n";
+    if (header.size() + compressed.size() >= frame.size()) {
+        // 压缩无收益时原样发送
+        stats.wireBytes += frame.size();
+        clientSocket->write(frame);
+        return;
+    }
+
+    stats.compressedFrames++;
+    stats.wireBytes += header.size() + compressed.size();
+    clientSocket->write(header);
+    clientSocket->write(compressed);
+}
+
+bool Server::isCompressedImage(const QByteArray &data)
+{
+    return data.startsWith("\xFF\xD8\xFF")                  // JPEG
+        || data.startsWith(QByteArray("\x89PNG\r\n\x1A\n", 8)) // PNG
+        || data.startsWith("GIF87a") || data.startsWith("GIF89a");
+}
+
+QString Server::rowWriterStats(const RowWriter &writer)
+{
+    return QString("编码:%1 行数:%2 字节:%3 峰值缓冲:%4 编码耗时:%5us")
+        .arg(writer.encodingName())
+        .arg(writer.rowCount())
+        .arg(writer.bytesWritten())
+        .arg(writer.peakBufferSize())
+        .arg(writer.encodeNsecs() / 1000);
+}
+
+void Server::streamRows(QTcpSocket *clientSocket, QSqlQuery &&query, const QByteArray &prefix, const QByteArray &suffix,
+                        const QString &logLabel, const RowStream::RowFunc &writeRow)
+{
+    auto stream = std::make_shared<RowStream>();
+    stream->query = std::make_unique<QSqlQuery>(std::move(query));
+    stream->writer = createRowWriter(clientSocket, prefix);
+    stream->writeRow = writeRow;
+    stream->suffix = suffix;
+    stream->logLabel = logLabel;
+
+    m_rowStreams.insert(clientSocket, stream);
+    pumpRowStream(clientSocket);
+}
+
+bool Server::pumpRowStream(QTcpSocket *clientSocket)
+{
+    auto it = m_rowStreams.find(clientSocket);
+    if (it == m_rowStreams.end()) {
+        return true;
+    }
+
+    RowStream &stream = *it.value();
+    while (clientSocket->bytesToWrite() < ROW_STREAM_SEND_WINDOW) {
+        if (!stream.query->next()) {
+            // 游标中途出错（如共享连接上其他事务回滚导致 SQLITE_ABORT_ROLLBACK）时不能当作正常结束补上结尾，
+            // 否则客户端会收到一份格式完整但缺行的结果。直接断开连接，客户端重连后重新请求
+            if (stream.query->lastError().isValid()) {
+                qDebug() << stream.logLabel << "| 读取中途失败，断开连接:" << stream.query->lastError().text();
+                m_rowStreams.erase(it);
+                clientSocket->abort();
+                return false;
+            }
+            stream.writer->finish(stream.suffix);
+            if (!stream.deferredPushes.isEmpty()) {
+                clientSocket->write(stream.deferredPushes);
+            }
+            qDebug() << stream.logLabel << "|" << rowWriterStats(*stream.writer);
+            m_rowStreams.erase(it);
+            return true;
+        }
+        stream.writer->beginRow();
+        stream.writeRow(*stream.query, *stream.writer);
+        stream.writer->endRow();
+    }
+    return false;
+}
+
+void Server::pushToClient(QTcpSocket *clientSocket, const QByteArray &data)
+{
+    auto it = m_rowStreams.constFind(clientSocket);
+    if (it != m_rowStreams.constEnd()) {
+        it.value()->deferredPushes.append(data);
+        return;
+    }
+    clientSocket->write(data);
+}
+
 // 处理获取预约请求
 void Server::handleAppointmentsRequest(const QString &message, QTcpSocket *clientSocket)
 {
     if (!m_db.isOpen()) {
         qDebug() << "Database not open in handleAppointmentsRequest";
-        clientSocket->write("APPOINTMENTS_FAIL#DB_NOT_OPEN");
+        clientSocket->write("APPOINTMENTS_FAIL#DB_NOT_OPEN\n");
         return;
     }
 
     // 请求格式: APPOINTMENTS#doctorId
     QString doctorId = message.section('#', 1, 1);
 
+    // 性别和出生日期在写入时已推断好，年龄由SQLite对整个结果集统一计算，
+    // 序列化时不再逐行解析身份证号
     QSqlQuery query(m_db);
+    query.setForwardOnly(true);
     query.prepare("SELECT a.patient_id, u.real_name as patient_name, a.appointment_date, "
-                  "d.department, p.case_info as symptom, u.phone, u.id_card, a.status "
+                  "d.department, p.case_info as symptom, u.phone, u.gender, a.status, "
+                  "CASE WHEN u.id_birth_date IS NULL THEN NULL ELSE "
+                  "CAST(strftime('%Y', 'now', 'localtime') AS INTEGER) - CAST(strftime('%Y', u.id_birth_date) AS INTEGER) "
+                  "- (strftime('%m-%d', 'now', 'localtime') < strftime('%m-%d', u.id_birth_date)) END AS age "
                   "FROM appointment a "
                   "JOIN user u ON a.patient_id = u.id "
                   "JOIN patient p ON a.patient_id = p.id "
@@ -997,61 +1508,32 @@ void Server::handleAppointmentsRequest(const QString &message, QTcpSocket *clien
     query.bindValue(":doctor_id", doctorId);
 
     if (query.exec()) {
-        QJsonArray appointmentsArray;
-
-        while (query.next()) {
-            QJsonObject appointment;
-            appointment["patient_id"] = query.value("patient_id").toString();
-            appointment["patient_name"] = query.value("patient_name").toString();
-            appointment["appointment_date"] = query.value("appointment_date").toString();
-            appointment["department"] = query.value("department").toString();
-            appointment["symptom"] = query.value("symptom").toString();
-            appointment["phone"] = query.value("phone").toString();
-            appointment["status"] = query.value("status").toString();
-
-            // 从身份证号推断性别和年龄
-            QString idCard = query.value("id_card").toString();
-            if (!idCard.isEmpty() && idCard.length() >= 18) {
-                // 推断性别：身份证第17位，奇数为男性，偶数为女性
-                QChar genderDigit = idCard.at(16);
-                QString gender = (genderDigit.digitValue() % 2 == 1) ? "男" : "女";
-                appointment["gender"] = gender;
-
-                // 推断年龄：从身份证第7-10位获取出生年份
-                QString birthYearStr = idCard.mid(6, 4);
-                bool ok;
-                int birthYear = birthYearStr.toInt(&ok);
-                if (ok && birthYear > 1900) {
-                    QDate currentDate = QDate::currentDate();
-                    int currentYear = currentDate.year();
-                    int age = currentYear - birthYear;
-
-                    // 检查是否已过生日
-                    QString birthMonthStr = idCard.mid(10, 2);
-                    QString birthDayStr = idCard.mid(12, 2);
-                    int birthMonth = birthMonthStr.toInt(&ok);
-                    if (ok) {
-                        int birthDay = birthDayStr.toInt(&ok);
-                        if (ok) {
-                            QDate birthDate(birthYear, birthMonth, birthDay);
-                            if (currentDate < QDate(currentYear, birthMonth, birthDay)) {
-                                age--; // 如果今年生日还没到，年龄减1
-                            }
-                        }
-                    }
-                    appointment["age"] = age;
-                }
+        streamRows(clientSocket, std::move(query), "APPOINTMENTS_SUCCESS#", "\n",
+                   QString("发送预约数据给医生: %1").arg(doctorId),
+                   [](const QSqlQuery &row, RowWriter &writer) {
+            writer.addString("patient_id", row.value(0).toString());
+            writer.addString("patient_name", row.value(1).toString());
+            writer.addString("appointment_date", row.value(2).toString());
+            writer.addString("department", row.value(3).toString());
+            writer.addString("symptom", row.value(4).toString());
+            writer.addString("phone", row.value(5).toString());
+            writer.addString("status", row.value(7).toString());
+
+            const QVariant gender = row.value(6);
+            if (!gender.isNull()) {
+                writer.addString("gender", gender.toString());
+            } else {
+                writer.addNull("gender");
             }
-
-            appointmentsArray.append(appointment);
-        }
-
-        QJsonDocument doc(appointmentsArray);
-        QString response = "APPOINTMENTS_SUCCESS#" + doc.toJson(QJsonDocument::Compact);
-        clientSocket->write(response.toUtf8());
-        qDebug() << "发送预约数据给医生:" << doctorId;
+            const QVariant age = row.value(8);
+            if (!age.isNull()) {
+                writer.addInt("age", age.toInt());
+            } else {
+                writer.addNull("age");
+            }
+        });
     } else {
-        clientSocket->write("APPOINTMENTS_FAIL");
+        clientSocket->write("APPOINTMENTS_FAIL\n");
         qDebug() << "获取预约数据失败:" << query.lastError().text();
     }
 }
@@ -1118,6 +1600,23 @@ void Server::start()
 {
     initializeDatabase();  // 初始化数据库
 
+    // ID分配器接管测试数据中已有的用户ID，启动时只扫描这一次
+    m_idAllocator.setDatabase(m_db);
+    for (const QString &prefix : {QString("11"), QString("12")}) {
+        QSqlQuery maxUserQuery(m_db);
+        maxUserQuery.prepare("SELECT MAX(CAST(substr(id, 3) AS INTEGER)) FROM user WHERE id LIKE :prefix");
+        maxUserQuery.bindValue(":prefix", prefix + "%");
+        if (maxUserQuery.exec() && maxUserQuery.next()) {
+            m_idAllocator.ensureFloor(prefix, maxUserQuery.value(0).toLongLong());
+        }
+    }
+
+    // 聊天消息ID在内存中分配，从当前最大ID之后开始
+    QSqlQuery maxIdQuery(m_db);
+    if (maxIdQuery.exec("SELECT COALESCE(MAX(message_id), 0) FROM message") && maxIdQuery.next()) {
+        m_nextMessageId = maxIdQuery.value(0).toLongLong() + 1;
+    }
+
     quint16 port = 8888;
     if (!m_server->listen(QHostAddress::Any, port)) {
         qDebug() << "Server could not start:" << m_server->errorString();
@@ -1127,6 +1626,10 @@ void Server::start()
     qDebug() << "Server listening on port" << port;
 
     connect(m_server, &QTcpServer::newConnection, this, &Server::handleNewConnection);
+
+    // 缺勤没有请求触发，由定时任务按班次补记
+    markAbsences();
+    m_absenceTimer->start(ABSENCE_CHECK_INTERVAL_MS);
 }
 
 void Server::handleNewConnection()
@@ -1138,6 +1641,18 @@ void Server::handleNewConnection()
 
     connect(clientSocket, &QTcpSocket::readyRead, this, &Server::handleClientData);
     connect(clientSocket, &QTcpSocket::disconnected, this, &Server::handleDisconnection);
+    connect(clientSocket, &QTcpSocket::bytesWritten, this, [this, clientSocket]() {
+        // 列表响应写完之前不插入附件数据帧
+        if (m_rowStreams.contains(clientSocket)) {
+            if (!pumpRowStream(clientSocket)) {
+                return;
+            }
+            QTimer::singleShot(0, clientSocket, [this, clientSocket]() {
+                processClientData(clientSocket);
+            });
+        }
+        pumpAttachmentDownload(clientSocket);
+    });
 }
 
 
@@ -1151,6 +1666,18 @@ void Server::handleDisconnection()
     qDebug() << "Client disconnected:" << username;
 
     m_connectedClients.remove(clientSocket);
+    m_payloadEncodings.remove(clientSocket);
+    m_compressionThresholds.remove(clientSocket);
+    m_receiveBuffers.remove(clientSocket);
+    m_avatarUploads.remove(clientSocket); // 未收完的头像上传随临时文件一起丢弃
+    m_attachmentChunks.remove(clientSocket); // 已写入的附件数据保留，客户端重连后续传
+    m_attachmentDownloads.remove(clientSocket);
+    m_rowStreams.remove(clientSocket);
+
+    // 取消该连接的点名板订阅
+    for (auto it = m_rollCallSubscribers.begin(); it != m_rollCallSubscribers.end(); ++it) {
+        it.value().remove(clientSocket);
+    }
     clientSocket->deleteLater();
 }
 
@@ -1159,14 +1686,14 @@ void Server::handleCheckIn(const QString &message, QTcpSocket *clientSocket)
 {
     if (!m_db.isOpen()) {
         qDebug() << "Database not open in handleCheckIn";
-        clientSocket->write("CHECKIN_FAIL#DB_NOT_OPEN");
+        clientSocket->write("CHECKIN_FAIL#DB_NOT_OPEN\n");
         return;
     }
 
     // 请求格式: CHECKIN#doctorId#date
     QStringList parts = message.split('#');
     if (parts.size() < 3) {
-        clientSocket->write("CHECKIN_FAIL#INVALID_FORMAT");
+        clientSocket->write("CHECKIN_FAIL#INVALID_FORMAT\n");
         return;
     }
 
@@ -1181,17 +1708,23 @@ void Server::handleCheckIn(const QString &message, QTcpSocket *clientSocket)
     checkQuery.bindValue(":date", date);
 
     if (checkQuery.exec() && checkQuery.next()) {
-        clientSocket->write("CHECKIN_FAIL#ALREADY_CHECKED_IN");
+        clientSocket->write("CHECKIN_FAIL#ALREADY_CHECKED_IN\n");
         qDebug() << "打卡失败: 医生" << doctorId << "在" << date << "已经签到过";
         return;
     }
 
-    // 判断打卡状态
+    // 判断打卡状态：晚于班次上班时间为迟到，没有班次的医生沿用 8:30
+    QTime shiftStart(8, 30);
+    QTime shiftEnd;
+    doctorShift(doctorId, QDate::fromString(date, "yyyy-MM-dd"), &shiftStart, &shiftEnd);
     QString status = "normal";
-    if (currentTime > QTime(8, 30)) {
+    if (currentTime > shiftStart) {
         status = "late";
     }
 
+    // 考勤记录和月度汇总在同一事务中更新
+    m_db.transaction();
+
     QSqlQuery query(m_db);
     query.prepare("INSERT INTO attendance (doctor_id, date, check_in_time, status) "
                   "VALUES (:doctor_id, :date, :check_in_time, :status)");
@@ -1200,11 +1733,13 @@ void Server::handleCheckIn(const QString &message, QTcpSocket *clientSocket)
     query.bindValue(":check_in_time", currentTime.toString("hh:mm:ss"));
     query.bindValue(":status", status);
 
-    if (query.exec()) {
-        clientSocket->write("CHECKIN_SUCCESS");
+    if (query.exec() && updateAttendanceRollup(doctorId, date, QString(), status) && m_db.commit()) {
+        clientSocket->write("CHECKIN_SUCCESS\n");
+        pushRollCallUpdate(doctorId, date);
         qDebug() << "打卡成功:" << doctorId << "-" << date << "-" << currentTime.toString("hh:mm:ss");
     } else {
-        clientSocket->write("CHECKIN_FAIL#DB_ERROR");
+        m_db.rollback();
+        clientSocket->write("CHECKIN_FAIL#DB_ERROR\n");
         qDebug() << "打卡失败:" << query.lastError().text();
     }
 }
@@ -1214,14 +1749,14 @@ void Server::handleCheckOut(const QString &message, QTcpSocket *clientSocket)
 {
     if (!m_db.isOpen()) {
         qDebug() << "Database not open in handleCheckOut";
-        clientSocket->write("CHECKOUT_FAIL#DB_NOT_OPEN");
+        clientSocket->write("CHECKOUT_FAIL#DB_NOT_OPEN\n");
         return;
     }
 
     // 请求格式: CHECKOUT#doctorId#date
     QStringList parts = message.split('#');
     if (parts.size() < 3) {
-        clientSocket->write("CHECKOUT_FAIL#INVALID_FORMAT");
+        clientSocket->write("CHECKOUT_FAIL#INVALID_FORMAT\n");
         return;
     }
 
@@ -1236,89 +1771,306 @@ void Server::handleCheckOut(const QString &message, QTcpSocket *clientSocket)
     checkQuery.bindValue(":date", date);
 
     if (!checkQuery.exec() || !checkQuery.next()) {
-        clientSocket->write("CHECKOUT_FAIL#NOT_CHECKED_IN");
+        clientSocket->write("CHECKOUT_FAIL#NOT_CHECKED_IN\n");
         qDebug() << "签出失败: 医生" << doctorId << "在" << date << "尚未签到";
         return;
     }
 
     // 检查是否已经签出过
     if (!checkQuery.value("check_out_time").isNull()) {
-        clientSocket->write("CHECKOUT_FAIL#ALREADY_CHECKED_OUT");
+        clientSocket->write("CHECKOUT_FAIL#ALREADY_CHECKED_OUT\n");
         qDebug() << "签出失败: 医生" << doctorId << "在" << date << "已经签出过";
         return;
     }
 
+    // 正常签到但早于班次下班时间签退的记为早退，迟到记录保持迟到；没有班次的医生不判定早退
+    QString oldStatus = checkQuery.value("status").toString();
+    QString newStatus = oldStatus;
+    QTime shiftStart;
+    QTime shiftEnd;
+    if (oldStatus == "normal" && doctorShift(doctorId, QDate::fromString(date, "yyyy-MM-dd"), &shiftStart, &shiftEnd)
+        && currentTime < shiftEnd) {
+        newStatus = "early_leave";
+    }
+
+    // 考勤记录和月度汇总在同一事务中更新
+    m_db.transaction();
+
     QSqlQuery query(m_db);
-    query.prepare("UPDATE attendance SET check_out_time = :check_out_time "
+    query.prepare("UPDATE attendance SET check_out_time = :check_out_time, status = :status "
                   "WHERE doctor_id = :doctor_id AND date = :date");
     query.bindValue(":check_out_time", currentTime.toString("hh:mm:ss"));
+    query.bindValue(":status", newStatus);
     query.bindValue(":doctor_id", doctorId);
     query.bindValue(":date", date);
 
-    if (query.exec() && query.numRowsAffected() > 0) {
-        clientSocket->write("CHECKOUT_SUCCESS");
+    if (query.exec() && query.numRowsAffected() > 0
+        && updateAttendanceRollup(doctorId, date, oldStatus, newStatus) && m_db.commit()) {
+        clientSocket->write("CHECKOUT_SUCCESS\n");
+        pushRollCallUpdate(doctorId, date);
         qDebug() << "签出成功:" << doctorId << "-" << date << "-" << currentTime.toString("hh:mm:ss");
     } else {
-        clientSocket->write("CHECKOUT_FAIL#DB_ERROR");
+        m_db.rollback();
+        clientSocket->write("CHECKOUT_FAIL#DB_ERROR\n");
         qDebug() << "签出失败:" << query.lastError().text();
     }
 }
 
-// 处理考勤历史记录请求
-void Server::handleAttendanceHistory(const QString &message, QTcpSocket *clientSocket)
+// 查询医生在某日的班次；没有班次或该日不是工作日时返回 false，start/end 保持不变
+bool Server::doctorShift(const QString &doctorId, const QDate &date, QTime *start, QTime *end)
+{
+    QSqlQuery query(m_db);
+    query.prepare("SELECT shift_start, shift_end, work_days FROM doctor_shift WHERE doctor_id = :doctor_id");
+    query.bindValue(":doctor_id", doctorId);
+    if (!query.exec() || !query.next()) {
+        return false;
+    }
+    if (!query.value("work_days").toString().split(',').contains(QString::number(date.dayOfWeek()))) {
+        return false;
+    }
+    *start = QTime::fromString(query.value("shift_start").toString(), "hh:mm:ss");
+    *end = QTime::fromString(query.value("shift_end").toString(), "hh:mm:ss");
+    return true;
+}
+
+// 补记缺勤：班次生效后的每个已过去的工作日，没有考勤记录且不在已批准的请假内，记为 absent 并计入月度汇总
+// 启动时和之后每小时执行一次，已检查过的日期不再重复扫描
+void Server::markAbsences()
 {
     if (!m_db.isOpen()) {
-        qDebug() << "Database not open in handleAttendanceHistory";
-        clientSocket->write("HISTORY_FAIL#DB_NOT_OPEN");
         return;
     }
 
-    // 请求格式: HISTORY#doctorId
-    QString doctorId = message.section('#', 1, 1);
+    QDate yesterday = QDate::currentDate().addDays(-1);
+    if (m_absenceCheckedThrough.isValid() && m_absenceCheckedThrough >= yesterday) {
+        return;
+    }
 
-    QSqlQuery query(m_db);
-    query.prepare("SELECT date, check_in_time, check_out_time, status FROM attendance "
-                  "WHERE doctor_id = :doctor_id "
-                  "ORDER BY date DESC"); // 近两年记录
-    query.bindValue(":doctor_id", doctorId);
+    QSqlQuery shiftQuery(m_db);
+    if (!shiftQuery.exec("SELECT doctor_id, work_days, effective_from FROM doctor_shift")) {
+        qDebug() << "读取医生班次失败:" << shiftQuery.lastError().text();
+        return;
+    }
 
+    QSqlQuery insertQuery(m_db);
+    insertQuery.prepare("INSERT INTO attendance (doctor_id, date, status) "
+                        "SELECT :doctor_id, :date, 'absent' "
+                        "WHERE NOT EXISTS (SELECT 1 FROM attendance WHERE doctor_id = :doctor_id2 AND date = :date2) "
+                        "AND NOT EXISTS (SELECT 1 FROM leave WHERE doctor_id = :doctor_id3 AND status = 'approved' "
+                        "                AND :date3 BETWEEN start_date AND end_date)");
 
-    if (query.exec()) {
-        QJsonArray historyArray;
+    int marked = 0;
+    m_db.transaction();
+    while (shiftQuery.next()) {
+        QString doctorId = shiftQuery.value("doctor_id").toString();
+        QStringList workDays = shiftQuery.value("work_days").toString().split(',');
+        QDate from = QDate::fromString(shiftQuery.value("effective_from").toString(), "yyyy-MM-dd");
+        if (m_absenceCheckedThrough.isValid()) {
+            from = qMax(from, m_absenceCheckedThrough.addDays(1));
+        }
 
-        while (query.next()) {
-            QJsonObject record;
-            record["date"] = query.value("date").toString();
-            record["check_in_time"] = query.value("check_in_time").toString();
-            record["check_out_time"] = query.value("check_out_time").toString();
-            record["status"] = query.value("status").toString();
-            historyArray.append(record);
+        for (QDate day = from; day.isValid() && day <= yesterday; day = day.addDays(1)) {
+            if (!workDays.contains(QString::number(day.dayOfWeek()))) {
+                continue;
+            }
+            QString date = day.toString("yyyy-MM-dd");
+            insertQuery.bindValue(":doctor_id", doctorId);
+            insertQuery.bindValue(":doctor_id2", doctorId);
+            insertQuery.bindValue(":doctor_id3", doctorId);
+            insertQuery.bindValue(":date", date);
+            insertQuery.bindValue(":date2", date);
+            insertQuery.bindValue(":date3", date);
+            if (!insertQuery.exec()) {
+                m_db.rollback();
+                qDebug() << "补记缺勤失败:" << insertQuery.lastError().text();
+                return;
+            }
+            if (insertQuery.numRowsAffected() > 0) {
+                if (!updateAttendanceRollup(doctorId, date, QString(), "absent")) {
+                    m_db.rollback();
+                    return;
+                }
+                ++marked;
+            }
         }
+    }
 
-        QJsonDocument doc(historyArray);
-        QString response = "HISTORY_SUCCESS#" + doc.toJson(QJsonDocument::Compact);
-        clientSocket->write(response.toUtf8());
-        qDebug() << "发送考勤历史数据给医生:" << doctorId;
-    } else {
-        clientSocket->write("HISTORY_FAIL");
-        qDebug() << "获取考勤历史失败:" << query.lastError().text();
+    if (!m_db.commit()) {
+        m_db.rollback();
+        qDebug() << "补记缺勤提交失败:" << m_db.lastError().text();
+        return;
+    }
+    m_absenceCheckedThrough = yesterday;
+    if (marked > 0) {
+        qDebug() << "补记缺勤:" << marked << "条，检查至" << yesterday.toString("yyyy-MM-dd");
     }
 }
 
-// 处理请假申请
-void Server::handleLeaveApplication(const QString &message, QTcpSocket *clientSocket)
+// 更新考勤月度汇总：旧状态计数减一，新状态计数加一（oldStatus 为空表示新增记录）
+bool Server::updateAttendanceRollup(const QString &doctorId, const QString &date, const QString &oldStatus, const QString &newStatus)
 {
-    if (!m_db.isOpen()) {
-        qDebug() << "Database not open in handleLeaveApplication";
-        clientSocket->write("LEAVE_FAIL#DB_NOT_OPEN");
-        return;
+    if (oldStatus == newStatus) {
+        return true;
     }
 
-    // 请求格式: LEAVE#doctorId#contact#leaveType#startDate#endDate#reason
-    QStringList parts = message.split('#');
-    if (parts.size() < 7) {
-        clientSocket->write("LEAVE_FAIL#INVALID_FORMAT");
-        return;
+    static const QStringList validStatuses = {"normal", "late", "early_leave", "absent"};
+    QString month = date.left(7); // YYYY-MM
+
+    QSqlQuery query(m_db);
+    query.prepare("INSERT OR IGNORE INTO attendance_monthly (doctor_id, month) VALUES (:doctor_id, :month)");
+    query.bindValue(":doctor_id", doctorId);
+    query.bindValue(":month", month);
+    if (!query.exec()) {
+        qDebug() << "考勤月度汇总更新失败:" << query.lastError().text();
+        return false;
+    }
+
+    QStringList assignments;
+    if (validStatuses.contains(oldStatus)) {
+        assignments.append(QString("%1_count = %1_count - 1").arg(oldStatus));
+    }
+    if (validStatuses.contains(newStatus)) {
+        assignments.append(QString("%1_count = %1_count + 1").arg(newStatus));
+    }
+    if (assignments.isEmpty()) {
+        return true;
+    }
+
+    query.prepare(QString("UPDATE attendance_monthly SET %1 WHERE doctor_id = :doctor_id AND month = :month")
+                      .arg(assignments.join(", ")));
+    query.bindValue(":doctor_id", doctorId);
+    query.bindValue(":month", month);
+    if (!query.exec()) {
+        qDebug() << "考勤月度汇总更新失败:" << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+// 处理考勤历史记录请求
+void Server::handleAttendanceHistory(const QString &message, QTcpSocket *clientSocket)
+{
+    if (!m_db.isOpen()) {
+        qDebug() << "Database not open in handleAttendanceHistory";
+        clientSocket->write("HISTORY_FAIL#DB_NOT_OPEN\n");
+        return;
+    }
+
+    // 请求格式: HISTORY#doctorId[#startDate#endDate]，日期格式 YYYY-MM-DD
+    // 未指定范围时默认返回近两年记录
+    QString doctorId = message.section('#', 1, 1);
+    QString startDate = message.section('#', 2, 2);
+    QString endDate = message.section('#', 3, 3);
+    if (startDate.isEmpty()) {
+        startDate = QDate::currentDate().addYears(-2).toString("yyyy-MM-dd");
+    }
+    if (endDate.isEmpty()) {
+        endDate = QDate::currentDate().toString("yyyy-MM-dd");
+    }
+
+    QSqlQuery query(m_db);
+    query.prepare("SELECT date, check_in_time, check_out_time, status FROM attendance "
+                  "WHERE doctor_id = :doctor_id AND date BETWEEN :start_date AND :end_date "
+                  "ORDER BY date DESC");
+    query.bindValue(":doctor_id", doctorId);
+    query.bindValue(":start_date", startDate);
+    query.bindValue(":end_date", endDate);
+
+
+    if (query.exec()) {
+        QJsonArray historyArray;
+
+        while (query.next()) {
+            QJsonObject record;
+            record["date"] = query.value("date").toString();
+            record["check_in_time"] = query.value("check_in_time").toString();
+            record["check_out_time"] = query.value("check_out_time").toString();
+            record["status"] = query.value("status").toString();
+            historyArray.append(record);
+        }
+
+        QJsonDocument doc(historyArray);
+        QString response = "HISTORY_SUCCESS#" + doc.toJson(QJsonDocument::Compact);
+        clientSocket->write(response.toUtf8() + "\n");
+        qDebug() << "发送考勤历史数据给医生:" << doctorId;
+    } else {
+        clientSocket->write("HISTORY_FAIL\n");
+        qDebug() << "获取考勤历史失败:" << query.lastError().text();
+    }
+}
+
+// 处理考勤月度统计请求，直接读取月度汇总表
+void Server::handleAttendanceSummary(const QString &message, QTcpSocket *clientSocket)
+{
+    if (!m_db.isOpen()) {
+        qDebug() << "Database not open in handleAttendanceSummary";
+        clientSocket->write("ATTENDANCE_SUMMARY_FAIL#DB_NOT_OPEN\n");
+        return;
+    }
+
+    // 请求格式: ATTENDANCE_SUMMARY#doctorId#startMonth#endMonth，月份格式 YYYY-MM
+    // doctorId 为 ALL 时返回全部医生的汇总
+    QStringList parts = message.split('#');
+    if (parts.size() < 4) {
+        clientSocket->write("ATTENDANCE_SUMMARY_FAIL#INVALID_FORMAT\n");
+        return;
+    }
+
+    QString doctorId = parts[1];
+    QString startMonth = parts[2];
+    QString endMonth = parts[3];
+    bool allDoctors = (doctorId == "ALL");
+
+    QSqlQuery query(m_db);
+    query.prepare(QString("SELECT doctor_id, month, normal_count, late_count, early_leave_count, absent_count "
+                          "FROM attendance_monthly "
+                          "WHERE month BETWEEN :start_month AND :end_month %1 "
+                          "ORDER BY doctor_id, month DESC")
+                      .arg(allDoctors ? "" : "AND doctor_id = :doctor_id"));
+    query.bindValue(":start_month", startMonth);
+    query.bindValue(":end_month", endMonth);
+    if (!allDoctors) {
+        query.bindValue(":doctor_id", doctorId);
+    }
+
+    if (query.exec()) {
+        QJsonArray summaryArray;
+
+        while (query.next()) {
+            QJsonObject record;
+            record["doctor_id"] = query.value("doctor_id").toString();
+            record["month"] = query.value("month").toString();
+            record["normal"] = query.value("normal_count").toInt();
+            record["late"] = query.value("late_count").toInt();
+            record["early_leave"] = query.value("early_leave_count").toInt();
+            record["absent"] = query.value("absent_count").toInt();
+            summaryArray.append(record);
+        }
+
+        QJsonDocument doc(summaryArray);
+        QString response = "ATTENDANCE_SUMMARY_SUCCESS#" + doc.toJson(QJsonDocument::Compact);
+        clientSocket->write(response.toUtf8() + "\n");
+        qDebug() << "发送考勤月度统计:" << doctorId << startMonth << "~" << endMonth << "，共" << summaryArray.size() << "条";
+    } else {
+        clientSocket->write("ATTENDANCE_SUMMARY_FAIL#DB_ERROR\n");
+        qDebug() << "获取考勤月度统计失败:" << query.lastError().text();
+    }
+}
+
+// 处理请假申请
+void Server::handleLeaveApplication(const QString &message, QTcpSocket *clientSocket)
+{
+    if (!m_db.isOpen()) {
+        qDebug() << "Database not open in handleLeaveApplication";
+        clientSocket->write("LEAVE_FAIL#DB_NOT_OPEN\n");
+        return;
+    }
+
+    // 请求格式: LEAVE#doctorId#contact#leaveType#startDate#endDate#reason
+    QStringList parts = message.split('#');
+    if (parts.size() < 7) {
+        clientSocket->write("LEAVE_FAIL#INVALID_FORMAT\n");
+        return;
     }
 
     QString doctorId = parts[1];
@@ -1338,10 +2090,11 @@ void Server::handleLeaveApplication(const QString &message, QTcpSocket *clientSo
     query.bindValue(":reason", reason);
 
     if (query.exec()) {
-        clientSocket->write("LEAVE_SUCCESS");
+        clientSocket->write("LEAVE_SUCCESS\n");
+        pushRollCallUpdate(doctorId, QDate::currentDate().toString("yyyy-MM-dd"));
         qDebug() << "请假申请提交成功:" << doctorId << "-" << leaveType << "-" << startDate << "-" << endDate;
     } else {
-        clientSocket->write("LEAVE_FAIL#DB_ERROR");
+        clientSocket->write("LEAVE_FAIL#DB_ERROR\n");
         qDebug() << "请假申请提交失败:" << query.lastError().text();
     }
 }
@@ -1351,7 +2104,7 @@ void Server::handleLeaveRecordsRequest(const QString &message, QTcpSocket *clien
 {
     if (!m_db.isOpen()) {
         qDebug() << "Database not open in handleLeaveRecordsRequest";
-        clientSocket->write("LEAVE_RECORDS_FAIL#DB_NOT_OPEN");
+        clientSocket->write("LEAVE_RECORDS_FAIL#DB_NOT_OPEN\n");
         return;
     }
 
@@ -1378,10 +2131,10 @@ void Server::handleLeaveRecordsRequest(const QString &message, QTcpSocket *clien
 
         QJsonDocument doc(leaveRecordsArray);
         QString response = "LEAVE_RECORDS_SUCCESS#" + doc.toJson(QJsonDocument::Compact);
-        clientSocket->write(response.toUtf8());
+        clientSocket->write(response.toUtf8() + "\n");
         qDebug() << "发送请假记录数据给医生:" << doctorId;
     } else {
-        clientSocket->write("LEAVE_RECORDS_FAIL");
+        clientSocket->write("LEAVE_RECORDS_FAIL\n");
         qDebug() << "获取请假记录失败:" << query.lastError().text();
     }
 }
@@ -1391,26 +2144,162 @@ void Server::handleReturnFromLeave(const QString &message, QTcpSocket *clientSoc
 {
     if (!m_db.isOpen()) {
         qDebug() << "Database not open in handleReturnFromLeave";
-        clientSocket->write("RETURN_FAIL#DB_NOT_OPEN");
+        clientSocket->write("RETURN_FAIL#DB_NOT_OPEN\n");
         return;
     }
 
     // 请求格式: RETURN#leaveId
     QString leaveId = message.section('#', 1, 1);
 
+    // 查出请假医生，销假后推送点名板更新
+    QString doctorId;
+    QSqlQuery doctorQuery(m_db);
+    doctorQuery.prepare("SELECT doctor_id FROM leave WHERE leave_id = :leave_id");
+    doctorQuery.bindValue(":leave_id", leaveId);
+    if (doctorQuery.exec() && doctorQuery.next()) {
+        doctorId = doctorQuery.value("doctor_id").toString();
+    }
+
     QSqlQuery query(m_db);
     query.prepare("UPDATE leave SET status = 'rejected' WHERE leave_id = :leave_id AND status = 'approved'");
     query.bindValue(":leave_id", leaveId);
 
     if (query.exec() && query.numRowsAffected() > 0) {
-        clientSocket->write("RETURN_SUCCESS");
+        clientSocket->write("RETURN_SUCCESS\n");
+        pushRollCallUpdate(doctorId, QDate::currentDate().toString("yyyy-MM-dd"));
         qDebug() << "销假成功:" << leaveId;
     } else {
-        clientSocket->write("RETURN_FAIL#DB_ERROR");
+        clientSocket->write("RETURN_FAIL#DB_ERROR\n");
         qDebug() << "销假失败:" << query.lastError().text();
     }
 }
 
+// 处理科室点名板请求：一次查询返回整个科室当天的签到/请假状态，并订阅后续变更
+void Server::handleRollCallBoard(const QString &message, QTcpSocket *clientSocket)
+{
+    if (!m_db.isOpen()) {
+        qDebug() << "Database not open in handleRollCallBoard";
+        clientSocket->write("ROLLCALL_BOARD_FAIL#DB_NOT_OPEN\n");
+        return;
+    }
+
+    // 请求格式: ROLLCALL_BOARD#department[#date]，date 默认为当天
+    QString department = message.section('#', 1, 1);
+    QString date = message.section('#', 2, 2);
+    if (department.isEmpty()) {
+        clientSocket->write("ROLLCALL_BOARD_FAIL#INVALID_FORMAT\n");
+        return;
+    }
+    if (date.isEmpty()) {
+        date = QDate::currentDate().toString("yyyy-MM-dd");
+    }
+
+    bool ok = false;
+    QJsonArray board = rollCallRows(department, QString(), date, &ok);
+    if (!ok) {
+        clientSocket->write("ROLLCALL_BOARD_FAIL#DB_ERROR\n");
+        return;
+    }
+
+    // 该连接订阅科室的变更推送，同一用户多处登录时各连接分别订阅
+    m_rollCallSubscribers[department].insert(clientSocket);
+
+    QJsonObject result;
+    result["department"] = department;
+    result["date"] = date;
+    result["doctors"] = board;
+    clientSocket->write("ROLLCALL_BOARD_SUCCESS#" + QJsonDocument(result).toJson(QJsonDocument::Compact) + "\n");
+    qDebug() << "发送科室点名板:" << department << date << "，医生数:" << board.size();
+}
+
+// 取消点名板订阅: ROLLCALL_UNSUBSCRIBE#department
+void Server::handleRollCallUnsubscribe(const QString &message, QTcpSocket *clientSocket)
+{
+    QString department = message.section('#', 1, 1);
+    if (m_rollCallSubscribers.contains(department)) {
+        m_rollCallSubscribers[department].remove(clientSocket);
+    }
+    clientSocket->write("ROLLCALL_UNSUBSCRIBE_SUCCESS\n");
+}
+
+// 查询点名板数据：doctorId 为空时返回整个科室，否则只返回该医生
+QJsonArray Server::rollCallRows(const QString &department, const QString &doctorId, const QString &date, bool *ok)
+{
+    QJsonArray rows;
+
+    QSqlQuery query(m_db);
+    query.prepare(QString("SELECT d.id, u.real_name, d.department, a.check_in_time, a.check_out_time, a.status, "
+                          "EXISTS(SELECT 1 FROM leave l WHERE l.doctor_id = d.id "
+                          "       AND l.status IN ('applied', 'approved') "
+                          "       AND :date BETWEEN l.start_date AND l.end_date) AS on_leave "
+                          "FROM doctor d "
+                          "JOIN user u ON u.id = d.id "
+                          "LEFT JOIN attendance a ON a.doctor_id = d.id AND a.date = :date "
+                          "WHERE %1 "
+                          "ORDER BY d.id")
+                      .arg(doctorId.isEmpty() ? "d.department = :department" : "d.id = :doctor_id"));
+    query.bindValue(":date", date);
+    if (doctorId.isEmpty()) {
+        query.bindValue(":department", department);
+    } else {
+        query.bindValue(":doctor_id", doctorId);
+    }
+
+    if (!query.exec()) {
+        qDebug() << "点名板查询失败:" << query.lastError().text();
+        if (ok) *ok = false;
+        return rows;
+    }
+
+    while (query.next()) {
+        QJsonObject row;
+        row["doctor_id"] = query.value("id").toString();
+        row["name"] = query.value("real_name").toString();
+        row["department"] = query.value("department").toString();
+        row["check_in_time"] = query.value("check_in_time").toString();
+        row["check_out_time"] = query.value("check_out_time").toString();
+        // 无考勤记录时状态为 not_checked_in
+        row["status"] = query.value("status").isNull() ? "not_checked_in" : query.value("status").toString();
+        row["on_leave"] = query.value("on_leave").toInt() != 0;
+        rows.append(row);
+    }
+
+    if (ok) *ok = true;
+    return rows;
+}
+
+// 医生考勤/请假状态变化时，把该医生的最新状态推送给订阅其科室的查看者
+void Server::pushRollCallUpdate(const QString &doctorId, const QString &date)
+{
+    if (doctorId.isEmpty() || m_rollCallSubscribers.isEmpty()) {
+        return;
+    }
+
+    bool ok = false;
+    QJsonArray rows = rollCallRows(QString(), doctorId, date, &ok);
+    if (!ok || rows.isEmpty()) {
+        return;
+    }
+
+    QJsonObject row = rows.first().toObject();
+    QString department = row["department"].toString();
+    const QSet<QTcpSocket*> subscribers = m_rollCallSubscribers.value(department);
+    if (subscribers.isEmpty()) {
+        return;
+    }
+
+    QJsonObject update;
+    update["department"] = department;
+    update["date"] = date;
+    update["doctor"] = row;
+    QByteArray data = "ROLLCALL_UPDATE#" + QJsonDocument(update).toJson(QJsonDocument::Compact) + "\n";
+    for (QTcpSocket *subscriber : subscribers) {
+        if (subscriber->state() == QTcpSocket::ConnectedState) {
+            pushToClient(subscriber, data);
+        }
+    }
+}
+
 // ================ 医患沟通相关函数实现 ================
 
 // 处理发送消息
@@ -1449,39 +2338,30 @@ void Server::handleSendMessage(const QString &message, QTcpSocket *clientSocket)
         return;
     }
 
-    // 保存消息到数据库
-    QSqlQuery insertQuery(m_db);
-    insertQuery.prepare("INSERT INTO message (sender_id, receiver_id, content) VALUES (:sender_id, :receiver_id, :content)");
-    insertQuery.bindValue(":sender_id", senderId);
-    insertQuery.bindValue(":receiver_id", receiverId);
-    insertQuery.bindValue(":content", content);
-
-    if (insertQuery.exec()) {
-        // 获取插入的消息ID和时间
-        qint64 messageId = insertQuery.lastInsertId().toLongLong();
-
-        QSqlQuery timeQuery(m_db);
-        timeQuery.prepare("SELECT send_time FROM message WHERE message_id = :message_id");
-        timeQuery.bindValue(":message_id", messageId);
+    // 消息进入批量写入队列，ID和时间在内存中分配，无需等待落盘即可回执
+    QString sendTime = m_clock.now().toUtcString();
+    qint64 messageId = enqueueMessage(senderId, receiverId, content, sendTime);
+    if (messageId == 0) {
+        clientSocket->write("SEND_MESSAGE_FAIL#QUEUE_FULL\n");
+        return;
+    }
 
-        QString sendTime;
-        if (timeQuery.exec() && timeQuery.next()) {
-            sendTime = timeQuery.value("send_time").toString();
-        }
+    // 同步模式下先提交再回执
+    if (m_messageDurability == MessageDurability::Sync && !flushPendingMessages()) {
+        m_pendingMessages.removeLast(); // 同步模式下写入失败的消息直接丢弃，由客户端重新发送
+        clientSocket->write("SEND_MESSAGE_FAIL#DB_ERROR\n");
+        return;
+    }
 
-        // 发送成功响应给发送者
-        QString response = QString("SEND_MESSAGE_SUCCESS#%1#%2").arg(messageId).arg(sendTime);
-        clientSocket->write(response.toUtf8() + "\n");
+    // 发送成功响应给发送者
+    QString response = QString("SEND_MESSAGE_SUCCESS#%1#%2").arg(messageId).arg(sendTime);
+    clientSocket->write(response.toUtf8() + "\n");
 
-        // 实时推送消息给接收者
-        QString broadcastData = QString("NEW_MESSAGE#%1#%2#%3#%4").arg(senderId).arg(receiverId).arg(content).arg(sendTime);
-        broadcastMessage(receiverId, broadcastData);
+    // 实时推送消息给接收者
+    QString broadcastData = QString("NEW_MESSAGE#%1#%2#%3#%4").arg(senderId).arg(receiverId).arg(content).arg(sendTime);
+    broadcastMessage(receiverId, broadcastData);
 
-        qDebug() << "消息发送成功:" << senderId << "->" << receiverId << ":" << content;
-    } else {
-        clientSocket->write("SEND_MESSAGE_FAIL#DB_ERROR\n");
-        qDebug() << "消息发送失败:" << insertQuery.lastError().text();
-    }
+    qDebug() << "消息发送成功:" << senderId << "->" << receiverId << ":" << content;
 }
 
 // 处理发送图片
@@ -1558,39 +2438,116 @@ void Server::handleSendImage(const QString &message, QTcpSocket *clientSocket)
         return;
     }
 
-    // 保存图片消息到数据库（内容格式：[IMAGE:filename]）
+    // 保存图片消息到数据库（内容格式：[IMAGE:filename]），与文字消息共用批量写入队列
     QString imageMessage = QString("[IMAGE:%1]").arg(imageName);
-    QSqlQuery insertQuery(m_db);
-    insertQuery.prepare("INSERT INTO message (sender_id, receiver_id, content) VALUES (:sender_id, :receiver_id, :content)");
-    insertQuery.bindValue(":sender_id", senderId);
-    insertQuery.bindValue(":receiver_id", receiverId);
-    insertQuery.bindValue(":content", imageMessage);
+    QString sendTime = m_clock.now().toUtcString();
+    qint64 messageId = enqueueMessage(senderId, receiverId, imageMessage, sendTime);
+    if (messageId == 0) {
+        clientSocket->write("SEND_IMAGE_FAIL#QUEUE_FULL\n");
+        return;
+    }
+
+    if (m_messageDurability == MessageDurability::Sync && !flushPendingMessages()) {
+        m_pendingMessages.removeLast(); // 同步模式下写入失败的消息直接丢弃，由客户端重新发送
+        clientSocket->write("SEND_IMAGE_FAIL#DB_ERROR\n");
+        return;
+    }
+
+    // 发送成功响应给发送者
+    QString response = QString("SEND_IMAGE_SUCCESS#%1#%2#%3").arg(messageId).arg(sendTime).arg(imageName);
+    clientSocket->write(response.toUtf8() + "\n");
+
+    // 实时推送图片消息给接收者
+    QString broadcastData = QString("NEW_IMAGE#%1#%2#%3#%4").arg(senderId).arg(receiverId).arg(imageName).arg(sendTime);
+    broadcastMessage(receiverId, broadcastData);
+
+    qDebug() << "图片消息发送成功:" << senderId << "->" << receiverId << ":" << imageName;
+}
+
+// 聊天消息入队：分配消息ID，攒满一批立即提交，否则等待定时器提交
+// 队列已满（数据库持续写入失败）时先尝试提交一次，仍满则返回0，调用方不得回执成功
+qint64 Server::enqueueMessage(const QString &senderId, const QString &receiverId, const QString &content, const QString &sendTime)
+{
+    if (m_pendingMessages.size() >= MESSAGE_QUEUE_LIMIT && !flushPendingMessages()) {
+        qDebug() << "聊天消息队列已满，拒绝新消息:" << senderId << "->" << receiverId;
+        return 0;
+    }
+
+    PendingMessage pending;
+    pending.messageId = m_nextMessageId++;
+    pending.senderId = senderId;
+    pending.receiverId = receiverId;
+    pending.content = content;
+    pending.sendTime = sendTime;
+    m_pendingMessages.append(pending);
+
+    if (m_pendingMessages.size() >= MESSAGE_BATCH_SIZE) {
+        flushPendingMessages();
+    } else if (!m_messageFlushTimer->isActive()) {
+        m_messageFlushTimer->start(MESSAGE_FLUSH_INTERVAL_MS);
+    }
+
+    return pending.messageId;
+}
 
-    if (insertQuery.exec()) {
-        // 获取插入的消息ID和时间
-        qint64 messageId = insertQuery.lastInsertId().toLongLong();
+// 批量提交排队中的聊天消息，整批共用一个事务
+bool Server::flushPendingMessages()
+{
+    m_messageFlushTimer->stop();
+    if (m_pendingMessages.isEmpty() || !m_db.isOpen()) {
+        return m_pendingMessages.isEmpty();
+    }
 
-        QSqlQuery timeQuery(m_db);
-        timeQuery.prepare("SELECT send_time FROM message WHERE message_id = :message_id");
-        timeQuery.bindValue(":message_id", messageId);
+    m_db.transaction();
 
-        QString sendTime;
-        if (timeQuery.exec() && timeQuery.next()) {
-            sendTime = timeQuery.value("send_time").toString();
+    try {
+        QSqlQuery insertQuery(m_db);
+        insertQuery.prepare("INSERT INTO message (message_id, sender_id, receiver_id, content, send_time) "
+                            "VALUES (:message_id, :sender_id, :receiver_id, :content, :send_time)");
+
+        for (PendingMessage &pending : m_pendingMessages) {
+            insertQuery.bindValue(":message_id", pending.messageId);
+            insertQuery.bindValue(":sender_id", pending.senderId);
+            insertQuery.bindValue(":receiver_id", pending.receiverId);
+            insertQuery.bindValue(":content", pending.content);
+            insertQuery.bindValue(":send_time", pending.sendTime);
+            if (!insertQuery.exec()) {
+                qDebug() << "批量写入消息失败:" << insertQuery.lastError().text() << "消息ID:" << pending.messageId;
+                ++pending.failedAttempts; // 只记在写入失败的那一条上，其余消息不受牵连
+                throw std::runtime_error("消息写入失败");
+            }
         }
 
-        // 发送成功响应给发送者
-        QString response = QString("SEND_IMAGE_SUCCESS#%1#%2#%3").arg(messageId).arg(sendTime).arg(imageName);
-        clientSocket->write(response.toUtf8() + "\n");
+        if (!m_db.commit()) {
+            for (PendingMessage &pending : m_pendingMessages) {
+                ++pending.failedAttempts;
+            }
+            throw std::runtime_error("事务提交失败");
+        }
+    } catch (const std::exception &e) {
+        m_db.rollback();
+        qDebug() << "聊天消息批量提交失败，稍后重试:" << e.what() << "待写入:" << m_pendingMessages.size();
+        dropFailedMessages();
+        m_messageFlushTimer->start(MESSAGE_FLUSH_INTERVAL_MS * 20);
+        return false;
+    }
 
-        // 实时推送图片消息给接收者
-        QString broadcastData = QString("NEW_IMAGE#%1#%2#%3#%4").arg(senderId).arg(receiverId).arg(imageName).arg(sendTime);
-        broadcastMessage(receiverId, broadcastData);
+    qDebug() << "聊天消息批量提交成功，条数:" << m_pendingMessages.size();
+    m_pendingMessages.clear();
+    return true;
+}
 
-        qDebug() << "图片消息发送成功:" << senderId << "->" << receiverId << ":" << imageName;
-    } else {
-        clientSocket->write("SEND_IMAGE_FAIL#DB_ERROR\n");
-        qDebug() << "图片消息发送失败:" << insertQuery.lastError().text();
+// 多次写入失败的消息移出队列，不再阻塞后面的消息；发送者已收到回执，推送 MESSAGE_NOT_SAVED#消息ID 告知未保存
+void Server::dropFailedMessages()
+{
+    for (int i = m_pendingMessages.size() - 1; i >= 0; --i) {
+        const PendingMessage &pending = m_pendingMessages[i];
+        if (pending.failedAttempts < MESSAGE_MAX_ATTEMPTS) {
+            continue;
+        }
+        qDebug() << "聊天消息多次写入失败，已丢弃:" << pending.messageId << pending.senderId << "->" << pending.receiverId;
+        broadcastMessage(pending.senderId, QString("MESSAGE_NOT_SAVED#%1#%2").arg(pending.messageId).arg(pending.receiverId));
+        m_pendingMessages.remove(i);
     }
 }
 
@@ -1633,21 +2590,13 @@ void Server::handleGetImage(const QString &message, QTcpSocket *clientSocket)
     QByteArray data = imageFile.readAll();
     imageFile.close();
 
-    QString base64 = QString::fromUtf8(data.toBase64());
-    QString header = QString("IMAGE_DATA#%1#%2").arg(imageName).arg(base64.size());
-
-    // 写入头部
-    clientSocket->write(header.toUtf8() + "\n");
+    QByteArray base64Data = data.toBase64();
+    QString header = QString("IMAGE_DATA#%1#%2").arg(imageName).arg(base64Data.size());
     qDebug() << "GET_IMAGE: 发送头部" << header;
 
-    // 确保头部发送完毕
-    clientSocket->flush();
-
-    // 一次性发送完整的 base64 数据，避免分块问题
-    QByteArray base64Data = base64.toUtf8();
-
-    // 一次性写入所有 base64 数据和换行符
-    clientSocket->write(base64Data + "\n");
+    // 头部和 base64 数据作为一帧发送：压缩时整帧进入 "@z#<字节数>\n" 帧，
+    // 客户端解压后得到的头部长度与其后的数据一致；JPEG/PNG 本身已压缩，不再做传输压缩
+    writeFrame(clientSocket, "IMAGE_DATA", header.toUtf8() + "\n" + base64Data + "\n", !isCompressedImage(data));
     clientSocket->flush();
 
     // 合理的发送超时：根据测试结果大幅放宽
@@ -1669,90 +2618,809 @@ void Server::handleGetImage(const QString &message, QTcpSocket *clientSocket)
     qDebug() << "GET_IMAGE: sent" << imageName << "原始字节:" << data.size() << "base64字节:" << base64Data.size() << "分块发送完成";
 }
 
-// 处理获取聊天历史
-void Server::handleGetChatHistory(const QString &message, QTcpSocket *clientSocket)
+// 服务器保存的头像尺寸：40 为聊天气泡（联系人列表的 30 由客户端再缩小），
+// 120 为个人信息页，240 为高分屏下的个人信息页和客户端头像缓存的原图
+static const int AVATAR_VARIANT_SIZES[] = {40, 120, 240};
+
+static bool isSha256Hex(const QByteArray &hash)
 {
-    if (!m_db.isOpen()) {
-        qDebug() << "Database not open in handleGetChatHistory";
-        clientSocket->write("GET_CHAT_HISTORY_FAIL#DB_NOT_OPEN\n");
-        return;
+    if (hash.size() != 64) {
+        return false;
     }
-
-    // 消息格式: GET_CHAT_HISTORY#userId#contactId
-    QStringList parts = message.split('#');
-    if (parts.size() < 3) {
-        clientSocket->write("GET_CHAT_HISTORY_FAIL#INVALID_FORMAT\n");
-        return;
+    for (char c : hash) {
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+            return false;
+        }
     }
+    return true;
+}
 
-    QString userId = parts[1];
-    QString contactId = parts[2];
-
-    QSqlQuery query(m_db);
-    query.prepare("SELECT message_id, sender_id, receiver_id, content, send_time "
-                  "FROM message "
-                  "WHERE (sender_id = :user_id AND receiver_id = :contact_id) "
-                  "   OR (sender_id = :contact_id AND receiver_id = :user_id) "
-                  "ORDER BY send_time ASC");
-    query.bindValue(":user_id", userId);
-    query.bindValue(":contact_id", contactId);
+QString Server::avatarDir()
+{
+    return QDir(QCoreApplication::applicationDirPath()).filePath("avatars");
+}
 
-    if (query.exec()) {
-        QJsonArray messagesArray;
+QString Server::avatarVariantPath(const QByteArray &hash, int size)
+{
+    return QDir(avatarDir()).filePath(QString("%1_%2.png").arg(QString::fromLatin1(hash)).arg(size));
+}
 
-        while (query.next()) {
-            QJsonObject messageObj;
-            messageObj["message_id"] = query.value("message_id").toString();
-            messageObj["sender_id"] = query.value("sender_id").toString();
-            messageObj["receiver_id"] = query.value("receiver_id").toString();
-            messageObj["content"] = query.value("content").toString();
-            messageObj["send_time"] = query.value("send_time").toString();
-            messagesArray.append(messageObj);
+bool Server::isAvatarStored(const QByteArray &hash)
+{
+    for (int size : AVATAR_VARIANT_SIZES) {
+        if (!QFile::exists(avatarVariantPath(hash, size))) {
+            return false;
         }
+    }
+    return true;
+}
 
-        QJsonDocument doc(messagesArray);
-        QByteArray jsonData = doc.toJson(QJsonDocument::Compact);
-
-        clientSocket->write("GET_CHAT_HISTORY_SUCCESS#" + jsonData + "\n");
-        qDebug() << "聊天历史发送成功:" << userId << "<->" << contactId;
-    } else {
-        clientSocket->write("GET_CHAT_HISTORY_FAIL#DB_ERROR\n");
-        qDebug() << "获取聊天历史失败:" << query.lastError().text();
+// 居中裁成正方形后缩放为各个尺寸，统一存为 PNG；QSaveFile 保证不会留下写了一半的文件
+bool Server::storeAvatarVariants(const QByteArray &hash, const QImage &image)
+{
+    QImage source = image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+    const int side = qMin(source.width(), source.height());
+    QImage square = source.copy((source.width() - side) / 2, (source.height() - side) / 2, side, side);
+
+    QDir().mkpath(avatarDir());
+    for (int size : AVATAR_VARIANT_SIZES) {
+        QImage variant = square.scaled(size, size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+        QSaveFile file(avatarVariantPath(hash, size));
+        if (!file.open(QIODevice::WriteOnly) || !variant.save(&file, "PNG") || !file.commit()) {
+            qDebug() << "头像保存失败:" << file.fileName() << file.errorString();
+            return false;
+        }
     }
+    return true;
 }
 
-// 处理获取联系人列表
-void Server::handleGetContactList(const QString &message, QTcpSocket *clientSocket)
+bool Server::assignAvatar(const QString &userId, const QByteArray &hash)
 {
     if (!m_db.isOpen()) {
-        qDebug() << "Database not open in handleGetContactList";
-        clientSocket->write("GET_CONTACT_LIST_FAIL#DB_NOT_OPEN\n");
-        return;
+        qDebug() << "Database not open in assignAvatar";
+        return false;
     }
 
-    // 消息格式: GET_CONTACT_LIST#userId
-    QString userId = message.section('#', 1, 1);
+    const int largest = AVATAR_VARIANT_SIZES[std::size(AVATAR_VARIANT_SIZES) - 1];
 
     QSqlQuery query(m_db);
-    // 使用简化的查询，分步获取联系人和最后消息
-    query.prepare("SELECT DISTINCT "
-                  "CASE WHEN m.sender_id = :user_id THEN m.receiver_id ELSE m.sender_id END as contact_id, "
-                  "u.real_name "
-                  "FROM message m "
-                  "JOIN user u ON (CASE WHEN m.sender_id = :user_id THEN m.receiver_id ELSE m.sender_id END) = u.id "
-                  "WHERE m.sender_id = :user_id OR m.receiver_id = :user_id "
-                  "ORDER BY m.send_time DESC");
+    query.prepare("UPDATE user SET avatar_path = :avatar_path, avatar_hash = :avatar_hash WHERE id = :id");
+    query.bindValue(":avatar_path", "avatars/" + QFileInfo(avatarVariantPath(hash, largest)).fileName());
+    query.bindValue(":avatar_hash", QString::fromLatin1(hash));
+    query.bindValue(":id", userId);
 
-    query.bindValue(":user_id", userId);
+    if (!query.exec()) {
+        qDebug() << "头像关联失败:" << query.lastError().text();
+        return false;
+    }
+    if (query.numRowsAffected() == 0) {
+        qDebug() << "头像关联失败，用户不存在:" << userId;
+        return false;
+    }
+    return true;
+}
 
-    if (query.exec()) {
-        QJsonArray contactsArray;
-        QSet<QString> processedContacts; // 避免重复联系人
+// 按内容哈希取头像：GET_AVATAR#sha256[#尺寸]，尺寸缺省为最大的一档
+// 回复 GET_AVATAR_SUCCESS#sha256#尺寸#<PNG 的 base64> 或 GET_AVATAR_FAIL#sha256#原因；
+// 头像文件按哈希命名、内容不变，客户端可以长期缓存
+void Server::handleGetAvatar(const QString &message, QTcpSocket *clientSocket)
+{
+    QByteArray hash = message.section('#', 1, 1).trimmed().toLower().toLatin1();
+    if (!isSha256Hex(hash)) {
+        clientSocket->write("GET_AVATAR_FAIL#" + hash + "#INVALID_HASH\n");
+        return;
+    }
 
-        while (query.next()) {
-            QString contactId = query.value("contact_id").toString();
+    int size = AVATAR_VARIANT_SIZES[std::size(AVATAR_VARIANT_SIZES) - 1];
+    QString sizeText = message.section('#', 2, 2);
+    if (!sizeText.isEmpty()) {
+        size = sizeText.toInt();
+        if (std::find(std::begin(AVATAR_VARIANT_SIZES), std::end(AVATAR_VARIANT_SIZES), size) == std::end(AVATAR_VARIANT_SIZES)) {
+            clientSocket->write("GET_AVATAR_FAIL#" + hash + "#INVALID_SIZE\n");
+            return;
+        }
+    }
 
-            // 如果已经处理过这个联系人，跳过
+    QFile file(avatarVariantPath(hash, size));
+    if (!file.open(QIODevice::ReadOnly)) {
+        clientSocket->write("GET_AVATAR_FAIL#" + hash + "#NOT_FOUND\n");
+        return;
+    }
+    QByteArray data = file.readAll();
+    file.close();
+
+    clientSocket->write("GET_AVATAR_SUCCESS#" + hash + "#" + QByteArray::number(size) + "#" + data.toBase64() + "\n");
+}
+
+// 头像去重检查：AVATAR_CHECK#userId#sha256
+// 服务器已有该内容时直接关联到用户，回复 AVATAR_CHECK_SUCCESS#exists#sha256；
+// 否则回复 AVATAR_CHECK_SUCCESS#missing#sha256，由客户端发起 AVATAR_UPLOAD
+void Server::handleAvatarCheck(const QString &message, QTcpSocket *clientSocket)
+{
+    QStringList parts = message.split('#');
+    if (parts.size() < 3) {
+        clientSocket->write("AVATAR_CHECK_FAIL#INVALID_FORMAT\n");
+        return;
+    }
+
+    QString userId = parts[1];
+    QByteArray hash = parts[2].trimmed().toLower().toLatin1();
+    if (!isSha256Hex(hash)) {
+        clientSocket->write("AVATAR_CHECK_FAIL#INVALID_HASH\n");
+        return;
+    }
+
+    if (!isAvatarStored(hash)) {
+        clientSocket->write("AVATAR_CHECK_SUCCESS#missing#" + hash + "\n");
+        return;
+    }
+
+    if (!assignAvatar(userId, hash)) {
+        clientSocket->write("AVATAR_CHECK_FAIL#DB_ERROR\n");
+        return;
+    }
+
+    clientSocket->write("AVATAR_CHECK_SUCCESS#exists#" + hash + "\n");
+    qDebug() << "头像已存在，跳过上传:" << userId << hash;
+}
+
+// 头像上传：AVATAR_UPLOAD#userId#sha256#字节数\n 之后紧跟该字节数的原始图片数据（不做 base64）
+// 数据边收边写入临时文件并计算哈希，收齐后校验、裁剪缩放并关联到用户，
+// 回复 AVATAR_UPLOAD_SUCCESS#sha256 或 AVATAR_UPLOAD_FAIL#原因
+void Server::handleAvatarUploadBegin(const QString &message, QTcpSocket *clientSocket)
+{
+    QStringList parts = message.split('#');
+    bool sizeOk = false;
+    qint64 size = parts.size() >= 4 ? parts[3].trimmed().toLongLong(&sizeOk) : 0;
+    if (!sizeOk || size <= 0) {
+        // 无法确定后续数据的长度，不进入接收状态
+        clientSocket->write("AVATAR_UPLOAD_FAIL#INVALID_FORMAT\n");
+        return;
+    }
+
+    auto upload = std::make_shared<AvatarUpload>();
+    upload->userId = parts[1];
+    upload->expectedHash = parts[2].trimmed().toLower().toLatin1();
+    upload->expectedSize = size;
+
+    // 请求无效时仍要读走声明的字节数，错误在数据收齐后统一回复
+    if (!isSha256Hex(upload->expectedHash)) {
+        upload->error = "INVALID_HASH";
+    } else if (size > AVATAR_MAX_BYTES) {
+        upload->error = "TOO_LARGE";
+    } else if (!isAvatarStored(upload->expectedHash)) {
+        QDir().mkpath(avatarDir());
+        upload->file.reset(new QTemporaryFile(QDir(avatarDir()).filePath("upload_XXXXXX.tmp")));
+        if (!upload->file->open()) {
+            qDebug() << "头像临时文件创建失败:" << upload->file->errorString();
+            upload->file.reset();
+            upload->error = "STORAGE_ERROR";
+        }
+    }
+
+    m_avatarUploads.insert(clientSocket, upload);
+    qDebug() << "开始接收头像:" << upload->userId << "字节数:" << size;
+}
+
+bool Server::consumeAvatarUpload(QTcpSocket *clientSocket, QByteArray &buffer)
+{
+    auto it = m_avatarUploads.find(clientSocket);
+    AvatarUpload &upload = *it.value();
+
+    const qint64 take = qMin<qint64>(upload.expectedSize - upload.received, buffer.size());
+    if (take > 0) {
+        upload.hash.addData(QByteArrayView(buffer.constData(), take));
+        if (upload.file && upload.file->write(buffer.constData(), take) != take) {
+            qDebug() << "头像临时文件写入失败:" << upload.file->errorString();
+            upload.file.reset();
+            upload.error = "STORAGE_ERROR";
+        }
+        upload.received += take;
+        buffer.remove(0, take);
+    }
+
+    if (upload.received < upload.expectedSize) {
+        return false;
+    }
+
+    std::shared_ptr<AvatarUpload> finished = it.value();
+    m_avatarUploads.erase(it);
+    finishAvatarUpload(clientSocket, *finished);
+    return true;
+}
+
+void Server::finishAvatarUpload(QTcpSocket *clientSocket, AvatarUpload &upload)
+{
+    if (upload.error.isEmpty() && upload.hash.result().toHex() != upload.expectedHash) {
+        upload.error = "HASH_MISMATCH";
+    }
+
+    // 没有临时文件说明服务器已有该内容（上传期间被其他用户传过），直接关联即可
+    if (upload.error.isEmpty() && upload.file) {
+        upload.file->flush();
+        upload.file->seek(0);
+
+        QImageReader reader(upload.file.get());
+        reader.setAutoTransform(true); // 按 EXIF 方向摆正手机照片
+        const QSize imageSize = reader.size();
+        if (imageSize.isValid()
+            && (imageSize.width() > AVATAR_MAX_DIMENSION || imageSize.height() > AVATAR_MAX_DIMENSION)) {
+            upload.error = "IMAGE_TOO_LARGE";
+        } else {
+            QImage image = reader.read();
+            if (image.isNull()) {
+                qDebug() << "头像解码失败:" << reader.errorString();
+                upload.error = "INVALID_IMAGE";
+            } else if (!storeAvatarVariants(upload.expectedHash, image)) {
+                upload.error = "STORAGE_ERROR";
+            }
+        }
+    }
+
+    if (upload.error.isEmpty() && !assignAvatar(upload.userId, upload.expectedHash)) {
+        upload.error = "DB_ERROR";
+    }
+
+    if (!upload.error.isEmpty()) {
+        clientSocket->write("AVATAR_UPLOAD_FAIL#" + upload.error + "\n");
+        qDebug() << "头像上传失败:" << upload.userId << upload.error;
+        return;
+    }
+
+    clientSocket->write("AVATAR_UPLOAD_SUCCESS#" + upload.expectedHash + "\n");
+    qDebug() << "头像上传成功:" << upload.userId << upload.expectedHash << "字节数:" << upload.received;
+}
+
+QString Server::attachmentDir()
+{
+    return QDir(QCoreApplication::applicationDirPath()).filePath("attachments");
+}
+
+QString Server::attachmentPartPath(qint64 attachmentId)
+{
+    return QDir(attachmentDir()).filePath(QString("upload_%1.part").arg(attachmentId));
+}
+
+QString Server::attachmentBlobPath(const QString &sha256)
+{
+    return QDir(attachmentDir()).filePath(sha256);
+}
+
+// 以 1MB 的块读取文件并计入哈希，文件不存在或读取出错时返回 false
+bool Server::addFileToHash(QCryptographicHash &hash, const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QByteArray block(ATTACHMENT_SEND_CHUNK, Qt::Uninitialized);
+    qint64 n;
+    while ((n = file.read(block.data(), block.size())) > 0) {
+        hash.addData(QByteArrayView(block.constData(), n));
+    }
+    return n == 0;
+}
+
+// 大文件传输时加大内核收发缓冲，减少高延迟链路上的窗口等待
+void Server::enlargeSocketBuffers(QTcpSocket *clientSocket)
+{
+    clientSocket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, ATTACHMENT_SOCKET_BUFFER);
+    clientSocket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, ATTACHMENT_SOCKET_BUFFER);
+}
+
+// 开始上传附件：ATTACH_BEGIN#senderId#receiverId#sha256#字节数#文件名
+// 回复 ATTACH_BEGIN_SUCCESS#附件ID#已收到的字节数，客户端从该偏移继续发送 ATTACH_CHUNK；
+// 服务器已有相同内容时直接登记完成，偏移即为文件大小
+void Server::handleAttachBegin(const QString &message, QTcpSocket *clientSocket)
+{
+    QStringList parts = message.split('#');
+    if (parts.size() < 6) {
+        clientSocket->write("ATTACH_BEGIN_FAIL#INVALID_FORMAT\n");
+        return;
+    }
+
+    QString senderId = parts[1];
+    QString receiverId = parts[2];
+    QByteArray sha256 = parts[3].trimmed().toLower().toLatin1();
+    bool sizeOk = false;
+    qint64 size = parts[4].trimmed().toLongLong(&sizeOk);
+    QString fileName = QFileInfo(message.section('#', 5)).fileName(); // 文件名可能包含 '#'，只保留文件名部分
+
+    if (!isSha256Hex(sha256) || !sizeOk || size <= 0 || fileName.isEmpty()) {
+        clientSocket->write("ATTACH_BEGIN_FAIL#INVALID_FORMAT\n");
+        return;
+    }
+    if (size > ATTACHMENT_MAX_BYTES) {
+        clientSocket->write("ATTACH_BEGIN_FAIL#TOO_LARGE\n");
+        return;
+    }
+    if (!m_db.isOpen()) {
+        qDebug() << "Database not open in handleAttachBegin";
+        clientSocket->write("ATTACH_BEGIN_FAIL#DB_NOT_OPEN\n");
+        return;
+    }
+
+    QDir().mkpath(attachmentDir());
+    enlargeSocketBuffers(clientSocket);
+
+    const bool stored = QFile::exists(attachmentBlobPath(QString::fromLatin1(sha256)));
+
+    qint64 attachmentId = 0;
+    qint64 offset = 0;
+    if (!stored) {
+        // 续传：同一发送者发给同一接收者的相同文件尚未传完
+        QSqlQuery findQuery(m_db);
+        findQuery.prepare("SELECT attachment_id FROM attachment "
+                          "WHERE sender_id = :sender_id AND receiver_id = :receiver_id "
+                          "  AND sha256 = :sha256 AND size = :size AND status = 'uploading' "
+                          "ORDER BY attachment_id DESC LIMIT 1");
+        findQuery.bindValue(":sender_id", senderId);
+        findQuery.bindValue(":receiver_id", receiverId);
+        findQuery.bindValue(":sha256", QString::fromLatin1(sha256));
+        findQuery.bindValue(":size", size);
+        if (findQuery.exec() && findQuery.next()) {
+            attachmentId = findQuery.value(0).toLongLong();
+            offset = QFileInfo(attachmentPartPath(attachmentId)).size();
+            if (offset > size) {
+                QFile::remove(attachmentPartPath(attachmentId));
+                m_uploadHashes.remove(attachmentId);
+                offset = 0;
+            }
+        }
+    }
+
+    if (attachmentId == 0) {
+        QSqlQuery insertQuery(m_db);
+        insertQuery.prepare("INSERT INTO attachment (sender_id, receiver_id, file_name, size, sha256, status, created_at) "
+                            "VALUES (:sender_id, :receiver_id, :file_name, :size, :sha256, :status, :created_at)");
+        insertQuery.bindValue(":sender_id", senderId);
+        insertQuery.bindValue(":receiver_id", receiverId);
+        insertQuery.bindValue(":file_name", fileName);
+        insertQuery.bindValue(":size", size);
+        insertQuery.bindValue(":sha256", QString::fromLatin1(sha256));
+        insertQuery.bindValue(":status", stored ? "complete" : "uploading");
+        insertQuery.bindValue(":created_at", m_clock.now().toUtcString());
+        if (!insertQuery.exec()) {
+            qDebug() << "附件登记失败:" << insertQuery.lastError().text();
+            clientSocket->write("ATTACH_BEGIN_FAIL#DB_ERROR\n");
+            return;
+        }
+        attachmentId = insertQuery.lastInsertId().toLongLong();
+        // 附件表每次启动重建，编号会重复使用；上次运行遗留的同编号分块文件和增量哈希不属于这个附件
+        QFile::remove(attachmentPartPath(attachmentId));
+        m_uploadHashes.remove(attachmentId);
+    }
+
+    if (stored) {
+        clientSocket->write("ATTACH_BEGIN_SUCCESS#" + QByteArray::number(attachmentId) + "#" + QByteArray::number(size) + "\n");
+        clientSocket->write("ATTACH_COMPLETE#" + QByteArray::number(attachmentId) + "#" + sha256 + "\n");
+        broadcastMessage(receiverId, QString("NEW_ATTACHMENT#%1#%2#%3#%4").arg(attachmentId).arg(senderId).arg(size).arg(fileName));
+        qDebug() << "附件内容已存在，跳过上传:" << attachmentId << fileName;
+        return;
+    }
+
+    clientSocket->write("ATTACH_BEGIN_SUCCESS#" + QByteArray::number(attachmentId) + "#" + QByteArray::number(offset) + "\n");
+    qDebug() << "开始接收附件:" << attachmentId << fileName << "大小:" << size << "续传偏移:" << offset;
+
+    if (offset == size) {
+        // 数据已全部收到（上次在校验前断开），直接完成
+        finishAttachmentUpload(clientSocket, attachmentId);
+    }
+}
+
+// 附件分块：ATTACH_CHUNK#附件ID#偏移#字节数\n 之后紧跟该字节数的原始数据
+// 偏移必须等于服务器已收到的字节数；回复 ATTACH_CHUNK_SUCCESS#附件ID#新偏移，
+// 失败时回复 ATTACH_CHUNK_FAIL#附件ID#原因#服务器当前偏移，客户端据此续传
+void Server::handleAttachChunkBegin(const QString &message, QTcpSocket *clientSocket)
+{
+    QStringList parts = message.split('#');
+    bool lengthOk = false;
+    qint64 length = parts.size() >= 4 ? parts[3].trimmed().toLongLong(&lengthOk) : 0;
+    if (!lengthOk || length <= 0) {
+        // 无法确定后续数据的长度，不进入接收状态
+        clientSocket->write("ATTACH_CHUNK_FAIL#0#INVALID_FORMAT#0\n");
+        return;
+    }
+
+    auto chunk = std::make_shared<AttachmentChunk>();
+    chunk->attachmentId = parts[1].toLongLong();
+    chunk->length = length;
+    qint64 offset = parts[2].toLongLong();
+
+    // 请求无效时仍要读走声明的字节数，错误在数据收齐后统一回复
+    QSqlQuery query(m_db);
+    query.prepare("SELECT size, status FROM attachment WHERE attachment_id = :attachment_id");
+    query.bindValue(":attachment_id", chunk->attachmentId);
+
+    if (length > ATTACHMENT_MAX_CHUNK) {
+        chunk->error = "CHUNK_TOO_LARGE";
+    } else if (!query.exec() || !query.next()) {
+        chunk->error = "NOT_FOUND";
+    } else if (query.value(1).toString() != "uploading") {
+        chunk->error = "ALREADY_COMPLETE";
+    } else {
+        chunk->totalSize = query.value(0).toLongLong();
+        const QString partPath = attachmentPartPath(chunk->attachmentId);
+        const qint64 partSize = QFileInfo(partPath).size();
+
+        if (offset != partSize) {
+            chunk->error = "OFFSET_MISMATCH";
+        } else if (offset + length > chunk->totalSize) {
+            chunk->error = "OUT_OF_RANGE";
+        } else {
+            // 增量哈希不在内存中（服务器重启过）时，先把已收到的部分计入
+            chunk->hash = m_uploadHashes.value(chunk->attachmentId);
+            if (!chunk->hash) {
+                chunk->hash = std::make_shared<QCryptographicHash>(QCryptographicHash::Sha256);
+                if (partSize > 0 && !addFileToHash(*chunk->hash, partPath)) {
+                    chunk->hash.reset();
+                } else {
+                    m_uploadHashes.insert(chunk->attachmentId, chunk->hash);
+                }
+            }
+
+            chunk->file.reset(new QFile(partPath));
+            if (!chunk->hash || !chunk->file->open(QIODevice::WriteOnly | QIODevice::Append)) {
+                qDebug() << "附件分块文件打开失败:" << partPath << chunk->file->errorString();
+                chunk->file.reset();
+                chunk->error = "STORAGE_ERROR";
+            }
+        }
+    }
+
+    m_attachmentChunks.insert(clientSocket, chunk);
+}
+
+bool Server::consumeAttachmentChunk(QTcpSocket *clientSocket, QByteArray &buffer)
+{
+    auto it = m_attachmentChunks.find(clientSocket);
+    AttachmentChunk &chunk = *it.value();
+
+    const qint64 take = qMin<qint64>(chunk.length - chunk.received, buffer.size());
+    if (take > 0) {
+        if (chunk.file) {
+            if (chunk.file->write(buffer.constData(), take) == take) {
+                chunk.hash->addData(QByteArrayView(buffer.constData(), take));
+            } else {
+                // 写入了多少不确定，增量哈希作废，下次从文件重建
+                qDebug() << "附件分块写入失败:" << chunk.file->errorString();
+                chunk.file.reset();
+                m_uploadHashes.remove(chunk.attachmentId);
+                chunk.error = "STORAGE_ERROR";
+            }
+        }
+        chunk.received += take;
+        buffer.remove(0, take);
+    }
+
+    if (chunk.received < chunk.length) {
+        return false;
+    }
+
+    std::shared_ptr<AttachmentChunk> finished = it.value();
+    m_attachmentChunks.erase(it);
+    finishAttachmentChunk(clientSocket, *finished);
+    return true;
+}
+
+void Server::finishAttachmentChunk(QTcpSocket *clientSocket, AttachmentChunk &chunk)
+{
+    if (chunk.file) {
+        chunk.file->close();
+    }
+
+    const QByteArray id = QByteArray::number(chunk.attachmentId);
+    const qint64 partSize = QFileInfo(attachmentPartPath(chunk.attachmentId)).size();
+
+    if (!chunk.error.isEmpty()) {
+        clientSocket->write("ATTACH_CHUNK_FAIL#" + id + "#" + chunk.error + "#" + QByteArray::number(partSize) + "\n");
+        qDebug() << "附件分块失败:" << chunk.attachmentId << chunk.error << "当前偏移:" << partSize;
+        return;
+    }
+
+    clientSocket->write("ATTACH_CHUNK_SUCCESS#" + id + "#" + QByteArray::number(partSize) + "\n");
+
+    if (partSize == chunk.totalSize) {
+        finishAttachmentUpload(clientSocket, chunk.attachmentId);
+    }
+}
+
+// 附件数据收齐：校验哈希后移入按内容寻址的存储，回复 ATTACH_COMPLETE#附件ID#sha256 并通知接收者
+void Server::finishAttachmentUpload(QTcpSocket *clientSocket, qint64 attachmentId)
+{
+    const QByteArray id = QByteArray::number(attachmentId);
+
+    QSqlQuery query(m_db);
+    query.prepare("SELECT sender_id, receiver_id, file_name, size, sha256 FROM attachment WHERE attachment_id = :attachment_id");
+    query.bindValue(":attachment_id", attachmentId);
+    if (!query.exec() || !query.next()) {
+        clientSocket->write("ATTACH_FAIL#" + id + "#NOT_FOUND\n");
+        return;
+    }
+
+    QString senderId = query.value(0).toString();
+    QString receiverId = query.value(1).toString();
+    QString fileName = query.value(2).toString();
+    qint64 size = query.value(3).toLongLong();
+    QString sha256 = query.value(4).toString();
+
+    const QString partPath = attachmentPartPath(attachmentId);
+    std::shared_ptr<QCryptographicHash> hash = m_uploadHashes.take(attachmentId);
+    if (!hash) {
+        hash = std::make_shared<QCryptographicHash>(QCryptographicHash::Sha256);
+        if (!addFileToHash(*hash, partPath)) {
+            clientSocket->write("ATTACH_FAIL#" + id + "#STORAGE_ERROR\n");
+            qDebug() << "附件分块文件读取失败:" << partPath;
+            return;
+        }
+    }
+
+    if (QString::fromLatin1(hash->result().toHex()) != sha256) {
+        QFile::remove(partPath);
+        clientSocket->write("ATTACH_FAIL#" + id + "#HASH_MISMATCH\n");
+        qDebug() << "附件校验失败，已丢弃:" << attachmentId << fileName;
+        return;
+    }
+
+    const QString blobPath = attachmentBlobPath(sha256);
+    if (QFile::exists(blobPath)) {
+        QFile::remove(partPath); // 其间已有相同内容传完
+    } else if (!QFile::rename(partPath, blobPath)) {
+        clientSocket->write("ATTACH_FAIL#" + id + "#STORAGE_ERROR\n");
+        qDebug() << "附件移入存储失败:" << partPath << "->" << blobPath;
+        return;
+    }
+
+    QSqlQuery updateQuery(m_db);
+    updateQuery.prepare("UPDATE attachment SET status = 'complete' WHERE attachment_id = :attachment_id");
+    updateQuery.bindValue(":attachment_id", attachmentId);
+    if (!updateQuery.exec()) {
+        clientSocket->write("ATTACH_FAIL#" + id + "#DB_ERROR\n");
+        qDebug() << "附件状态更新失败:" << updateQuery.lastError().text();
+        return;
+    }
+
+    clientSocket->write("ATTACH_COMPLETE#" + id + "#" + sha256.toLatin1() + "\n");
+    broadcastMessage(receiverId, QString("NEW_ATTACHMENT#%1#%2#%3#%4").arg(attachmentId).arg(senderId).arg(size).arg(fileName));
+    qDebug() << "附件上传完成:" << attachmentId << fileName << "大小:" << size;
+}
+
+// 下载附件：ATTACH_GET#userId#附件ID#偏移
+// 回复 ATTACH_GET_SUCCESS#附件ID#大小#sha256#偏移，之后是若干 ATTACH_DATA#附件ID#偏移#字节数\n<原始数据>，
+// 最后是 ATTACH_GET_DONE#附件ID；客户端保留已收到的部分，断开后从该偏移重新请求即可续传
+void Server::handleAttachGet(const QString &message, QTcpSocket *clientSocket)
+{
+    QStringList parts = message.split('#');
+    if (parts.size() < 3) {
+        clientSocket->write("ATTACH_GET_FAIL#0#INVALID_FORMAT\n");
+        return;
+    }
+
+    QString userId = parts[1];
+    qint64 attachmentId = parts[2].toLongLong();
+    qint64 offset = parts.size() >= 4 ? parts[3].trimmed().toLongLong() : 0;
+    const QByteArray id = QByteArray::number(attachmentId);
+
+    QSqlQuery query(m_db);
+    query.prepare("SELECT sender_id, receiver_id, size, sha256, status FROM attachment WHERE attachment_id = :attachment_id");
+    query.bindValue(":attachment_id", attachmentId);
+    if (!query.exec() || !query.next()) {
+        clientSocket->write("ATTACH_GET_FAIL#" + id + "#NOT_FOUND\n");
+        return;
+    }
+
+    QString senderId = query.value(0).toString();
+    QString receiverId = query.value(1).toString();
+    qint64 size = query.value(2).toLongLong();
+    QString sha256 = query.value(3).toString();
+
+    if (userId != senderId && userId != receiverId) {
+        clientSocket->write("ATTACH_GET_FAIL#" + id + "#FORBIDDEN\n");
+        return;
+    }
+    if (query.value(4).toString() != "complete") {
+        clientSocket->write("ATTACH_GET_FAIL#" + id + "#NOT_READY\n");
+        return;
+    }
+    if (offset < 0 || offset > size) {
+        offset = 0;
+    }
+
+    auto download = std::make_shared<AttachmentDownload>();
+    download->attachmentId = attachmentId;
+    download->end = size;
+    download->markDownloaded = (userId == receiverId);
+    download->file.reset(new QFile(attachmentBlobPath(sha256)));
+    if (!download->file->open(QIODevice::ReadOnly) || !download->file->seek(offset)) {
+        clientSocket->write("ATTACH_GET_FAIL#" + id + "#STORAGE_ERROR\n");
+        qDebug() << "附件打开失败:" << download->file->fileName() << download->file->errorString();
+        return;
+    }
+
+    enlargeSocketBuffers(clientSocket);
+    m_attachmentDownloads.insert(clientSocket, download); // 同一连接上新的下载替换未完成的旧下载
+
+    clientSocket->write("ATTACH_GET_SUCCESS#" + id + "#" + QByteArray::number(size) + "#"
+                        + sha256.toLatin1() + "#" + QByteArray::number(offset) + "\n");
+    qDebug() << "开始发送附件:" << attachmentId << "偏移:" << offset << "大小:" << size;
+
+    pumpAttachmentDownload(clientSocket);
+}
+
+void Server::pumpAttachmentDownload(QTcpSocket *clientSocket)
+{
+    auto it = m_attachmentDownloads.find(clientSocket);
+    if (it == m_attachmentDownloads.end()) {
+        return;
+    }
+
+    AttachmentDownload &download = *it.value();
+    const QByteArray id = QByteArray::number(download.attachmentId);
+
+    // 发送缓冲中积压不超过 ATTACHMENT_SEND_WINDOW，其余等 bytesWritten 后继续，不把整个文件读进内存
+    while (clientSocket->bytesToWrite() < ATTACHMENT_SEND_WINDOW && download.file->pos() < download.end) {
+        const qint64 offset = download.file->pos();
+        QByteArray data = download.file->read(qMin<qint64>(ATTACHMENT_SEND_CHUNK, download.end - offset));
+        if (data.isEmpty()) {
+            clientSocket->write("ATTACH_GET_FAIL#" + id + "#READ_ERROR\n");
+            qDebug() << "附件读取失败:" << download.file->fileName() << download.file->errorString();
+            m_attachmentDownloads.erase(it);
+            return;
+        }
+        clientSocket->write("ATTACH_DATA#" + id + "#" + QByteArray::number(offset) + "#" + QByteArray::number(data.size()) + "\n");
+        clientSocket->write(data);
+    }
+
+    if (download.file->pos() < download.end) {
+        return;
+    }
+
+    clientSocket->write("ATTACH_GET_DONE#" + id + "\n");
+    if (download.markDownloaded) {
+        QSqlQuery query(m_db);
+        query.prepare("UPDATE attachment SET downloaded = 1 WHERE attachment_id = :attachment_id");
+        query.bindValue(":attachment_id", download.attachmentId);
+        query.exec();
+    }
+    qDebug() << "附件发送完毕:" << download.attachmentId;
+    m_attachmentDownloads.erase(it);
+}
+
+// 待接收附件列表：ATTACH_LIST#userId，回复 ATTACH_LIST_SUCCESS#<数组>（发给该用户、已传完、尚未下载的附件）
+void Server::handleAttachList(const QString &message, QTcpSocket *clientSocket)
+{
+    if (!m_db.isOpen()) {
+        qDebug() << "Database not open in handleAttachList";
+        clientSocket->write("ATTACH_LIST_FAIL#DB_NOT_OPEN\n");
+        return;
+    }
+
+    QString userId = message.section('#', 1, 1);
+
+    QSqlQuery query(m_db);
+    query.setForwardOnly(true);
+    query.prepare("SELECT attachment_id, sender_id, file_name, size, sha256, created_at FROM attachment "
+                  "WHERE receiver_id = :receiver_id AND status = 'complete' AND downloaded = 0 "
+                  "ORDER BY attachment_id ASC");
+    query.bindValue(":receiver_id", userId);
+
+    if (!query.exec()) {
+        clientSocket->write("ATTACH_LIST_FAIL#DB_ERROR\n");
+        qDebug() << "获取待接收附件失败:" << query.lastError().text();
+        return;
+    }
+
+    streamRows(clientSocket, std::move(query), "ATTACH_LIST_SUCCESS#", "\n",
+               QString("待接收附件列表发送成功: %1").arg(userId),
+               [](const QSqlQuery &row, RowWriter &writer) {
+        writer.addInt("attachment_id", row.value(0).toLongLong());
+        writer.addString("sender_id", row.value(1).toString());
+        writer.addString("file_name", row.value(2).toString());
+        writer.addInt("size", row.value(3).toLongLong());
+        writer.addString("sha256", row.value(4).toString());
+        writer.addString("created_at", row.value(5).toString());
+    });
+}
+
+// 处理获取聊天历史
+void Server::handleGetChatHistory(const QString &message, QTcpSocket *clientSocket)
+{
+    if (!m_db.isOpen()) {
+        qDebug() << "Database not open in handleGetChatHistory";
+        clientSocket->write("GET_CHAT_HISTORY_FAIL#DB_NOT_OPEN\n");
+        return;
+    }
+
+    // 消息格式: GET_CHAT_HISTORY#userId#contactId[#since_message_id]
+    // 携带 since_message_id 时只返回 message_id 更大的消息（按 message_id 升序），响应为 CHAT_HISTORY_DELTA#<json数组>
+    QStringList parts = message.split('#');
+    if (parts.size() < 3) {
+        clientSocket->write("GET_CHAT_HISTORY_FAIL#INVALID_FORMAT\n");
+        return;
+    }
+
+    QString userId = parts[1];
+    QString contactId = parts[2];
+    bool isDelta = parts.size() >= 4 && !parts[3].trimmed().isEmpty();
+    qint64 sinceMessageId = isDelta ? parts[3].trimmed().toLongLong() : 0;
+
+    // 读取前先提交排队中的消息，保证能读到刚发送的内容
+    flushPendingMessages();
+
+    QSqlQuery query(m_db);
+    query.setForwardOnly(true);
+    if (isDelta) {
+        query.prepare("SELECT message_id, sender_id, receiver_id, content, send_time "
+                      "FROM message "
+                      "WHERE ((sender_id = :user_id AND receiver_id = :contact_id) "
+                      "    OR (sender_id = :contact_id AND receiver_id = :user_id)) "
+                      "  AND message_id > :since_message_id "
+                      "ORDER BY message_id ASC");
+        query.bindValue(":since_message_id", sinceMessageId);
+    } else {
+        query.prepare("SELECT message_id, sender_id, receiver_id, content, send_time "
+                      "FROM message "
+                      "WHERE (sender_id = :user_id AND receiver_id = :contact_id) "
+                      "   OR (sender_id = :contact_id AND receiver_id = :user_id) "
+                      "ORDER BY send_time ASC, message_id ASC");
+    }
+    query.bindValue(":user_id", userId);
+    query.bindValue(":contact_id", contactId);
+
+    if (query.exec()) {
+        // 逐行直接写入连接，图片消息的 base64 内容不再在内存中复制多份
+        streamRows(clientSocket, std::move(query), isDelta ? "CHAT_HISTORY_DELTA#" : "GET_CHAT_HISTORY_SUCCESS#", "\n",
+                   QString("聊天历史发送成功: %1 <-> %2").arg(userId, contactId),
+                   [](const QSqlQuery &row, RowWriter &writer) {
+            writer.addString("message_id", row.value(0).toString());
+            writer.addString("sender_id", row.value(1).toString());
+            writer.addString("receiver_id", row.value(2).toString());
+            writer.addString("content", row.value(3).toString());
+            writer.addString("send_time", row.value(4).toString());
+        });
+    } else {
+        clientSocket->write("GET_CHAT_HISTORY_FAIL#DB_ERROR\n");
+        qDebug() << "获取聊天历史失败:" << query.lastError().text();
+    }
+}
+
+// 处理获取联系人列表
+void Server::handleGetContactList(const QString &message, QTcpSocket *clientSocket)
+{
+    if (!m_db.isOpen()) {
+        qDebug() << "Database not open in handleGetContactList";
+        clientSocket->write("GET_CONTACT_LIST_FAIL#DB_NOT_OPEN\n");
+        return;
+    }
+
+    // 消息格式: GET_CONTACT_LIST#userId
+    QString userId = message.section('#', 1, 1);
+
+    // 读取前先提交排队中的消息，保证联系人和最后一条消息是最新的
+    flushPendingMessages();
+
+    QSqlQuery query(m_db);
+    // 使用简化的查询，分步获取联系人和最后消息
+    query.prepare("SELECT DISTINCT "
+                  "CASE WHEN m.sender_id = :user_id THEN m.receiver_id ELSE m.sender_id END as contact_id, "
+                  "u.real_name, u.username "
+                  "FROM message m "
+                  "JOIN user u ON (CASE WHEN m.sender_id = :user_id THEN m.receiver_id ELSE m.sender_id END) = u.id "
+                  "WHERE m.sender_id = :user_id OR m.receiver_id = :user_id "
+                  "ORDER BY m.send_time DESC");
+
+    query.bindValue(":user_id", userId);
+
+    if (query.exec()) {
+        QJsonArray contactsArray;
+        QSet<QString> processedContacts; // 避免重复联系人
+
+        while (query.next()) {
+            QString contactId = query.value("contact_id").toString();
+
+            // 如果已经处理过这个联系人，跳过
             if (processedContacts.contains(contactId)) {
                 continue;
             }
@@ -1777,6 +3445,7 @@ void Server::handleGetContactList(const QString &message, QTcpSocket *clientSock
             QJsonObject contactObj;
             contactObj["contact_id"] = contactId;
             contactObj["name"] = query.value("real_name").toString();
+            contactObj["username"] = query.value("username").toString(); // 聊天窗口按用户名显示联系人
             contactObj["last_message"] = lastMessage;
             contactObj["last_time"] = lastTime;
             contactsArray.append(contactObj);
@@ -1817,6 +3486,7 @@ void Server::handleMedicineSearch(const QString &message, QTcpSocket *clientSock
     // 构建SQL查询语句，实现模糊搜索
     QString queryStr = "SELECT * FROM medicine WHERE 1=1";
     QSqlQuery query(m_db);
+    query.setForwardOnly(true);
 
     // 添加药品名称模糊搜索条件 - 修正：当搜索文本为"全部"时不添加条件
     if (!searchText.isEmpty() && searchText != "全部") {
@@ -1848,45 +3518,121 @@ void Server::handleMedicineSearch(const QString &message, QTcpSocket *clientSock
     }
 
     if (query.exec()) {
-        QJsonArray medicinesArray;
-        int resultCount = 0;
-
-        while (query.next()) {
-            resultCount++;
-            QJsonObject medicine;
-            medicine["medicine_id"] = query.value("medicine_id").toString();
-            medicine["name"] = query.value("name").toString();
-            medicine["dosage_form"] = query.value("dosage_form").toString();
-            medicine["specification"] = query.value("specification").toString();
-            medicine["manufacturer"] = query.value("manufacturer").toString();
-            medicine["usage"] = query.value("usage").toString();
+        // SELECT * 的列序不固定，列下标在循环外按名称解析一次
+        const QSqlRecord record = query.record();
+        const int idCol = record.indexOf("medicine_id");
+        const int nameCol = record.indexOf("name");
+        const int dosageFormCol = record.indexOf("dosage_form");
+        const int specificationCol = record.indexOf("specification");
+        const int manufacturerCol = record.indexOf("manufacturer");
+        const int usageCol = record.indexOf("usage");
+        const int indicationsCol = record.indexOf("indications");
+        const int sideEffectsCol = record.indexOf("side_effects");
+        const int contraindicationsCol = record.indexOf("contraindications");
+        const int storageCol = record.indexOf("storage");
+        const int expiryDateCol = record.indexOf("expiry_date");
+        const int priceCol = record.indexOf("price");
+        const int descriptionCol = record.indexOf("description");
+
+        streamRows(clientSocket, std::move(query), "MEDICINE_SEARCH_SUCCESS#", "\n", "发送药品搜索结果给客户端",
+                   [=](const QSqlQuery &row, RowWriter &writer) {
+            const QString contraindications = row.value(contraindicationsCol).toString();
+
+            writer.addString("medicine_id", row.value(idCol).toString());
+            writer.addString("name", row.value(nameCol).toString());
+            writer.addString("dosage_form", row.value(dosageFormCol).toString());
+            writer.addString("specification", row.value(specificationCol).toString());
+            writer.addString("manufacturer", row.value(manufacturerCol).toString());
+            writer.addString("usage", row.value(usageCol).toString());
             // 客户端期望的字段名是 indication（单数），而数据库是 indications（复数）
-            medicine["indication"] = query.value("indications").toString();
+            writer.addString("indication", row.value(indicationsCol).toString());
             // 客户端期望的字段名是 side_effect（单数），而数据库是 side_effects（复数）
-            medicine["side_effect"] = query.value("side_effects").toString();
+            writer.addString("side_effect", row.value(sideEffectsCol).toString());
             // 客户端期望的字段名是 contraindication（单数），而数据库是 contraindications（复数）
-            medicine["contraindication"] = query.value("contraindications").toString();
+            writer.addString("contraindication", contraindications);
             // 添加客户端期望的 notice 字段，可以使用 contraindications 的内容
-            medicine["notice"] = query.value("contraindications").toString();
-            medicine["storage"] = query.value("storage").toString();
-            medicine["expiry_date"] = query.value("expiry_date").toString();
+            writer.addString("notice", contraindications);
+            writer.addString("storage", row.value(storageCol).toString());
+            writer.addString("expiry_date", row.value(expiryDateCol).toString());
             // 添加价格和描述信息，客户端可能需要这些
-            medicine["price"] = query.value("price").toDouble();
-            medicine["description"] = query.value("description").toString();
-
-            medicinesArray.append(medicine);
-        }
-
-        QJsonDocument doc(medicinesArray);
-        QString response = "MEDICINE_SEARCH_SUCCESS#" + doc.toJson(QJsonDocument::Compact);
-        clientSocket->write(response.toUtf8() + "\n");
-        qDebug() << "发送药品搜索结果给客户端，响应长度：" << response.length();
+            writer.addNumber("price", row.value(priceCol).toDouble());
+            writer.addString("description", row.value(descriptionCol).toString());
+        });
     } else {
         clientSocket->write("MEDICINE_SEARCH_FAIL#DB_ERROR\n");
         qDebug() << "药品搜索失败:" << query.lastError().text();
     }
 }
 
+// 语音识别词表: GET_SPEECH_VOCABULARY[#version]
+// 返回药品名称和科室名称，客户端用来纠正识别结果；version 为词表内容摘要，
+// 客户端携带的版本与当前一致时只回 SPEECH_VOCABULARY_UNCHANGED，不重复下发整张表。
+// 词表缓存在服务器上，只有触发器递增了 speech_vocabulary 版本后才重新查询
+void Server::handleGetSpeechVocabulary(const QString &message, QTcpSocket *clientSocket)
+{
+    if (!m_db.isOpen()) {
+        qDebug() << "Database not open in handleGetSpeechVocabulary";
+        clientSocket->write("SPEECH_VOCABULARY_FAIL#DB_NOT_OPEN\n");
+        return;
+    }
+
+    QString knownVersion = message.section('#', 1, 1);
+
+    qint64 sourceVersion = currentEntityVersion("speech_vocabulary");
+    if (m_vocabularyJson.isEmpty() || sourceVersion != m_vocabularySourceVersion) {
+        if (!rebuildSpeechVocabulary()) {
+            clientSocket->write("SPEECH_VOCABULARY_FAIL#DB_ERROR\n");
+            return;
+        }
+        m_vocabularySourceVersion = sourceVersion;
+    }
+
+    if (!knownVersion.isEmpty() && knownVersion == m_vocabularyVersion) {
+        clientSocket->write("SPEECH_VOCABULARY_UNCHANGED#" + m_vocabularyVersion.toUtf8() + "\n");
+        return;
+    }
+    clientSocket->write("SPEECH_VOCABULARY_SUCCESS#" + m_vocabularyJson + "\n");
+}
+
+// 重新查询药品和科室名称，生成词表响应和内容摘要
+bool Server::rebuildSpeechVocabulary()
+{
+    QStringList medicines;
+    QStringList departments;
+    QSqlQuery query(m_db);
+    if (!query.exec("SELECT DISTINCT name FROM medicine ORDER BY name")) {
+        qDebug() << "查询药品词表失败:" << query.lastError().text();
+        return false;
+    }
+    while (query.next()) {
+        medicines.append(query.value(0).toString());
+    }
+
+    // 新注册医生的"待分配"不是真实科室
+    if (!query.exec("SELECT DISTINCT department FROM doctor WHERE department != '待分配' ORDER BY department")) {
+        qDebug() << "查询科室词表失败:" << query.lastError().text();
+        return false;
+    }
+    while (query.next()) {
+        departments.append(query.value(0).toString());
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(medicines.join('\n').toUtf8());
+    hash.addData(QByteArray(1, '\0'));
+    hash.addData(departments.join('\n').toUtf8());
+    // 摘要由内容计算，服务器重启后版本号表重建也不会让客户端误用旧词表
+    m_vocabularyVersion = QString::fromLatin1(hash.result().toHex().left(16));
+
+    QJsonObject result;
+    result["version"] = m_vocabularyVersion;
+    result["medicines"] = QJsonArray::fromStringList(medicines);
+    result["departments"] = QJsonArray::fromStringList(departments);
+    m_vocabularyJson = QJsonDocument(result).toJson(QJsonDocument::Compact);
+    qDebug() << "重建语音识别词表，药品:" << medicines.size() << "科室:" << departments.size() << "版本:" << m_vocabularyVersion;
+    return true;
+}
+
 // 广播消息给指定用户
 void Server::broadcastMessage(const QString &receiverId, const QString &messageData)
 {
@@ -1895,7 +3641,7 @@ void Server::broadcastMessage(const QString &receiverId, const QString &messageD
         if (it.value() == receiverId) {
             QTcpSocket *receiverSocket = it.key();
             if (receiverSocket && receiverSocket->state() == QTcpSocket::ConnectedState) {
-                receiverSocket->write(messageData.toUtf8() + "\n");
+                pushToClient(receiverSocket, messageData.toUtf8() + "\n");
                 qDebug() << "实时消息推送给用户:" << receiverId;
                 break;
             }
@@ -1917,8 +3663,11 @@ void Server::handleVideoCallRequest(const QString &message, QTcpSocket *clientSo
     
     qDebug() << "收到视频通话请求:" << senderId << "呼叫" << receiverId;
     
-    // 构造转发消息
+    // 构造转发消息；新版客户端附带媒体端口，补上服务器看到的主叫地址供对方直连
     QString forwardMessage = QString("VIDEO_CALL_REQUEST#%1#%2").arg(senderId, receiverId);
+    if (parts.size() >= 4) {
+        forwardMessage += "#" + mediaEndpoint(clientSocket, parts[3]);
+    }
     
     // 转发给接收者
     broadcastMessage(receiverId, forwardMessage);
@@ -1939,13 +3688,28 @@ void Server::handleVideoCallResponse(const QString &message, QTcpSocket *clientS
     
     qDebug() << "收到视频通话响应:" << senderId << "回复" << receiverId << ":" << accepted;
     
-    // 构造转发消息
+    // 构造转发消息；接受通话时附带被叫的媒体地址
     QString forwardMessage = QString("VIDEO_CALL_RESPONSE#%1#%2#%3").arg(senderId, receiverId, accepted);
+    if (parts.size() >= 5) {
+        forwardMessage += "#" + mediaEndpoint(clientSocket, parts[4]);
+    }
     
     // 转发给发起者
     broadcastMessage(receiverId, forwardMessage);
 }
 
+// 媒体端点: "<该连接的对端IP>#<客户端上报的UDP端口>"
+QString Server::mediaEndpoint(QTcpSocket *clientSocket, const QString &mediaPort)
+{
+    QHostAddress address = clientSocket->peerAddress();
+    bool isIPv4 = false;
+    quint32 ipv4 = address.toIPv4Address(&isIPv4);
+    if (isIPv4) {
+        address = QHostAddress(ipv4); // 去掉 ::ffff: 前缀
+    }
+    return QString("%1#%2").arg(address.toString(), mediaPort.trimmed());
+}
+
 // 处理视频通话结束
 void Server::handleVideoCallEnd(const QString &message, QTcpSocket *clientSocket)
 {
@@ -1975,178 +3739,437 @@ void Server::handleSubmitPrescription(const QString &message, QTcpSocket *client
         return;
     }
 
-    // 请求格式: SUBMIT_PRESCRIPTION#patient_id#doctor_id#medicine_name#dosage#usage#frequency#quantity#notes
+    // 请求格式: SUBMIT_PRESCRIPTION#patient_id#doctor_id#medicine_name#dosage#usage#frequency#quantity[#idempotency_key]#notes
+    // 备注放在最后，可以包含 '#'；幂等键为 UUID，据此与备注区分
     QStringList parts = message.split("#");
-    if (parts.size() != 9) {
+    if (parts.size() < 9) {
         clientSocket->write("PRESCRIPTION_SUBMIT_FAIL#INVALID_FORMAT\n");
-        qDebug() << "处方提交格式错误，参数数量:" << parts.size() << "预期:9";
+        qDebug() << "处方提交格式错误，参数数量:" << parts.size() << "预期至少9个";
+        return;
+    }
+
+    // 可选的幂等键：同一键的重试直接回放首次成功的响应
+    QString idempotencyKey;
+    int notesIndex = 8;
+    if (parts.size() > 9 && !QUuid::fromString(parts[8]).isNull()) {
+        idempotencyKey = parts[8];
+        notesIndex = 9;
+    }
+    QString notes = parts.mid(notesIndex).join('#');
+    QByteArray payloadHash = idempotencyPayloadHash((parts.mid(1, 7).join('#') + "#" + notes).toUtf8());
+    if (replayIdempotentResponse("SUBMIT_PRESCRIPTION", idempotencyKey, payloadHash,
+                                 "PRESCRIPTION_SUBMIT_FAIL#IDEMPOTENCY_KEY_REUSED\n", clientSocket)) {
+        return;
+    }
+
+    QString patientId = parts[1];
+    QString doctorId = parts[2];
+    QString medicineName = parts[3];
+    QString dosage = parts[4];
+    QString usage = parts[5];
+    QString frequency = parts[6];
+    QString quantityStr = parts[7];
+
+    // 验证购买数量是否为有效整数
+    bool ok;
+    int quantity = quantityStr.toInt(&ok);
+    if (!ok || quantity <= 0) {
+        clientSocket->write("PRESCRIPTION_SUBMIT_FAIL#INVALID_QUANTITY\n");
+        qDebug() << "购买数量无效:" << quantityStr;
+        return;
+    }
+
+    qDebug() << "处方提交信息:";
+    qDebug() << "患者ID:" << patientId;
+    qDebug() << "医生ID:" << doctorId;
+    qDebug() << "药品名称:" << medicineName;
+    qDebug() << "剂量:" << dosage;
+    qDebug() << "用法:" << usage;
+    qDebug() << "频次:" << frequency;
+    qDebug() << "购买数量:" << quantity;
+    qDebug() << "备注:" << notes;
+
+    // 检查患者是否存在
+    QSqlQuery checkPatient(m_db);
+    checkPatient.prepare("SELECT COUNT(*) FROM patient WHERE id = :patient_id");
+    checkPatient.bindValue(":patient_id", patientId);
+    if (!checkPatient.exec() || !checkPatient.next() || checkPatient.value(0).toInt() == 0) {
+        clientSocket->write("PRESCRIPTION_SUBMIT_FAIL#PATIENT_NOT_FOUND\n");
+        qDebug() << "患者不存在:" << patientId;
+        return;
+    }
+
+    // 检查医生是否存在
+    QSqlQuery checkDoctor(m_db);
+    checkDoctor.prepare("SELECT COUNT(*) FROM doctor WHERE id = :doctor_id");
+    checkDoctor.bindValue(":doctor_id", doctorId);
+    if (!checkDoctor.exec() || !checkDoctor.next() || checkDoctor.value(0).toInt() == 0) {
+        clientSocket->write("PRESCRIPTION_SUBMIT_FAIL#DOCTOR_NOT_FOUND\n");
+        qDebug() << "医生不存在:" << doctorId;
+        return;
+    }
+
+    // 查询药品价格以计算处方费用 - 使用精确匹配
+    QSqlQuery medicineQuery(m_db);
+    medicineQuery.prepare("SELECT medicine_id, name, price, specification FROM medicine WHERE name = :medicine_name LIMIT 1");
+    medicineQuery.bindValue(":medicine_name", medicineName);
+
+    double medicinePrice = 0.0;
+    QString medicineSpec = "";
+    int medicineId = 0;
+
+    if (medicineQuery.exec() && medicineQuery.next()) {
+        medicineId = medicineQuery.value("medicine_id").toInt();
+        medicinePrice = medicineQuery.value("price").toDouble();
+        medicineSpec = medicineQuery.value("specification").toString();
+        qDebug() << "找到药品信息:" << medicineName << "价格:" << medicinePrice << "规格:" << medicineSpec;
+    } else {
+        // 如果精确匹配失败，尝试模糊匹配
+        QSqlQuery fuzzyQuery(m_db);
+        fuzzyQuery.prepare("SELECT medicine_id, name, price, specification FROM medicine WHERE name LIKE :medicine_pattern LIMIT 1");
+        fuzzyQuery.bindValue(":medicine_pattern", QString("%%%1%%").arg(medicineName));
+
+        if (fuzzyQuery.exec() && fuzzyQuery.next()) {
+            medicineId = fuzzyQuery.value("medicine_id").toInt();
+            medicinePrice = fuzzyQuery.value("price").toDouble();
+            medicineSpec = fuzzyQuery.value("specification").toString();
+            qDebug() << "模糊匹配找到药品:" << fuzzyQuery.value("name").toString() << "价格:" << medicinePrice;
+        } else {
+            // 如果都找不到，记录错误并使用默认价格
+            qDebug() << "警告：药品价格未找到 -" << medicineName << "，使用默认价格";
+            medicinePrice = 15.0; // 提高默认价格到15元
+        }
+    }
+
+    // 验证价格的合理性
+    if (medicinePrice <= 0) {
+        qDebug() << "药品价格异常，使用默认价格:" << medicinePrice << "→ 15.0";
+        medicinePrice = 15.0;
+    }
+
+    // 计算总费用 = 药品单价 * 购买数量
+    double totalCost = medicinePrice * quantity;
+
+    // 本次写入统一使用同一个时间戳，显式绑定，不依赖数据库默认值
+    MonotonicClock::Timestamp writeTime = m_clock.now();
+
+    // 记录写入前的版本号，提交后只推送变更的行
+    qint64 prescriptionVersion = currentEntityVersion("prescription");
+    qint64 paymentVersion = currentEntityVersion("payment_items");
+
+    // 处方、缴费项目、待支付记录和幂等键在同一事务中提交，避免重试产生重复处方或重复收费
+    m_db.transaction();
+
+    try {
+        QSqlQuery query(m_db);
+        query.prepare("INSERT INTO prescription (patient_id, doctor_id, medicine_name, dosage, usage, frequency, quantity, notes, prescribed_date) "
+                      "VALUES (:patient_id, :doctor_id, :medicine_name, :dosage, :usage, :frequency, :quantity, :notes, :prescribed_date)");
+        query.bindValue(":patient_id", patientId);
+        query.bindValue(":doctor_id", doctorId);
+        query.bindValue(":medicine_name", medicineName);
+        query.bindValue(":dosage", dosage);
+        query.bindValue(":usage", usage);
+        query.bindValue(":frequency", frequency);
+        query.bindValue(":quantity", quantity);
+        query.bindValue(":notes", notes);
+        query.bindValue(":prescribed_date", writeTime.toLocalString()); // 与缴费项目 created_at 同一时间戳、同为本地时间
+
+        if (!query.exec()) {
+            qDebug() << "处方插入失败:" << query.lastError().text();
+            throw std::runtime_error("处方插入失败");
+        }
+
+        int prescriptionId = query.lastInsertId().toInt();
+
+        // 自动添加处方费用到缴费项目
+        QSqlQuery paymentQuery(m_db);
+        paymentQuery.prepare("INSERT INTO payment_items "
+                           "(patient_id, description, amount, status, type, application_id, created_at) "
+                           "VALUES (:patient_id, :description, :amount, :status, :type, :application_id, :created_at)");
+
+        QString description = QString("处方费用 - %1 (数量:%2)").arg(medicineName).arg(quantity);
+        QString prescriptionRef = QString("PRESC_%1").arg(prescriptionId);
+        QString currentTime = writeTime.toLocalString();
+
+        paymentQuery.bindValue(":patient_id", patientId);
+        paymentQuery.bindValue(":description", description);
+        paymentQuery.bindValue(":amount", totalCost);
+        paymentQuery.bindValue(":status", "pending");
+        paymentQuery.bindValue(":type", "prescription");
+        paymentQuery.bindValue(":application_id", prescriptionRef);
+        paymentQuery.bindValue(":created_at", currentTime);
+
+        if (!paymentQuery.exec()) {
+            throw std::runtime_error("缴费项目添加失败");
+        }
+
+        // 在缴费记录表中插入待支付记录
+        QSqlQuery recordQuery(m_db);
+        recordQuery.prepare("INSERT INTO payment_records "
+                          "(patient_id, total_amount, payment_time, payment_method) "
+                          "VALUES (:patient_id, :total_amount, :payment_time, :payment_method)");
+        recordQuery.bindValue(":patient_id", patientId);
+        recordQuery.bindValue(":total_amount", totalCost);
+        recordQuery.bindValue(":payment_time", currentTime);
+        recordQuery.bindValue(":payment_method", "待支付");
+
+        if (!recordQuery.exec()) {
+            throw std::runtime_error("缴费记录添加失败");
+        }
+
+        QByteArray response = QString("PRESCRIPTION_SUBMIT_SUCCESS#%1").arg(prescriptionId).toUtf8() + "\n";
+        if (!saveIdempotentResponse("SUBMIT_PRESCRIPTION", idempotencyKey, payloadHash, response)) {
+            throw std::runtime_error("幂等键记录失败");
+        }
+
+        // 提交事务
+        if (!m_db.commit()) {
+            throw std::runtime_error("事务提交失败");
+        }
+        cacheIdempotentResponse("SUBMIT_PRESCRIPTION", idempotencyKey, payloadHash, response);
+
+        clientSocket->write(response);
+        qDebug() << "处方提交成功，ID:" << prescriptionId << "费用:" << totalCost;
+
+        // 向患者端推送变更的处方和缴费项目
+        pushPrescriptionChanges(patientId, prescriptionVersion);
+        pushPaymentItemChanges(patientId, paymentVersion);
+
+    } catch (const std::exception &e) {
+        m_db.rollback();
+        clientSocket->write("PRESCRIPTION_SUBMIT_FAIL#DB_ERROR\n");
+        qDebug() << "处方提交失败:" << e.what();
+    }
+}
+
+// 处理多药品处方提交：一个处方头 + N 条药品明细，一次校验、一次批量查价、一个事务
+void Server::handleSubmitPrescriptionBatch(const QString &message, QTcpSocket *clientSocket)
+{
+    if (!m_db.isOpen()) {
+        clientSocket->write("PRESCRIPTION_BATCH_SUBMIT_FAIL#DB_NOT_OPEN\n");
+        return;
+    }
+
+    // 请求格式: SUBMIT_PRESCRIPTION_BATCH#<json数据>
+    // {"patient_id":"", "doctor_id":"", "idempotency_key":"", "items":[{"medicine_name":"", "dosage":"", "usage":"", "frequency":"", "quantity":1, "notes":""}, ...]}
+    QString jsonStr = message.section('#', 1);
+    QJsonDocument doc = QJsonDocument::fromJson(jsonStr.toUtf8());
+    if (doc.isNull() || !doc.isObject()) {
+        clientSocket->write("PRESCRIPTION_BATCH_SUBMIT_FAIL#INVALID_JSON\n");
+        return;
+    }
+
+    QJsonObject header = doc.object();
+    QString patientId = header["patient_id"].toString();
+    QString doctorId = header["doctor_id"].toString();
+    QString idempotencyKey = header["idempotency_key"].toString();
+    QJsonArray items = header["items"].toArray();
+
+    if (patientId.isEmpty() || doctorId.isEmpty() || items.isEmpty()) {
+        clientSocket->write("PRESCRIPTION_BATCH_SUBMIT_FAIL#INVALID_FORMAT\n");
+        return;
+    }
+    if (items.size() > PRESCRIPTION_MAX_ITEMS) {
+        clientSocket->write("PRESCRIPTION_BATCH_SUBMIT_FAIL#TOO_MANY_ITEMS\n");
+        qDebug() << "处方明细过多:" << items.size() << "上限:" << PRESCRIPTION_MAX_ITEMS;
+        return;
+    }
+
+    QJsonObject payload = header;
+    payload.remove("idempotency_key");
+    QByteArray payloadHash = idempotencyPayloadHash(QJsonDocument(payload).toJson(QJsonDocument::Compact));
+    if (replayIdempotentResponse("SUBMIT_PRESCRIPTION_BATCH", idempotencyKey, payloadHash,
+                                 "PRESCRIPTION_BATCH_SUBMIT_FAIL#IDEMPOTENCY_KEY_REUSED\n", clientSocket)) {
         return;
     }
 
-    QString patientId = parts[1];
-    QString doctorId = parts[2];
-    QString medicineName = parts[3];
-    QString dosage = parts[4];
-    QString usage = parts[5];
-    QString frequency = parts[6];
-    QString quantityStr = parts[7];
-    QString notes = parts[8];
+    // 校验每条明细，同时收集需要查价的药品名
+    QStringList medicineNames;
+    for (const QJsonValue &value : items) {
+        QJsonObject item = value.toObject();
+        QString medicineName = item["medicine_name"].toString();
+        int quantity = item["quantity"].toInt();
+        if (medicineName.isEmpty() || quantity <= 0) {
+            clientSocket->write("PRESCRIPTION_BATCH_SUBMIT_FAIL#INVALID_ITEM\n");
+            qDebug() << "处方明细无效:" << medicineName << "数量:" << quantity;
+            return;
+        }
+        if (!medicineNames.contains(medicineName)) {
+            medicineNames.append(medicineName);
+        }
+    }
 
-    // 验证购买数量是否为有效整数
-    bool ok;
-    int quantity = quantityStr.toInt(&ok);
-    if (!ok || quantity <= 0) {
-        clientSocket->write("PRESCRIPTION_SUBMIT_FAIL#INVALID_QUANTITY\n");
-        qDebug() << "购买数量无效:" << quantityStr;
+    // 一次查询同时确认患者和医生存在
+    QSqlQuery checkQuery(m_db);
+    checkQuery.prepare("SELECT (SELECT COUNT(*) FROM patient WHERE id = :patient_id), "
+                       "(SELECT COUNT(*) FROM doctor WHERE id = :doctor_id)");
+    checkQuery.bindValue(":patient_id", patientId);
+    checkQuery.bindValue(":doctor_id", doctorId);
+    if (!checkQuery.exec() || !checkQuery.next()) {
+        clientSocket->write("PRESCRIPTION_BATCH_SUBMIT_FAIL#DB_ERROR\n");
+        qDebug() << "处方校验查询失败:" << checkQuery.lastError().text();
         return;
     }
-
-    qDebug() << "处方提交信息:";
-    qDebug() << "患者ID:" << patientId;
-    qDebug() << "医生ID:" << doctorId;
-    qDebug() << "药品名称:" << medicineName;
-    qDebug() << "剂量:" << dosage;
-    qDebug() << "用法:" << usage;
-    qDebug() << "频次:" << frequency;
-    qDebug() << "购买数量:" << quantity;
-    qDebug() << "备注:" << notes;
-
-    // 检查患者是否存在
-    QSqlQuery checkPatient(m_db);
-    checkPatient.prepare("SELECT COUNT(*) FROM patient WHERE id = :patient_id");
-    checkPatient.bindValue(":patient_id", patientId);
-    if (!checkPatient.exec() || !checkPatient.next() || checkPatient.value(0).toInt() == 0) {
-        clientSocket->write("PRESCRIPTION_SUBMIT_FAIL#PATIENT_NOT_FOUND\n");
+    if (checkQuery.value(0).toInt() == 0) {
+        clientSocket->write("PRESCRIPTION_BATCH_SUBMIT_FAIL#PATIENT_NOT_FOUND\n");
         qDebug() << "患者不存在:" << patientId;
         return;
     }
-
-    // 检查医生是否存在
-    QSqlQuery checkDoctor(m_db);
-    checkDoctor.prepare("SELECT COUNT(*) FROM doctor WHERE id = :doctor_id");
-    checkDoctor.bindValue(":doctor_id", doctorId);
-    if (!checkDoctor.exec() || !checkDoctor.next() || checkDoctor.value(0).toInt() == 0) {
-        clientSocket->write("PRESCRIPTION_SUBMIT_FAIL#DOCTOR_NOT_FOUND\n");
+    if (checkQuery.value(1).toInt() == 0) {
+        clientSocket->write("PRESCRIPTION_BATCH_SUBMIT_FAIL#DOCTOR_NOT_FOUND\n");
         qDebug() << "医生不存在:" << doctorId;
         return;
     }
 
-    QSqlQuery query(m_db);
-    query.prepare("INSERT INTO prescription (patient_id, doctor_id, medicine_name, dosage, usage, frequency, quantity, notes) "
-                  "VALUES (:patient_id, :doctor_id, :medicine_name, :dosage, :usage, :frequency, :quantity, :notes)");
-    query.bindValue(":patient_id", patientId);
-    query.bindValue(":doctor_id", doctorId);
-    query.bindValue(":medicine_name", medicineName);
-    query.bindValue(":dosage", dosage);
-    query.bindValue(":usage", usage);
-    query.bindValue(":frequency", frequency);
-    query.bindValue(":quantity", quantity);
-    query.bindValue(":notes", notes);
+    // 批量查价：一次 IN 查询取回所有药品价格，明细条数已限制在 PRESCRIPTION_MAX_ITEMS 以内
+    QMap<QString, double> medicinePrices;
+    QStringList placeholders;
+    for (int i = 0; i < medicineNames.size(); ++i) {
+        placeholders.append(QString(":name%1").arg(i));
+    }
+    QSqlQuery priceQuery(m_db);
+    priceQuery.prepare(QString("SELECT name, price FROM medicine WHERE name IN (%1)").arg(placeholders.join(", ")));
+    for (int i = 0; i < medicineNames.size(); ++i) {
+        priceQuery.bindValue(placeholders[i], medicineNames[i]);
+    }
+    if (priceQuery.exec()) {
+        while (priceQuery.next()) {
+            medicinePrices.insert(priceQuery.value("name").toString(), priceQuery.value("price").toDouble());
+        }
+    } else {
+        qDebug() << "批量查询药品价格失败:" << priceQuery.lastError().text();
+    }
 
-    if (query.exec()) {
-        int prescriptionId = query.lastInsertId().toInt();
-        
-        // 查询药品价格以计算处方费用 - 使用精确匹配
-        QSqlQuery medicineQuery(m_db);
-        medicineQuery.prepare("SELECT medicine_id, name, price, specification FROM medicine WHERE name = :medicine_name LIMIT 1");
-        medicineQuery.bindValue(":medicine_name", medicineName);
-        
-        double medicinePrice = 0.0;
-        QString medicineSpec = "";
-        int medicineId = 0;
-        
-        if (medicineQuery.exec() && medicineQuery.next()) {
-            medicineId = medicineQuery.value("medicine_id").toInt();
-            medicinePrice = medicineQuery.value("price").toDouble();
-            medicineSpec = medicineQuery.value("specification").toString();
-            qDebug() << "找到药品信息:" << medicineName << "价格:" << medicinePrice << "规格:" << medicineSpec;
-        } else {
-            // 如果精确匹配失败，尝试模糊匹配
-            QSqlQuery fuzzyQuery(m_db);
-            fuzzyQuery.prepare("SELECT medicine_id, name, price, specification FROM medicine WHERE name LIKE :medicine_pattern LIMIT 1");
-            fuzzyQuery.bindValue(":medicine_pattern", QString("%%%1%%").arg(medicineName));
-            
-            if (fuzzyQuery.exec() && fuzzyQuery.next()) {
-                medicineId = fuzzyQuery.value("medicine_id").toInt();
-                medicinePrice = fuzzyQuery.value("price").toDouble();
-                medicineSpec = fuzzyQuery.value("specification").toString();
-                qDebug() << "模糊匹配找到药品:" << fuzzyQuery.value("name").toString() << "价格:" << medicinePrice;
-            } else {
-                // 如果都找不到，记录错误并使用默认价格
-                qDebug() << "警告：药品价格未找到 -" << medicineName << "，使用默认价格";
-                medicinePrice = 15.0; // 提高默认价格到15元
-            }
+    // 精确匹配不到的药品再做模糊匹配，仍找不到则使用默认价格
+    for (const QString &medicineName : medicineNames) {
+        if (medicinePrices.contains(medicineName)) {
+            continue;
         }
-        
-        // 验证价格的合理性
-        if (medicinePrice <= 0) {
-            qDebug() << "药品价格异常，使用默认价格:" << medicinePrice << "→ 15.0";
-            medicinePrice = 15.0;
+        double price = 15.0;
+        QSqlQuery fuzzyQuery(m_db);
+        fuzzyQuery.prepare("SELECT name, price FROM medicine WHERE name LIKE :medicine_pattern LIMIT 1");
+        fuzzyQuery.bindValue(":medicine_pattern", QString("%%%1%%").arg(medicineName));
+        if (fuzzyQuery.exec() && fuzzyQuery.next()) {
+            price = fuzzyQuery.value("price").toDouble();
+            qDebug() << "模糊匹配找到药品:" << fuzzyQuery.value("name").toString() << "价格:" << price;
+        } else {
+            qDebug() << "警告：药品价格未找到 -" << medicineName << "，使用默认价格";
         }
-        
-        // 计算总费用 = 药品单价 * 购买数量
-        double totalCost = medicinePrice * quantity;
-        
-        // 开始事务确保数据一致性
-        m_db.transaction();
-        
-        try {
-            // 自动添加处方费用到缴费项目
-            QSqlQuery paymentQuery(m_db);
-            paymentQuery.prepare("INSERT INTO payment_items "
-                               "(patient_id, description, amount, status, type, application_id, created_at) "
-                               "VALUES (:patient_id, :description, :amount, :status, :type, :application_id, :created_at)");
-            
-            QString description = QString("处方费用 - %1 (数量:%2)").arg(medicineName).arg(quantity);
-            QString prescriptionRef = QString("PRESC_%1").arg(prescriptionId);
-            QString currentTime = QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
-            
-            paymentQuery.bindValue(":patient_id", patientId);
-            paymentQuery.bindValue(":description", description);
-            paymentQuery.bindValue(":amount", totalCost);
-            paymentQuery.bindValue(":status", "pending");
-            paymentQuery.bindValue(":type", "prescription");
-            paymentQuery.bindValue(":application_id", prescriptionRef);
-            paymentQuery.bindValue(":created_at", currentTime);
-            
-            if (!paymentQuery.exec()) {
-                throw std::runtime_error("缴费项目添加失败");
+        medicinePrices.insert(medicineName, price);
+    }
+
+    MonotonicClock::Timestamp writeTime = m_clock.now();
+    QString currentTime = writeTime.toLocalString();
+
+    // 记录写入前的版本号，提交后只推送变更的行
+    qint64 prescriptionVersion = currentEntityVersion("prescription");
+    qint64 paymentVersion = currentEntityVersion("payment_items");
+
+    m_db.transaction();
+
+    try {
+        QSqlQuery insertQuery(m_db);
+        insertQuery.prepare("INSERT INTO prescription (patient_id, doctor_id, medicine_name, dosage, usage, frequency, quantity, notes, prescribed_date) "
+                            "VALUES (:patient_id, :doctor_id, :medicine_name, :dosage, :usage, :frequency, :quantity, :notes, :prescribed_date)");
+
+        QStringList prescriptionIds;
+        QStringList descriptionParts;
+        double totalCost = 0.0;
+
+        for (const QJsonValue &value : items) {
+            QJsonObject item = value.toObject();
+            QString medicineName = item["medicine_name"].toString();
+            int quantity = item["quantity"].toInt();
+
+            insertQuery.bindValue(":patient_id", patientId);
+            insertQuery.bindValue(":doctor_id", doctorId);
+            insertQuery.bindValue(":medicine_name", medicineName);
+            insertQuery.bindValue(":dosage", item["dosage"].toString());
+            insertQuery.bindValue(":usage", item["usage"].toString());
+            insertQuery.bindValue(":frequency", item["frequency"].toString());
+            insertQuery.bindValue(":quantity", quantity);
+            insertQuery.bindValue(":notes", item["notes"].toString());
+            insertQuery.bindValue(":prescribed_date", writeTime.toLocalString());
+
+            if (!insertQuery.exec()) {
+                qDebug() << "处方明细插入失败:" << insertQuery.lastError().text();
+                throw std::runtime_error("处方插入失败");
             }
-            
-            // 在缴费记录表中插入待支付记录
-            QSqlQuery recordQuery(m_db);
-            recordQuery.prepare("INSERT INTO payment_records "
-                              "(patient_id, total_amount, payment_time, payment_method) "
-                              "VALUES (:patient_id, :total_amount, :payment_time, :payment_method)");
-            recordQuery.bindValue(":patient_id", patientId);
-            recordQuery.bindValue(":total_amount", totalCost);
-            recordQuery.bindValue(":payment_time", currentTime);
-            recordQuery.bindValue(":payment_method", "待支付");
-            
-            if (!recordQuery.exec()) {
-                throw std::runtime_error("缴费记录添加失败");
+
+            prescriptionIds.append(insertQuery.lastInsertId().toString());
+            descriptionParts.append(QString("%1×%2").arg(medicineName).arg(quantity));
+
+            double price = medicinePrices.value(medicineName, 15.0);
+            if (price <= 0) {
+                price = 15.0;
             }
-            
-            // 提交事务
-            m_db.commit();
-            
-            qDebug() << "处方缴费项目和记录添加成功，费用:" << totalCost;
-            
-        } catch (const std::exception &e) {
-            m_db.rollback();
-            qDebug() << "处方缴费处理失败:" << e.what();
+            totalCost += price * quantity;
         }
-        
-        QString response = QString("PRESCRIPTION_SUBMIT_SUCCESS#%1").arg(prescriptionId);
-        clientSocket->write(response.toUtf8() + "\n");
-        qDebug() << "处方提交成功，ID:" << prescriptionId << "费用:" << totalCost;
 
-        // 发送处方更新通知给患者端
-        QString notificationMessage = QString("PRESCRIPTION_UPDATE#%1").arg(patientId);
-        broadcastMessage(patientId, notificationMessage);
-    } else {
-        clientSocket->write("PRESCRIPTION_SUBMIT_FAIL#DB_ERROR\n");
-        qDebug() << "处方提交失败:" << query.lastError().text();
+        // 整张处方只生成一个合并的缴费项目，application_id 为 PRESC_ 加逗号分隔的处方ID
+        QString prescriptionRef = "PRESC_" + prescriptionIds.join(",");
+        QString description = QString("处方费用 - %1").arg(descriptionParts.join("、"));
+
+        QSqlQuery paymentQuery(m_db);
+        paymentQuery.prepare("INSERT INTO payment_items "
+                             "(patient_id, description, amount, status, type, application_id, created_at) "
+                             "VALUES (:patient_id, :description, :amount, :status, :type, :application_id, :created_at)");
+        paymentQuery.bindValue(":patient_id", patientId);
+        paymentQuery.bindValue(":description", description);
+        paymentQuery.bindValue(":amount", totalCost);
+        paymentQuery.bindValue(":status", "pending");
+        paymentQuery.bindValue(":type", "prescription");
+        paymentQuery.bindValue(":application_id", prescriptionRef);
+        paymentQuery.bindValue(":created_at", currentTime);
+
+        if (!paymentQuery.exec()) {
+            throw std::runtime_error("缴费项目添加失败");
+        }
+
+        // 在缴费记录表中插入待支付记录
+        QSqlQuery recordQuery(m_db);
+        recordQuery.prepare("INSERT INTO payment_records "
+                            "(patient_id, total_amount, payment_time, payment_method) "
+                            "VALUES (:patient_id, :total_amount, :payment_time, :payment_method)");
+        recordQuery.bindValue(":patient_id", patientId);
+        recordQuery.bindValue(":total_amount", totalCost);
+        recordQuery.bindValue(":payment_time", currentTime);
+        recordQuery.bindValue(":payment_method", "待支付");
+
+        if (!recordQuery.exec()) {
+            throw std::runtime_error("缴费记录添加失败");
+        }
+
+        QJsonObject result;
+        QJsonArray idArray;
+        for (const QString &id : prescriptionIds) {
+            idArray.append(id.toInt());
+        }
+        result["prescription_ids"] = idArray;
+        result["application_id"] = prescriptionRef;
+        result["total_amount"] = totalCost;
+        QByteArray response = "PRESCRIPTION_BATCH_SUBMIT_SUCCESS#" + QJsonDocument(result).toJson(QJsonDocument::Compact) + "\n";
+
+        if (!saveIdempotentResponse("SUBMIT_PRESCRIPTION_BATCH", idempotencyKey, payloadHash, response)) {
+            throw std::runtime_error("幂等键记录失败");
+        }
+
+        if (!m_db.commit()) {
+            throw std::runtime_error("事务提交失败");
+        }
+        cacheIdempotentResponse("SUBMIT_PRESCRIPTION_BATCH", idempotencyKey, payloadHash, response);
+
+        clientSocket->write(response);
+        qDebug() << "多药品处方提交成功，处方ID:" << prescriptionIds << "合计费用:" << totalCost;
+
+        // 向患者端推送变更的处方和缴费项目
+        pushPrescriptionChanges(patientId, prescriptionVersion);
+        pushPaymentItemChanges(patientId, paymentVersion);
+
+    } catch (const std::exception &e) {
+        m_db.rollback();
+        clientSocket->write("PRESCRIPTION_BATCH_SUBMIT_FAIL#DB_ERROR\n");
+        qDebug() << "多药品处方提交失败:" << e.what();
     }
 }
 
@@ -2158,53 +4181,75 @@ void Server::handleGetPatientPrescriptions(const QString &message, QTcpSocket *c
         return;
     }
 
-    // 请求格式: GET_PATIENT_PRESCRIPTIONS#patient_id
+    // 请求格式: GET_PATIENT_PRESCRIPTIONS#patient_id[#since_version]
+    // 携带 since_version 时只返回版本号更大的行，响应为 PRESCRIPTION_DELTA#<json数组>
     QStringList parts = message.split("#");
-    if (parts.size() != 2) {
+    if (parts.size() != 2 && parts.size() != 3) {
         clientSocket->write("PRESCRIPTION_LIST_FAIL#INVALID_FORMAT\n");
         return;
     }
 
     QString patientId = parts[1];
+    bool isDelta = parts.size() == 3;
+    qint64 sinceVersion = isDelta ? parts[2].toLongLong() : 0;
+
+    bool ok = false;
+    QJsonArray prescriptionsArray = prescriptionRows(patientId, sinceVersion, &ok);
+    if (!ok) {
+        clientSocket->write("PRESCRIPTION_LIST_FAIL#DB_ERROR\n");
+        return;
+    }
+
+    QJsonDocument doc(prescriptionsArray);
+    QString response = (isDelta ? "PRESCRIPTION_DELTA#" : "PRESCRIPTION_LIST_SUCCESS#") + doc.toJson(QJsonDocument::Compact);
+    clientSocket->write(response.toUtf8() + "\n");
+    qDebug() << "发送患者处方列表，共" << prescriptionsArray.size() << "条记录" << (isDelta ? "(增量)" : "");
+}
+
+// 查询患者处方（sinceVersion 大于0时只查变更的行）
+QJsonArray Server::prescriptionRows(const QString &patientId, qint64 sinceVersion, bool *ok)
+{
+    QJsonArray prescriptionsArray;
 
     QSqlQuery query(m_db);
     query.prepare("SELECT p.prescription_id, p.medicine_name, p.dosage, p.usage, p.frequency, p.quantity, p.notes, "
-                  "p.prescribed_date, p.status, u.real_name as doctor_name, d.department "
+                  "p.prescribed_date, p.status, p.version, u.real_name as doctor_name, d.department "
                   "FROM prescription p "
                   "LEFT JOIN doctor d ON p.doctor_id = d.id "
                   "LEFT JOIN user u ON p.doctor_id = u.id "
-                  "WHERE p.patient_id = :patient_id "
+                  "WHERE p.patient_id = :patient_id AND p.version > :since_version "
                   "ORDER BY p.prescribed_date DESC");
     query.bindValue(":patient_id", patientId);
+    query.bindValue(":since_version", sinceVersion);
 
-    if (query.exec()) {
-        QJsonArray prescriptionsArray;
-        while (query.next()) {
-            QJsonObject prescription;
-            prescription["prescription_id"] = query.value("prescription_id").toInt();
-            prescription["medicine_name"] = query.value("medicine_name").toString();
-            prescription["dosage"] = query.value("dosage").toString();
-            prescription["usage"] = query.value("usage").toString();
-            prescription["frequency"] = query.value("frequency").toString();
-            prescription["quantity"] = query.value("quantity").toInt();
-            prescription["notes"] = query.value("notes").toString();
-            prescription["prescribed_date"] = query.value("prescribed_date").toString();
-            prescription["status"] = query.value("status").toString();
-            prescription["doctor_name"] = query.value("doctor_name").toString();
-            prescription["department"] = query.value("department").toString();
-
-            prescriptionsArray.append(prescription);
-        }
-
-        QJsonDocument doc(prescriptionsArray);
-        QString response = "PRESCRIPTION_LIST_SUCCESS#" + doc.toJson(QJsonDocument::Compact);
-        clientSocket->write(response.toUtf8() + "\n");
-        qDebug() << "发送患者处方列表，共" << prescriptionsArray.size() << "条记录";
-    } else {
-        clientSocket->write("PRESCRIPTION_LIST_FAIL#DB_ERROR\n");
+    if (!query.exec()) {
         qDebug() << "患者处方查询失败:" << query.lastError().text();
-    }
+        if (ok) *ok = false;
+        return prescriptionsArray;
+    }
+
+    while (query.next()) {
+        QJsonObject prescription;
+        prescription["prescription_id"] = query.value("prescription_id").toInt();
+        prescription["medicine_name"] = query.value("medicine_name").toString();
+        prescription["dosage"] = query.value("dosage").toString();
+        prescription["usage"] = query.value("usage").toString();
+        prescription["frequency"] = query.value("frequency").toString();
+        prescription["quantity"] = query.value("quantity").toInt();
+        prescription["notes"] = query.value("notes").toString();
+        prescription["prescribed_date"] = query.value("prescribed_date").toString();
+        prescription["status"] = query.value("status").toString();
+        prescription["version"] = query.value("version").toLongLong();
+        prescription["doctor_name"] = query.value("doctor_name").toString();
+        prescription["department"] = query.value("department").toString();
+
+        prescriptionsArray.append(prescription);
+    }
+
+    if (ok) *ok = true;
+    return prescriptionsArray;
 }
+
 // 处理住院申请
 void Server::handleHospitalizationApply(const QString &message, QTcpSocket *clientSocket)
 {
@@ -2225,8 +4270,14 @@ void Server::handleHospitalizationApply(const QString &message, QTcpSocket *clie
 
     QJsonObject application = doc.object();
 
-    // 生成住院申请ID
-    QString applicationId = "HOSP" + QDateTime::currentDateTime().toString("yyyyMMddhhmmsszzz");
+    // 生成住院申请ID：HOSP + 日期 + 6位递增序号，按时间有序且不会因同一毫秒并发而重复
+    qint64 sequence = m_idAllocator.next("HOSP");
+    if (sequence < 0) {
+        clientSocket->write("HOSPITALIZATION_APPLY_FAIL#DB_ERROR\n");
+        return;
+    }
+    QString applicationId = "HOSP" + m_clock.now().toLocalString().left(10).remove('-')
+                            + QString::number(sequence).rightJustified(6, '0');
 
     // 插入住院申请到数据库
     QSqlQuery query(m_db);
@@ -2319,6 +4370,7 @@ void Server::handleAddPaymentItem(const QString &message, QTcpSocket *clientSock
     }
 
     QJsonObject paymentItem = doc.object();
+    qint64 paymentVersion = currentEntityVersion("payment_items");
 
     // 插入缴费项目到数据库
     QSqlQuery query(m_db);
@@ -2339,6 +4391,7 @@ void Server::handleAddPaymentItem(const QString &message, QTcpSocket *clientSock
 
     if (query.exec()) {
         clientSocket->write("ADD_PAYMENT_ITEM_SUCCESS\n");
+        pushPaymentItemChanges(paymentItem["patient_id"].toString(), paymentVersion);
         qDebug() << "缴费项目添加成功:" << paymentItem["description"].toString();
     } else {
         clientSocket->write("ADD_PAYMENT_ITEM_FAIL#DB_ERROR\n");
@@ -2355,39 +4408,91 @@ void Server::handleGetPaymentItems(const QString &message, QTcpSocket *clientSoc
         return;
     }
 
-    // 消息格式: GET_PAYMENT_ITEMS#<患者ID>
-    QString patientId = message.section('#', 1);
+    // 消息格式: GET_PAYMENT_ITEMS#<患者ID>[#since_version]
+    // 携带 since_version 时只返回版本号更大的行，响应为 PAYMENT_ITEMS_DELTA#<json数组>
+    QString patientId = message.section('#', 1, 1);
+    QString sinceStr = message.section('#', 2, 2);
+    bool isDelta = !sinceStr.isEmpty();
+
+    bool ok = false;
+    QJsonArray itemsArray = paymentItemRows(patientId, sinceStr.toLongLong(), &ok);
+    if (!ok) {
+        clientSocket->write("GET_PAYMENT_ITEMS_FAIL#DB_ERROR\n");
+        return;
+    }
+
+    QJsonDocument doc(itemsArray);
+    QString response = (isDelta ? "PAYMENT_ITEMS_DELTA#" : "GET_PAYMENT_ITEMS_SUCCESS#") + doc.toJson(QJsonDocument::Compact);
+    clientSocket->write(response.toUtf8() + "\n");
+    qDebug() << "发送缴费项目数据给患者:" << patientId << "，共" << itemsArray.size() << "项" << (isDelta ? "(增量)" : "");
+}
+
+// 查询患者缴费项目（sinceVersion 大于0时只查变更的行）
+QJsonArray Server::paymentItemRows(const QString &patientId, qint64 sinceVersion, bool *ok)
+{
+    QJsonArray itemsArray;
 
     QSqlQuery query(m_db);
-    query.prepare("SELECT item_id, description, amount, created_at, paid_at, status, type, application_id "
-                  "FROM payment_items WHERE patient_id = :patient_id "
+    query.prepare("SELECT item_id, description, amount, created_at, paid_at, status, type, application_id, version "
+                  "FROM payment_items WHERE patient_id = :patient_id AND version > :since_version "
                   "ORDER BY created_at DESC");
     query.bindValue(":patient_id", patientId);
+    query.bindValue(":since_version", sinceVersion);
 
-    if (query.exec()) {
-        QJsonArray itemsArray;
+    if (!query.exec()) {
+        qDebug() << "获取缴费项目失败:" << query.lastError().text();
+        if (ok) *ok = false;
+        return itemsArray;
+    }
 
-        while (query.next()) {
-            QJsonObject item;
-            item["item_id"] = query.value("item_id").toInt();
-            item["description"] = query.value("description").toString();
-            item["amount"] = query.value("amount").toDouble();
-            item["created_at"] = query.value("created_at").toString();
-            item["paid_at"] = query.value("paid_at").toString();
-            item["status"] = query.value("status").toString();
-            item["type"] = query.value("type").toString();
-            item["application_id"] = query.value("application_id").toString();
+    while (query.next()) {
+        QJsonObject item;
+        item["item_id"] = query.value("item_id").toInt();
+        item["description"] = query.value("description").toString();
+        item["amount"] = query.value("amount").toDouble();
+        item["created_at"] = query.value("created_at").toString();
+        item["paid_at"] = query.value("paid_at").toString();
+        item["status"] = query.value("status").toString();
+        item["type"] = query.value("type").toString();
+        item["application_id"] = query.value("application_id").toString();
+        item["version"] = query.value("version").toLongLong();
 
-            itemsArray.append(item);
-        }
+        itemsArray.append(item);
+    }
 
-        QJsonDocument doc(itemsArray);
-        QString response = "GET_PAYMENT_ITEMS_SUCCESS#" + doc.toJson(QJsonDocument::Compact);
-        clientSocket->write(response.toUtf8() + "\n");
-        qDebug() << "发送缴费项目数据给患者:" << patientId << "，共" << itemsArray.size() << "项";
-    } else {
-        clientSocket->write("GET_PAYMENT_ITEMS_FAIL#DB_ERROR\n");
-        qDebug() << "获取缴费项目失败:" << query.lastError().text();
+    if (ok) *ok = true;
+    return itemsArray;
+}
+
+// 读取某类实体当前的版本号
+qint64 Server::currentEntityVersion(const QString &entity)
+{
+    QSqlQuery query(m_db);
+    query.prepare("SELECT version FROM entity_version WHERE entity = :entity");
+    query.bindValue(":entity", entity);
+    if (query.exec() && query.next()) {
+        return query.value(0).toLongLong();
+    }
+    return 0;
+}
+
+// 把 sinceVersion 之后变更的处方行推送给患者
+void Server::pushPrescriptionChanges(const QString &patientId, qint64 sinceVersion)
+{
+    bool ok = false;
+    QJsonArray rows = prescriptionRows(patientId, sinceVersion, &ok);
+    if (ok && !rows.isEmpty()) {
+        broadcastMessage(patientId, "PRESCRIPTION_DELTA#" + QJsonDocument(rows).toJson(QJsonDocument::Compact));
+    }
+}
+
+// 把 sinceVersion 之后变更的缴费项目推送给患者
+void Server::pushPaymentItemChanges(const QString &patientId, qint64 sinceVersion)
+{
+    bool ok = false;
+    QJsonArray rows = paymentItemRows(patientId, sinceVersion, &ok);
+    if (ok && !rows.isEmpty()) {
+        broadcastMessage(patientId, "PAYMENT_ITEMS_DELTA#" + QJsonDocument(rows).toJson(QJsonDocument::Compact));
     }
 }
 
@@ -2412,11 +4517,26 @@ void Server::handleProcessPayment(const QString &message, QTcpSocket *clientSock
     QJsonObject payment = doc.object();
     QString patientId = payment["patient_id"].toString();
     QString paymentMethod = payment["payment_method"].toString();
+
+    // 可选的幂等键：客户端超时重试时携带同一个键，已处理过的支付直接回放原响应，避免重复扣费
+    // 成功响应末尾带回幂等键，客户端据此丢弃同一次支付迟到的重复响应
+    QString idempotencyKey = payment["idempotency_key"].toString();
+    QJsonObject payload = payment;
+    payload.remove("idempotency_key");
+    QByteArray payloadHash = idempotencyPayloadHash(QJsonDocument(payload).toJson(QJsonDocument::Compact));
+    if (replayIdempotentResponse("PROCESS_PAYMENT", idempotencyKey, payloadHash,
+                                 "PROCESS_PAYMENT_FAIL#IDEMPOTENCY_KEY_REUSED\n", clientSocket)) {
+        return;
+    }
+
+    // 记录写入前的版本号，支付完成后只推送变更的行
+    qint64 prescriptionVersion = currentEntityVersion("prescription");
+    qint64 paymentVersion = currentEntityVersion("payment_items");
     
     // 检查是否是单个项目支付（通过 application_id）
     if (payment.contains("application_id")) {
         QString applicationId = payment["application_id"].toString();
-        QString currentTime = QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
+        QString currentTime = m_clock.now().toLocalString();
         
         // 开始事务
         m_db.transaction();
@@ -2462,13 +4582,14 @@ void Server::handleProcessPayment(const QString &message, QTcpSocket *clientSock
                 }
                 qDebug() << "预约支付完成，预约ID:" << appointmentId << "状态更新为已确认";
             } else if (applicationId.startsWith("PRESC_")) {
-                // 更新处方状态（可选）
-                QString prescriptionId = applicationId.mid(6);
+                // 更新处方状态（可选），多药品处方的 application_id 为 PRESC_id1,id2,...
                 QSqlQuery prescQuery(m_db);
                 prescQuery.prepare("UPDATE prescription SET status = 'paid' WHERE prescription_id = :prescription_id");
-                prescQuery.bindValue(":prescription_id", prescriptionId.toInt());
-                prescQuery.exec(); // 不强制要求成功，因为原始prescription表可能没有status字段
-                qDebug() << "处方支付完成，处方ID:" << prescriptionId;
+                for (const QString &prescriptionId : applicationId.mid(6).split(',', Qt::SkipEmptyParts)) {
+                    prescQuery.bindValue(":prescription_id", prescriptionId.toInt());
+                    prescQuery.exec(); // 不强制要求成功，因为原始prescription表可能没有status字段
+                }
+                qDebug() << "处方支付完成，处方ID:" << applicationId.mid(6);
             } else if (applicationId.startsWith("HOSP_")) {
                 // 更新住院申请状态
                 QString hospId = applicationId.mid(5);
@@ -2495,11 +4616,21 @@ void Server::handleProcessPayment(const QString &message, QTcpSocket *clientSock
                 throw std::runtime_error("添加支付记录失败");
             }
             
-            // 提交事务
-            m_db.commit();
-            
             QString paymentId = recordQuery.lastInsertId().toString();
-            clientSocket->write(QString("PROCESS_PAYMENT_SUCCESS#%1\n").arg(paymentId).toUtf8());
+            QByteArray response = QString("PROCESS_PAYMENT_SUCCESS#%1#%2\n").arg(paymentId, idempotencyKey).toUtf8();
+            if (!saveIdempotentResponse("PROCESS_PAYMENT", idempotencyKey, payloadHash, response)) {
+                throw std::runtime_error("幂等键记录失败");
+            }
+
+            // 提交事务
+            if (!m_db.commit()) {
+                throw std::runtime_error("事务提交失败");
+            }
+            cacheIdempotentResponse("PROCESS_PAYMENT", idempotencyKey, payloadHash, response);
+
+            clientSocket->write(response);
+            pushPaymentItemChanges(patientId, paymentVersion);
+            pushPrescriptionChanges(patientId, prescriptionVersion);
             qDebug() << "单项支付处理成功:" << patientId << "-" << amount << "-" << description;
             
         } catch (const std::exception &e) {
@@ -2565,13 +4696,15 @@ void Server::handleProcessPayment(const QString &message, QTcpSocket *clientSock
                 }
                 // 处理处方费用
                 else if (applicationId.startsWith("PRESC_")) {
-                    QString prescriptionId = applicationId.mid(6); // 移除 "PRESC_" 前缀
+                    QString prescriptionIds = applicationId.mid(6); // 移除 "PRESC_" 前缀，多药品处方为逗号分隔的ID
                     // 处方支付完成后可以更新处方状态为已支付（如果需要）
                     QSqlQuery prescQuery(m_db);
                     prescQuery.prepare("UPDATE prescription SET status = 'paid' WHERE prescription_id = :prescription_id");
-                    prescQuery.bindValue(":prescription_id", prescriptionId.toInt());
-                    prescQuery.exec(); // 这个更新是可选的，不影响主流程
-                    qDebug() << "处方支付完成，处方ID:" << prescriptionId;
+                    for (const QString &prescriptionId : prescriptionIds.split(',', Qt::SkipEmptyParts)) {
+                        prescQuery.bindValue(":prescription_id", prescriptionId.toInt());
+                        prescQuery.exec(); // 这个更新是可选的，不影响主流程
+                    }
+                    qDebug() << "处方支付完成，处方ID:" << prescriptionIds;
                 }
             }
             // 兼容旧版本的预约状态更新逻辑
@@ -2606,12 +4739,22 @@ void Server::handleProcessPayment(const QString &message, QTcpSocket *clientSock
             throw std::runtime_error("添加支付记录失败");
         }
 
+        QString paymentId = recordQuery.lastInsertId().toString();
+        QByteArray response = QString("PROCESS_PAYMENT_SUCCESS#%1#%2\n").arg(paymentId, idempotencyKey).toUtf8();
+        if (!saveIdempotentResponse("PROCESS_PAYMENT", idempotencyKey, payloadHash, response)) {
+            throw std::runtime_error("幂等键记录失败");
+        }
+
         // 提交事务
-        m_db.commit();
+        if (!m_db.commit()) {
+            throw std::runtime_error("事务提交失败");
+        }
+        cacheIdempotentResponse("PROCESS_PAYMENT", idempotencyKey, payloadHash, response);
 
         // 发送成功响应
-        QString paymentId = recordQuery.lastInsertId().toString();
-        clientSocket->write(QString("PROCESS_PAYMENT_SUCCESS#%1\n").arg(paymentId).toUtf8());
+        clientSocket->write(response);
+        pushPaymentItemChanges(patientId, paymentVersion);
+        pushPrescriptionChanges(patientId, prescriptionVersion);
         qDebug() << "支付处理成功:" << patientId << "-" << totalAmount;
 
     } catch (const std::exception &e) {
@@ -2635,6 +4778,7 @@ void Server::handleGetPaymentRecords(const QString &message, QTcpSocket *clientS
     QString patientId = message.section('#', 1);
 
     QSqlQuery query(m_db);
+    query.setForwardOnly(true);
     query.prepare("SELECT description, amount, paid_at, 'online_payment' as payment_method "
                   "FROM payment_items "
                   "WHERE patient_id = :patient_id AND status = 'paid' "
@@ -2642,22 +4786,14 @@ void Server::handleGetPaymentRecords(const QString &message, QTcpSocket *clientS
     query.bindValue(":patient_id", patientId);
 
     if (query.exec()) {
-        QJsonArray recordsArray;
-
-        while (query.next()) {
-            QJsonObject record;
-            record["description"] = query.value("description").toString();
-            record["amount"] = query.value("amount").toDouble();
-            record["paid_at"] = query.value("paid_at").toString();
-            record["payment_method"] = query.value("payment_method").toString();
-
-            recordsArray.append(record);
-        }
-
-        QJsonDocument doc(recordsArray);
-        QString response = "GET_PAYMENT_RECORDS_SUCCESS#" + doc.toJson(QJsonDocument::Compact);
-        clientSocket->write(response.toUtf8() + "\n");
-        qDebug() << "发送缴费记录数据给患者:" << patientId;
+        streamRows(clientSocket, std::move(query), "GET_PAYMENT_RECORDS_SUCCESS#", "\n",
+                   QString("发送缴费记录数据给患者: %1").arg(patientId),
+                   [](const QSqlQuery &row, RowWriter &writer) {
+            writer.addString("description", row.value(0).toString());
+            writer.addNumber("amount", row.value(1).toDouble());
+            writer.addString("paid_at", row.value(2).toString());
+            writer.addString("payment_method", row.value(3).toString());
+        });
     } else {
         clientSocket->write("GET_PAYMENT_RECORDS_FAIL#DB_ERROR\n");
         qDebug() << "获取缴费记录失败:" << query.lastError().text();
@@ -2715,7 +4851,7 @@ void Server::handleMakeAppointment(const QString &message, QTcpSocket *clientSoc
         return;
     }
 
-    // 消息格式: MAKE_APPOINTMENT#patientId#doctorId#appointmentDate
+    // 消息格式: MAKE_APPOINTMENT#patientId#doctorId#appointmentDate[#idempotencyKey]
     QStringList parts = message.split('#');
     if (parts.size() < 4) {
         clientSocket->write("MAKE_APPOINTMENT_FAIL#INVALID_FORMAT\n");
@@ -2726,6 +4862,16 @@ void Server::handleMakeAppointment(const QString &message, QTcpSocket *clientSoc
     QString doctorId = parts[2];
     QString appointmentDate = parts[3];
 
+    // 可选的幂等键：同一键的重试直接回放首次成功的响应，避免重复占号和重复生成挂号费
+    QString idempotencyKey = parts.size() > 4 ? parts[4] : QString();
+    QByteArray payloadHash = idempotencyPayloadHash(parts.mid(1, 3).join('#').toUtf8());
+    if (replayIdempotentResponse("MAKE_APPOINTMENT", idempotencyKey, payloadHash,
+                                 "MAKE_APPOINTMENT_FAIL#IDEMPOTENCY_KEY_REUSED\n", clientSocket)) {
+        return;
+    }
+
+    qint64 paymentVersion = currentEntityVersion("payment_items");
+
     // 开始事务
     m_db.transaction();
 
@@ -2784,7 +4930,7 @@ void Server::handleMakeAppointment(const QString &message, QTcpSocket *clientSoc
 
         QString description = QString("预约挂号费 - %1医生 (科室:%2)").arg(doctorName).arg(department.isEmpty() ? "未知科室" : department);
         QString appointmentRef = QString("APPT_%1").arg(appointmentId);
-        QString currentTime = QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
+        QString currentTime = m_clock.now().toLocalString();
         
         paymentQuery.bindValue(":patient_id", patientId);
         paymentQuery.bindValue(":description", description);
@@ -2803,10 +4949,19 @@ void Server::handleMakeAppointment(const QString &message, QTcpSocket *clientSoc
             throw std::runtime_error("PAYMENT_ITEM_ERROR");
         }
 
+        QByteArray response = QString("MAKE_APPOINTMENT_SUCCESS#%1#%2#%3\n").arg(appointmentId).arg(doctorId).arg(registrationFee).toUtf8();
+        if (!saveIdempotentResponse("MAKE_APPOINTMENT", idempotencyKey, payloadHash, response)) {
+            throw std::runtime_error("DB_ERROR");
+        }
+
         // 提交事务
-        m_db.commit();
+        if (!m_db.commit()) {
+            throw std::runtime_error("DB_ERROR");
+        }
+        cacheIdempotentResponse("MAKE_APPOINTMENT", idempotencyKey, payloadHash, response);
 
-        clientSocket->write(QString("MAKE_APPOINTMENT_SUCCESS#%1#%2#%3\n").arg(appointmentId).arg(doctorId).arg(registrationFee).toUtf8());
+        clientSocket->write(response);
+        pushPaymentItemChanges(patientId, paymentVersion);
         qDebug() << "预约成功:" << patientId << "预约了医生" << doctorId << "，费用:" << registrationFee;
 
     } catch (const std::exception &e) {
@@ -2863,3 +5018,86 @@ void Server::handleGetUserAppointments(const QString &message, QTcpSocket *clien
         clientSocket->write("GET_USER_APPOINTMENTS_FAIL\n");
     }
 }
+
+// 幂等键绑定的请求内容摘要（不含幂等键本身）
+QByteArray Server::idempotencyPayloadHash(const QByteArray &payload)
+{
+    return QCryptographicHash::hash(payload, QCryptographicHash::Sha256).toHex();
+}
+
+// 查找幂等键：先查内存缓存，再查数据库；内容一致则回放首次成功的响应，内容不同则回复 mismatchResponse
+// 返回 true 表示请求已处理完毕
+bool Server::replayIdempotentResponse(const QString &requestType, const QString &idempotencyKey, const QByteArray &payloadHash,
+                                      const QByteArray &mismatchResponse, QTcpSocket *clientSocket)
+{
+    if (idempotencyKey.isEmpty()) {
+        return false;
+    }
+
+    QString cacheKey = requestType + "#" + idempotencyKey;
+    IdempotentResponse *entry = m_idempotencyCache.object(cacheKey);
+    if (!entry) {
+        QSqlQuery query(m_db);
+        query.prepare("SELECT payload_hash, response FROM idempotency_key WHERE idem_key = :idem_key AND request_type = :request_type");
+        query.bindValue(":idem_key", idempotencyKey);
+        query.bindValue(":request_type", requestType);
+
+        if (!query.exec()) {
+            qDebug() << "查询幂等键失败:" << query.lastError().text();
+            return false;
+        }
+
+        if (!query.next()) {
+            return false;
+        }
+
+        entry = new IdempotentResponse{query.value("payload_hash").toByteArray(), query.value("response").toByteArray()};
+        m_idempotencyCache.insert(cacheKey, entry);
+        entry = m_idempotencyCache.object(cacheKey);
+        if (!entry) {
+            return false;
+        }
+    }
+
+    if (entry->payloadHash != payloadHash) {
+        clientSocket->write(mismatchResponse);
+        qDebug() << "幂等键被用于不同的请求内容，拒绝:" << cacheKey;
+        return true;
+    }
+
+    clientSocket->write(entry->response);
+    qDebug() << "重复请求，回放已保存响应:" << cacheKey;
+    return true;
+}
+
+// 记录幂等键、请求内容摘要和响应，需在业务事务内调用，随业务数据一起提交或回滚
+bool Server::saveIdempotentResponse(const QString &requestType, const QString &idempotencyKey, const QByteArray &payloadHash, const QByteArray &response)
+{
+    if (idempotencyKey.isEmpty()) {
+        return true;
+    }
+
+    QSqlQuery query(m_db);
+    query.prepare("INSERT INTO idempotency_key (idem_key, request_type, payload_hash, response, created_at) "
+                  "VALUES (:idem_key, :request_type, :payload_hash, :response, :created_at)");
+    query.bindValue(":idem_key", idempotencyKey);
+    query.bindValue(":request_type", requestType);
+    query.bindValue(":payload_hash", QString::fromLatin1(payloadHash));
+    query.bindValue(":response", response);
+    query.bindValue(":created_at", m_clock.now().toLocalString());
+
+    if (!query.exec()) {
+        qDebug() << "记录幂等键失败:" << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+// 事务提交成功后放入内存缓存，后续重试无需访问数据库
+void Server::cacheIdempotentResponse(const QString &requestType, const QString &idempotencyKey, const QByteArray &payloadHash, const QByteArray &response)
+{
+    if (idempotencyKey.isEmpty()) {
+        return;
+    }
+    m_idempotencyCache.insert(requestType + "#" + idempotencyKey, new IdempotentResponse{payloadHash, response});
+}
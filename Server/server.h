@@ -9,11 +9,25 @@
 #include <QSqlError>
 #include <QDebug>
 #include <QMap>
+#include <QSet>
 #include <QFile>
 #include <QFileInfo>
 #include <QDir>
 #include <QCoreApplication>
 #include <QThread>
+#include <QJsonArray>
+#include <QCache>
+#include <QHash>
+#include <QTimer>
+#include <QVector>
+#include <QCryptographicHash>
+#include <QTemporaryFile>
+#include <QImage>
+#include "MonotonicClock.h"
+#include "IdAllocator.h"
+#include "RowWriter.h"
+#include <memory>
+#include <functional>
 
 class Server : public QObject
 {
@@ -21,19 +35,30 @@ class Server : public QObject
 
 public:
     explicit Server(QObject *parent = nullptr);
+    ~Server();
     void start(); // 启动服务器
 
+    // 聊天消息落盘模式：Batched 先回执后批量提交，Sync 提交成功后再回执
+    enum class MessageDurability { Batched, Sync };
+    void setMessageDurability(MessageDurability mode);
+
 private slots:
     void handleNewConnection(); // 处理新客户端连接
     void handleClientData();    // 处理客户端数据
+    void processClientData(QTcpSocket *clientSocket); // 按行处理该连接已缓存的数据
     void handleDisconnection(); // 处理客户端断开连接
     void handleLogIn(QString message, QTcpSocket *clientSocket);  //处理登录
+    bool flushPendingMessages(); // 将排队的聊天消息在一个事务中批量写入数据库
+    void markAbsences();         // 按医生班次补记缺勤
 
 private:
     void initializeDatabase(); // 初始化数据库
     void sendFileToClient(QTcpSocket *clientSocket, const QString &filePath); // 发送文件到客户端
     void getContactList();
     QString generateUserId(const QString &identity); // 生成用户ID
+    static const int USER_ID_DIGITS = 6;             // 用户ID = 2位身份前缀 + 6位补零序号，如 11000001
+    static const qint64 USER_ID_MAX_SEQUENCE = 999999;
+    static void deriveIdCardInfo(const QString &idCard, QString &gender, QString &idBirthDate); // 从身份证号推断性别和出生日期（仅写入时调用）
     void handleRegister(const QString &message, QTcpSocket *clientSocket); // 处理注册
 
     QTcpServer *m_server; // TCP服务器对象
@@ -49,6 +74,19 @@ private:
     void handleCheckIn(const QString &message, QTcpSocket *clientSocket);
     void handleCheckOut(const QString &message, QTcpSocket *clientSocket);
     void handleAttendanceHistory(const QString &message, QTcpSocket *clientSocket);
+    void handleAttendanceSummary(const QString &message, QTcpSocket *clientSocket); // 考勤月度统计
+    bool updateAttendanceRollup(const QString &doctorId, const QString &date, const QString &oldStatus, const QString &newStatus);
+    bool doctorShift(const QString &doctorId, const QDate &date, QTime *start, QTime *end); // 查询医生当日班次
+    QTimer *m_absenceTimer;
+    QDate m_absenceCheckedThrough; // 已补记缺勤的最后日期
+    static const int ABSENCE_CHECK_INTERVAL_MS = 60 * 60 * 1000;
+
+    // 科室点名板相关函数
+    void handleRollCallBoard(const QString &message, QTcpSocket *clientSocket);
+    void handleRollCallUnsubscribe(const QString &message, QTcpSocket *clientSocket);
+    QJsonArray rollCallRows(const QString &department, const QString &doctorId, const QString &date, bool *ok);
+    void pushRollCallUpdate(const QString &doctorId, const QString &date);
+    QMap<QString, QSet<QTcpSocket*>> m_rollCallSubscribers; // 科室 -> 订阅点名板的连接，断开时移除
     void handleLeaveApplication(const QString &message, QTcpSocket *clientSocket);
     void handleLeaveRecordsRequest(const QString &message, QTcpSocket *clientSocket);
     void handleReturnFromLeave(const QString &message, QTcpSocket *clientSocket);
@@ -63,14 +101,85 @@ private:
     // 图片拉取
     void handleGetImage(const QString &message, QTcpSocket *clientSocket);
 
+    // 头像上传：按内容哈希（SHA-256）去重，服务器已有该哈希时跳过上传；
+    // 新头像以二进制流上传，服务器校验哈希后裁成正方形并缩放为界面使用的各个尺寸
+    struct AvatarUpload {
+        QString userId;
+        QByteArray expectedHash;   // 小写十六进制
+        qint64 expectedSize = 0;
+        qint64 received = 0;
+        QCryptographicHash hash{QCryptographicHash::Sha256};
+        std::unique_ptr<QTemporaryFile> file; // 为空表示请求无效，只读走数据保持流同步
+        QByteArray error;
+    };
+    static const qint64 AVATAR_MAX_BYTES = 8 * 1024 * 1024;
+    static const int AVATAR_MAX_DIMENSION = 8192;
+    void handleGetAvatar(const QString &message, QTcpSocket *clientSocket);
+    void handleAvatarCheck(const QString &message, QTcpSocket *clientSocket);
+    void handleAvatarUploadBegin(const QString &message, QTcpSocket *clientSocket);
+    bool consumeAvatarUpload(QTcpSocket *clientSocket, QByteArray &buffer); // 收齐声明的字节数时返回 true
+    void finishAvatarUpload(QTcpSocket *clientSocket, AvatarUpload &upload);
+    static QString avatarDir();
+    static QString avatarVariantPath(const QByteArray &hash, int size);
+    static bool isAvatarStored(const QByteArray &hash);
+    static bool storeAvatarVariants(const QByteArray &hash, const QImage &image);
+    bool assignAvatar(const QString &userId, const QByteArray &hash);
+    QHash<QTcpSocket*, std::shared_ptr<AvatarUpload>> m_avatarUploads; // 正在接收头像数据的连接
+    QHash<QTcpSocket*, QByteArray> m_receiveBuffers; // 按连接保存未处理完的数据，避免不同连接的数据混在一起
+
+    // 聊天附件：文件分块上传到服务器按 SHA-256 寻址的存储，支持断点续传和断点下载
+    // 上传中的数据写在 attachments/upload_<附件ID>.part，校验通过后改名为 attachments/<sha256>
+    struct AttachmentChunk {
+        qint64 attachmentId = 0;
+        qint64 totalSize = 0;
+        qint64 length = 0;
+        qint64 received = 0;
+        std::unique_ptr<QFile> file; // 为空表示请求无效，只读走数据保持流同步
+        std::shared_ptr<QCryptographicHash> hash;
+        QByteArray error;
+    };
+    struct AttachmentDownload {
+        qint64 attachmentId = 0;
+        qint64 end = 0;
+        bool markDownloaded = false; // 接收者下载完成后不再出现在待接收列表中
+        std::unique_ptr<QFile> file;
+    };
+    static const qint64 ATTACHMENT_MAX_BYTES = 2LL * 1024 * 1024 * 1024;
+    static const int ATTACHMENT_MAX_CHUNK = 4 * 1024 * 1024;
+    static const int ATTACHMENT_SEND_CHUNK = 1024 * 1024;       // 下载时每帧的数据量
+    static const int ATTACHMENT_SEND_WINDOW = 4 * 1024 * 1024;  // socket 发送缓冲中最多积压的字节数
+    static const int ATTACHMENT_SOCKET_BUFFER = 4 * 1024 * 1024; // 传输连接的内核收发缓冲
+    void handleAttachBegin(const QString &message, QTcpSocket *clientSocket);
+    void handleAttachChunkBegin(const QString &message, QTcpSocket *clientSocket);
+    bool consumeAttachmentChunk(QTcpSocket *clientSocket, QByteArray &buffer); // 收齐声明的字节数时返回 true
+    void finishAttachmentChunk(QTcpSocket *clientSocket, AttachmentChunk &chunk);
+    void finishAttachmentUpload(QTcpSocket *clientSocket, qint64 attachmentId);
+    void handleAttachGet(const QString &message, QTcpSocket *clientSocket);
+    void handleAttachList(const QString &message, QTcpSocket *clientSocket);
+    void pumpAttachmentDownload(QTcpSocket *clientSocket); // 随发送进度继续写出下载数据
+    static QString attachmentDir();
+    static QString attachmentPartPath(qint64 attachmentId);
+    static QString attachmentBlobPath(const QString &sha256);
+    static bool addFileToHash(QCryptographicHash &hash, const QString &path);
+    static void enlargeSocketBuffers(QTcpSocket *clientSocket);
+    QHash<QTcpSocket*, std::shared_ptr<AttachmentChunk>> m_attachmentChunks;       // 正在接收附件分块的连接
+    QHash<QTcpSocket*, std::shared_ptr<AttachmentDownload>> m_attachmentDownloads; // 正在下载附件的连接
+    QHash<qint64, std::shared_ptr<QCryptographicHash>> m_uploadHashes; // 上传中附件的增量哈希，服务器重启后从已收到的部分重建
+
 
     // 声明药品搜索处理函数
     void handleMedicineSearch(const QString &message, QTcpSocket *clientSocket);
+    void handleGetSpeechVocabulary(const QString &message, QTcpSocket *clientSocket); // 语音识别用药品/科室词表
+    bool rebuildSpeechVocabulary();
+    qint64 m_vocabularySourceVersion = -1; // 生成缓存时的 speech_vocabulary 版本号
+    QString m_vocabularyVersion;           // 词表内容摘要
+    QByteArray m_vocabularyJson;           // 缓存的词表响应
     
     // 视频通话相关函数
     void handleVideoCallRequest(const QString &message, QTcpSocket *clientSocket);
     void handleVideoCallResponse(const QString &message, QTcpSocket *clientSocket);
     void handleVideoCallEnd(const QString &message, QTcpSocket *clientSocket);
+    QString mediaEndpoint(QTcpSocket *clientSocket, const QString &mediaPort); // 视频通话点对点媒体地址
 
     //住院缴费
     void handleHospitalizationApply(const QString &message, QTcpSocket *clientSocket);
@@ -87,7 +196,97 @@ private:
 
     // 处方管理相关函数
     void handleSubmitPrescription(const QString &message, QTcpSocket *clientSocket);
+    void handleSubmitPrescriptionBatch(const QString &message, QTcpSocket *clientSocket); // 多药品处方一次提交
+    static const int PRESCRIPTION_MAX_ITEMS = 100; // 一张处方最多的药品明细条数
     void handleGetPatientPrescriptions(const QString &message, QTcpSocket *clientSocket);
+
+    // 处方/缴费项目变更推送相关函数（按版本号增量同步）
+    QJsonArray prescriptionRows(const QString &patientId, qint64 sinceVersion, bool *ok);
+    QJsonArray paymentItemRows(const QString &patientId, qint64 sinceVersion, bool *ok);
+    qint64 currentEntityVersion(const QString &entity);
+    void pushPrescriptionChanges(const QString &patientId, qint64 sinceVersion);
+    void pushPaymentItemChanges(const QString &patientId, qint64 sinceVersion);
+
+    // 幂等请求相关函数（缴费、预约、处方写操作的重试去重）
+    // 幂等键与请求内容的哈希绑定：同一键携带不同内容时拒绝，而不是回放另一个请求的结果
+    struct IdempotentResponse {
+        QByteArray payloadHash;
+        QByteArray response;
+    };
+    static QByteArray idempotencyPayloadHash(const QByteArray &payload);
+    bool replayIdempotentResponse(const QString &requestType, const QString &idempotencyKey, const QByteArray &payloadHash,
+                                  const QByteArray &mismatchResponse, QTcpSocket *clientSocket);
+    bool saveIdempotentResponse(const QString &requestType, const QString &idempotencyKey, const QByteArray &payloadHash, const QByteArray &response);
+    void cacheIdempotentResponse(const QString &requestType, const QString &idempotencyKey, const QByteArray &payloadHash, const QByteArray &response);
+    QCache<QString, IdempotentResponse> m_idempotencyCache; // 幂等响应前置缓存（按条数限制大小）
+
+    // 聊天消息批量写入相关
+    struct PendingMessage {
+        qint64 messageId;
+        QString senderId;
+        QString receiverId;
+        QString content;
+        QString sendTime;
+        int failedAttempts = 0; // 该条消息导致批量提交失败的次数
+    };
+    qint64 enqueueMessage(const QString &senderId, const QString &receiverId, const QString &content, const QString &sendTime); // 队列已满时返回0
+    void dropFailedMessages();
+    static const int MESSAGE_FLUSH_INTERVAL_MS = 50; // 最长攒批时间
+    static const int MESSAGE_BATCH_SIZE = 200;       // 攒满该条数立即提交
+    static const int MESSAGE_QUEUE_LIMIT = 5000;     // 队列上限，写库持续失败时不再接收新消息
+    static const int MESSAGE_MAX_ATTEMPTS = 5;       // 同一条消息写入失败达到该次数后丢弃并通知发送者
+    QVector<PendingMessage> m_pendingMessages;
+    QTimer *m_messageFlushTimer;
+    qint64 m_nextMessageId;
+    QString m_chatEpoch;   // 本次启动的标识：消息表每次启动重建，message_id 从 1 重新分配，客户端据此作废本地同步游标
+    MessageDurability m_messageDurability;
+
+    // 列表响应的负载编码，按连接协商（SET_ENCODING），默认 JSON 文本
+    enum class PayloadEncoding { Json, Cbor };
+    void handleSetEncoding(const QString &message, QTcpSocket *clientSocket);
+    std::unique_ptr<RowWriter> createRowWriter(QTcpSocket *clientSocket, const QByteArray &prefix);
+    static QString rowWriterStats(const RowWriter &writer); // 编码、行数、字节数、编码耗时，用于日志对比
+    QHash<QTcpSocket*, PayloadEncoding> m_payloadEncodings;
+
+    // 列表响应按发送进度分批取行：发送缓冲中积压超过 ROW_STREAM_SEND_WINDOW 时暂停，等 bytesWritten 后继续，
+    // 查询游标在此期间保持打开。响应写完之前该连接后续的请求留在接收缓冲中，推送消息暂存，避免插入响应中间
+    struct RowStream {
+        using RowFunc = std::function<void(const QSqlQuery &query, RowWriter &writer)>;
+        std::unique_ptr<QSqlQuery> query;
+        std::unique_ptr<RowWriter> writer;
+        RowFunc writeRow;
+        QByteArray suffix;
+        QString logLabel;
+        QByteArray deferredPushes; // 响应期间产生的推送，写完后再发
+    };
+    static const int ROW_STREAM_SEND_WINDOW = 256 * 1024;
+    void streamRows(QTcpSocket *clientSocket, QSqlQuery &&query, const QByteArray &prefix, const QByteArray &suffix,
+                    const QString &logLabel, const RowStream::RowFunc &writeRow);
+    bool pumpRowStream(QTcpSocket *clientSocket); // 响应已全部写出时返回 true；中途失败会断开连接并返回 false
+    void pushToClient(QTcpSocket *clientSocket, const QByteArray &data); // 主动推送，正在输出列表响应时延后发送
+    QHash<QTcpSocket*, std::shared_ptr<RowStream>> m_rowStreams;
+
+    // 传输压缩，按连接协商（SET_COMPRESSION）；超过阈值的响应整帧 qCompress 后以 "@z#<字节数>\n" 帧发送
+    struct CompressionStats {
+        qint64 frames = 0;           // 经过压缩判断的帧数
+        qint64 compressedFrames = 0; // 实际压缩发送的帧数
+        qint64 skippedFrames = 0;    // 已是压缩格式（JPEG/PNG）而跳过的帧数
+        qint64 rawBytes = 0;         // 原始字节数
+        qint64 wireBytes = 0;        // 实际发送字节数
+        qint64 cpuNsecs = 0;         // 压缩耗时
+    };
+    static const int COMPRESSION_DEFAULT_THRESHOLD = 2048; // 小于该字节数的帧不压缩
+    static const int COMPRESSION_MIN_THRESHOLD = 256;
+    static const int COMPRESSION_LEVEL = 6;
+    void handleSetCompression(const QString &message, QTcpSocket *clientSocket);
+    void handleCompressionStats(QTcpSocket *clientSocket);
+    void writeFrame(QTcpSocket *clientSocket, const QString &opcode, const QByteArray &frame, bool compressible = true);
+    static bool isCompressedImage(const QByteArray &data); // JPEG/PNG 等本身已压缩的格式
+    QHash<QTcpSocket*, int> m_compressionThresholds; // 启用压缩的连接及其阈值
+    QMap<QString, CompressionStats> m_compressionStats; // 按响应类型统计
+
+    MonotonicClock m_clock; // 写操作时间戳统一由进程内单调时钟生成
+    IdAllocator m_idAllocator; // 用户ID、住院申请ID的序号分配
 };
 
 #endif // SERVER_H